@@ -1,6 +1,11 @@
 /*
  * Functions used for debugging purposes (e.g. printing backtraces).
  * Copyright (C)2013, 2018 Mike Bourgeous.  Released under AGPLv3 in 2018.
+ *
+ * When asynchronous logging is enabled (see nl_log_start_async()), crash
+ * signal handlers should call nl_log_crash_flush() before printing anything
+ * with these functions, so that queued log messages are written first and the
+ * crash report is written directly.
  */
 #ifndef NLUTILS_DEBUG_H_
 #define NLUTILS_DEBUG_H_
@@ -5,6 +5,9 @@
 #ifndef NLUTILS_ESCAPE_H_
 #define NLUTILS_ESCAPE_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
 /*
  * Values for dequote parameter to nl_unescape_string().
  */
@@ -14,6 +17,37 @@ enum nl_unescape_dequote {
 	ESCAPE_IF_QUOTED = 2,	// Always dequote, unescape only if quoted
 };
 
+/*
+ * Value of struct nl_escape_table's escape entries for bytes that are escaped
+ * as the escape character, 'x', and two hexadecimal digits.
+ */
+#define NL_ESCAPE_HEX 'x'
+
+/*
+ * A lookup table describing an escape format, built by nl_escape_table_init().
+ * Every lookup is a single array index, and the nibbles and high fields let
+ * SIMD code find the next byte to escape many bytes at a time.
+ */
+struct nl_escape_table {
+	uint8_t escape[256];	// Character to write after escape_char for each byte, NL_ESCAPE_HEX, or 0 to copy unchanged
+	uint8_t original[256];	// Byte represented by escape_char followed by each character, or 0
+	uint8_t nibbles[16];	// Bit n of entry l is set if byte n * 16 + l (below 0x80) is escaped
+	uint8_t high;		// Nonzero if any byte from 0x80 up is escaped
+	char escape_char;	// Character that starts each escape sequence
+};
+
+/*
+ * Implementations of the search for the next character to escape used by the
+ * escaping functions.
+ */
+enum nl_escape_scanner {
+	NL_ESCAPE_SCAN_AUTO,	// Fastest implementation supported by the CPU
+	NL_ESCAPE_SCAN_SCALAR,	// One byte at a time (always supported)
+	NL_ESCAPE_SCAN_SSSE3,	// 16 bytes at a time on x86
+	NL_ESCAPE_SCAN_AVX2,	// 32 bytes at a time on x86
+	NL_ESCAPE_SCAN_NEON,	// 16 bytes at a time on 64-bit ARM
+};
+
 /*
  * Returns the number of additional bytes needed to escape the given string for
  * serialization safety.  Does not check to see if str is NULL.
@@ -25,8 +59,8 @@ int nl_count_escapes(char *str);
  * using realloc() if more than *size bytes are required (including the
  * terminating zero byte).  If the string is resized, the new size is stored in
  * *size, and the new pointer is stored in *str.  Returns 0 on success, or -1
- * if a temporary expansion buffer couldn't be allocated or the string buffer
- * couldn't be resized.  Use nl_escape_string() only for 0-terminated strings.
+ * if the string buffer couldn't be resized.  Use nl_escape_string() only for
+ * 0-terminated strings.
  */
 int nl_escape_string(char **str, size_t *size);
 
@@ -62,4 +96,62 @@ size_t nl_count_data_escapes(const char *data, size_t data_size);
  */
 int nl_escape_data(char **data, size_t *data_size, size_t *buf_size, int add_null);
 
+/*
+ * Initializes an escape table with the given escape character and the given
+ * array of pairs_len characters, which alternates between a character to
+ * escape and the character to write after the escape character in its place
+ * (like "\tt\nn").  The escape character is escaped as itself if it is not in
+ * the array.  If hex is nonzero, other bytes below 0x20 or above 0x7e are
+ * escaped as the escape character, 'x', and two lowercase hexadecimal digits.
+ * Replacement characters must be printable and cannot be 'x' when hex is
+ * nonzero.  Returns 0 on success, -1 on error.
+ */
+int nl_escape_table_init(struct nl_escape_table *table, char escape_char, const char *pairs, size_t pairs_len, int hex);
+
+/*
+ * Returns the table used by nl_escape_string(), nl_count_escapes(), and
+ * nl_unescape_string(), for use with the other nl_escape_table_*()
+ * functions.
+ */
+const struct nl_escape_table *nl_escape_string_table(void);
+
+/*
+ * Returns the table used by nl_escape_data() and nl_count_data_escapes().
+ */
+const struct nl_escape_table *nl_escape_data_table(void);
+
+/*
+ * Returns the number of additional bytes needed to escape len bytes of data
+ * with the given table.  Does not check to see if table or data is NULL.
+ */
+size_t nl_escape_table_count(const struct nl_escape_table *table, const char *data, size_t len);
+
+/*
+ * Escapes len bytes of data with the given table into out in a single pass,
+ * writing at most out_size bytes and never a partial escape sequence.  No
+ * terminating zero byte is written.  Returns the full length of the escaped
+ * data, like snprintf(), so the output was complete if the return value is
+ * less than or equal to out_size.  Does not check to see if table, data, or
+ * out is NULL.
+ */
+size_t nl_escape_table_into(const struct nl_escape_table *table, const char *data, size_t len, char *out, size_t out_size);
+
+/*
+ * Like nl_unescape_string(), but uses the escape character and escape
+ * sequences from the given table.  Hexadecimal escapes are always
+ * recognized.  Does not check to see if table is NULL.
+ */
+int nl_unescape_table_string(const struct nl_escape_table *table, char *str, int include_zero,
+		enum nl_unescape_dequote dequote);
+
+/*
+ * Selects the implementation used to find characters that need escaping.
+ * NL_ESCAPE_SCAN_AUTO (the default) picks the widest SIMD scanner supported by
+ * the CPU.  The scanner only skips runs of bytes that pass through unchanged,
+ * so every choice escapes the same way; tests use this to check each scanner
+ * against the original escaping rules.  Returns 0 on success, or -1 if the
+ * implementation is not supported by this build or CPU.
+ */
+int nl_escape_set_scanner(enum nl_escape_scanner impl);
+
 #endif /* NLUTILS_ESCAPE_H_ */
@@ -6,6 +6,48 @@
 #define NLUTILS_EXEC_H_
 
 #include <sys/types.h>
+#include <sys/resource.h>
+
+/*
+ * Types of actions applied by nl_popen3vea() in the child process before the
+ * command executes.
+ */
+enum nl_spawn_action_type {
+	// Marks the end of an action list.
+	NL_SPAWN_END = 0,
+
+	// Sets the child's niceness to value (see setpriority()).
+	NL_SPAWN_NICE,
+
+	// Raises the child's niceness to value if it is lower, e.g. to keep a
+	// command from inheriting a high priority.  Never raises priority.
+	NL_SPAWN_NICE_MIN,
+
+	// Sets the child's scheduling policy to SCHED_OTHER.
+	NL_SPAWN_SCHED_OTHER,
+
+	// Sets the child's resource limit for resource value (e.g. RLIMIT_CPU)
+	// to limit (see setrlimit()).
+	NL_SPAWN_RLIMIT,
+};
+
+/*
+ * An action for nl_popen3vea() to apply in the child process before the
+ * command executes.  Actions are passed as an array ending with an
+ * NL_SPAWN_END action:
+ *
+ *	(struct nl_spawn_action[]){
+ *		{ .type = NL_SPAWN_NICE_MIN, .value = 0 },
+ *		{ .type = NL_SPAWN_RLIMIT, .value = RLIMIT_CPU, .limit = { 10, 10 } },
+ *		{ .type = NL_SPAWN_END },
+ *	}
+ */
+struct nl_spawn_action {
+	enum nl_spawn_action_type type;
+	int value; // Niceness for NL_SPAWN_NICE*, resource for NL_SPAWN_RLIMIT
+	struct rlimit limit; // Limits for NL_SPAWN_RLIMIT
+	int ignore_errors; // Nonzero to run the command even if this action fails
+};
 
 /*
  * Runs the given command (without searching $PATH) with the given arguments in
@@ -22,19 +64,37 @@
  * Note that the called process will inherit open file descriptors, so make
  * sure that opened files are set to close (e.g. with nl_set_cloexec()).  The
  * file descriptors returned by this function will already be set to close on
- * execute, but may still be inherited if another thread executes another
- * process between creation and marking as FD_CLOEXEC.
+ * execute.
+ *
+ * Equivalent to nl_popen3vea() with no actions.
  */
 pid_t nl_popen3ve(int *writefd, int *readfd, int *errfd, const char *cmd, char *const argv[], char *const envp[]);
 
 /*
- * Exactly like nl_popen3ve().  If callback is not NULL, it will be called in
- * the child process after forking.  The callback will be called before the
- * child process's standard I/O is redirected to pipes.  An example use of the
+ * Like nl_popen3ve().  If callback is not NULL, it will be called in the child
+ * process after forking.  The callback will be called before the child
+ * process's standard I/O is redirected to pipes.  An example use of the
  * callback is dropping privileges before the command executes.
+ *
+ * This uses fork(), so the time taken grows with the size of the calling
+ * process.  Use nl_popen3vea() if the child's setup can be described by a list
+ * of actions.  Failure to execute the command is returned as -1 with errno
+ * set, as the parent waits for the child's close-on-execute status pipe.
  */
 pid_t nl_popen3vec(int *writefd, int *readfd, int *errfd, const char *cmd, char *const argv[], char *const envp[], void (*callback)(void));
 
+/*
+ * Like nl_popen3ve(), but applies the given list of actions (NULL for none) in
+ * the child process before the command executes.  The child is started with
+ * vfork(), so the time taken does not grow with the size of the calling
+ * process, and failure to execute the command (or to apply an action without
+ * ignore_errors set) is returned as -1 with errno set.  Pipe file descriptors
+ * are created with close-on-execute already set, so they can't leak into
+ * processes started by other threads.
+ */
+pid_t nl_popen3vea(int *writefd, int *readfd, int *errfd, const char *cmd, char *const argv[], char *const envp[],
+		const struct nl_spawn_action *actions);
+
 /*
  * Runs command in another process with full remote interaction capabilities.
  * Be aware that command is passed to sh -c, so shell expansion will occur.
@@ -46,12 +106,49 @@ pid_t nl_popen3vec(int *writefd, int *readfd, int *errfd, const char *cmd, char
  */
 pid_t nl_popen3(char *command, int *writefd, int *readfd, int *errfd);
 
+/*
+ * A buffer for one output stream of a command run by nl_popenve_capture().
+ * Leave data.data NULL to have a buffer allocated, or preallocate it with
+ * malloc() and set alloc to its size.  Either way the buffer grows
+ * geometrically with realloc() as needed, and is kept NUL-terminated (the
+ * terminator is not counted in data.size).  If limit is nonzero, output
+ * beyond limit bytes is read and discarded, and truncated is set.
+ */
+struct nl_capture_buf {
+	struct nl_raw_data data; // Captured output (appended to any existing data)
+	size_t alloc; // Bytes allocated at data.data
+	size_t limit; // Maximum size of data (0 for no limit)
+	unsigned int truncated:1; // Set if output beyond limit was discarded
+};
+
+/*
+ * Runs the command (without searching PATH) with the given argument list and
+ * environment (in the format used by execve()), writing input (if not NULL)
+ * to its stdin while capturing its stdout into *out and its stderr into *err.
+ * The three streams are serviced together with poll(), so a command that
+ * writes a lot of output before reading all of its input cannot deadlock.  If
+ * input, out, or err is NULL, the command's stdin, stdout, or stderr is not
+ * changed.  A command that exits without reading all of its input is not an
+ * error.  If timeout_ms is greater than zero, the command is killed if it has
+ * not closed its output and exited within that many milliseconds.  SIGPIPE is
+ * blocked in the calling thread while the command's input is written.
+ *
+ * Captured output is appended to each buffer's existing data (see struct
+ * nl_capture_buf).  The caller must free() out->data.data and err->data.data,
+ * even if an error occurs.  Returns the command's return value in the format
+ * of nl_wait_get_return(), or -1 with errno set on error (ETIMEDOUT if the
+ * timeout expired, in which case the command has been killed and reaped).
+ */
+int nl_popenve_capture(const char *cmd, char *const argv[], char *const envp[], const struct nl_raw_data *input,
+		struct nl_capture_buf *out, struct nl_capture_buf *err, int timeout_ms);
+
 /*
  * Runs the command (without searching PATH) with the given argument list and
  * environment (in the format used by execve()), reading its stdout output into
  * an nl_raw_data structure that must be destroyed with nl_destroy_data().  If
- * *output is not NULL, it will be written to the command's stdin before
- * reading from the command's stdout.  Returns NULL on error.
+ * *output is not NULL, it will be written to the command's stdin while
+ * reading from the command's stdout (see nl_popenve_capture()).  Returns NULL
+ * on error.
  */
 struct nl_raw_data *nl_popenve_readall(const char *cmd, char *const argv[], char *const envp[], struct nl_raw_data *output);
 
@@ -75,4 +172,58 @@ char *nl_popen_readall(char *command, size_t *size);
  */
 int nl_wait_get_return(pid_t pid);
 
+/*
+ * Handle for a set of child processes watched by nl_reaper_watch().
+ */
+struct nl_reaper;
+
+/*
+ * Called by nl_reaper_reap() for each watched child that has exited, with the
+ * child's return value in the format used by nl_wait_get_return().  The child
+ * has already been reaped and is no longer watched.
+ */
+typedef void (*nl_reaper_callback)(pid_t pid, int ret, void *cb_data);
+
+/*
+ * Creates a child process reaper.  The reaper's file descriptor (see
+ * nl_reaper_fd()) becomes readable when watched children exit, so many exits
+ * can be reaped in one pass from an event loop, instead of blocking in
+ * nl_wait_get_return() for each child.  Only watched children are reaped.  A
+ * reaper must only be used by one thread at a time.  Returns NULL on error,
+ * with errno set to ENOSYS if the system lacks pidfd_open().
+ */
+struct nl_reaper *nl_reaper_create(void);
+
+/*
+ * Destroys a reaper.  Children that are still being watched are not reaped.
+ */
+void nl_reaper_destroy(struct nl_reaper *reaper);
+
+/*
+ * Returns a file descriptor that is readable while any watched child has
+ * exited and not been reaped by nl_reaper_reap().
+ */
+int nl_reaper_fd(struct nl_reaper *reaper);
+
+/*
+ * Starts watching the given child process.  The callback will be called from
+ * nl_reaper_reap() after the child exits.  Returns 0 on success, an errno-like
+ * value on error.
+ */
+int nl_reaper_watch(struct nl_reaper *reaper, pid_t pid, nl_reaper_callback cb, void *cb_data);
+
+/*
+ * Stops watching the given child process without reaping it (e.g. so it can
+ * be killed and waited for with nl_wait_get_return()).  Returns 0 on success,
+ * ENOENT if the child was not being watched.
+ */
+int nl_reaper_unwatch(struct nl_reaper *reaper, pid_t pid);
+
+/*
+ * Reaps every watched child that has exited, calling each child's callback.
+ * Callbacks may watch and unwatch other children.  Does not block.  Returns
+ * the number of children reaped, or -1 on error.
+ */
+int nl_reaper_reap(struct nl_reaper *reaper);
+
 #endif /* NLUTILS_EXEC_H_ */
@@ -1,22 +1,35 @@
 /*
- * A naïve implementation of an associative array with string keys and values.
+ * An associative array with string keys and values, using an open-addressing
+ * (Robin Hood) hash table.  Entries are iterated in insertion order.
  * Copied and modified from the Automation Controller's depthcam/zonevar plugin.
  * Copyright (C)2011-2015 Mike Bourgeous.  Released under AGPLv3 in 2018.
  */
 #ifndef NLUTILS_HASH_H
 #define NLUTILS_HASH_H
 
-// FIXME: It would be better to use an existing hash table implementation.
-// Note that this is not yet a hash table; it's just an array.
 struct nl_hash_entry {
 	uint32_t hash;
 	char *key;
 	char *value;
 	// TODO: Consider using a variant for the value
 };
+
+/*
+ * Internal hash table data structure.  Fields should not be modified by the
+ * user, and only count should be read.
+ */
+struct nl_hash_slot;
 struct nl_hash {
-	// TODO: Use an actual hash table, with hashing
-	struct nl_fifo *table;
+	// Entries in insertion order.  Removed entries leave a NULL hole
+	// until the array is compacted.
+	struct nl_hash_entry **entries;
+	size_t entries_used; // Entries used, including holes
+	size_t entries_size; // Entries allocated
+
+	// Open-addressed index into entries (a power of two in size)
+	struct nl_hash_slot *slots;
+	size_t slot_mask;
+
 	size_t count;
 };
 
@@ -27,8 +40,9 @@ typedef int (*nl_hash_callback)(void *cb_data, char *key, char *value);
 
 
 /*
- * Returns a matching entry, if any, or NULL.  TODO: This is O(n).  Does not
- * check for NULL parameters.
+ * Returns a matching entry, if any, or NULL.  The entry remains valid until it
+ * is removed or the hash is cleared or destroyed.  Does not check for NULL
+ * parameters.
  */
 struct nl_hash_entry *nl_hash_find(const struct nl_hash * const hash, const char * const key);
 
@@ -22,6 +22,41 @@ typedef void (*nl_kvp_cb)(void *cb_data, char *key, char *value, int quoted_valu
 typedef void (*nl_typed_kvp_cb)(void *cb_data, char *key, char *strvalue, struct nl_variant value);
 
 
+/*
+ * A key or value found by nl_parse_kvp_slices().  The str pointer points into
+ * the original line, and is not 0-terminated.  For quoted keys and values,
+ * str and len exclude the surrounding quotation marks, and quoted is nonzero.
+ * If escaped is nonzero, the slice contains escape sequences that must be
+ * removed with nl_kvp_unescape_slice() to get the same string as would be
+ * given to an nl_kvp_cb.  Unquoted slices are never escaped.
+ */
+struct nl_kvp_slice {
+	const char *str;
+	size_t len;
+	int quoted;
+	int escaped;
+};
+
+/*
+ * Callback type given to nl_parse_kvp_slices() to receive pointers into the
+ * original line for each key and value, without any copying or unescaping.
+ */
+typedef void (*nl_kvp_slice_cb)(void *cb_data, struct nl_kvp_slice key, struct nl_kvp_slice value);
+
+
+/*
+ * Implementations of the search for structural characters (whitespace, equal
+ * signs, quotes, and backslashes) used by the key-value pair parsers.
+ */
+enum nl_kvp_scanner {
+	NL_KVP_SCAN_AUTO,	// Fastest implementation supported by the CPU
+	NL_KVP_SCAN_SCALAR,	// One byte at a time (always supported)
+	NL_KVP_SCAN_SSE2,	// 16 bytes at a time on x86
+	NL_KVP_SCAN_AVX2,	// 32 bytes at a time on x86
+	NL_KVP_SCAN_NEON,	// 16 bytes at a time on ARM
+};
+
+
 /*
  * Structure to pass to nl_parse_kvp()'s cb_data parameter with nl_kvp_wrapper.
  */
@@ -59,6 +94,16 @@ struct nl_kvp_wrap {
  */
 void nl_kvp_wrapper(void *data, char *key, char *value, int quoted_value);
 
+/*
+ * Selects the implementation used to find the ends of keys and values in
+ * nl_parse_kvp() and related functions.  NL_KVP_SCAN_AUTO (the default) picks
+ * the fastest implementation supported by the CPU.  Output is identical for
+ * every implementation; this is meant for testing and benchmarking.  Returns 0
+ * on success, or -1 if the implementation is not supported by this build or
+ * CPU.
+ */
+int nl_kvp_set_scanner(enum nl_kvp_scanner impl);
+
 /*
  * Parses optionally quoted key-value pairs.  A key with an equal sign but no
  * value will be ignored.  The given callback will be called for each key-value
@@ -71,6 +116,31 @@ void nl_kvp_wrapper(void *data, char *key, char *value, int quoted_value);
  */
 void nl_parse_kvp(const char *kvp_line, nl_kvp_cb callback, void *cb_data);
 
+/*
+ * Parses optionally quoted key-value pairs with the same rules as
+ * nl_parse_kvp(), but without allocating memory or copying the key or value.
+ * The callback receives slices pointing into kvp_line (see struct
+ * nl_kvp_slice), which remain valid for as long as kvp_line does.
+ */
+void nl_parse_kvp_slices(const char *kvp_line, nl_kvp_slice_cb callback, void *cb_data);
+
+/*
+ * Copies the given slice into buf as a 0-terminated string, removing escape
+ * sequences if the slice is escaped.  The buffer must have room for at least
+ * slice.len + 3 bytes.  Returns the length of the resulting string, or -1 if
+ * buf is NULL or too small.
+ */
+ssize_t nl_kvp_unescape_slice(struct nl_kvp_slice slice, char *buf, size_t buf_size);
+
+/*
+ * Parses optionally quoted key-value pairs like nl_parse_kvp(), but uses the
+ * given scratch buffer to hold the dequoted and unescaped key and value given
+ * to the callback, instead of allocating memory.  The scratch buffer must be
+ * at least strlen(kvp_line) + 1 bytes.  Returns 0 on success, or -1 if a
+ * parameter is NULL or the scratch buffer is too small.
+ */
+int nl_parse_kvp_buf(const char *kvp_line, char *scratch, size_t scratch_size, nl_kvp_cb callback, void *cb_data);
+
 /*
  * Parses optionally quoted key-value pairs, converting unquoted values (but
  * not keys) to the closest matching nl_variant type.  The given callback will
@@ -103,6 +173,14 @@ void nl_parse_kvp(const char *kvp_line, nl_kvp_cb callback, void *cb_data);
  */
 void nl_parse_kvp_variant(const char *kvp_line, nl_typed_kvp_cb callback, void *cb_data);
 
+/*
+ * Parses key-value pairs into variants like nl_parse_kvp_variant(), without
+ * allocating memory.  The scratch buffer must be at least strlen(kvp_line) + 1
+ * bytes.  Returns 0 on success, or -1 if a parameter is NULL or the scratch
+ * buffer is too small.
+ */
+int nl_parse_kvp_variant_buf(const char *kvp_line, char *scratch, size_t scratch_size, nl_typed_kvp_cb callback, void *cb_data);
+
 /*
  * Adds the key-value pairs from the given string into the given associative
  * array using nl_hash_set().  Values are stored as strings.
@@ -1,10 +1,41 @@
 /*
  * Logging-related functions.
  * Copyright (C)2012 Mike Bourgeous.  Released under AGPLv3 in 2018.
+ *
+ * By default each log message is formatted and written to its FILE by the
+ * calling thread, holding a lockf() lock on the file.  nl_log_start_async()
+ * switches messages sent to stdout and stderr to an asynchronous mode: each
+ * thread formats its messages into its own lock-free ring buffer, and a
+ * background writer thread writes them to the file descriptors in batches
+ * with writev().  Output written to stdout or stderr without these functions
+ * (e.g. printf()) is not ordered with asynchronous messages.
  */
 #ifndef NLUTILS_LOG_H_
 #define NLUTILS_LOG_H_
 
+/*
+ * Flags for nl_fptmf_src().
+ */
+#define NL_PTMF_BOLD		0x1 // Wrap the message in bold terminal escape codes
+#define NL_PTMF_ERRNO		0x2 // Append errno and strerror(errno), then a newline
+#define NL_PTMF_NOPREFIX	0x4 // Omit the timestamp and thread name (for INFO_OUT_EX() etc.)
+
+/*
+ * Parameters for nl_log_start_async().  Zero fields use defaults.
+ */
+struct nl_log_params {
+	size_t ring_size; // Bytes of ring buffer per logging thread, rounded up to a power of two (default 65536)
+
+	// Longest time in microseconds a thread waits for room in its full ring
+	// buffer before dropping a message (default 0: drop immediately).
+	unsigned int block_usec;
+
+	// Longest time in microseconds the writer thread waits to collect a
+	// batch of messages after writing one (default 1000).  Messages
+	// arriving at an idle writer are written immediately.
+	unsigned int flush_usec;
+};
+
 /*
  * Like printf(), but prepends a timestamp and the name of the current thread
  * or process.  The output FILE will be locked using lockf() while the
@@ -29,4 +60,59 @@ int __attribute__ ((__format__(__printf__, 2, 3))) nl_fptmf(FILE *out, const cha
  */
 int __attribute__ ((__format__(__printf__, 2, 0))) nl_vfptmf(FILE *out, const char *format, va_list args);
 
+/*
+ * Like nl_fptmf(), but also prepends the given source file, line, and
+ * function, and applies the NL_PTMF_* flags, writing the whole message at
+ * once.  Used by INFO_OUT(), ERROR_OUT(), and related macros.  Does not
+ * modify errno.
+ */
+int __attribute__ ((__format__(__printf__, 6, 7))) nl_fptmf_src(FILE *out, int flags,
+		const char *file, int line, const char *func, const char *fmt, ...);
+
+/*
+ * Starts asynchronous logging of messages sent to stdout and stderr by the
+ * functions in this file, creating the writer thread.  params may be NULL to
+ * use the defaults.  If a thread's ring buffer is full, its message is
+ * dropped after waiting at most params->block_usec; dropped messages are
+ * counted and reported on stderr.  Messages too large for a quarter of a ring
+ * buffer are written directly after the thread's queued messages.  Queued
+ * messages are written at exit() or nl_log_stop_async().  Returns 0 on
+ * success, EBUSY if asynchronous logging is already running, or another
+ * errno-like value on error.
+ */
+int nl_log_start_async(const struct nl_log_params *params);
+
+/*
+ * Writes all queued messages, stops the writer thread, and returns to
+ * synchronous logging.  Ring buffers are kept for reuse by a later call to
+ * nl_log_start_async(), and resized when empty if its ring size differs.
+ * Returns 0 on success (including if asynchronous logging was not running),
+ * or an errno-like value on error.
+ */
+int nl_log_stop_async(void);
+
+/*
+ * Waits until every message logged so far has been written.  Returns
+ * immediately in synchronous mode.  Returns 0 on success, or an errno-like
+ * value on error.  Not safe to call from a signal handler.
+ */
+int nl_log_flush(void);
+
+/*
+ * Writes all queued messages from the calling thread, then switches to
+ * synchronous logging so that messages logged afterward (e.g. by
+ * nl_print_signal() or NL_PRINT_TRACE()) follow them directly.  Uses no locks
+ * or memory allocation, so it is safe to call at the start of a crash signal
+ * handler.  Messages are not written if the writer thread is stuck writing
+ * them itself.  nl_log_stop_async() or nl_log_start_async() will clean up the
+ * idle writer thread if the process continues.
+ */
+void nl_log_crash_flush(void);
+
+/*
+ * Returns the number of messages dropped because a thread's ring buffer was
+ * full, since the process started.
+ */
+unsigned long nl_log_dropped(void);
+
 #endif /* NLUTILS_LOG_H_ */
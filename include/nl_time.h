@@ -12,15 +12,24 @@
  * is between -1 and 0 should use -1 for tv_sec, and a positive value for
  * tv_nsec between 0 and 1000000000.
  *
- * Copyright (C)2015-2020 Mike Bourgeous.  Released under AGPLv3 in 2018.
+ * Times may also be stored as int64_t nanoseconds, which covers about 292
+ * years on either side of zero (i.e. CLOCK_REALTIME from 1678 through 2262).
+ * Arithmetic on nanoseconds is plain integer arithmetic, and the timespec
+ * arithmetic and comparison functions convert through nanoseconds, so they
+ * share that range.
+ *
+ * Copyright (C)2015-2026 Mike Bourgeous.  Released under AGPLv3 in 2018.
  */
 #ifndef NLUTILS_TIME_H_
 #define NLUTILS_TIME_H_
 
+#include <stdint.h>
 #include <time.h>
 #include <math.h>
 #include <sys/time.h>
 
+#define NL_NSEC_PER_SEC INT64_C(1000000000)
+
 /*
  * Evaluates to true if a >= b, where a and b are both positive, or in positive
  * nanosecond form (evaluates a and b multiple times).  Only works for
@@ -29,6 +38,68 @@
 #define NL_TIMESPEC_GTE(a, b) ( (a).tv_sec > (b).tv_sec || ((a).tv_sec == (b).tv_sec && (a).tv_nsec >= (b).tv_nsec) )
 
 
+/*
+ * Returns the int64_t nanoseconds represented by the given timespec in
+ * away-from-zero form.  tv_nsec need not be normalized.  Compiles without
+ * branches.
+ */
+NLUTILS_INLINE int64_t nl_timespec_to_ns(const struct timespec ts)
+{
+	int64_t nsec = ts.tv_nsec;
+
+	return ts.tv_sec * NL_NSEC_PER_SEC + (ts.tv_sec < 0 ? -nsec : nsec);
+}
+
+/*
+ * Returns a normalized timespec in away-from-zero form for the given int64_t
+ * nanoseconds.  Division by the constant compiles to a multiplication, and
+ * the sign selection compiles without branches.
+ */
+NLUTILS_INLINE struct timespec nl_ns_to_timespec(const int64_t ns)
+{
+	int64_t sec = ns / NL_NSEC_PER_SEC;
+	int64_t nsec = ns % NL_NSEC_PER_SEC;
+
+	// tv_nsec carries the sign only when tv_sec is zero
+	return (struct timespec){
+		.tv_sec = sec,
+		.tv_nsec = sec < 0 ? -nsec : nsec,
+	};
+}
+
+/*
+ * Returns the int64_t nanoseconds represented by the given timeval, which
+ * must be normalized.
+ */
+NLUTILS_INLINE int64_t nl_timeval_to_ns(const struct timeval tv)
+{
+	return tv.tv_sec * NL_NSEC_PER_SEC + tv.tv_usec * INT64_C(1000);
+}
+
+/*
+ * Returns the current time of clock_id in int64_t nanoseconds, or INT64_MIN
+ * if clock_gettime() fails (e.g. for an invalid clock_id).
+ */
+NLUTILS_INLINE int64_t nl_clock_ns(const clockid_t clock_id)
+{
+	struct timespec ts;
+
+	if(clock_gettime(clock_id, &ts)) {
+		return INT64_MIN;
+	}
+
+	return ts.tv_sec * NL_NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/*
+ * Returns -1, 0, or 1 if a is less than, equal to, or greater than b,
+ * respectively, without branching.
+ */
+NLUTILS_INLINE int nl_compare_ns(const int64_t a, const int64_t b)
+{
+	return (a > b) - (a < b);
+}
+
 /*
  * Converts a timespec from away-from-zero form (more natural for a human to
  * write) to positive nanosecond form (easier for arithmetic).
@@ -83,20 +154,7 @@ NLUTILS_INLINE struct timespec nl_timespec_from_pos(struct timespec ts)
  */
 NLUTILS_INLINE struct timespec nl_normalize_timespec(struct timespec ts)
 {
-	ts = nl_timespec_to_pos(ts);
-
-	while(ts.tv_nsec < 0) {
-		ts.tv_sec--;
-		ts.tv_nsec += 1000000000;
-	}
-	while(ts.tv_nsec >= 1000000000) {
-		ts.tv_sec++;
-		ts.tv_nsec -= 1000000000;
-	}
-
-	ts = nl_timespec_from_pos(ts);
-
-	return ts;
+	return nl_ns_to_timespec(nl_timespec_to_ns(ts));
 }
 
 /*
@@ -115,69 +173,31 @@ NLUTILS_INLINE struct timespec nl_negate_timespec(const struct timespec ts)
 }
 
 /*
- * Returns the sum of timespecs a and b in away-from-zero form.  Does not
- * handle integer overflow of seconds or nanoseconds, but nanosecond overflow
- * will not occur if both timespecs are normalized with absolute nanoseconds
- * less than one billion.
+ * Returns the sum of timespecs a and b in away-from-zero form.  Neither input
+ * needs to be normalized.
  */
 NLUTILS_INLINE struct timespec nl_add_timespec(const struct timespec a, const struct timespec b)
 {
-	struct timespec ts;
-
-	// Convert to additive nanosecond form first (similar to two's complement)
-	struct timespec a_pos = nl_timespec_to_pos(a), b_pos = nl_timespec_to_pos(b);
-
-	ts.tv_sec = a_pos.tv_sec + b_pos.tv_sec;
-	ts.tv_nsec = a_pos.tv_nsec + b_pos.tv_nsec;
-
-	int sign = ts.tv_nsec < 0 ? -1 : 1;
-	int offs = sign * 1000000000;
-	while(ts.tv_nsec >= 1000000000 || ts.tv_nsec < 0) {
-		ts.tv_sec += sign;
-		ts.tv_nsec -= offs;
-	}
-
-	// Convert back to away-from-zero nanosecond form
-	return nl_timespec_from_pos(ts);
+	return nl_ns_to_timespec(nl_timespec_to_ns(a) + nl_timespec_to_ns(b));
 }
 
 /*
- * Returns timespec a minus timespec b in away-from-zero form.  Does not handle
- * integer overflow of seconds or nanoseconds, but nanosecond overflow will not
- * occur if both timespecs are normalized with absolute nanoseconds less than
- * one billion.
+ * Returns timespec a minus timespec b in away-from-zero form.  Neither input
+ * needs to be normalized.
  */
 NLUTILS_INLINE struct timespec nl_sub_timespec(const struct timespec a, const struct timespec b)
 {
-	return nl_add_timespec(a, nl_negate_timespec(b));
+	return nl_ns_to_timespec(nl_timespec_to_ns(a) - nl_timespec_to_ns(b));
 }
 
 /*
  * Returns a value less than, equal to, or greater than zero if a is less than,
  * equal to, or greater than b, respectively.  Both a and b should be in
- * away-from-zero form.  Only works correctly for normalized timespecs.
+ * away-from-zero form, but need not be normalized.
  */
 NLUTILS_INLINE int nl_compare_timespec(const struct timespec a, const struct timespec b)
 {
-	if(a.tv_sec < b.tv_sec) {
-		return -1;
-	}
-	if(a.tv_sec == b.tv_sec) {
-		if(a.tv_nsec == b.tv_nsec) {
-			return 0;
-		}
-		if(a.tv_sec < 0) {
-			if(a.tv_nsec > b.tv_nsec) {
-				return -1;
-			}
-		} else {
-			if(a.tv_nsec < b.tv_nsec) {
-				return -1;
-			}
-		}
-	}
-
-	return 1;
+	return nl_compare_ns(nl_timespec_to_ns(a), nl_timespec_to_ns(b));
 }
 
 /*
@@ -57,8 +57,8 @@ extern const char * const nlutils_version;
  */
 #ifdef DEBUG
 # define DEBUG_NEWLINE() printf("\n")
-# define DEBUG_OUT(...) { nl_ptmf("%s:%d: %s():\t", __FILE__, __LINE__, __func__); printf(__VA_ARGS__); }
-# define DEBUG_OUT_EX(...) { printf(__VA_ARGS__); }
+# define DEBUG_OUT(...) { nl_fptmf_src(stdout, 0, __FILE__, __LINE__, __func__, __VA_ARGS__); }
+# define DEBUG_OUT_EX(...) { nl_fptmf_src(stdout, NL_PTMF_NOPREFIX, NULL, 0, NULL, __VA_ARGS__); }
 #else /* DEBUG */
 # define DEBUG_NEWLINE()
 # define DEBUG_OUT(...)
@@ -68,26 +68,23 @@ extern const char * const nlutils_version;
 /*
  * Behaves similarly to printf(...), but adds file, line, and function
  * information, as well as a timestamp and the name of the current thread.
+ * The _EX variants continue a previous message without adding anything, and
+ * are kept in order with it when logging asynchronously.
  */
 #define INFO_OUT(...) {\
-	nl_ptmf("%s:%d: %s():\t", __FILE__, __LINE__, __func__);\
-	printf(__VA_ARGS__);\
+	nl_fptmf_src(stdout, 0, __FILE__, __LINE__, __func__, __VA_ARGS__);\
 }
-#define INFO_OUT_EX(...) printf(__VA_ARGS__)
+#define INFO_OUT_EX(...) nl_fptmf_src(stdout, NL_PTMF_NOPREFIX, NULL, 0, NULL, __VA_ARGS__)
 
 /*
  * Behaves similarly to fprintf(stderr, ...), but adds file, line, and function
  * information, as well as a timestamp and the name of the current thread.
  */
 #define ERROR_OUT(...) {\
-	nl_fptmf(stderr, "\e[0;1m%s:%d: %s():\t", __FILE__, __LINE__, __func__);\
-	fprintf(stderr, __VA_ARGS__);\
-	fprintf(stderr, "\e[0m");\
+	nl_fptmf_src(stderr, NL_PTMF_BOLD, __FILE__, __LINE__, __func__, __VA_ARGS__);\
 }
 #define ERROR_OUT_EX(...) {\
-	fprintf(stderr, "\e[0;1m");\
-	fprintf(stderr, __VA_ARGS__);\
-	fprintf(stderr, "\e[0m");\
+	nl_fptmf_src(stderr, NL_PTMF_BOLD | NL_PTMF_NOPREFIX, NULL, 0, NULL, __VA_ARGS__);\
 }
 
 /*
@@ -96,9 +93,7 @@ extern const char * const nlutils_version;
  * the current thread.
  */
 #define ERRNO_OUT(...) {\
-	nl_fptmf(stderr, "\e[0;1m%s:%d: %s():\t", __FILE__, __LINE__, __func__);\
-	fprintf(stderr, __VA_ARGS__);\
-	fprintf(stderr, ": %d (%s)\e[0m\n", errno, strerror(errno));\
+	nl_fptmf_src(stderr, NL_PTMF_BOLD | NL_PTMF_ERRNO, __FILE__, __LINE__, __func__, __VA_ARGS__);\
 }
 
 /*
@@ -133,12 +128,17 @@ extern const char * const nlutils_version;
 #include "stream.h"
 #include "net.h"
 #include "log.h"
+#include "trace.h"
 #include "thread.h"
+#include "threadpool.h"
+#include "timerwheel.h"
 #include "variant.h"
 #include "hash.h"
 #include "kvp.h"
 #include "url.h"
 #include "fifo.h"
+#include "ring.h"
+#include "queue.h"
 #include "url_req.h"
 #include "debug.h"
 #include "term.h"
@@ -0,0 +1,89 @@
+/*
+ * queue.h - A bounded lock-free multi-producer, multi-consumer queue.
+ * Copyright (C)2026 Mike Bourgeous.  Released under AGPLv3.
+ *
+ * struct nl_queue passes non-NULL pointers between threads in FIFO order
+ * without a lock in the common case.  The nl_queue_try_*() functions never
+ * block.  The blocking and timed functions only use a mutex and condition
+ * variables to sleep when the queue is full or empty.
+ */
+#ifndef NLUTILS_QUEUE_H_
+#define NLUTILS_QUEUE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+
+struct nl_queue;
+
+
+/*
+ * Creates a new empty queue that can hold at least capacity elements (rounded
+ * up to a power of two).  Returns NULL on error.
+ */
+struct nl_queue *nl_queue_create(size_t capacity);
+
+/*
+ * Destroys the given queue.  Elements remaining in the queue are not freed.
+ * No other threads may be using the queue.  A NULL queue is ignored.
+ */
+void nl_queue_destroy(struct nl_queue *q);
+
+/*
+ * Returns the number of elements the queue can hold.
+ */
+size_t nl_queue_capacity(struct nl_queue *q);
+
+/*
+ * Returns the approximate number of elements in the queue.  The result may
+ * already be out of date if other threads are using the queue.
+ */
+size_t nl_queue_count(struct nl_queue *q);
+
+/*
+ * Adds an element to the end of the queue if there is room, without blocking.
+ * Returns 0 on success, EAGAIN if the queue is full, or EINVAL if q or data is
+ * NULL.
+ */
+int nl_queue_try_put(struct nl_queue *q, void *data);
+
+/*
+ * Adds an element to the end of the queue, waiting as long as necessary for
+ * room.  Returns 0 on success, or an errno-like value on error (e.g. EINVAL if
+ * q or data is NULL).
+ */
+int nl_queue_put(struct nl_queue *q, void *data);
+
+/*
+ * Adds an element to the end of the queue, waiting up to the given relative
+ * timeout for room.  Returns 0 on success, ETIMEDOUT if the queue remained
+ * full, or another errno-like value on error.
+ */
+int nl_queue_put_timed(struct nl_queue *q, void *data, struct timespec timeout);
+
+/*
+ * Removes and returns the oldest element from the queue, without blocking.
+ * Returns NULL if the queue is empty or q is NULL.
+ */
+void *nl_queue_try_get(struct nl_queue *q);
+
+/*
+ * Removes and returns the oldest element from the queue, waiting as long as
+ * necessary for an element to be added.  Returns NULL only on error.
+ */
+void *nl_queue_get(struct nl_queue *q);
+
+/*
+ * Removes and returns the oldest element from the queue, waiting up to the
+ * given relative timeout for an element to be added.  Returns NULL if the
+ * timeout expired or an error occurred.
+ */
+void *nl_queue_get_timed(struct nl_queue *q, struct timespec timeout);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* NLUTILS_QUEUE_H_ */
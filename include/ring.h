@@ -0,0 +1,141 @@
+/*
+ * ring.h - A generic FIFO implementation using a growable ring buffer.
+ * Copyright (C)2026 Mike Bourgeous.  Released under AGPLv3.
+ *
+ * struct nl_ring stores the same kind of data as struct nl_fifo (non-NULL
+ * pointers), with the same ordering semantics, but keeps elements in a single
+ * contiguous array instead of allocating a list element for every entry.
+ * Once the ring has grown to its working size, adding and removing elements
+ * does not allocate memory, and indexing is O(1).  Unlike nl_fifo, the ring
+ * may not be modified while it is being iterated.
+ */
+#ifndef NLUTILS_RING_H_
+#define NLUTILS_RING_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+
+/*
+ * Internal ring data structure.  Fields should not be modified by the user,
+ * and only count should be read.
+ */
+struct nl_ring {
+	void **data;
+	size_t size; // Number of allocated elements (a power of two, or 0)
+	size_t head; // Index of the first element in data
+	size_t count;
+};
+
+
+/*
+ * Creates a new empty ring with room for at least the given number of
+ * elements before it must grow (0 to allocate on first use).  Returns NULL on
+ * error.
+ */
+struct nl_ring *nl_ring_create(size_t capacity);
+
+/*
+ * Removes all elements from and destroys an existing ring.  A NULL ring is
+ * ignored.
+ */
+void nl_ring_destroy(struct nl_ring *r);
+
+/*
+ * Makes sure the ring can hold at least capacity elements without allocating
+ * more memory.  Returns 0 on success, -1 on error.
+ */
+int nl_ring_reserve(struct nl_ring *r, size_t capacity);
+
+/*
+ * Adds a new element to the end of the ring.  The return value is the number
+ * of elements in the ring after the new element is added, or negative on
+ * error.  NULL data is considered to be an error.
+ */
+ssize_t nl_ring_put(struct nl_ring *r, void *data);
+
+/*
+ * Prepends an element to the beginning of the ring.  The return value is the
+ * number of elements in the ring after the new element is added, or negative
+ * on error.  NULL data is considered to be an error.
+ */
+ssize_t nl_ring_prepend(struct nl_ring *r, void *data);
+
+/*
+ * Removes the least-recently-added element from the ring.  Returns NULL if the
+ * ring is empty or an error occurs.
+ */
+void *nl_ring_get(struct nl_ring *r);
+
+/*
+ * Retrieves, but does not remove the least-recently-added element from the
+ * ring.  Returns NULL if the ring is empty or an error occurs.
+ */
+void *nl_ring_peek(struct nl_ring *r);
+
+/*
+ * Retrieves, but does not remove the most-recently-added (last) element from
+ * the ring.  Returns NULL if the ring is empty or an error occurs.
+ */
+void *nl_ring_peek_last(struct nl_ring *r);
+
+/*
+ * Retrieves, but does not remove the Nth element in the ring.  If the index is
+ * negative, then indexing starts from the end, with -1 referring to the
+ * most-recently-added (last) element.  This is O(1).
+ *
+ * Returns NULL if the ring is empty, the index is out of range, or an error
+ * occurs.
+ */
+void *nl_ring_peek_index(struct nl_ring *r, ssize_t index);
+
+/*
+ * Removes the least-recently-added instance of the given element from the
+ * ring.  Returns 0 if the element existed and was deleted, -1 if the element
+ * did not exist or an error occurred.  NULL data is an error.  This is O(N),
+ * as elements must be both searched and shifted.
+ */
+int nl_ring_remove(struct nl_ring *r, void *data);
+
+/*
+ * Iterates through ring elements without altering the ring.  For the first
+ * call, *iter should be 0.  For subsequent calls, *iter should be unmodified.
+ * The ring must not be modified while iterating.
+ *
+ * Returns NULL at the end of the ring, or on error.
+ */
+void *nl_ring_next(struct nl_ring *r, size_t *iter);
+
+/*
+ * Removes all elements from the ring.  Note that this does not free the
+ * elements stored in the ring, and does not release the ring's own memory.
+ */
+void nl_ring_clear(struct nl_ring *r);
+
+/*
+ * Removes all elements from the ring, calling the given callback (if not NULL)
+ * for each element before its removal.  This may be used e.g. to free memory.
+ */
+void nl_ring_clear_cb(struct nl_ring *r, void (*cb)(void *el, void *user_data), void *user_data);
+
+/*
+ * Removes the first count elements from the ring, calling the given callback
+ * (if not NULL) for each element before its removal.  Returns the number of
+ * elements remaining after removal, or 0 if the ring was NULL.
+ */
+size_t nl_ring_remove_start(struct nl_ring *r, size_t count, void (*cb)(void *el, void *user_data), void *user_data);
+
+/*
+ * Removes the last count elements from the ring, calling the given callback
+ * (if not NULL) for each element before its removal.  Returns the number of
+ * elements remaining after removal, or 0 if the ring was NULL.
+ */
+size_t nl_ring_remove_end(struct nl_ring *r, size_t count, void (*cb)(void *el, void *user_data), void *user_data);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* NLUTILS_RING_H_ */
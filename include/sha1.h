@@ -21,6 +21,19 @@ struct nl_sha1_ctx {
 };
 
 #define SHA1_DIGEST_SIZE 20
+#define SHA1_HEX_SIZE 41 // Hexadecimal digest and NUL terminator
+
+/*
+ * Implementations of the SHA-1 block transform (see nl_sha1_set_impl()).
+ */
+enum nl_sha1_impl {
+	NL_SHA1_AUTO,	// Hardware SHA-1 instructions if supported, otherwise scalar
+	NL_SHA1_SCALAR,	// Portable C (always supported)
+	NL_SHA1_SSSE3,	// SSSE3 message schedule on x86 (not chosen automatically)
+	NL_SHA1_AVX2,	// AVX2 message schedule, two blocks at a time, on x86 (not chosen automatically)
+	NL_SHA1_SHANI,	// SHA extensions (SHA-NI) on x86
+	NL_SHA1_ARMV8,	// ARMv8 cryptography extensions
+};
 
 void nl_sha1_init(struct nl_sha1_ctx* context);
 void nl_sha1_update(struct nl_sha1_ctx* context, const uint8_t* data, const size_t len);
@@ -34,6 +47,58 @@ void nl_sha1_final(struct nl_sha1_ctx* context, uint8_t digest[SHA1_DIGEST_SIZE]
  */
 char *nl_sha1(uint8_t *data, size_t len);
 
+/*
+ * Selects the SHA-1 block transform used by nl_sha1_update() and nl_sha1().
+ * NL_SHA1_AUTO (the default) uses the CPU's SHA-1 instructions if it has
+ * them, and the scalar transform otherwise.  Each transform updates the same
+ * five-word state from the same 64-byte blocks, so digests don't depend on
+ * the choice; the self-test compares every transform with the scalar one.
+ * Returns 0 on success, or -1 if the implementation is not supported by this
+ * build or CPU.
+ */
+int nl_sha1_set_impl(enum nl_sha1_impl impl);
+
+/*
+ * One of the messages hashed by nl_sha1_multi().
+ */
+struct nl_sha1_msg {
+	const uint8_t *data;
+	size_t len;
+};
+
+/*
+ * Implementations of nl_sha1_multi() (see nl_sha1_multi_set_impl()).
+ */
+enum nl_sha1_multi_impl {
+	NL_SHA1_MULTI_AUTO,	// Fastest implementation supported by the CPU
+	NL_SHA1_MULTI_SERIAL,	// One message at a time with nl_sha1_update() (always supported)
+	NL_SHA1_MULTI_SSE2,	// Four messages at a time on x86
+	NL_SHA1_MULTI_AVX2,	// Eight messages at a time on x86
+	NL_SHA1_MULTI_NEON,	// Four messages at a time on ARM
+};
+
+/*
+ * Hashes count independent messages, several at a time in parallel SIMD lanes
+ * where supported.  Stores the raw digest of msgs[i] in digests[i] if
+ * digests is not NULL, and its NUL-terminated lowercase hexadecimal digest in
+ * hex[i] if hex is not NULL.  Never allocates memory.  Output is identical to
+ * hashing each message with nl_sha1_init(), nl_sha1_update(), and
+ * nl_sha1_final().
+ */
+void nl_sha1_multi(const struct nl_sha1_msg *msgs, size_t count,
+		uint8_t (*digests)[SHA1_DIGEST_SIZE], char (*hex)[SHA1_HEX_SIZE]);
+
+/*
+ * Selects the implementation used by nl_sha1_multi().  The SIMD
+ * implementations give each message a 32-bit lane of a vector register and
+ * run the rounds of four (SSE2, NEON) or eight (AVX2) messages side by side.
+ * NL_SHA1_MULTI_AUTO (the default) uses eight AVX2 lanes if available, hashes
+ * messages one at a time if the CPU has SHA-1 instructions, and otherwise uses
+ * four lanes.  Returns 0 on success, or -1 if the implementation is not
+ * supported by this build or CPU.
+ */
+int nl_sha1_multi_set_impl(enum nl_sha1_multi_impl impl);
+
 #ifdef __cplusplus
 }
 #endif
@@ -5,10 +5,24 @@
 #ifndef NLUTILS_STREAM_H_
 #define NLUTILS_STREAM_H_
 
+/*
+ * Copies from srcfd's current offset to end-of-file into destfd, advancing
+ * both file offsets.  Uses copy_file_range() between regular files, splice()
+ * if either descriptor is a pipe, sendfile() from a regular file to anything
+ * else (e.g. a socket), and a large-buffer read()/write() loop if the kernel
+ * copy methods are unavailable or unsupported for the given descriptors.
+ * Returns the number of bytes copied on success, -1 on error (some data may
+ * have been copied).
+ */
+ssize_t nl_copy_fd(int srcfd, int destfd);
+
 /*
  * Reads from src until feof(src) returns nonzero, writing all data read to
  * destfd.  Use fseek()/ftell() to copy file contents multiple times.  Returns
  * the number of bytes written on success, -1 on error.
+ *
+ * If src is seekable, its data is copied with nl_copy_fd() without passing
+ * through stdio's buffer (src is repositioned past the copied data).
  */
 ssize_t nl_stream_to_fd(FILE *src, int destfd);
 
@@ -23,6 +37,10 @@ int nl_write_stream(int fd, const struct nl_raw_data * const data);
  * to the data but is not counted in the returned size.  Call nl_destroy_data()
  * on the returned pointer.  The stream is not closed after reading.  Returns
  * the data (includes size and contents) on success, NULL on error.
+ *
+ * Data is read directly into a buffer that doubles in size as it fills.  If
+ * fd is a regular file, the buffer is sized from fstat() to hold the rest of
+ * the file in one read().
  */
 struct nl_raw_data *nl_read_stream(int fd);
 
@@ -33,6 +51,25 @@ struct nl_raw_data *nl_read_stream(int fd);
  */
 struct nl_raw_data *nl_read_file(const char *filename);
 
+/*
+ * Maps the entire contents of the given filename read-only into memory,
+ * returning a struct nl_raw_data that must be released with nl_unmap_data()
+ * (not nl_destroy_data()).  The data is followed by a NUL byte that is not
+ * counted in its size, as with nl_read_file().  Writing to the data will
+ * crash the program.  Files that cannot be mapped (e.g. empty files, pipes,
+ * and devices) are read into memory with nl_read_stream() instead.  Changes
+ * made to the file by other processes while it is mapped may be visible in
+ * the data, and truncating a mapped file causes SIGBUS when the missing part
+ * is accessed, so prefer nl_read_file() for files that may change.  Returns
+ * NULL on error.
+ */
+struct nl_raw_data *nl_map_file(const char *filename);
+
+/*
+ * Releases data returned by nl_map_file().  Does nothing if data is NULL.
+ */
+void nl_unmap_data(struct nl_raw_data *data);
+
 /*
  * Sets the FD_CLOEXEC flag on the given file descriptor.  Returns 0 on
  * success, -1 on error
@@ -9,6 +9,7 @@
 
 struct nl_thread_ctx;
 struct nl_thread;
+struct nl_threadpool;
 
 /*
  * Callback function for nl_iterate_threads().
@@ -37,6 +38,7 @@ struct nl_thread_ctx {
 	pthread_t main_thread;		// The thread that created this context
 	pthread_mutex_t lock;		// Protects access to thread list
 	struct nl_thread *threads;	// Linked list of threads
+	struct nl_threadpool *pools;	// Linked list of thread pools (see threadpool.h)
 };
 
 
@@ -55,6 +57,15 @@ int nl_set_threadname(char *name);
  */
 int nl_get_threadname(char *name);
 
+/*
+ * Returns the name of the current thread from a thread-local cache, reading it
+ * with nl_get_threadname() on the first call in each thread.  The cache is
+ * updated by nl_set_threadname(), but not by other ways of renaming a thread
+ * (e.g. calling prctl() directly).  The returned string belongs to the calling
+ * thread and remains valid until the thread exits.
+ */
+const char *nl_threadname(void);
+
 /*
  * Creates an empty thread context for use with nl_create_thread() and related
  * functions.  Returns NULL on error.
@@ -62,7 +73,10 @@ int nl_get_threadname(char *name);
 struct nl_thread_ctx *nl_create_thread_context();
 
 /*
- * Joins all threads on the given context, then frees the context's memory.
+ * Destroys any thread pools on the given context (finishing their queued
+ * tasks), joins all threads on the context, then frees the context's memory.
+ * If a pool cannot be destroyed (e.g. if called from one of its workers), an
+ * error is printed and the context is left intact.
  */
 void nl_destroy_thread_context(struct nl_thread_ctx *ctx);
 
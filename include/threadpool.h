@@ -0,0 +1,117 @@
+/*
+ * threadpool.h - A work-stealing thread pool built on nl_thread_ctx.
+ * Copyright (C)2026 Mike Bourgeous.  Released under AGPLv3.
+ *
+ * struct nl_threadpool runs short tasks on a fixed set of worker threads
+ * created with nl_create_thread(), instead of starting a thread per task.
+ * Each worker owns a Chase-Lev deque.  Tasks submitted by a worker (e.g.
+ * subtasks of a running task) go on that worker's deque, and idle workers
+ * steal from the other end of other workers' deques.  Tasks submitted from
+ * other threads go through a lock-free injection stack.
+ *
+ * Pools are registered with their thread context, so
+ * nl_destroy_thread_context() finishes all queued tasks and stops the pool's
+ * workers before joining the context's other threads.
+ */
+#ifndef NLUTILS_THREADPOOL_H_
+#define NLUTILS_THREADPOOL_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+
+struct nl_thread_ctx;
+struct nl_threadpool;
+struct nl_threadpool_task;
+
+/*
+ * Task function type, identical to a pthread thread function.  The return
+ * value is passed to nl_threadpool_task_wait().
+ */
+typedef void *(*nl_threadpool_func)(void *data);
+
+/*
+ * Parameters for nl_threadpool_create().  Zero or NULL fields use defaults.
+ */
+struct nl_threadpool_params {
+	unsigned int workers; // Number of worker threads (default: one per online CPU)
+	char *name; // Worker name prefix; workers are named "<name>-<index>" (default: "pool")
+
+	// CPU affinity (default: no affinity).  Worker i is pinned to CPU
+	// cpus[i % cpu_count].
+	const unsigned int *cpus;
+	unsigned int cpu_count;
+};
+
+
+/*
+ * Creates a thread pool whose workers are threads in the given thread
+ * context.  params may be NULL to use the defaults.  The pool is destroyed by
+ * nl_threadpool_destroy() or nl_destroy_thread_context().  Returns NULL on
+ * error.
+ */
+struct nl_threadpool *nl_threadpool_create(struct nl_thread_ctx *ctx, const struct nl_threadpool_params *params);
+
+/*
+ * Waits for all submitted tasks to finish, then stops and joins the pool's
+ * workers and frees the pool.  Tasks submitted with nl_threadpool_submit()
+ * must still be passed to nl_threadpool_task_wait() (which will return
+ * immediately) to free them.  Must not be called from one of the pool's
+ * workers.  A NULL pool is ignored.
+ */
+void nl_threadpool_destroy(struct nl_threadpool *pool);
+
+/*
+ * Returns the number of worker threads in the pool.
+ */
+unsigned int nl_threadpool_workers(struct nl_threadpool *pool);
+
+/*
+ * Queues func(data) to run on the pool, returning a task handle that must be
+ * passed to nl_threadpool_task_wait() to get the result and free the task.
+ * Returns NULL on error.
+ */
+struct nl_threadpool_task *nl_threadpool_submit(struct nl_threadpool *pool, nl_threadpool_func func, void *data);
+
+/*
+ * Queues func(data) to run on the pool without a task handle.  The return
+ * value of func is ignored.  Returns 0 on success, or an errno-like value on
+ * error.
+ */
+int nl_threadpool_run(struct nl_threadpool *pool, nl_threadpool_func func, void *data);
+
+/*
+ * Returns nonzero if the given task has finished, zero if it is queued or
+ * running.  Does not free the task.
+ */
+int nl_threadpool_task_done(struct nl_threadpool_task *task);
+
+/*
+ * Waits for the given task to finish, frees it, and returns its function's
+ * return value.  When called from one of the pool's workers (e.g. to wait for
+ * a subtask), the worker runs other queued tasks while it waits.  Returns
+ * NULL if task is NULL.
+ */
+void *nl_threadpool_task_wait(struct nl_threadpool_task *task);
+
+/*
+ * Waits until every task submitted to the pool so far, and any tasks they
+ * submit, has finished.  Returns 0 on success, EDEADLK if called from one of
+ * the pool's workers, or another errno-like value on error.
+ */
+int nl_threadpool_wait(struct nl_threadpool *pool);
+
+/*
+ * Pins the given worker (0 to nl_threadpool_workers() - 1) to the given CPU,
+ * or restores the affinity of the thread that created the pool if cpu is
+ * negative.  Returns 0 on success, or an errno-like value on error.
+ */
+int nl_threadpool_set_affinity(struct nl_threadpool *pool, unsigned int worker, int cpu);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* NLUTILS_THREADPOOL_H_ */
@@ -0,0 +1,168 @@
+/*
+ * timerwheel.h - A hierarchical timing wheel for many deadlines.
+ * Copyright (C)2026 Mike Bourgeous.  Released under AGPLv3.
+ *
+ * struct nl_timerwheel schedules callbacks at CLOCK_MONOTONIC deadlines in
+ * int64_t nanoseconds (see nl_clock_ns()).  Scheduling, rescheduling, and
+ * canceling a timer take constant time regardless of how many timers are
+ * scheduled.  Deadlines are rounded up to the wheel's tick, so callbacks run
+ * at most one tick late and never early.
+ *
+ * Timers are struct nl_timer objects owned by the caller (usually embedded in
+ * a larger structure), so the wheel never allocates memory per timer.  A
+ * wheel and its timers must only be used by one thread at a time, except for
+ * nl_timerwheel_submit(), which any thread may call.
+ *
+ * A wheel can be driven by calling nl_timerwheel_advance() with the current
+ * time (using nl_timerwheel_next() for poll() timeouts), or from an event loop
+ * by watching nl_timerwheel_fd() for reading and calling nl_timerwheel_run()
+ * when it is readable.  For example, with libevent:
+ *
+ *	event_set(&ev, nl_timerwheel_fd(wheel), EV_READ | EV_PERSIST, run_wheel_cb, wheel);
+ *
+ * where run_wheel_cb() calls nl_timerwheel_run(wheel).
+ */
+#ifndef NLUTILS_TIMERWHEEL_H_
+#define NLUTILS_TIMERWHEEL_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+
+struct nl_timerwheel;
+struct nl_timer;
+
+/*
+ * Called by nl_timerwheel_advance() when a timer's deadline has passed.  The
+ * timer is no longer scheduled, so the callback may reschedule it or free it.
+ */
+typedef void (*nl_timer_callback)(struct nl_timer *timer, void *cb_data);
+
+/*
+ * A timer that can be scheduled on one wheel at a time.  Initialize with
+ * nl_timer_init(); the fields should not be modified by the user.
+ */
+struct nl_timer {
+	struct nl_timer *next; // Slot list links
+	struct nl_timer **pprev;
+	struct nl_timer *submit_next; // Submission stack link
+
+	int64_t deadline; // Nanoseconds
+	uint64_t expiry; // Tick at which the timer fires
+
+	nl_timer_callback cb;
+	void *cb_data;
+
+	unsigned int state;
+	uint8_t level; // Wheel level and slot of the list the timer is on
+	uint8_t slot;
+};
+
+/*
+ * Parameters for nl_timerwheel_create().  Zero fields use defaults.
+ */
+struct nl_timerwheel_params {
+	int64_t tick_ns; // Resolution of the wheel in nanoseconds (default 1000000)
+};
+
+
+/*
+ * Initializes a timer that calls cb(timer, cb_data) when it fires.  Must not
+ * be called on a scheduled timer.
+ */
+void nl_timer_init(struct nl_timer *timer, nl_timer_callback cb, void *cb_data);
+
+/*
+ * Returns nonzero if the timer is scheduled or submitted and has not yet
+ * fired or been canceled.
+ */
+int nl_timer_pending(const struct nl_timer *timer);
+
+/*
+ * Creates a timer wheel whose current time is the current CLOCK_MONOTONIC
+ * time.  params may be NULL to use the defaults.  Returns NULL on error.
+ */
+struct nl_timerwheel *nl_timerwheel_create(const struct nl_timerwheel_params *params);
+
+/*
+ * Destroys a timer wheel.  Timers that are still scheduled are not called,
+ * and may be reused after nl_timer_init().  A NULL wheel is ignored.
+ */
+void nl_timerwheel_destroy(struct nl_timerwheel *wheel);
+
+/*
+ * Schedules the timer to fire at the given CLOCK_MONOTONIC deadline in
+ * nanoseconds, moving it if it was already scheduled on this wheel.  Deadlines
+ * in the past fire on the next call to nl_timerwheel_advance().  Returns 0 on
+ * success, or EBUSY if the timer was submitted with nl_timerwheel_submit() and
+ * has not yet been taken by the wheel.
+ */
+int nl_timerwheel_schedule(struct nl_timerwheel *wheel, struct nl_timer *timer, int64_t deadline);
+
+/*
+ * Cancels a scheduled timer.  Returns 0 on success, ENOENT if the timer was
+ * not scheduled, or EBUSY if the timer was submitted with
+ * nl_timerwheel_submit() and has not yet been taken by the wheel.
+ */
+int nl_timerwheel_cancel(struct nl_timerwheel *wheel, struct nl_timer *timer);
+
+/*
+ * Schedules a timer from any thread.  The timer must not be scheduled, and
+ * must not be used by the wheel's thread, until the wheel takes it during its
+ * next nl_timerwheel_advance() or nl_timerwheel_run().  If the wheel's file
+ * descriptor is in use, it becomes readable so the wheel's thread takes the
+ * timer promptly.  Returns 0 on success, or EBUSY if the timer is already
+ * scheduled or submitted.
+ */
+int nl_timerwheel_submit(struct nl_timerwheel *wheel, struct nl_timer *timer, int64_t deadline);
+
+/*
+ * Takes submitted timers, then fires every timer whose deadline is at or
+ * before now (in CLOCK_MONOTONIC nanoseconds), one tick's batch at a time.
+ * Callbacks may schedule and cancel any timers.  Timers scheduled by a
+ * callback for a time that has already passed fire with the next tick's
+ * batch, or on the next call if this call has no ticks left.  Returns the
+ * number of timers fired.
+ */
+size_t nl_timerwheel_advance(struct nl_timerwheel *wheel, int64_t now);
+
+/*
+ * Returns the time in CLOCK_MONOTONIC nanoseconds at or before which
+ * nl_timerwheel_advance() should next be called, or INT64_MAX if no timers
+ * are scheduled.  This is the exact (tick-rounded) deadline of the next timer
+ * if it is within 64 ticks, and otherwise the time when more distant timers
+ * must be redistributed within the wheel.  Submitted timers that have not
+ * been taken are not included.
+ */
+int64_t nl_timerwheel_next(struct nl_timerwheel *wheel);
+
+/*
+ * Returns the number of timers scheduled on the wheel, excluding submitted
+ * timers that have not yet been taken.
+ */
+size_t nl_timerwheel_count(struct nl_timerwheel *wheel);
+
+/*
+ * Returns a timerfd that is readable when nl_timerwheel_run() should be
+ * called.  After this is called, the wheel keeps the timerfd armed for its
+ * earliest deadline, and nl_timerwheel_submit() makes it readable
+ * immediately.  Returns -1 on error.
+ */
+int nl_timerwheel_fd(struct nl_timerwheel *wheel);
+
+/*
+ * Clears the wheel's file descriptor, advances the wheel to the current
+ * CLOCK_MONOTONIC time, and rearms the file descriptor for the next
+ * deadline.  Returns the number of timers fired.
+ */
+size_t nl_timerwheel_run(struct nl_timerwheel *wheel);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* NLUTILS_TIMERWHEEL_H_ */
@@ -0,0 +1,79 @@
+/*
+ * Binary trace logging with deferred formatting.
+ * Copyright (C)2026 Mike Bourgeous.  Released under AGPLv3.
+ *
+ * NL_TRACE() logs a printf()-style message without formatting it.  The
+ * calling thread stores the format string's ID, a CLOCK_MONOTONIC timestamp,
+ * and the raw arguments (copying strings) as a binary record in the trace
+ * file opened by nl_trace_open().  Each format string and thread name is
+ * written to the file once, the first time it is used.  nl_trace_decode() and
+ * the nl_trace_decode tool convert a trace file back to the text written by
+ * nl_fptmf().
+ *
+ * Records go through the per-thread ring buffers and writer thread when
+ * asynchronous logging is running (see nl_log_start_async()), and are written
+ * directly otherwise.
+ *
+ * Trace files use the byte order and type sizes of the machine that wrote
+ * them, and must be decoded on a compatible machine.  Formats that cannot be
+ * deferred (%n, %m, wide characters, positional arguments, or string
+ * precision without '*') are formatted by the calling thread instead.
+ */
+#ifndef NLUTILS_TRACE_H_
+#define NLUTILS_TRACE_H_
+
+#include <stdint.h>
+
+#define NL_TRACE_MAX_ARGS 16 // Formats with more arguments are formatted by the caller
+
+/*
+ * Per-call-site format information, filled in the first time a format is
+ * used.  Fields should not be modified by the user.
+ */
+struct nl_trace_format {
+	unsigned int generation;	// Trace file in which the format was last written
+	uint32_t id;			// Format ID within the process
+	uint8_t arg_count;
+	uint8_t args[NL_TRACE_MAX_ARGS];	// Argument types
+};
+
+/*
+ * Logs a printf()-style message to the trace file, if one is open.  The
+ * format must be a string literal (or otherwise never change for a given call
+ * site).  Arguments are type-checked like printf().
+ */
+#define NL_TRACE(...) do { \
+	static struct nl_trace_format nl_trace_format_; \
+	nl_trace(&nl_trace_format_, __VA_ARGS__); \
+} while(0)
+
+
+/*
+ * Creates or truncates the given trace file and starts writing NL_TRACE()
+ * records to it.  Returns 0 on success, EBUSY if a trace file is already
+ * open, or another errno-like value on error.
+ */
+int nl_trace_open(const char *filename);
+
+/*
+ * Writes any queued trace records and closes the trace file.  Must not be
+ * called while other threads may be calling NL_TRACE().  Returns 0 on success
+ * (including if no trace file was open), or an errno-like value on error.
+ */
+int nl_trace_close(void);
+
+/*
+ * Implementation of NL_TRACE().  The format pointer must be the same for
+ * every call with a given nl_trace_format.
+ */
+void __attribute__ ((__format__(__printf__, 2, 3))) nl_trace(struct nl_trace_format *format, const char *fmt, ...);
+
+/*
+ * Reads a trace file written by NL_TRACE() from in, and writes each record to
+ * out as the text that nl_fptmf() would have written, using the local time
+ * zone of the decoding process.  Returns 0 on success, or -1 if in is not a
+ * valid trace file or an error occurs.
+ */
+int nl_trace_decode(FILE *in, FILE *out);
+
+#endif /* NLUTILS_TRACE_H_ */
@@ -1,10 +1,12 @@
 /*
- * Wrapper for the curl (and possibly wget in the future) command.
+ * Background HTTP requests, using the curl command or libcurl.
  * Copyright (C)2015 Mike Bourgeous.  Released under AGPLv3 in 2018.
  */
 #ifndef NLUTILS_URL_REQ_H_
 #define NLUTILS_URL_REQ_H_
 
+#include <stdint.h>
+
 #include "thread.h"
 
 /*
@@ -12,6 +14,70 @@
  */
 struct nl_url_ctx;
 
+/*
+ * Ways a url_req context can perform requests.
+ */
+enum nl_url_backend {
+	// Runs one curl(1) process per request.  Isolates each request in its
+	// own process, but costs a fork/exec, a new connection, and a TLS
+	// handshake for every request.
+	NL_URL_BACKEND_PROCESS = 0,
+
+	// Runs requests with libcurl's multi interface on the context's event
+	// thread.  Connections to the same host are reused between requests.
+	// Only available if nlutils was built with libcurl.
+	NL_URL_BACKEND_LIBCURL = 1,
+
+	NL_URL_BACKEND_MAX = 1,
+};
+
+/*
+ * Parameters for nl_url_req_init_ex().  Zero-initialized fields select the
+ * defaults used by nl_url_req_init().
+ */
+struct nl_url_ctx_params {
+	// The request backend to use (default NL_URL_BACKEND_PROCESS).
+	enum nl_url_backend backend;
+
+	// The maximum total size in bytes of response bodies held in memory by
+	// all of the context's requests at once.  A request whose body would
+	// exceed the budget fails with too_large set.  Streamed data does not
+	// count against the budget.  0 for no limit.
+	size_t memory_budget;
+
+	// The maximum number of requests the context runs at once (e.g. curl
+	// processes for NL_URL_BACKEND_PROCESS).  Further requests wait in a
+	// queue, highest priority first, until a running request finishes.
+	// 0 for no limit.
+	unsigned int max_in_flight;
+
+	// Set to 1 to fill in each result's request_headers with the
+	// NL_URL_BACKEND_LIBCURL backend.  This turns on libcurl's debug
+	// trace, so it is off by default.  The process backend always fills
+	// in request_headers.
+	unsigned int record_request_headers;
+};
+
+/*
+ * Request queueing statistics for a url_req context.  See
+ * nl_url_req_get_stats().
+ */
+struct nl_url_stats {
+	// Requests currently running.
+	unsigned int in_flight;
+
+	// Requests currently waiting for max_in_flight, and the most that have
+	// waited at once.
+	unsigned int queued;
+	unsigned int max_queued;
+
+	// Requests started since the context was created, and the total and
+	// longest times in nanoseconds from nl_url_req_add() to their start.
+	uint64_t started;
+	uint64_t total_wait_ns;
+	uint64_t max_wait_ns;
+};
+
 /*
  * Result of a request.  Includes success/failure status, the original request
  * URL, headers, response body, error messages, etc.  Passed to request
@@ -38,7 +104,16 @@ struct nl_url_result {
 	// Set to 1 if an error occurred.
 	unsigned int error:1;
 
-	// Request headers (sent to server)
+	// Set to 1 (along with error) if the response body exceeded the
+	// request's max_response_size or the context's memory budget.
+	unsigned int too_large:1;
+
+	// Set to 1 (along with error) if the request was stopped by
+	// nl_url_req_cancel() or nl_url_req_cancel_tag().
+	unsigned int cancelled:1;
+
+	// Request headers (sent to server).  Empty with the libcurl backend
+	// unless the context's record_request_headers parameter is set.
 	struct nl_hash *request_headers;
 
 	// Response headers (received from server)
@@ -48,6 +123,47 @@ struct nl_url_result {
 	struct nl_raw_data response_body;
 };
 
+/*
+ * Return values for an nl_url_data_callback.
+ */
+enum nl_url_stream_status {
+	// The chunk was consumed; keep reading.
+	NL_URL_STREAM_OK = 0,
+
+	// The chunk was not consumed.  Reading pauses until
+	// nl_url_req_resume() is called, then the same data is passed again
+	// (possibly with more data appended).  The request timeout still
+	// applies while reading is paused.
+	NL_URL_STREAM_BUSY = 1,
+
+	// Stop the request.  The completion callback receives an error.
+	NL_URL_STREAM_ABORT = -1,
+};
+
+/*
+ * Called from the event thread when a streaming request's response status and
+ * headers have arrived, before any body data.  The result's code and
+ * response_headers are valid.
+ */
+typedef void (*nl_url_headers_callback)(const struct nl_url_result *result, void *data);
+
+/*
+ * Called from the event thread with each chunk of a streaming request's
+ * response body.  The chunk is only valid during the callback.  Returns one of
+ * enum nl_url_stream_status.
+ */
+typedef int (*nl_url_data_callback)(const struct nl_url_result *result, const char *chunk, size_t size, void *data);
+
+/*
+ * Queueing priorities for requests waiting for a context's max_in_flight
+ * limit.  Requests with the same priority start in the order they were added.
+ */
+enum nl_url_priority {
+	NL_URL_PRIORITY_LOW = -1,
+	NL_URL_PRIORITY_NORMAL = 0,
+	NL_URL_PRIORITY_HIGH = 1,
+};
+
 /*
  * Structure for passing parameters to nl_url_req_add().  Use a C99 compound
  * initializer to omit parameters for which the default is acceptable:
@@ -98,6 +214,29 @@ struct nl_url_params {
 	// The timeout for entire request process, in milliseconds.
 	// Pass 0 for the default of 30000ms (30s).
 	int request_timeout;
+
+	// The maximum size of the response body in bytes, including streamed
+	// bodies.  Larger responses are stopped early and fail with too_large
+	// set in the result.  0 for no limit.
+	size_t max_response_size;
+
+	// The request's place in the queue if the context's max_in_flight
+	// requests are already running.  Default is NL_URL_PRIORITY_NORMAL.
+	enum nl_url_priority priority;
+
+	// An optional label shared by related requests (e.g. all requests for
+	// one page of a UI) so they can be stopped together with
+	// nl_url_req_cancel_tag().  NULL for no tag.
+	const char *tag;
+
+	// Streaming mode.  If data_cb is set, the response body is passed to
+	// data_cb in chunks as it arrives instead of being stored in the
+	// result's response_body, which will be empty.  headers_cb (optional,
+	// only allowed with data_cb) is called once before the first chunk.
+	// Both receive the cb_data given to nl_url_req_add().  The completion
+	// callback is still called when the request finishes.
+	nl_url_headers_callback headers_cb;
+	nl_url_data_callback data_cb;
 };
 
 /*
@@ -113,6 +252,20 @@ typedef void (*nl_url_callback)(const struct nl_url_result *result, void *data);
  */
 struct nl_url_ctx *nl_url_req_init(struct nl_thread_ctx *thread_ctx);
 
+/*
+ * Initializes a URL request context with the given parameters (NULL for
+ * defaults).  Uses thread_ctx, if given, to create the URL event processing
+ * thread.  Returns NULL on error, including when the requested backend is not
+ * available.
+ */
+struct nl_url_ctx *nl_url_req_init_ex(struct nl_thread_ctx *thread_ctx, const struct nl_url_ctx_params *params);
+
+/*
+ * Returns 1 if the given request backend was compiled into nlutils, 0
+ * otherwise.
+ */
+int nl_url_req_has_backend(enum nl_url_backend backend);
+
 /*
  * Stops the given request context's processing thread, waits for the context's
  * thread to finish (by calling nl_url_req_wait()), then frees the context's
@@ -152,6 +305,47 @@ void nl_url_req_wait(struct nl_url_ctx *ctx);
  */
 int nl_url_req_add(struct nl_url_ctx *ctx, nl_url_callback cb, void *cb_data, const struct nl_url_params * const params);
 
+/*
+ * Like nl_url_req_add(), but also stores a handle for the new request in
+ * *handle (if handle is not NULL) for use with nl_url_req_cancel().  Handles
+ * are never 0 and are not reused by a context.  Returns 0 on success, an
+ * errno-like value on error.
+ */
+int nl_url_req_add_ex(struct nl_url_ctx *ctx, nl_url_callback cb, void *cb_data, const struct nl_url_params * const params,
+		uint64_t *handle);
+
+/*
+ * Stops the request with the given handle from nl_url_req_add_ex(), killing
+ * its curl process or closing its libcurl transfer and freeing its buffers.
+ * The request's callback is still called (from the event thread) with error
+ * and cancelled set in the result.  May be called from any thread, including
+ * from request callbacks.  Returns 0 on success, ENOENT if the request has
+ * already finished, or another errno-like value on error.
+ */
+int nl_url_req_cancel(struct nl_url_ctx *ctx, uint64_t handle);
+
+/*
+ * Stops all of the context's requests whose tag parameter matches the given
+ * tag, as with nl_url_req_cancel().  Returns the number of requests cancelled
+ * (0 if none matched), or -1 on error.
+ */
+int nl_url_req_cancel_tag(struct nl_url_ctx *ctx, const char *tag);
+
+/*
+ * Copies the context's current request queueing statistics into *stats.
+ * Returns 0 on success, an errno-like value on error.
+ */
+int nl_url_req_get_stats(struct nl_url_ctx *ctx, struct nl_url_stats *stats);
+
+/*
+ * Resumes reading a streaming request that was paused by its data callback
+ * returning NL_URL_STREAM_BUSY.  Pass the result pointer given to the data
+ * callback.  May be called from any thread, including from the data callback
+ * before it returns NL_URL_STREAM_BUSY.  Returns 0 on success, ENOENT if the
+ * request has already finished, or another errno-like value on error.
+ */
+int nl_url_req_resume(struct nl_url_ctx *ctx, const struct nl_url_result *result);
+
 
 
 #endif /* NLUTILS_URL_REQ_H_ */
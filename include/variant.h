@@ -130,11 +130,20 @@ int nl_fprint_variant(FILE *output, struct nl_variant value);
  */
 void nl_display_variant(FILE *output, struct nl_variant value);
 
+/*
+ * Formats the given variant value for display into buf, exactly as
+ * nl_variant_to_string() would, without allocating memory.  Writes at most len
+ * bytes, including a terminating NUL byte if len is not zero.  Returns the
+ * full length of the formatted value, excluding the NUL byte, like snprintf(),
+ * so the output was truncated if the return value is len or more.  Returns -1
+ * on error.
+ */
+int nl_variant_format_into(char *buf, size_t len, struct nl_variant value);
+
 /*
  * Stores the given data in a newly-allocated string, formatted for display.
- * The data is formatted twice: once to calculate the length of the string, and
- * again to store the data in the string.  Returns NULL if a new string could
- * not be allocated.  The returned buffer must be free()d.
+ * Returns NULL if a new string could not be allocated.  The returned buffer
+ * must be free()d.
  */
 char *nl_variant_to_string(struct nl_variant value);
 
@@ -144,9 +153,10 @@ char *nl_variant_to_string(struct nl_variant value);
  * *result on error.  Integer values are treated as base 16 if prefixed with
  * 0x, base 10 otherwise (leading zeros are ignored).  For integer values, the
  * string "true" is treated as 1, "false" as 0.  Initial whitespace is skipped
- * for numeric types.  Conversion of numeric types is performed by strtol and
- * strtof.  Conversion of string types stops at the first newline or carriage
- * return, or at the end of the string.  Strings are de-escaped using
+ * for numeric types.  Numeric types are converted exactly as strtol() and
+ * strtof() would, using those functions for inputs not handled by faster
+ * internal parsers.  Conversion of string types stops at the first newline or
+ * carriage return, or at the end of the string.  Strings are de-escaped using
  * nl_unescape_string().  If the considered part of str contains exactly "\\0",
  * then a NULL string is stored in *result.  Invalid integer and floating point
  * values will not be converted.  String and data values must later be freed
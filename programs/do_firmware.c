@@ -15,106 +15,175 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <signal.h>
+#include <limits.h>
+#include <zlib.h>
 
 #include "nlutils.h"
 
 
+#define READ_SIZE 65536
+#define INFLATE_SIZE 262144
+
 /*
- * Calculates the sha1sum of the gzip decompressed remainder of the given
- * stream.  The csum array must be able to hold at least 128 bytes.  The stream
- * is rewound to the position it had at the start of this function.  Returns
+ * Decompresses the gzip-compressed remainder of the given stream into the
+ * file descriptor stagefd in a single pass, calculating the SHA-1 checksum of
+ * the decompressed data along the way.  Concatenated gzip members are
+ * decompressed like gzip -d; anything else after the last member is ignored.
+ * The csum array must be able to hold at least SHA1_HEX_SIZE bytes.  Returns
  * the compressed size of the data on success, -1 on error.
  */
-static ssize_t checksum(FILE *f, char *csum)
+static ssize_t checksum_stage(FILE *f, int stagefd, char *csum)
 {
-	int wrfd, rdfd;
-	FILE *rd;
-	ssize_t size;
-	off_t start;
+	static uint8_t inbuf[READ_SIZE];
+	static uint8_t outbuf[INFLATE_SIZE];
+	uint8_t digest[SHA1_DIGEST_SIZE];
+	struct nl_sha1_ctx sha1;
+	z_stream zs = { .next_in = inbuf };
+	ssize_t size = 0;
+	int stream_end = 0;
 	int ret;
 
-	start = ftello(f);
-	if(start == -1) {
-		perror("Error getting current file position");
+	ret = inflateInit2(&zs, 16 + MAX_WBITS);
+	if(ret != Z_OK) {
+		fprintf(stderr, "Error initializing decompression: %s\n", zs.msg ? zs.msg : zError(ret));
 		return -1;
 	}
 
-	pid_t pid = nl_popen3("gzip -d | sha1sum 2>/dev/null", &wrfd, &rdfd, NULL);
-	if(pid == -1) {
-		fprintf(stderr, "Unable to start checksum verification process.\n");
-		return -1;
+	nl_sha1_init(&sha1);
+
+	while(!stream_end) {
+		if(zs.avail_in == 0) {
+			zs.next_in = inbuf;
+			zs.avail_in = fread(inbuf, 1, sizeof(inbuf), f);
+			if(zs.avail_in == 0) {
+				if(ferror(f)) {
+					perror("Error reading firmware data");
+				} else {
+					fprintf(stderr, "Firmware data is truncated.\n");
+				}
+				goto error;
+			}
+			size += zs.avail_in;
+		}
+
+		zs.next_out = outbuf;
+		zs.avail_out = sizeof(outbuf);
+		ret = inflate(&zs, Z_NO_FLUSH);
+		if(ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+			fprintf(stderr, "Error decompressing firmware data: %s\n", zs.msg ? zs.msg : zError(ret));
+			goto error;
+		}
+
+		struct nl_raw_data out = { .data = (char *)outbuf, .size = sizeof(outbuf) - zs.avail_out };
+		nl_sha1_update(&sha1, outbuf, out.size);
+		if(nl_write_stream(stagefd, &out)) {
+			fprintf(stderr, "Error writing decompressed firmware to staging directory.\n");
+			goto error;
+		}
+
+		if(ret == Z_STREAM_END) {
+			// Continue with another gzip member if one follows.  The
+			// magic number may straddle the end of the buffer, so any
+			// leftover byte is moved to the start before refilling.
+			if(zs.avail_in < 2 && !feof(f)) {
+				size_t count;
+
+				memmove(inbuf, zs.next_in, zs.avail_in);
+				zs.next_in = inbuf;
+				count = fread(inbuf + zs.avail_in, 1, sizeof(inbuf) - zs.avail_in, f);
+				zs.avail_in += count;
+				size += count;
+			}
+
+			if(zs.avail_in >= 2 && zs.next_in[0] == 0x1f && zs.next_in[1] == 0x8b) {
+				inflateReset(&zs);
+			} else {
+				stream_end = 1;
+			}
+		}
 	}
 
-	// Write data to the stdin pipe
-	size = nl_stream_to_fd(f, wrfd);
-	if(size == -1) {
-		fprintf(stderr, "Error copying data to checksum process.\n");
-		close(rdfd);
-		close(wrfd);
-		kill(pid, SIGKILL);
-		return -1;
+	// Count any ignored trailing data in the compressed size, as before
+	while((ret = fread(inbuf, 1, sizeof(inbuf), f)) > 0) {
+		size += ret;
+	}
+	if(ferror(f)) {
+		perror("Error reading firmware data");
+		goto error;
 	}
-	close(wrfd);
 
-	// Wait for the process to finish
-	ret = nl_wait_get_return(pid);
-	if(ret) {
-		if(ret == -1) {
-			fprintf(stderr, "Error waiting for checksum process to finish.\n");
-		} else {
-			fprintf(stderr, "Checksum process failed with return code %d.\n", ret);
-		}
-		close(rdfd);
-		return -1;
+	inflateEnd(&zs);
+
+	nl_sha1_final(&sha1, digest);
+	nl_to_hex(digest, SHA1_DIGEST_SIZE, csum);
+
+	return size;
+
+error:
+	inflateEnd(&zs);
+	return -1;
+}
+
+/*
+ * Creates the file that holds the decompressed firmware until its checksum is
+ * verified, in a private staging directory under $TMPDIR (or /tmp).  The file
+ * and directory are removed immediately, so nothing is left behind if the
+ * update fails.  Returns a close-on-exec file descriptor open for reading and
+ * writing, or -1 on error.
+ */
+static int create_stage_file(void)
+{
+	const char *tmpdir = getenv("TMPDIR");
+	char dir[PATH_MAX - sizeof("/firmware")];
+	char path[PATH_MAX];
+	int fd;
+
+	if(tmpdir == NULL || *tmpdir == 0) {
+		tmpdir = "/tmp";
 	}
 
-	// Read the result from the stdout pipe
-	rd = fdopen(rdfd, "rb");
-	if(rd == NULL) {
-		perror("Error opening checksum file descriptor as stream");
-		close(rdfd);
+	if(snprintf(dir, sizeof(dir), "%s/do_firmware.XXXXXX", tmpdir) >= (int)sizeof(dir)) {
+		fprintf(stderr, "Staging directory name is too long.\n");
 		return -1;
 	}
-	if(fscanf(rd, "%127[0-9A-Fa-f]%*2[ ]-%*1[\n]", csum) != 1) {
-		fprintf(stderr, "Error reading computed checksum.\n");
-		fclose(rd);
+	if(mkdtemp(dir) == NULL) {
+		perror("Error creating staging directory");
 		return -1;
 	}
-	fclose(rd);
 
-	if(fseeko(f, start, SEEK_SET) == -1) {
-		perror("Error rewinding stream after calculating checksum");
+	snprintf(path, sizeof(path), "%s/firmware", dir);
+	fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+	if(fd == -1) {
+		perror("Error creating staging file");
+	} else {
+		unlink(path);
 	}
+	rmdir(dir);
 
-	return size;
+	return fd;
 }
 
 /*
- * Decrypts, decompresses, and extracts the remainder of the given stream as a
- * firmware image.  Returns the compressed size of the data on success, -1 on
- * error.
+ * Runs the verified, decompressed firmware script in the file descriptor
+ * stagefd with bash.  The script becomes this process's stdin, which bash
+ * inherits, so the script sees the same stdin as it did when it was piped
+ * through gzip -d | bash, but bash can read a seekable file in blocks instead
+ * of one byte at a time.  Returns 0 on success, -1 on error.
  */
-static ssize_t extract(FILE *f)
+static int extract(int stagefd)
 {
-	int wrfd;
-	ssize_t size;
 	int ret;
 
-	pid_t pid = nl_popen3("gzip -d | bash", &wrfd, NULL, NULL);
-	if(pid == -1) {
-		fprintf(stderr, "Unable to start extraction process.\n");
+	if(lseek(stagefd, 0, SEEK_SET) == -1 || dup2(stagefd, STDIN_FILENO) == -1) {
+		perror("Error redirecting staged firmware to stdin");
 		return -1;
 	}
 
-	// Write data to the stdin pipe
-	size = nl_stream_to_fd(f, wrfd);
-	if(size == -1) {
-		fprintf(stderr, "Error copying data to extraction process.\n");
-		close(wrfd);
-		kill(pid, SIGKILL);
+	pid_t pid = nl_popen3("bash", NULL, NULL, NULL);
+	if(pid == -1) {
+		fprintf(stderr, "Unable to start extraction process.\n");
 		return -1;
 	}
-	close(wrfd);
 
 	// Wait for the process to finish
 	ret = nl_wait_get_return(pid);
@@ -127,19 +196,20 @@ static ssize_t extract(FILE *f)
 		return -1;
 	}
 
-	return size;
+	return 0;
 }
 
 int main(int argc, char *argv[])
 {
 	struct stat statbuf;
 	char csum_in[128] = "";
-	char csum_verify[128] = "";
+	char csum_verify[SHA1_HEX_SIZE] = "";
 	char arch_line[64] = "";
 	char name_line[64] = "";
 	FILE *fw;
 	int version;
 	ssize_t exec_size = 0;
+	int stagefd = -1;
 
 	if(argc != 2) {
 		printf("Usage: %s (firmware_file|--version)\n", argv[0]);
@@ -223,8 +293,12 @@ int main(int argc, char *argv[])
 		goto error;
 	}
 
-	// Verify checksum (TODO: use nl_sha1*() and zlib)
-	exec_size = checksum(fw, csum_verify);
+	// Decompress into the staging directory and verify checksum in one pass
+	stagefd = create_stage_file();
+	if(stagefd == -1) {
+		goto error;
+	}
+	exec_size = checksum_stage(fw, stagefd, csum_verify);
 	if(exec_size == -1) {
 		fprintf(stderr, "Error calculating checksum for firmware file.\n");
 		goto error;
@@ -243,11 +317,12 @@ int main(int argc, char *argv[])
 		fprintf(stderr, "Error changing to root directory.\n");
 		goto error;
 	}
-	if(extract(fw) == -1) {
+	if(extract(stagefd) == -1) {
 		fprintf(stderr, "Error extracting firmware.\n");
 		goto error;
 	}
 
+	close(stagefd);
 	fclose(fw);
 
 	printf("Firmware extraction complete.\n");
@@ -255,6 +330,9 @@ int main(int argc, char *argv[])
 	return 0;
 
 error:
+	if(stagefd != -1) {
+		close(stagefd);
+	}
 	fclose(fw);
 	return -1;
 }
@@ -0,0 +1,42 @@
+/*
+ * Converts a binary trace file written by NL_TRACE() to text.
+ * Copyright (C)2026 Mike Bourgeous.  Released under AGPLv3.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nlutils.h"
+
+int main(int argc, char *argv[])
+{
+	FILE *in = stdin;
+	int ret;
+
+	if(argc > 2 || (argc == 2 && !strcmp(argv[1], "--help"))) {
+		printf("Usage: %s [trace_file|--version]\n", argv[0]);
+		printf("Reads from stdin if trace_file is omitted or -.\n");
+		return argc == 2 ? 0 : -1;
+	}
+
+	if(argc == 2 && !strcmp(argv[1], "--version")) {
+		printf("%s\n", NLUTILS_VERSION);
+		return 0;
+	}
+
+	if(argc == 2 && strcmp(argv[1], "-")) {
+		in = fopen(argv[1], "r");
+		if(in == NULL) {
+			ERRNO_OUT("Error opening trace file %s", argv[1]);
+			return -1;
+		}
+	}
+
+	ret = nl_trace_decode(in, stdout);
+
+	if(in != stdin) {
+		fclose(in);
+	}
+
+	return ret;
+}
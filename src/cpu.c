@@ -0,0 +1,53 @@
+/*
+ * Runtime CPU feature detection for the SIMD code paths.
+ * Copyright (C)2026 Mike Bourgeous.  Released under AGPLv3.
+ */
+#if defined(__aarch64__) || defined(__arm__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif /* __aarch64__ || __arm__ */
+
+#include "cpu_internal.h"
+
+/*
+ * Returns nonzero if both this build and the CPU support the given feature.
+ * x86 features are checked with __builtin_cpu_supports(), ARMv8 SHA-1 with
+ * the kernel's hardware capability bits, and NEON at compile time.
+ */
+int nl_cpu_has(enum nl_cpu_feature feature)
+{
+	switch(feature) {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+		case NL_CPU_SSE2:
+			return __builtin_cpu_supports("sse2");
+
+		case NL_CPU_SSSE3:
+			return __builtin_cpu_supports("ssse3");
+
+		case NL_CPU_SSE4_1:
+			return __builtin_cpu_supports("sse4.1");
+
+		case NL_CPU_AVX2:
+			return __builtin_cpu_supports("avx2");
+
+		case NL_CPU_SHA:
+			return __builtin_cpu_supports("sha");
+#endif /* x86 */
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+		case NL_CPU_NEON:
+			return 1;
+#endif /* __ARM_NEON */
+
+#if defined(__aarch64__)
+		case NL_CPU_ARM_SHA1:
+			return !!(getauxval(AT_HWCAP) & HWCAP_SHA1);
+#elif defined(__arm__) && defined(HWCAP2_SHA1)
+		case NL_CPU_ARM_SHA1:
+			return !!(getauxval(AT_HWCAP2) & HWCAP2_SHA1);
+#endif /* __aarch64__, __arm__ */
+
+		default:
+			return 0;
+	}
+}
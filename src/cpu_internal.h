@@ -0,0 +1,29 @@
+/*
+ * Runtime CPU feature detection shared by the SIMD implementations in
+ * escape.c, kvp.c, and sha1.c.  Not installed with the public headers.
+ * Copyright (C)2026 Mike Bourgeous.  Released under AGPLv3.
+ */
+#ifndef NLUTILS_CPU_INTERNAL_H_
+#define NLUTILS_CPU_INTERNAL_H_
+
+/*
+ * Instruction set extensions checked by nl_cpu_has().
+ */
+enum nl_cpu_feature {
+	NL_CPU_SSE2,
+	NL_CPU_SSSE3,
+	NL_CPU_SSE4_1,
+	NL_CPU_AVX2,
+	NL_CPU_SHA,		// x86 SHA extensions (SHA-NI)
+	NL_CPU_NEON,
+	NL_CPU_ARM_SHA1,	// ARMv8 SHA-1 instructions
+};
+
+/*
+ * Returns nonzero if both this build and the CPU support the given feature.
+ * x86 features are checked with __builtin_cpu_supports(), ARMv8 SHA-1 with
+ * the kernel's hardware capability bits, and NEON at compile time.
+ */
+int nl_cpu_has(enum nl_cpu_feature feature);
+
+#endif /* NLUTILS_CPU_INTERNAL_H_ */
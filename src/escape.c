@@ -5,8 +5,10 @@
 #include <string.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <pthread.h>
 
 #include "nlutils.h"
+#include "cpu_internal.h"
 
 /*
  * The character to use for escaping characters from esc_chars.
@@ -30,75 +32,488 @@ static const char esc_chars[] = {
 	// TODO: Add all escape sequences that may be generated by Ruby's String#inspect method (including \a, \b, \uNNNN).
 };
 
-// TODO: Make generic versions of nl_count_escapes and nl_escape_string that use an escape table parameter
+// Lookup tables built from esc_chars by escape_tables_init().  The string
+// table is used by nl_escape_string() and nl_unescape_string().  The data
+// table is used by nl_escape_data(), which leaves colons alone and escapes
+// unprintable characters as hexadecimal.
+static struct nl_escape_table string_table;
+static struct nl_escape_table data_table;
+static pthread_once_t escape_tables_once = PTHREAD_ONCE_INIT;
+
+static void escape_tables_init(void)
+{
+	char data_chars[ARRAY_SIZE(esc_chars)];
+	size_t data_len = 0;
+	size_t i;
+
+	for(i = 0; i < ARRAY_SIZE(esc_chars); i += 2) {
+		if(esc_chars[i] != ':') {
+			data_chars[data_len++] = esc_chars[i];
+			data_chars[data_len++] = esc_chars[i + 1];
+		}
+	}
+
+	if(nl_escape_table_init(&string_table, escape_char, esc_chars, ARRAY_SIZE(esc_chars), 0) ||
+			nl_escape_table_init(&data_table, escape_char, data_chars, data_len, 1)) {
+		ERROR_OUT("BUG: the built-in escape tables are invalid\n");
+		abort();
+	}
+}
+
+// Returns the lookup table for the built-in string escapes.
+static inline const struct nl_escape_table *get_string_table(void)
+{
+	pthread_once(&escape_tables_once, escape_tables_init);
+	return &string_table;
+}
+
+// Returns the lookup table for the built-in data escapes.
+static inline const struct nl_escape_table *get_data_table(void)
+{
+	pthread_once(&escape_tables_once, escape_tables_init);
+	return &data_table;
+}
+
+/*
+ * Returns the number of additional bytes needed to escape the given byte with
+ * the given table.
+ */
+static inline size_t escape_extra(const struct nl_escape_table *table, uint8_t c)
+{
+	uint8_t esc = table->escape[c];
+
+	return esc == 0 ? 0 : (esc == NL_ESCAPE_HEX ? 3 : 1);
+}
 
 /*
- * Returns the replacement character for the given character, or 0 if the given
- * character is not in the escape table.
+ * Returns the offset of the first byte in data that the table escapes, or
+ * len if there are none.
  */
-static inline char get_escape(char c)
+static size_t escape_scan_scalar(const struct nl_escape_table *table, const uint8_t *data, size_t len)
 {
 	size_t i;
 
-	for(i = 0; i < ARRAY_SIZE(esc_chars); i += 2) {
-		if(esc_chars[i] == c) {
-			return esc_chars[i + 1];
+	for(i = 0; i < len && !table->escape[data[i]]; i++) {
+	}
+
+	return i;
+}
+
+// The SIMD scanners look up each byte's low nibble in table->nibbles and test
+// the bit for its high nibble, which is exact for bytes below 0x80.  Bytes
+// from 0x80 up are treated as matches if the table escapes any of them, so
+// the scanners check each block's matches with the scalar scanner before
+// returning.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+
+/*
+ * Looks for bytes to escape 16 bytes at a time with SSSE3.
+ */
+__attribute__((target("ssse3")))
+static size_t escape_scan_ssse3(const struct nl_escape_table *table, const uint8_t *data, size_t len)
+{
+	__m128i nibbles = _mm_loadu_si128((const __m128i *)table->nibbles);
+	__m128i bits = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 0, 0, 0, 0, 0, 0, 0, 0);
+	__m128i low = _mm_set1_epi8(0x0f);
+	int high = table->high ? 0xffff : 0;
+	size_t i;
+
+	for(i = 0; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+		__m128i row = _mm_shuffle_epi8(nibbles, _mm_and_si128(v, low));
+		__m128i col = _mm_shuffle_epi8(bits, _mm_and_si128(_mm_srli_epi16(v, 4), low));
+		int clean = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(row, col), _mm_setzero_si128()));
+		int mask = (clean ^ 0xffff) | (_mm_movemask_epi8(v) & high);
+
+		if(mask) {
+			size_t off = i + __builtin_ctz(mask);
+			size_t found = escape_scan_scalar(table, data + off, i + 16 - off);
+			if(off + found < i + 16) {
+				return off + found;
+			}
 		}
 	}
 
-	return 0;
+	return i + escape_scan_scalar(table, data + i, len - i);
 }
 
 /*
- * Returns the original character for the given escaped character, or 0 if the
- * given character is not in the escape table.
+ * Looks for bytes to escape 32 bytes at a time with AVX2.
  */
-static inline char get_original(char c)
+__attribute__((target("avx2")))
+static size_t escape_scan_avx2(const struct nl_escape_table *table, const uint8_t *data, size_t len)
 {
+	__m256i nibbles = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)table->nibbles));
+	__m256i bits = _mm256_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 0, 0, 0, 0, 0, 0, 0, 0,
+			1, 2, 4, 8, 16, 32, 64, -128, 0, 0, 0, 0, 0, 0, 0, 0);
+	__m256i low = _mm256_set1_epi8(0x0f);
+	uint32_t high = table->high ? 0xffffffff : 0;
 	size_t i;
 
-	for(i = 1; i < ARRAY_SIZE(esc_chars); i += 2) {
-		if(esc_chars[i] == c) {
-			return esc_chars[i - 1];
+	for(i = 0; i + 32 <= len; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(data + i));
+		__m256i row = _mm256_shuffle_epi8(nibbles, _mm256_and_si256(v, low));
+		__m256i col = _mm256_shuffle_epi8(bits, _mm256_and_si256(_mm256_srli_epi16(v, 4), low));
+		uint32_t clean = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(row, col), _mm256_setzero_si256()));
+		uint32_t mask = ~clean | ((uint32_t)_mm256_movemask_epi8(v) & high);
+
+		if(mask) {
+			size_t off = i + __builtin_ctz(mask);
+			size_t found = escape_scan_scalar(table, data + off, i + 32 - off);
+			if(off + found < i + 32) {
+				return off + found;
+			}
 		}
 	}
 
-	return 0;
+	return i + escape_scan_scalar(table, data + i, len - i);
 }
+#endif /* x86 */
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
 
 /*
- * Returns the number of additional bytes needed to escape the given string for
- * serialization safety.  Does not check to see if str is NULL.
+ * Looks for bytes to escape 16 bytes at a time with AArch64 NEON.
  */
-int nl_count_escapes(char *str)
+static size_t escape_scan_neon(const struct nl_escape_table *table, const uint8_t *data, size_t len)
 {
-	int count = 0;
+	static const uint8_t bit_values[16] = { 1, 2, 4, 8, 16, 32, 64, 128 };
+	uint8x16_t nibbles = vld1q_u8(table->nibbles);
+	uint8x16_t bits = vld1q_u8(bit_values);
+	uint8x16_t low = vdupq_n_u8(0x0f);
+	uint8x16_t high = vdupq_n_u8(table->high ? 0x80 : 0xff);
+	size_t i;
 
-	while(*str != 0) {
-		if(get_escape(*str)) {
-			count++;
+	for(i = 0; i + 16 <= len; i += 16) {
+		uint8x16_t v = vld1q_u8(data + i);
+		uint8x16_t row = vqtbl1q_u8(nibbles, vandq_u8(v, low));
+		uint8x16_t col = vqtbl1q_u8(bits, vshrq_n_u8(v, 4));
+		uint8x16_t mask = vorrq_u8(vtstq_u8(row, col), vcgeq_u8(v, high));
+
+		if(vmaxvq_u8(mask)) {
+			size_t found = escape_scan_scalar(table, data + i, 16);
+			if(found < 16) {
+				return i + found;
+			}
+		}
+	}
+
+	return i + escape_scan_scalar(table, data + i, len - i);
+}
+#endif /* __aarch64__ && __ARM_NEON */
+
+typedef size_t (*escape_scan_func)(const struct nl_escape_table *table, const uint8_t *data, size_t len);
+
+static size_t escape_scan_init(const struct nl_escape_table *table, const uint8_t *data, size_t len);
+
+// The scanner used to find bytes to escape, selected at runtime by the first
+// call to escape_scan_init() or nl_escape_set_scanner().
+static escape_scan_func escape_scan = escape_scan_init;
+
+/*
+ * Returns the scanner for the given implementation, or NULL if it is not
+ * supported by this build or CPU.
+ */
+static escape_scan_func escape_get_scanner(enum nl_escape_scanner impl)
+{
+	switch(impl) {
+		case NL_ESCAPE_SCAN_AUTO:
+			break;
+
+		case NL_ESCAPE_SCAN_SCALAR:
+			return escape_scan_scalar;
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+		case NL_ESCAPE_SCAN_SSSE3:
+			return nl_cpu_has(NL_CPU_SSSE3) ? escape_scan_ssse3 : NULL;
+
+		case NL_ESCAPE_SCAN_AVX2:
+			return nl_cpu_has(NL_CPU_AVX2) ? escape_scan_avx2 : NULL;
+#endif /* x86 */
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+		case NL_ESCAPE_SCAN_NEON:
+			return nl_cpu_has(NL_CPU_NEON) ? escape_scan_neon : NULL;
+#endif /* __aarch64__ && __ARM_NEON */
+
+		default:
+			return NULL;
+	}
+
+	// Automatic selection picks the widest supported implementation
+	for(int i = NL_ESCAPE_SCAN_NEON; i > NL_ESCAPE_SCAN_SCALAR; i--) {
+		escape_scan_func scan = escape_get_scanner(i);
+		if(scan != NULL) {
+			return scan;
 		}
-		str++;
+	}
+
+	return escape_scan_scalar;
+}
+
+/*
+ * Selects the best scanner the first time it's needed, then uses it.
+ */
+static size_t escape_scan_init(const struct nl_escape_table *table, const uint8_t *data, size_t len)
+{
+	escape_scan_func scan = escape_get_scanner(NL_ESCAPE_SCAN_AUTO);
+	__atomic_store_n(&escape_scan, scan, __ATOMIC_RELAXED);
+	return scan(table, data, len);
+}
+
+/*
+ * Selects the implementation used to find characters that need escaping.
+ * NL_ESCAPE_SCAN_AUTO (the default) picks the widest SIMD scanner supported by
+ * the CPU.  The scanner only skips runs of bytes that pass through unchanged,
+ * so every choice escapes the same way; tests use this to check each scanner
+ * against the original escaping rules.  Returns 0 on success, or -1 if the
+ * implementation is not supported by this build or CPU.
+ */
+int nl_escape_set_scanner(enum nl_escape_scanner impl)
+{
+	escape_scan_func scan = escape_get_scanner(impl);
+
+	if(scan == NULL) {
+		return -1;
+	}
+
+	__atomic_store_n(&escape_scan, scan, __ATOMIC_RELAXED);
+
+	return 0;
+}
+
+// Clean runs are checked one byte at a time until they reach this length, then
+// handed to the scanner, as escape-heavy data would otherwise spend more time
+// calling the scanner than scanning.
+#define ESCAPE_SHORT_RUN 16
+
+/*
+ * Returns the number of additional bytes needed to escape len bytes of data
+ * with the given table.
+ */
+static size_t escape_count(const struct nl_escape_table *table, const uint8_t *data, size_t len)
+{
+	escape_scan_func scan = __atomic_load_n(&escape_scan, __ATOMIC_RELAXED);
+	size_t count = 0;
+	size_t clean = 0;
+	size_t i = 0;
+
+	while(i < len) {
+		if(table->escape[data[i]]) {
+			count += escape_extra(table, data[i]);
+			clean = 0;
+		} else if(++clean == ESCAPE_SHORT_RUN) {
+			// Hand long clean runs to the scanner
+			i += scan(table, data + i + 1, len - i - 1);
+			clean = 0;
+		}
+		i++;
 	}
 
 	return count;
 }
 
+/*
+ * Escapes len bytes from src into dst, copying runs of characters that don't
+ * need escaping in bulk.  Stops before the first escape sequence that would
+ * pass dst + dst_size.  The output may overlap the input as long as it never
+ * starts after the input, and the output reaches no further than the input for
+ * the bytes consumed so far (as when escaping in place from the end of a
+ * buffer; see nl_escape_string()).  Stores the number of bytes written in
+ * *written.  Returns the number of input bytes consumed.
+ */
+static size_t escape_copy(const struct nl_escape_table *table, const uint8_t *src, size_t len,
+		char *dst, size_t dst_size, size_t *written)
+{
+	static const char hex_digits[] = "0123456789abcdef";
+	escape_scan_func scan = __atomic_load_n(&escape_scan, __ATOMIC_RELAXED);
+	char *out = dst;
+	char *out_end = dst + dst_size;
+	size_t clean = 0;
+	size_t i = 0;
+
+	while(i < len) {
+		uint8_t c = src[i];
+		uint8_t esc = table->escape[c];
+
+		if(esc == 0) {
+			if(out == out_end) {
+				break;
+			}
+			*out++ = c;
+			i++;
+
+			// Hand long clean runs to the scanner
+			if(++clean == ESCAPE_SHORT_RUN) {
+				size_t run = scan(table, src + i, len - i);
+				if(run > (size_t)(out_end - out)) {
+					run = out_end - out;
+					len = i + run;
+				}
+				memmove(out, src + i, run);
+				out += run;
+				i += run;
+				clean = 0;
+			}
+			continue;
+		}
+
+		clean = 0;
+		if((size_t)(out_end - out) < 1 + escape_extra(table, c)) {
+			break;
+		}
+
+		if(esc == NL_ESCAPE_HEX) {
+			out[0] = table->escape_char;
+			out[1] = 'x';
+			out[2] = hex_digits[c >> 4];
+			out[3] = hex_digits[c & 0xf];
+			out += 4;
+		} else {
+			out[0] = table->escape_char;
+			out[1] = esc;
+			out += 2;
+		}
+		i++;
+	}
+
+	*written = out - dst;
+
+	return i;
+}
+
+/*
+ * Initializes an escape table with the given escape character and the given
+ * array of pairs_len characters, which alternates between a character to
+ * escape and the character to write after the escape character in its place
+ * (like "\tt\nn").  The escape character is escaped as itself if it is not in
+ * the array.  If hex is nonzero, other bytes below 0x20 or above 0x7e are
+ * escaped as the escape character, 'x', and two lowercase hexadecimal digits.
+ * Replacement characters must be printable and cannot be 'x' when hex is
+ * nonzero.  Returns 0 on success, -1 on error.
+ */
+int nl_escape_table_init(struct nl_escape_table *table, char escape_char, const char *pairs, size_t pairs_len, int hex)
+{
+	size_t i;
+
+	if(CHECK_NULL(table) || CHECK_NULL(pairs)) {
+		return -1;
+	}
+	if(pairs_len % 2) {
+		ERROR_OUT("Escape table pairs must have an even length (got %zu)\n", pairs_len);
+		return -1;
+	}
+
+	memset(table, 0, sizeof(*table));
+	table->escape_char = escape_char;
+
+	for(i = 0; i < pairs_len; i += 2) {
+		uint8_t c = pairs[i];
+		uint8_t replace = pairs[i + 1];
+
+		if(replace < 0x20 || replace > 0x7e || (hex && replace == NL_ESCAPE_HEX)) {
+			ERROR_OUT("Invalid replacement 0x%02x for escaped character 0x%02x\n", replace, c);
+			return -1;
+		}
+
+		table->escape[c] = replace;
+		table->original[replace] = c;
+	}
+
+	if(!table->escape[(uint8_t)escape_char]) {
+		table->escape[(uint8_t)escape_char] = escape_char;
+		table->original[(uint8_t)escape_char] = escape_char;
+	}
+
+	for(i = 0; i < 256; i++) {
+		if(hex && !table->escape[i] && (i < 0x20 || i > 0x7e)) {
+			table->escape[i] = NL_ESCAPE_HEX;
+		}
+
+		if(table->escape[i]) {
+			if(i < 0x80) {
+				table->nibbles[i & 0xf] |= 1 << (i >> 4);
+			} else {
+				table->high = 1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Returns the table used by nl_escape_string(), nl_count_escapes(), and
+ * nl_unescape_string(), for use with the other nl_escape_table_*()
+ * functions.
+ */
+const struct nl_escape_table *nl_escape_string_table(void)
+{
+	return get_string_table();
+}
+
+/*
+ * Returns the table used by nl_escape_data() and nl_count_data_escapes().
+ */
+const struct nl_escape_table *nl_escape_data_table(void)
+{
+	return get_data_table();
+}
+
+/*
+ * Returns the number of additional bytes needed to escape len bytes of data
+ * with the given table.  Does not check to see if table or data is NULL.
+ */
+size_t nl_escape_table_count(const struct nl_escape_table *table, const char *data, size_t len)
+{
+	return escape_count(table, (const uint8_t *)data, len);
+}
+
+/*
+ * Escapes len bytes of data with the given table into out in a single pass,
+ * writing at most out_size bytes and never a partial escape sequence.  No
+ * terminating zero byte is written.  Returns the full length of the escaped
+ * data, like snprintf(), so the output was complete if the return value is
+ * less than or equal to out_size.  Does not check to see if table, data, or
+ * out is NULL.
+ */
+size_t nl_escape_table_into(const struct nl_escape_table *table, const char *data, size_t len, char *out, size_t out_size)
+{
+	size_t written;
+	size_t used = escape_copy(table, (const uint8_t *)data, len, out, out_size, &written);
+
+	if(used < len) {
+		written += len - used + escape_count(table, (const uint8_t *)data + used, len - used);
+	}
+
+	return written;
+}
+
+/*
+ * Returns the number of additional bytes needed to escape the given string for
+ * serialization safety.  Does not check to see if str is NULL.
+ */
+int nl_count_escapes(char *str)
+{
+	return escape_count(get_string_table(), (const uint8_t *)str, strlen(str));
+}
+
 /*
  * Escapes serialization-unsafe characters in the given string, expanding it
  * using realloc() if more than *size bytes are required (including the
  * terminating zero byte).  If the string is resized, the new size is stored in
  * *size, and the new pointer is stored in *str.  Returns 0 on success, or -1
- * if a temporary expansion buffer couldn't be allocated or the string buffer
- * couldn't be resized.  Use nl_escape_string() only for 0-terminated strings.
+ * if the string buffer couldn't be resized.  Use nl_escape_string() only for
+ * 0-terminated strings.
  */
 int nl_escape_string(char **str, size_t *size)
 {
-	char *tmp;	// Temporary allocated buffer
-	char *ptr;	// Pointer to current character in *str
-	char *ptr2;	// Pointer to current character in tmp
-	char replace;	// Replacement character from get_escape()
-	size_t len;
+	const struct nl_escape_table *table = get_string_table();
+	escape_scan_func scan = __atomic_load_n(&escape_scan, __ATOMIC_RELAXED);
+	size_t len, first, extra, written;
+	char *tmp;
 
 	if(str == NULL || *str == NULL) {
 		ERROR_OUT("Null string parameter\n");
@@ -109,52 +524,31 @@ int nl_escape_string(char **str, size_t *size)
 		return -1;
 	}
 
-	// There's probably a way to speed this up, like integrating counting,
-	// buffer reallocation, and escaping into a single loop, and unrolling
-	// loops to allow use of memcpy and/or 32- or 64-bit memory operations.
-	// A 256-entry table could also be created so that escape characters
-	// are discovered by an array lookup rather than a loop.
-	
-	// TODO: Run some benchmarks to see if doing an in-place replacement in
-	// reverse order (like nl_escape_data()) would be better
+	// Most strings need no escaping, so stop at the first clean scan
+	len = strlen(*str);
+	first = scan(table, (const uint8_t *)*str, len);
+	if(first == len) {
+		return 0;
+	}
 
 	// Expand the string buffer
-	len = strlen(*str) + nl_count_escapes(*str) + 1;
-	if(len > *size) {
-		tmp = realloc(*str, len);
+	extra = escape_count(table, (const uint8_t *)*str + first, len - first);
+	if(len + extra + 1 > *size) {
+		tmp = realloc(*str, len + extra + 1);
 		if(tmp == NULL) {
-			ERRNO_OUT("Error resizing string buffer from %zu to %zu", *size, len);
+			ERRNO_OUT("Error resizing string buffer from %zu to %zu", *size, len + extra + 1);
 			return -1;
 		}
 		*str = tmp;
-		*size = len;
+		*size = len + extra + 1;
 	}
 
-	// Allocate temporary buffer
-	tmp = nl_strdup(*str);
-	if(tmp == NULL) {
-		ERROR_OUT("Error allocating temporary string copy\n");
-		return -1;
-	}
+	// Move the unescaped remainder to the end of the buffer, then escape
+	// it forward in place
+	memmove(*str + first + extra, *str + first, len - first);
+	escape_copy(table, (const uint8_t *)*str + first + extra, len - first, *str + first, len - first + extra, &written);
+	(*str)[len + extra] = 0;
 
-	// Copy data with escaping
-	ptr = *str;
-	ptr2 = tmp;
-	while(*ptr2 != 0) {
-		replace = get_escape(*ptr2);
-		if(replace) {
-			ptr[0] = escape_char;
-			ptr[1] = replace;
-			ptr += 2;
-		} else {
-			*ptr = *ptr2;
-			ptr++;
-		}
-		ptr2++;
-	}
-	*ptr = 0;
-
-	free(tmp);
 	return 0;
 }
 
@@ -174,6 +568,18 @@ int nl_escape_string(char **str, size_t *size)
  */
 int nl_unescape_string(char *str, int include_zero, enum nl_unescape_dequote dequote)
 {
+	return nl_unescape_table_string(get_string_table(), str, include_zero, dequote);
+}
+
+/*
+ * Like nl_unescape_string(), but uses the escape character and escape
+ * sequences from the given table.  Hexadecimal escapes are always
+ * recognized.  Does not check to see if table is NULL.
+ */
+int nl_unescape_table_string(const struct nl_escape_table *table, char *str, int include_zero,
+		enum nl_unescape_dequote dequote)
+{
+	const char escape_char = table->escape_char;
 	char *write = str;
 	char replace;
 	int count = 0;
@@ -212,16 +618,17 @@ int nl_unescape_string(char *str, int include_zero, enum nl_unescape_dequote deq
 			*write++ = *str++;
 		}
 	} else {
-		while(*str != escape_char && *str != 0) {
-			write++;
-			str++;
+		char *next = strchr(str, escape_char);
+		if(next == NULL) {
+			next = str + strlen(str);
 		}
+		write += next - str;
+		str = next;
 	}
 
 	// No doubt this could be made more efficient by consolidating common
-	// logic from the various execution paths and using something more
-	// optimized than get_original(), if this code proves to be a source of
-	// slowness.
+	// logic from the various execution paths, if this code proves to be a
+	// source of slowness.
 	// TODO: This code is functional, but convoluted.  Clean it up.
 	while(*str != 0) {
 		if(*str == escape_char) {
@@ -260,7 +667,7 @@ int nl_unescape_string(char *str, int include_zero, enum nl_unescape_dequote deq
 				}
 			} else {
 				// Standard escape
-				replace = get_original(str[1]);
+				replace = table->original[(uint8_t)str[1]];
 				if(!replace) {
 #ifdef DEBUG
 					snprintf(buf, ARRAY_SIZE(buf), "%02x", str[1]);
@@ -311,21 +718,7 @@ int nl_unescape_string(char *str, int include_zero, enum nl_unescape_dequote deq
  */
 size_t nl_count_data_escapes(const char *data, size_t data_size)
 {
-	size_t count = 0;
-	size_t i;
-
-	for(i = 0; i < data_size; i++) {
-		// Process common escape sequences ('\n', etc.) except for the colon
-		// used in serialization, and replace other unprintables with
-		// hex escape sequences
-		if(data[i] != ':' && get_escape(data[i]) != 0) {
-			count++;
-		} else if(data[i] < 0x20 || data[i] > 0x7e || data[i] == escape_char) {
-			count += 3; // "xNN" - 3 bytes
-		}
-	}
-
-	return count;
+	return escape_count(get_data_table(), (const uint8_t *)data, data_size);
 }
 
 /*
@@ -338,10 +731,10 @@ size_t nl_count_data_escapes(const char *data, size_t data_size)
  */
 int nl_escape_data(char **data, size_t *data_size, size_t *buf_size, int add_null)
 {
-	char hexbuf[5];
-	char *tmp, *src, *dst;
-	char esc;
-	size_t new_size;
+	const struct nl_escape_table *table = get_data_table();
+	escape_scan_func scan = __atomic_load_n(&escape_scan, __ATOMIC_RELAXED);
+	size_t first, extra, new_size, written;
+	char *tmp;
 
 	if(data == NULL || *data == NULL) {
 		ERROR_OUT("Null data parameter\n");
@@ -361,7 +754,9 @@ int nl_escape_data(char **data, size_t *data_size, size_t *buf_size, int add_nul
 		return -1;
 	}
 
-	new_size = *data_size + (add_null ? 1 : 0) + nl_count_data_escapes(*data, *data_size);
+	first = scan(table, (const uint8_t *)*data, *data_size);
+	extra = first < *data_size ? escape_count(table, (const uint8_t *)*data + first, *data_size - first) : 0;
+	new_size = *data_size + (add_null ? 1 : 0) + extra;
 
 	// Nothing to do
 	if(new_size == *data_size) {
@@ -380,35 +775,18 @@ int nl_escape_data(char **data, size_t *data_size, size_t *buf_size, int add_nul
 		*buf_size = new_size;
 	}
 
-	// Process the characters
-	dst = *data + new_size - 1;
-	src = *data + *data_size - 1;
+	// Move the unescaped remainder to the end of the escaped data, then
+	// escape it forward in place
+	if(extra) {
+		memmove(*data + first + extra, *data + first, *data_size - first);
+		escape_copy(table, (const uint8_t *)*data + first + extra, *data_size - first,
+				*data + first, *data_size - first + extra, &written);
+	}
 	if(add_null) {
-		*dst = 0;
-		dst--;
-	}
-
-	while(dst >= *data && src >= *data) {
-		esc = get_escape(*src);
-		if(*src != ':' && esc != 0) {
-			*dst = esc;
-			dst--;
-			*dst = escape_char;
-			dst--;
-		} else if(*src < 0x20 || *src > 0x7e || *src == escape_char) {
-			snprintf(hexbuf, ARRAY_SIZE(hexbuf), "\\x%02x", (unsigned int)(*src) & 0xff);
-			memcpy(dst - 3, hexbuf, 4);
-			dst -= 4;
-		} else {
-			*dst = *src;
-			dst--;
-		}
-		src--;
+		(*data)[new_size - 1] = 0;
 	}
 
 	*data_size = new_size;
 
 	return 0;
 }
-
-
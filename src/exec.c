@@ -5,12 +5,69 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <limits.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sched.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
 
 #include "nlutils.h"
 
 
+// Waits for a new child process to execute its command or fail, by reading
+// from the read end of the child's close-on-execute status pipe.  Closes
+// status_fd.  Returns 0 if the command was executed, or the errno reported by
+// the child if it failed.
+static int read_exec_status(int status_fd)
+{
+	ssize_t ret;
+	int err;
+
+	do {
+		ret = read(status_fd, &err, sizeof(err));
+	} while(ret == -1 && errno == EINTR);
+
+	close(status_fd);
+
+	if(ret == 0) {
+		return 0;
+	}
+
+	return ret == sizeof(err) ? err : EIO;
+}
+
+// Reports errno from a forked child to its parent through the child's status
+// pipe (see read_exec_status()), then exits the child.
+static void fork_child_fail(int status_fd)
+{
+	int err = errno;
+
+	if(write(status_fd, &err, sizeof(err)) != sizeof(err)) {
+		// Nothing else can be done; the parent will see the exit status
+	}
+
+	exit(-1);
+}
+
+// Converts a status value from waitpid() to nl_wait_get_return()'s format.
+static int wait_status_to_return(int status)
+{
+	if(WIFEXITED(status)) {
+		return WEXITSTATUS(status);
+	}
+	if(WIFSIGNALED(status)) {
+		return -(WTERMSIG(status) + 100);
+	}
+
+	return -1;
+}
+
 /*
  * Runs the given command (without searching $PATH) with the given arguments in
  * another process, with full remote interaction capabilities.  The arguments
@@ -26,28 +83,37 @@
  * Note that the called process will inherit open file descriptors, so make
  * sure that opened files are set to close (e.g. with nl_set_cloexec()).  The
  * file descriptors returned by this function will already be set to close on
- * execute, but may still be inherited if another thread executes another
- * process between creation and marking as FD_CLOEXEC.
+ * execute.
+ *
+ * Equivalent to nl_popen3vea() with no actions.
  */
 pid_t nl_popen3ve(int *writefd, int *readfd, int *errfd, const char *cmd, char *const argv[], char *const envp[])
 {
-	return nl_popen3vec(writefd, readfd, errfd, cmd, argv, envp, NULL);
+	return nl_popen3vea(writefd, readfd, errfd, cmd, argv, envp, NULL);
 }
 
 /*
- * Exactly like nl_popen3ve().  If callback is not NULL, it will be called in
- * the child process after forking.  The callback will be called before the
- * child process's standard I/O is redirected to pipes.  An example use of the
+ * Like nl_popen3ve().  If callback is not NULL, it will be called in the child
+ * process after forking.  The callback will be called before the child
+ * process's standard I/O is redirected to pipes.  An example use of the
  * callback is dropping privileges before the command executes.
+ *
+ * This uses fork(), so the time taken grows with the size of the calling
+ * process.  Use nl_popen3vea() if the child's setup can be described by a list
+ * of actions.  Failure to execute the command is returned as -1 with errno
+ * set, as the parent waits for the child's close-on-execute status pipe.
  */
 pid_t nl_popen3vec(int *writefd, int *readfd, int *errfd, const char *cmd, char *const argv[], char *const envp[], void (*callback)(void))
 {
+	int status_pipe[2] = {-1, -1};
 	int in_pipe[2] = {-1, -1};
 	int out_pipe[2] = {-1, -1};
 	int err_pipe[2] = {-1, -1};
 	pid_t pid;
+	int err;
 
 	if(CHECK_NULL(cmd) || CHECK_NULL(argv) || CHECK_NULL(envp)) {
+		errno = EFAULT;
 		goto error;
 	}
 
@@ -68,6 +134,10 @@ pid_t nl_popen3vec(int *writefd, int *readfd, int *errfd, const char *cmd, char
 		ERRNO_OUT("Error creating pipe for stderr");
 		goto error;
 	}
+	if(pipe2(status_pipe, O_CLOEXEC)) {
+		ERRNO_OUT("Error creating pipe for child process status");
+		goto error;
+	}
 
 	pid = fork();
 	switch(pid) {
@@ -78,6 +148,18 @@ pid_t nl_popen3vec(int *writefd, int *readfd, int *errfd, const char *cmd, char
 
 		case 0:
 			// Child
+			close(status_pipe[0]);
+
+			// Keep the status pipe clear of the standard fds
+			if(status_pipe[1] < 3) {
+				int status_fd = fcntl(status_pipe[1], F_DUPFD_CLOEXEC, 3);
+				if(status_fd == -1) {
+					ERRNO_OUT("Error moving status pipe in child process");
+					fork_child_fail(status_pipe[1]);
+				}
+				status_pipe[1] = status_fd;
+			}
+
 			if(callback) {
 				callback();
 			}
@@ -86,7 +168,7 @@ pid_t nl_popen3vec(int *writefd, int *readfd, int *errfd, const char *cmd, char
 				close(in_pipe[1]);
 				if(dup2(in_pipe[0], 0) == -1) {
 					ERRNO_OUT("Error assigning stdin in child process");
-					exit(-1);
+					fork_child_fail(status_pipe[1]);
 				}
 				close(in_pipe[0]);
 			}
@@ -94,7 +176,7 @@ pid_t nl_popen3vec(int *writefd, int *readfd, int *errfd, const char *cmd, char
 				close(out_pipe[0]);
 				if(dup2(out_pipe[1], 1) == -1) {
 					ERRNO_OUT("Error assigning stdout in child process");
-					exit(-1);
+					fork_child_fail(status_pipe[1]);
 				}
 				close(out_pipe[1]);
 			}
@@ -102,25 +184,34 @@ pid_t nl_popen3vec(int *writefd, int *readfd, int *errfd, const char *cmd, char
 				close(err_pipe[0]);
 				if(dup2(err_pipe[1], 2) == -1) {
 					ERRNO_OUT("Error assigning stderr in child process");
-					exit(-1);
+					fork_child_fail(status_pipe[1]);
 				}
 				close(err_pipe[1]);
 			}
 
+			// The status pipe is closed without data if this succeeds
 			execve(cmd, argv, envp);
 
-			// TODO: Have the parent wait very briefly for failure
-			// of execve, notify via a pipe, so parent can return
-			// failure?
-
 			ERRNO_OUT("Error executing command in child process");
-			exit(-1);
+			fork_child_fail(status_pipe[1]);
 
 		default:
 			// Parent
 			break;
 	}
 
+	close(status_pipe[1]);
+	status_pipe[1] = -1;
+	err = read_exec_status(status_pipe[0]);
+	status_pipe[0] = -1;
+	if(err) {
+		errno = err;
+		ERRNO_OUT("Error executing %s in child process", cmd);
+		waitpid(pid, NULL, 0);
+		errno = err;
+		goto error;
+	}
+
 	if(writefd) {
 		close(in_pipe[0]);
 		nl_set_cloexec(in_pipe[1]);
@@ -133,13 +224,276 @@ pid_t nl_popen3vec(int *writefd, int *readfd, int *errfd, const char *cmd, char
 	}
 	if(errfd) {
 		close(err_pipe[1]);
-		nl_set_cloexec(out_pipe[0]);
+		nl_set_cloexec(err_pipe[0]);
+		*errfd = err_pipe[0];
+	}
+
+	return pid;
+
+error:
+	err = errno;
+
+	if(status_pipe[0] >= 0) {
+		close(status_pipe[0]);
+	}
+	if(status_pipe[1] >= 0) {
+		close(status_pipe[1]);
+	}
+	if(in_pipe[0] >= 0) {
+		close(in_pipe[0]);
+	}
+	if(in_pipe[1] >= 0) {
+		close(in_pipe[1]);
+	}
+	if(out_pipe[0] >= 0) {
+		close(out_pipe[0]);
+	}
+	if(out_pipe[1] >= 0) {
+		close(out_pipe[1]);
+	}
+	if(err_pipe[0] >= 0) {
+		close(err_pipe[0]);
+	}
+	if(err_pipe[1] >= 0) {
+		close(err_pipe[1]);
+	}
+
+	errno = err;
+
+	return -1;
+}
+
+// State shared by nl_popen3vea() with its vfork() child.
+struct spawn_child {
+	const char *cmd;
+	char *const *argv;
+	char *const *envp;
+	const struct nl_spawn_action *actions;
+	int fds[3]; // Pipe ends to become the child's stdin, stdout, and stderr (-1 to inherit)
+	sigset_t sigmask; // The parent's signal mask, restored before execve()
+	int status_fd; // Close-on-execute pipe for reporting errno if the child fails
+};
+
+// Applies a spawn action in the child process.  Returns 0 on success, -1 with
+// errno set on error.
+static int apply_spawn_action(const struct nl_spawn_action *action)
+{
+	int nice;
+
+	switch(action->type) {
+		case NL_SPAWN_NICE:
+			return setpriority(PRIO_PROCESS, 0, action->value);
+
+		case NL_SPAWN_NICE_MIN:
+			errno = 0;
+			nice = getpriority(PRIO_PROCESS, 0);
+			if(nice == -1 && errno) {
+				return -1;
+			}
+			return nice < action->value ? setpriority(PRIO_PROCESS, 0, action->value) : 0;
+
+		case NL_SPAWN_SCHED_OTHER:
+			return sched_setscheduler(0, SCHED_OTHER, &(struct sched_param){ .sched_priority = 0 });
+
+		case NL_SPAWN_RLIMIT:
+			return setrlimit(action->value, &action->limit);
+
+		default:
+			errno = EINVAL;
+			return -1;
+	}
+}
+
+// Runs in the vfork() child of nl_popen3vea().  The child shares the parent's
+// memory until it executes the command, so this only makes system calls, and
+// reports errors by writing errno to c->status_fd instead of logging.  A pipe
+// is used instead of shared memory because vfork() may be emulated with fork()
+// (e.g. by Valgrind).  Never returns.
+static void spawn_child(struct spawn_child *c)
+{
+	const struct nl_spawn_action *action;
+	struct sigaction sa;
+	int status_fd = c->status_fd;
+	int fds[3];
+	int err;
+	int i;
+
+	// A signal handler from the parent would run on the parent's memory
+	for(i = 1; i < NSIG; i++) {
+		if(sigaction(i, NULL, &sa) == 0 && sa.sa_handler != SIG_DFL && sa.sa_handler != SIG_IGN) {
+			sa.sa_handler = SIG_DFL;
+			sa.sa_flags = 0;
+			sigemptyset(&sa.sa_mask);
+			sigaction(i, &sa, NULL);
+		}
+	}
+
+	// Move pipe ends that landed on another standard fd out of the way
+	if(status_fd < 3) {
+		status_fd = fcntl(c->status_fd, F_DUPFD_CLOEXEC, 3);
+		if(status_fd == -1) {
+			// Report the error through the original fd
+			status_fd = c->status_fd;
+			goto error;
+		}
+	}
+	for(i = 0; i < 3; i++) {
+		fds[i] = c->fds[i];
+		if(fds[i] >= 0 && fds[i] < 3 && fds[i] != i) {
+			fds[i] = fcntl(fds[i], F_DUPFD_CLOEXEC, 3);
+			if(fds[i] == -1) {
+				goto error;
+			}
+		}
+	}
+
+	// dup2() clears close-on-execute, except on an fd that is already in
+	// place
+	for(i = 0; i < 3; i++) {
+		if(fds[i] == i) {
+			if(fcntl(i, F_SETFD, 0)) {
+				goto error;
+			}
+		} else if(fds[i] >= 0 && dup2(fds[i], i) == -1) {
+			goto error;
+		}
+	}
+
+	for(action = c->actions; action != NULL && action->type != NL_SPAWN_END; action++) {
+		if(apply_spawn_action(action) && !action->ignore_errors) {
+			goto error;
+		}
+	}
+
+	sigprocmask(SIG_SETMASK, &c->sigmask, NULL);
+
+	execve(c->cmd, c->argv, c->envp);
+
+error:
+	err = errno;
+	if(write(status_fd, &err, sizeof(err)) != sizeof(err)) {
+		// Nothing else can be done; the parent will see exit status 127
+	}
+	_exit(127);
+}
+
+/*
+ * Like nl_popen3ve(), but applies the given list of actions (NULL for none) in
+ * the child process before the command executes.  The child is started with
+ * vfork(), so the time taken does not grow with the size of the calling
+ * process, and failure to execute the command (or to apply an action without
+ * ignore_errors set) is returned as -1 with errno set.  Pipe file descriptors
+ * are created with close-on-execute already set, so they can't leak into
+ * processes started by other threads.
+ */
+pid_t nl_popen3vea(int *writefd, int *readfd, int *errfd, const char *cmd, char *const argv[], char *const envp[],
+		const struct nl_spawn_action *actions)
+{
+	struct spawn_child c = {
+		.cmd = cmd,
+		.argv = argv,
+		.envp = envp,
+		.actions = actions,
+	};
+	int status_pipe[2] = {-1, -1};
+	int in_pipe[2] = {-1, -1};
+	int out_pipe[2] = {-1, -1};
+	int err_pipe[2] = {-1, -1};
+	sigset_t all_signals;
+	pid_t pid;
+	int err;
+
+	if(CHECK_NULL(cmd) || CHECK_NULL(argv) || CHECK_NULL(envp)) {
+		errno = EFAULT;
+		goto error;
+	}
+
+	if(access(cmd, X_OK | R_OK)) {
+		ERRNO_OUT("Unable to execute external command");
+		goto error;
+	}
+
+	if(writefd && pipe2(in_pipe, O_CLOEXEC)) {
+		ERRNO_OUT("Error creating pipe for stdin");
+		goto error;
+	}
+	if(readfd && pipe2(out_pipe, O_CLOEXEC)) {
+		ERRNO_OUT("Error creating pipe for stdout");
+		goto error;
+	}
+	if(errfd && pipe2(err_pipe, O_CLOEXEC)) {
+		ERRNO_OUT("Error creating pipe for stderr");
+		goto error;
+	}
+	if(pipe2(status_pipe, O_CLOEXEC)) {
+		ERRNO_OUT("Error creating pipe for child process status");
+		goto error;
+	}
+
+	c.status_fd = status_pipe[1];
+	c.fds[0] = in_pipe[0];
+	c.fds[1] = out_pipe[1];
+	c.fds[2] = err_pipe[1];
+
+	// Signals stay blocked until the child has reset its signal handlers
+	sigfillset(&all_signals);
+	err = pthread_sigmask(SIG_BLOCK, &all_signals, &c.sigmask);
+	if(err) {
+		errno = err;
+		ERRNO_OUT("Error blocking signals to start child process");
+		goto error;
+	}
+
+	pid = vfork();
+	if(pid == 0) {
+		spawn_child(&c);
+	}
+
+	err = errno;
+	pthread_sigmask(SIG_SETMASK, &c.sigmask, NULL);
+
+	if(pid == -1) {
+		errno = err;
+		ERRNO_OUT("Error creating child process");
+		goto error;
+	}
+
+	close(status_pipe[1]);
+	status_pipe[1] = -1;
+	err = read_exec_status(status_pipe[0]);
+	status_pipe[0] = -1;
+	if(err) {
+		errno = err;
+		ERRNO_OUT("Error executing %s in child process", cmd);
+		waitpid(pid, NULL, 0);
+		errno = err;
+		goto error;
+	}
+
+	if(writefd) {
+		close(in_pipe[0]);
+		*writefd = in_pipe[1];
+	}
+	if(readfd) {
+		close(out_pipe[1]);
+		*readfd = out_pipe[0];
+	}
+	if(errfd) {
+		close(err_pipe[1]);
 		*errfd = err_pipe[0];
 	}
 
 	return pid;
 
 error:
+	err = errno;
+
+	if(status_pipe[0] >= 0) {
+		close(status_pipe[0]);
+	}
+	if(status_pipe[1] >= 0) {
+		close(status_pipe[1]);
+	}
 	if(in_pipe[0] >= 0) {
 		close(in_pipe[0]);
 	}
@@ -159,6 +513,8 @@ error:
 		close(err_pipe[1]);
 	}
 
+	errno = err;
+
 	return -1;
 }
 
@@ -181,77 +537,346 @@ pid_t nl_popen3(char *command, int *writefd, int *readfd, int *errfd)
 			(char *[]){"/bin/sh", "-c", command, NULL}, environ);
 }
 
+// Smallest read() nl_popenve_capture() will make into a growable buffer
+// before growing it, and the initial size of an unallocated buffer.
+#define CAPTURE_MIN_READ 16384
+
+// Returns the current CLOCK_MONOTONIC time in milliseconds.
+static int64_t monotonic_ms(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+// Makes room in buf for at least want more bytes plus a NUL terminator,
+// doubling the allocation as needed (but not beyond the buffer's limit).
+// Returns 0 on success, -1 on error.
+static int capture_reserve(struct nl_capture_buf *buf, size_t want)
+{
+	size_t alloc = buf->alloc;
+	char *data;
+
+	if(buf->data.data != NULL && alloc - buf->data.size > want) {
+		return 0;
+	}
+
+	if(buf->data.data == NULL) {
+		alloc = 0;
+	}
+	if(alloc < CAPTURE_MIN_READ) {
+		alloc = CAPTURE_MIN_READ;
+	}
+	while(alloc - buf->data.size <= want) {
+		alloc *= 2;
+	}
+	if(buf->limit && alloc > buf->limit + 1) {
+		alloc = MAX_NUM(buf->limit, buf->data.size + want) + 1;
+	}
+
+	data = realloc(buf->data.data, alloc);
+	if(data == NULL) {
+		ERRNO_OUT("Error growing command output buffer to %zu bytes", alloc);
+		return -1;
+	}
+
+	buf->data.data = data;
+	buf->alloc = alloc;
+	buf->data.data[buf->data.size] = 0;
+
+	return 0;
+}
+
+// Reads available output from fd into buf, discarding anything past the
+// buffer's limit.  Returns 1 at end-of-file, 0 if fd may have more data, -1
+// on error.
+static int capture_read(int fd, struct nl_capture_buf *buf)
+{
+	char discard[CAPTURE_MIN_READ];
+	size_t room;
+	ssize_t ret;
+
+	if(buf->limit && buf->data.size >= buf->limit) {
+		ret = read(fd, discard, sizeof(discard));
+		if(ret > 0) {
+			buf->truncated = 1;
+		}
+	} else {
+		room = CAPTURE_MIN_READ;
+		if(buf->limit) {
+			room = MIN_NUM(room, buf->limit - buf->data.size);
+		}
+		if(capture_reserve(buf, room)) {
+			return -1;
+		}
+
+		// Read as much as fits, even past CAPTURE_MIN_READ
+		room = buf->alloc - buf->data.size - 1;
+		if(buf->limit) {
+			room = MIN_NUM(room, buf->limit - buf->data.size);
+		}
+
+		ret = read(fd, buf->data.data + buf->data.size, room);
+		if(ret > 0) {
+			buf->data.size += ret;
+			buf->data.data[buf->data.size] = 0;
+		}
+	}
+
+	if(ret == 0) {
+		return 1;
+	}
+	if(ret < 0) {
+		if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+			return 0;
+		}
+		ERRNO_OUT("Error reading command output from fd %d", fd);
+		return -1;
+	}
+
+	return 0;
+}
+
+// Discards a SIGPIPE raised while nl_popenve_capture() had it blocked (unless
+// one was already pending beforehand), then restores the thread's signal
+// mask.
+static void restore_sigpipe(const sigset_t *old_mask, int was_pending)
+{
+	sigset_t pipe_mask, pending;
+
+	sigemptyset(&pipe_mask);
+	sigaddset(&pipe_mask, SIGPIPE);
+
+	if(!was_pending && !sigpending(&pending) && sigismember(&pending, SIGPIPE)) {
+		sigtimedwait(&pipe_mask, NULL, &(struct timespec){ 0, 0 });
+	}
+
+	pthread_sigmask(SIG_SETMASK, old_mask, NULL);
+}
+
+// Waits for the given child to exit until the CLOCK_MONOTONIC deadline (from
+// monotonic_ms(); 0 for no deadline).  Returns the child's return value in
+// nl_wait_get_return()'s format, or -1 with errno set to ETIMEDOUT if the
+// deadline passed, or another errno-like value on error.
+static int wait_until(pid_t pid, int64_t deadline)
+{
+	int64_t remaining;
+	int status;
+	pid_t ret;
+
+	if(deadline == 0) {
+		return nl_wait_get_return(pid);
+	}
+
+	for(;;) {
+		ret = waitpid(pid, &status, WNOHANG);
+		if(ret == pid) {
+			return wait_status_to_return(status);
+		}
+		if(ret == -1 && errno != EINTR) {
+			ERRNO_OUT("Error waiting for child PID %ld to exit", (long)pid);
+			return -1;
+		}
+
+		remaining = deadline - monotonic_ms();
+		if(remaining <= 0) {
+			errno = ETIMEDOUT;
+			return -1;
+		}
+
+		// The command has closed its output, so it should be exiting soon
+		poll(NULL, 0, MIN_NUM(remaining, 10));
+	}
+}
+
 /*
  * Runs the command (without searching PATH) with the given argument list and
- * environment, reading its stdout output into an nl_raw_data structure that
- * must be destroyed with nl_destroy_data().  If *output is not NULL, it will
- * be written to the command's stdin before reading from the command's stdout.
- * Returns NULL on error.
+ * environment (in the format used by execve()), writing input (if not NULL)
+ * to its stdin while capturing its stdout into *out and its stderr into *err.
+ * The three streams are serviced together with poll(), so a command that
+ * writes a lot of output before reading all of its input cannot deadlock.  If
+ * input, out, or err is NULL, the command's stdin, stdout, or stderr is not
+ * changed.  A command that exits without reading all of its input is not an
+ * error.  If timeout_ms is greater than zero, the command is killed if it has
+ * not closed its output and exited within that many milliseconds.  SIGPIPE is
+ * blocked in the calling thread while the command's input is written.
+ *
+ * Captured output is appended to each buffer's existing data (see struct
+ * nl_capture_buf).  The caller must free() out->data.data and err->data.data,
+ * even if an error occurs.  Returns the command's return value in the format
+ * of nl_wait_get_return(), or -1 with errno set on error (ETIMEDOUT if the
+ * timeout expired, in which case the command has been killed and reaped).
  */
-struct nl_raw_data *nl_popenve_readall(const char *cmd, char *const argv[], char *const envp[], struct nl_raw_data *output)
+int nl_popenve_capture(const char *cmd, char *const argv[], char *const envp[], const struct nl_raw_data *input,
+		struct nl_capture_buf *out, struct nl_capture_buf *err, int timeout_ms)
 {
-	struct nl_raw_data *data = NULL;
-	int outfd = -1;
-	int infd = -1;
-	pid_t pid = -1;
+	struct nl_capture_buf *bufs[3] = { NULL, out, err };
+	int fds[3] = { -1, -1, -1 }; // Command's stdin, stdout, stderr
+	struct pollfd pfds[3];
+	int pfd_idx[3];
+	sigset_t pipe_mask, old_mask, pending;
+	int sigpipe_pending = 0;
+	int sigpipe_blocked = 0;
+	int64_t deadline = 0;
+	size_t in_off = 0;
+	int nfds;
+	int saved_errno;
+	int ret;
+	pid_t pid;
 
-	// TODO: Allow retrieving the stderr (maybe in another function)
+	if(input != NULL && input->data == NULL && input->size != 0) {
+		ERROR_OUT("Input data specified with NULL input->data\n");
+		errno = EINVAL;
+		return -1;
+	}
 
-	if(output != NULL && output->data == NULL) {
-		ERROR_OUT("Output data specified with NULL output->data\n");
-		return NULL;
+	for(int i = 1; i < 3; i++) {
+		if(bufs[i] != NULL && (bufs[i]->data.data != NULL ?
+					bufs[i]->alloc <= bufs[i]->data.size : bufs[i]->data.size != 0)) {
+			ERROR_OUT("Output buffer %d has %zu bytes of data but only %zu allocated\n",
+					i, bufs[i]->data.size, bufs[i]->data.data ? bufs[i]->alloc : 0);
+			errno = EINVAL;
+			return -1;
+		}
+	}
+
+	if(timeout_ms > 0) {
+		deadline = monotonic_ms() + timeout_ms;
 	}
 
-	pid = nl_popen3ve(output ? &outfd : NULL, &infd, NULL, cmd, argv, envp);
+	for(int i = 1; i < 3; i++) {
+		if(bufs[i] != NULL) {
+			if(capture_reserve(bufs[i], 0)) {
+				return -1;
+			}
+			bufs[i]->data.data[bufs[i]->data.size] = 0;
+		}
+	}
+
+	pid = nl_popen3ve(input ? &fds[0] : NULL, out ? &fds[1] : NULL, err ? &fds[2] : NULL, cmd, argv, envp);
 	if(pid == -1) {
 		ERROR_OUT("Error executing command with nl_popen3ve().\n");
-		return NULL;
+		return -1;
 	}
 
-	if(output && nl_write_stream(outfd, output)) {
-		ERROR_OUT("Error writing to command's stdin.\n");
-		goto error;
+	for(int i = 0; i < 3; i++) {
+		if(fds[i] >= 0 && nl_set_nonblock(fds[i], 1)) {
+			goto error;
+		}
 	}
 
-	if(outfd >= 0 && close(outfd)) {
-		ERRNO_OUT("Error closing command stdin stream.\n");
-		outfd = -1;
-		goto error;
+	if(fds[0] >= 0) {
+		if(input->size == 0) {
+			close(fds[0]);
+			fds[0] = -1;
+		} else {
+			// Block SIGPIPE (only after the fork, so the command doesn't
+			// inherit the mask) so a command that stops reading its input
+			// produces EPIPE instead of killing this process.  A SIGPIPE
+			// caused by this function is discarded afterward.
+			sigemptyset(&pipe_mask);
+			sigaddset(&pipe_mask, SIGPIPE);
+			if(pthread_sigmask(SIG_BLOCK, &pipe_mask, &old_mask) == 0) {
+				sigpipe_blocked = 1;
+				sigpending(&pending);
+				sigpipe_pending = sigismember(&pending, SIGPIPE);
+			}
+		}
 	}
-	outfd = -1;
 
-	data = nl_read_stream(infd);
-	if(data == NULL) {
-		ERROR_OUT("Error reading command output into memory.\n");
-		goto error;
+	while(fds[0] >= 0 || fds[1] >= 0 || fds[2] >= 0) {
+		int wait_ms = -1;
+
+		nfds = 0;
+		for(int i = 0; i < 3; i++) {
+			if(fds[i] >= 0) {
+				pfds[nfds] = (struct pollfd){ .fd = fds[i], .events = i == 0 ? POLLOUT : POLLIN };
+				pfd_idx[nfds] = i;
+				nfds++;
+			}
+		}
+
+		if(deadline) {
+			int64_t remaining = deadline - monotonic_ms();
+			if(remaining <= 0) {
+				ERROR_OUT("Command %s timed out after %d ms\n", cmd, timeout_ms);
+				errno = ETIMEDOUT;
+				goto error;
+			}
+			wait_ms = MIN_NUM(remaining, INT_MAX);
+		}
+
+		ret = poll(pfds, nfds, wait_ms);
+		if(ret == -1) {
+			if(errno == EINTR) {
+				continue;
+			}
+			ERRNO_OUT("Error waiting for command I/O");
+			goto error;
+		}
+
+		for(int p = 0; p < nfds; p++) {
+			int i = pfd_idx[p];
+
+			if(pfds[p].revents == 0) {
+				continue;
+			}
+
+			if(i == 0) {
+				ssize_t written = write(fds[0], input->data + in_off, input->size - in_off);
+				if(written > 0) {
+					in_off += written;
+				} else if(written == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+					if(errno != EPIPE) {
+						ERRNO_OUT("Error writing to command's stdin");
+						goto error;
+					}
+
+					// The command stopped reading its input
+					in_off = input->size;
+				}
+
+				if(in_off == input->size) {
+					close(fds[0]);
+					fds[0] = -1;
+				}
+			} else {
+				ret = capture_read(fds[i], bufs[i]);
+				if(ret == -1) {
+					goto error;
+				}
+				if(ret == 1) {
+					close(fds[i]);
+					fds[i] = -1;
+				}
+			}
+		}
 	}
 
-	if(close(infd)) {
-		ERRNO_OUT("Error closing command stdout stream.\n");
-		infd = -1;
-		goto error;
+	if(sigpipe_blocked) {
+		restore_sigpipe(&old_mask, sigpipe_pending);
+		sigpipe_blocked = 0;
 	}
-	infd = -1;
 
-	if(nl_wait_get_return(pid) == -1) {
-		ERROR_OUT("Error waiting for command to finish.\n");
-		pid = -1;
+	ret = wait_until(pid, deadline);
+	if(ret == -1) {
+		if(errno == ETIMEDOUT) {
+			ERROR_OUT("Command %s did not exit within %d ms\n", cmd, timeout_ms);
+		} else {
+			ERROR_OUT("Error waiting for command to finish.\n");
+		}
 		goto error;
 	}
 
-	return data;
+	return ret;
 
 error:
-	if(data != NULL) {
-		nl_destroy_data(data);
-	}
-
-	if(infd >= 0) {
-		close(infd);
-	}
+	saved_errno = errno;
 
-	if(outfd >= 0) {
-		close(outfd);
+	for(int i = 0; i < 3; i++) {
+		if(fds[i] >= 0) {
+			close(fds[i]);
+		}
 	}
 
 	if(pid > 0) {
@@ -260,7 +885,49 @@ error:
 		nl_wait_get_return(pid);
 	}
 
-	return NULL;
+	if(sigpipe_blocked) {
+		restore_sigpipe(&old_mask, sigpipe_pending);
+		sigpipe_blocked = 0;
+	}
+
+	errno = saved_errno;
+
+	return -1;
+}
+
+/*
+ * Runs the command (without searching PATH) with the given argument list and
+ * environment, reading its stdout output into an nl_raw_data structure that
+ * must be destroyed with nl_destroy_data().  If *output is not NULL, it will
+ * be written to the command's stdin while reading from the command's stdout
+ * (see nl_popenve_capture()).  Returns NULL on error.
+ */
+struct nl_raw_data *nl_popenve_readall(const char *cmd, char *const argv[], char *const envp[], struct nl_raw_data *output)
+{
+	struct nl_capture_buf out = { .data = { .size = 0, .data = NULL } };
+	struct nl_raw_data *data;
+
+	if(output != NULL && output->data == NULL) {
+		ERROR_OUT("Output data specified with NULL output->data\n");
+		return NULL;
+	}
+
+	data = malloc(sizeof(struct nl_raw_data));
+	if(data == NULL) {
+		ERRNO_OUT("Error allocating data+length structure");
+		return NULL;
+	}
+
+	if(nl_popenve_capture(cmd, argv, envp, output, &out, NULL, 0) == -1) {
+		ERROR_OUT("Error running command to read its output into memory.\n");
+		free(out.data.data);
+		free(data);
+		return NULL;
+	}
+
+	*data = out.data;
+
+	return data;
 }
 
 /*
@@ -297,6 +964,90 @@ char *nl_popen_readall(char *command, size_t *size)
 	return outbuf;
 }
 
+// A child process watched by a struct nl_reaper.
+struct nl_reaper_child {
+	pid_t pid;
+	int pidfd; // Readable when the child exits
+	nl_reaper_callback cb;
+	void *cb_data;
+};
+
+// Marks an unused position in a reaper's PID index.
+#define REAPER_INDEX_EMPTY SIZE_MAX
+
+// Child processes watched for exit via pidfds in an epoll set.
+struct nl_reaper {
+	int epfd;
+	struct nl_reaper_child *children;
+	size_t count;
+	size_t alloc;
+
+	// Open-addressed (linear probing) map from PID to position in
+	// children, twice alloc in size so it is never more than half full.
+	size_t *index;
+	size_t index_mask;
+};
+
+// Returns the preferred position of the given PID in the reaper's index.
+static size_t pid_home(struct nl_reaper *reaper, pid_t pid)
+{
+	uint32_t h = (uint32_t)pid * 2654435761u; // Fibonacci hashing
+	return (h ^ (h >> 16)) & reaper->index_mask;
+}
+
+// Returns the position of the given PID in the reaper's index, or the empty
+// position where it would be inserted.  The index must be allocated.
+static size_t find_index(struct nl_reaper *reaper, pid_t pid)
+{
+	size_t pos = pid_home(reaper, pid);
+
+	while(reaper->index[pos] != REAPER_INDEX_EMPTY && reaper->children[reaper->index[pos]].pid != pid) {
+		pos = (pos + 1) & reaper->index_mask;
+	}
+
+	return pos;
+}
+
+// Returns the index of the given child in the reaper's list, or -1 if it is
+// not being watched.
+static ssize_t find_child(struct nl_reaper *reaper, pid_t pid)
+{
+	size_t idx;
+
+	if(reaper->index == NULL) {
+		return -1;
+	}
+
+	idx = reaper->index[find_index(reaper, pid)];
+	return idx == REAPER_INDEX_EMPTY ? -1 : (ssize_t)idx;
+}
+
+// Closes the pidfd of the child at the given index and removes it from the
+// reaper's list.
+static void remove_child(struct nl_reaper *reaper, size_t idx)
+{
+	size_t pos = find_index(reaper, reaper->children[idx].pid);
+	size_t mask = reaper->index_mask;
+
+	close(reaper->children[idx].pidfd); // Also removes it from the epoll set
+
+	// Shift later entries back into the hole so no probe sequence is broken
+	for(size_t next = (pos + 1) & mask; reaper->index[next] != REAPER_INDEX_EMPTY; next = (next + 1) & mask) {
+		size_t home = pid_home(reaper, reaper->children[reaper->index[next]].pid);
+		if(((next - home) & mask) >= ((next - pos) & mask)) {
+			reaper->index[pos] = reaper->index[next];
+			pos = next;
+		}
+	}
+	reaper->index[pos] = REAPER_INDEX_EMPTY;
+
+	reaper->count--;
+	if(idx != reaper->count) {
+		reaper->children[idx] = reaper->children[reaper->count];
+		reaper->index[find_index(reaper, reaper->children[idx].pid)] = idx;
+	}
+}
+
 /*
  * Waits for the given child PID to exit.  Returns the child's exit status
  * value if the child exited normally.  Returns a negative signal number, minus
@@ -312,12 +1063,252 @@ int nl_wait_get_return(pid_t pid)
 		return -1;
 	}
 
-	if(WIFEXITED(status)) {
-		return WEXITSTATUS(status);
+	return wait_status_to_return(status);
+}
+
+/*
+ * Creates a child process reaper.  The reaper's file descriptor (see
+ * nl_reaper_fd()) becomes readable when watched children exit, so many exits
+ * can be reaped in one pass from an event loop, instead of blocking in
+ * nl_wait_get_return() for each child.  Only watched children are reaped.  A
+ * reaper must only be used by one thread at a time.  Returns NULL on error,
+ * with errno set to ENOSYS if the system lacks pidfd_open().
+ */
+struct nl_reaper *nl_reaper_create(void)
+{
+#ifdef SYS_pidfd_open
+	struct nl_reaper *reaper;
+	int pidfd;
+
+	// Check for kernel support (Linux 5.3+)
+	pidfd = syscall(SYS_pidfd_open, getpid(), 0);
+	if(pidfd == -1) {
+		ERRNO_OUT("pidfd_open() is not available for the child process reaper");
+		errno = ENOSYS;
+		return NULL;
 	}
-	if(WIFSIGNALED(status)) {
-		return -(WTERMSIG(status) + 100);
+	close(pidfd);
+
+	reaper = calloc(1, sizeof(struct nl_reaper));
+	if(reaper == NULL) {
+		ERRNO_OUT("Error allocating child process reaper");
+		return NULL;
 	}
 
-	return -1;
+	reaper->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if(reaper->epfd == -1) {
+		ERRNO_OUT("Error creating epoll set for child process reaper");
+		free(reaper);
+		return NULL;
+	}
+
+	return reaper;
+#else /* SYS_pidfd_open */
+	ERROR_OUT("nlutils was built without pidfd_open() support.\n");
+	errno = ENOSYS;
+	return NULL;
+#endif /* SYS_pidfd_open */
+}
+
+/*
+ * Destroys a reaper.  Children that are still being watched are not reaped.
+ */
+void nl_reaper_destroy(struct nl_reaper *reaper)
+{
+	if(CHECK_NULL(reaper)) {
+		return;
+	}
+
+	while(reaper->count > 0) {
+		remove_child(reaper, reaper->count - 1);
+	}
+
+	close(reaper->epfd);
+	free(reaper->children);
+	free(reaper->index);
+	free(reaper);
+}
+
+/*
+ * Returns a file descriptor that is readable while any watched child has
+ * exited and not been reaped by nl_reaper_reap().
+ */
+int nl_reaper_fd(struct nl_reaper *reaper)
+{
+	if(CHECK_NULL(reaper)) {
+		return -1;
+	}
+
+	return reaper->epfd;
+}
+
+/*
+ * Starts watching the given child process.  The callback will be called from
+ * nl_reaper_reap() after the child exits.  Returns 0 on success, an errno-like
+ * value on error.
+ */
+int nl_reaper_watch(struct nl_reaper *reaper, pid_t pid, nl_reaper_callback cb, void *cb_data)
+{
+#ifdef SYS_pidfd_open
+	struct epoll_event ev = { .events = EPOLLIN, .data.u64 = pid };
+	int pidfd;
+	int ret;
+
+	if(CHECK_NULL(reaper) || CHECK_NULL(cb)) {
+		return EFAULT;
+	}
+	if(pid <= 0) {
+		ERROR_OUT("Invalid child PID %ld\n", (long)pid);
+		return EINVAL;
+	}
+	if(find_child(reaper, pid) >= 0) {
+		ERROR_OUT("Child PID %ld is already being watched\n", (long)pid);
+		return EEXIST;
+	}
+
+	if(reaper->count == reaper->alloc) {
+		size_t new_alloc = MAX_NUM(16, reaper->alloc * 2);
+		size_t *index = malloc(new_alloc * 2 * sizeof(index[0]));
+		if(index == NULL) {
+			ERRNO_OUT("Error growing child process reaper index to %zu children", new_alloc);
+			return ENOMEM;
+		}
+
+		struct nl_reaper_child *children = realloc(reaper->children, new_alloc * sizeof(children[0]));
+		if(children == NULL) {
+			ERRNO_OUT("Error growing child process reaper to %zu children", new_alloc);
+			free(index);
+			return ENOMEM;
+		}
+
+		reaper->children = children;
+		reaper->alloc = new_alloc;
+
+		free(reaper->index);
+		reaper->index = index;
+		reaper->index_mask = new_alloc * 2 - 1;
+		for(size_t i = 0; i <= reaper->index_mask; i++) {
+			index[i] = REAPER_INDEX_EMPTY;
+		}
+		for(size_t i = 0; i < reaper->count; i++) {
+			index[find_index(reaper, children[i].pid)] = i;
+		}
+	}
+
+	// pidfds are always close-on-execute
+	pidfd = syscall(SYS_pidfd_open, pid, 0);
+	if(pidfd == -1) {
+		ret = errno;
+		ERRNO_OUT("Error opening pidfd for child PID %ld", (long)pid);
+		return ret;
+	}
+
+	if(epoll_ctl(reaper->epfd, EPOLL_CTL_ADD, pidfd, &ev)) {
+		ret = errno;
+		ERRNO_OUT("Error adding child PID %ld to reaper", (long)pid);
+		close(pidfd);
+		return ret;
+	}
+
+	reaper->index[find_index(reaper, pid)] = reaper->count;
+	reaper->children[reaper->count++] = (struct nl_reaper_child){
+		.pid = pid,
+		.pidfd = pidfd,
+		.cb = cb,
+		.cb_data = cb_data,
+	};
+
+	return 0;
+#else /* SYS_pidfd_open */
+	(void)reaper;
+	(void)pid;
+	(void)cb;
+	(void)cb_data;
+	return ENOSYS;
+#endif /* SYS_pidfd_open */
+}
+
+/*
+ * Stops watching the given child process without reaping it (e.g. so it can
+ * be killed and waited for with nl_wait_get_return()).  Returns 0 on success,
+ * ENOENT if the child was not being watched.
+ */
+int nl_reaper_unwatch(struct nl_reaper *reaper, pid_t pid)
+{
+	ssize_t idx;
+
+	if(CHECK_NULL(reaper)) {
+		return EFAULT;
+	}
+
+	idx = find_child(reaper, pid);
+	if(idx < 0) {
+		return ENOENT;
+	}
+
+	remove_child(reaper, idx);
+
+	return 0;
+}
+
+/*
+ * Reaps every watched child that has exited, calling each child's callback.
+ * Callbacks may watch and unwatch other children.  Does not block.  Returns
+ * the number of children reaped, or -1 on error.
+ */
+int nl_reaper_reap(struct nl_reaper *reaper)
+{
+	struct epoll_event events[64];
+	struct nl_reaper_child child;
+	int count = 0;
+	int nev, status;
+	ssize_t idx;
+	pid_t pid;
+
+	if(CHECK_NULL(reaper)) {
+		return -1;
+	}
+
+	for(;;) {
+		nev = epoll_wait(reaper->epfd, events, ARRAY_SIZE(events), 0);
+		if(nev == -1 && errno == EINTR) {
+			continue;
+		}
+		if(nev == -1) {
+			ERRNO_OUT("Error checking for exited children");
+			return -1;
+		}
+
+		for(int i = 0; i < nev; i++) {
+			// An earlier callback may have unwatched this child
+			idx = find_child(reaper, (pid_t)events[i].data.u64);
+			if(idx < 0) {
+				continue;
+			}
+
+			child = reaper->children[idx];
+			pid = waitpid(child.pid, &status, WNOHANG);
+			if(pid == 0) {
+				continue;
+			}
+
+			remove_child(reaper, idx);
+
+			if(pid == -1) {
+				ERRNO_OUT("Error getting return status of child process %ld", (long)child.pid);
+				child.cb(child.pid, -1, child.cb_data);
+			} else {
+				child.cb(child.pid, wait_status_to_return(status), child.cb_data);
+			}
+
+			count++;
+		}
+
+		// A full batch may mean more children have exited
+		if(nev < (int)ARRAY_SIZE(events)) {
+			break;
+		}
+	}
+
+	return count;
 }
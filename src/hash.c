@@ -1,35 +1,183 @@
 /*
- * A naïve implementation of an associative array with string keys and values.
+ * An associative array with string keys and values, using an open-addressing
+ * (Robin Hood) hash table.  Entries are iterated in insertion order.
  * Copied from the logic system's depthcam/zonevar plugin.
  * Copyright (C)2011, 2014 Mike Bourgeous.  Released under AGPLv3 in 2018.
+ *
+ * Entries are kept in a dense array in insertion order, and the hash table
+ * itself is an array of slots that store each entry's hash and its position in
+ * the entry array.  Collisions are resolved with linear probing, keeping each
+ * run ordered by probe distance (Robin Hood hashing), so failed lookups can
+ * stop early and removal can shift later slots backward instead of leaving
+ * tombstones.  Removing an entry leaves a hole in the entry array, which is
+ * compacted when holes outnumber live entries.
  */
 #include <stdio.h>
 #include <stdlib.h>
 #include "nlutils.h"
 
-// TODO: Use an actual hash table, probably a public domain or BSD version.
 // TODO: Add support for storing nl_variant or void* instead of char*.
 
+// Initial number of slots in the index (must be a power of two)
+#define NL_HASH_INITIAL_SLOTS 8
+
+// Initial number of entries allocated on first insertion
+#define NL_HASH_INITIAL_ENTRIES 8
+
 /*
- * Returns a matching entry, if any, or NULL.  TODO: This is O(n).  Does not
- * check for NULL parameters.
+ * Single slot in the hash table index.  An index of 0 indicates an empty
+ * slot; otherwise the slot refers to hash->entries[index - 1].
  */
-struct nl_hash_entry *nl_hash_find(const struct nl_hash * const hash, const char * const key)
+struct nl_hash_slot {
+	uint32_t hash;
+	uint32_t index;
+};
+
+/*
+ * 32-bit FNV-1a hash of a NUL-terminated string.
+ */
+static uint32_t nl_hash_string(const char *key)
 {
-	const struct nl_fifo_element *iter = NULL;
-	struct nl_hash_entry *entry;
+	const unsigned char *s = (const unsigned char *)key;
+	uint32_t h = 2166136261U;
+
+	while(*s) {
+		h ^= *s++;
+		h *= 16777619U;
+	}
+
+	return h;
+}
+
+/*
+ * Returns the distance of a slot's entry from its preferred slot.
+ */
+static inline size_t nl_hash_probe_distance(const struct nl_hash *hash, size_t pos, uint32_t h)
+{
+	return (pos - h) & hash->slot_mask;
+}
+
+/*
+ * Returns the index of the slot holding the given key, or -1 if the key is not
+ * present.
+ */
+static ssize_t nl_hash_find_slot(const struct nl_hash * const hash, const char * const key, uint32_t h)
+{
+	size_t pos = h & hash->slot_mask;
+	size_t dist;
+
+	for(dist = 0; ; dist++, pos = (pos + 1) & hash->slot_mask) {
+		const struct nl_hash_slot *slot = &hash->slots[pos];
+
+		if(slot->index == 0 || nl_hash_probe_distance(hash, pos, slot->hash) < dist) {
+			return -1;
+		}
 
-	while((entry = nl_fifo_next(hash->table, &iter))) {
-		if(!strcmp(entry->key, key)) {
-			return entry;
+		if(slot->hash == h && !strcmp(hash->entries[slot->index - 1]->key, key)) {
+			return pos;
 		}
 	}
+}
+
+/*
+ * Inserts a reference to hash->entries[index] into the slot table.  There
+ * must be at least one empty slot.
+ */
+static void nl_hash_insert_slot(struct nl_hash *hash, uint32_t h, size_t index)
+{
+	struct nl_hash_slot cur = { .hash = h, .index = index + 1 };
+	size_t pos = cur.hash & hash->slot_mask;
+	size_t dist = 0;
+
+	for(;;) {
+		struct nl_hash_slot *slot = &hash->slots[pos];
+		size_t slot_dist;
 
-	if(iter == nl_fifo_error) {
-		ERROR_OUT("Error iterating over key-value pairs.\n");
+		if(slot->index == 0) {
+			*slot = cur;
+			return;
+		}
+
+		// Take the slot from an entry that is closer to its home slot
+		slot_dist = nl_hash_probe_distance(hash, pos, slot->hash);
+		if(slot_dist < dist) {
+			struct nl_hash_slot tmp = *slot;
+			*slot = cur;
+			cur = tmp;
+			dist = slot_dist;
+		}
+
+		pos = (pos + 1) & hash->slot_mask;
+		dist++;
 	}
+}
 
-	return NULL;
+/*
+ * Removes the given slot, shifting following displaced slots backward.
+ */
+static void nl_hash_delete_slot(struct nl_hash *hash, size_t pos)
+{
+	size_t next = (pos + 1) & hash->slot_mask;
+
+	while(hash->slots[next].index != 0 && nl_hash_probe_distance(hash, next, hash->slots[next].hash) != 0) {
+		hash->slots[pos] = hash->slots[next];
+		pos = next;
+		next = (next + 1) & hash->slot_mask;
+	}
+
+	hash->slots[pos] = (struct nl_hash_slot){ .index = 0 };
+}
+
+/*
+ * Clears and rebuilds the slot table from the entry array, optionally
+ * resizing it to slot_count slots (pass 0 to keep the current size).  Also
+ * compacts the entry array if there are any holes.  Returns 0 on success, -1
+ * on error (the table is unmodified on error).
+ */
+static int nl_hash_rebuild(struct nl_hash *hash, size_t slot_count)
+{
+	size_t i, j;
+
+	if(slot_count != 0 && slot_count != hash->slot_mask + 1) {
+		struct nl_hash_slot *slots = calloc(slot_count, sizeof(struct nl_hash_slot));
+		if(slots == NULL) {
+			ERRNO_OUT("Error allocating %zu hash table slots", slot_count);
+			return -1;
+		}
+
+		free(hash->slots);
+		hash->slots = slots;
+		hash->slot_mask = slot_count - 1;
+	} else {
+		memset(hash->slots, 0, sizeof(struct nl_hash_slot) * (hash->slot_mask + 1));
+	}
+
+	for(i = 0, j = 0; i < hash->entries_used; i++) {
+		if(hash->entries[i] != NULL) {
+			hash->entries[j] = hash->entries[i];
+			nl_hash_insert_slot(hash, hash->entries[j]->hash, j);
+			j++;
+		}
+	}
+	hash->entries_used = j;
+
+	return 0;
+}
+
+/*
+ * Returns a matching entry, if any, or NULL.  The entry remains valid until it
+ * is removed or the hash is cleared or destroyed.  Does not check for NULL
+ * parameters.
+ */
+struct nl_hash_entry *nl_hash_find(const struct nl_hash * const hash, const char * const key)
+{
+	ssize_t pos = nl_hash_find_slot(hash, key, nl_hash_string(key));
+
+	if(pos < 0) {
+		return NULL;
+	}
+
+	return hash->entries[hash->slots[pos].index - 1];
 }
 
 /*
@@ -53,16 +201,43 @@ const char *nl_hash_get(const struct nl_hash * const hash, const char * const ke
 }
 
 // To be used only by nl_hash_set()
-static int nl_hash_add(struct nl_hash *hash, char *key, char *value)
+static int nl_hash_add(struct nl_hash *hash, char *key, char *value, uint32_t h)
 {
 	struct nl_hash_entry *entry;
 
+	// Keep the slot table at most 3/4 full
+	if((hash->count + 1) * 4 > (hash->slot_mask + 1) * 3) {
+		if(nl_hash_rebuild(hash, (hash->slot_mask + 1) * 2)) {
+			ERROR_OUT("Error growing hash table.\n");
+			return -1;
+		}
+	}
+
+	if(hash->entries_used == hash->entries_size) {
+		if(hash->count < hash->entries_used / 2) {
+			// Mostly holes; compacting is enough to make room
+			nl_hash_rebuild(hash, 0);
+		} else {
+			size_t new_size = hash->entries_size ? hash->entries_size * 2 : NL_HASH_INITIAL_ENTRIES;
+			struct nl_hash_entry **entries = realloc(hash->entries, sizeof(struct nl_hash_entry *) * new_size);
+			if(entries == NULL) {
+				ERRNO_OUT("Error growing hash entry array to %zu entries", new_size);
+				return -1;
+			}
+
+			hash->entries = entries;
+			hash->entries_size = new_size;
+		}
+	}
+
 	entry = malloc(sizeof(struct nl_hash_entry));
 	if(entry == NULL) {
 		ERRNO_OUT("Error allocating memory for new hash entry");
 		return -1;
 	}
 
+	entry->hash = h;
+
 	entry->key = nl_strdup(key);
 	if(entry->key == NULL) {
 		ERROR_OUT("Error duplicating key for new hash entry.\n");
@@ -78,14 +253,9 @@ static int nl_hash_add(struct nl_hash *hash, char *key, char *value)
 		return -1;
 	}
 
-	if(nl_fifo_put(hash->table, entry) < 0) {
-		ERROR_OUT("Error adding hash entry to table.\n");
-		free(entry->value);
-		free(entry->key);
-		free(entry);
-		return -1;
-	}
-
+	hash->entries[hash->entries_used] = entry;
+	nl_hash_insert_slot(hash, h, hash->entries_used);
+	hash->entries_used++;
 	hash->count++;
 
 	return 0;
@@ -100,13 +270,17 @@ int nl_hash_set(struct nl_hash *hash, char *key, char *value)
 {
 	struct nl_hash_entry *entry;
 	char *oldval, *newval;
+	uint32_t h;
+	ssize_t pos;
 
 	if(CHECK_NULL(hash) || CHECK_NULL(key) || CHECK_NULL(value)) {
 		return -1;
 	}
 
-	entry = nl_hash_find(hash, key);
-	if(entry != NULL) {
+	h = nl_hash_string(key);
+	pos = nl_hash_find_slot(hash, key, h);
+	if(pos >= 0) {
+		entry = hash->entries[hash->slots[pos].index - 1];
 		newval = nl_strdup(value);
 		if(newval == NULL) {
 			ERROR_OUT("Error duplicating new value for existing hash entry.\n");
@@ -116,7 +290,7 @@ int nl_hash_set(struct nl_hash *hash, char *key, char *value)
 		entry->value = newval;
 		free(oldval);
 	} else {
-		return nl_hash_add(hash, key, value);
+		return nl_hash_add(hash, key, value, h);
 	}
 
 	return 0;
@@ -136,20 +310,26 @@ static void nl_hash_destroy_entry(struct nl_hash_entry *entry)
  */
 int nl_hash_remove(struct nl_hash *hash, char *key)
 {
-	struct nl_hash_entry *entry;
+	size_t index;
+	ssize_t pos;
 
 	if(CHECK_NULL(hash) || CHECK_NULL(key)) {
 		return -1;
 	}
 
-	entry = nl_hash_find(hash, key);
-	if(entry) {
-		if(nl_fifo_remove(hash->table, entry)) {
-			ERROR_OUT("Error removing entry from hash table.\n");
-			return -1;
-		}
-		nl_hash_destroy_entry(entry);
+	pos = nl_hash_find_slot(hash, key, nl_hash_string(key));
+	if(pos >= 0) {
+		index = hash->slots[pos].index - 1;
+
+		nl_hash_delete_slot(hash, pos);
+		nl_hash_destroy_entry(hash->entries[index]);
+		hash->entries[index] = NULL;
 		hash->count--;
+
+		// Trailing holes can be reused immediately
+		while(hash->entries_used > 0 && hash->entries[hash->entries_used - 1] == NULL) {
+			hash->entries_used--;
+		}
 	}
 
 	return 0;
@@ -162,14 +342,15 @@ int nl_hash_remove(struct nl_hash *hash, char *key)
 void nl_hash_iterate(const struct nl_hash * const hash, nl_hash_callback callback, void *cb_data)
 {
 	struct nl_hash_entry *entry;
-	const struct nl_fifo_element *iter = NULL;
+	size_t i;
 
 	if(CHECK_NULL(hash) || CHECK_NULL(callback)) {
 		return;
 	}
 
-	while((entry = nl_fifo_next(hash->table, &iter))) {
-		if(callback(cb_data, entry->key, entry->value)) {
+	for(i = 0; i < hash->entries_used; i++) {
+		entry = hash->entries[i];
+		if(entry != NULL && callback(cb_data, entry->key, entry->value)) {
 			break;
 		}
 	}
@@ -183,19 +364,19 @@ struct nl_hash *nl_hash_create()
 {
 	struct nl_hash *hash;
 
-	hash = malloc(sizeof(struct nl_hash));
+	hash = calloc(1, sizeof(struct nl_hash));
 	if(hash == NULL) {
 		ERRNO_OUT("Error allocating memory for new hash");
 		return NULL;
 	}
 
-	hash->count = 0;
-	hash->table = nl_fifo_create();
-	if(hash->table == NULL) {
-		ERROR_OUT("Error creating table to store hash entries.\n");
+	hash->slots = calloc(NL_HASH_INITIAL_SLOTS, sizeof(struct nl_hash_slot));
+	if(hash->slots == NULL) {
+		ERRNO_OUT("Error allocating table to store hash entries");
 		free(hash);
 		return NULL;
 	}
+	hash->slot_mask = NL_HASH_INITIAL_SLOTS - 1;
 
 	return hash;
 }
@@ -241,16 +422,20 @@ struct nl_hash *nl_hash_clone(const struct nl_hash * const hash)
  */
 void nl_hash_clear(struct nl_hash *hash)
 {
-	struct nl_hash_entry *entry;
+	size_t i;
 
 	if(CHECK_NULL(hash)) {
 		return;
 	}
 
-	while((entry = nl_fifo_get(hash->table))) {
-		nl_hash_destroy_entry(entry);
+	for(i = 0; i < hash->entries_used; i++) {
+		if(hash->entries[i] != NULL) {
+			nl_hash_destroy_entry(hash->entries[i]);
+		}
 	}
 
+	memset(hash->slots, 0, sizeof(struct nl_hash_slot) * (hash->slot_mask + 1));
+	hash->entries_used = 0;
 	hash->count = 0;
 }
 
@@ -264,6 +449,7 @@ void nl_hash_destroy(struct nl_hash *hash)
 	}
 
 	nl_hash_clear(hash);
-	nl_fifo_destroy(hash->table);
+	free(hash->entries);
+	free(hash->slots);
 	free(hash);
 }
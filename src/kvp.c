@@ -3,10 +3,12 @@
  * Copyright (C)2014 Mike Bourgeous.  Released under AGPLv3 in 2018.
  */
 #include <stdlib.h>
+#include <stdint.h>
 #include <ctype.h>
 #include <sys/types.h>
 
 #include "nlutils.h"
+#include "cpu_internal.h"
 
 /*
  * Sends a string to a variant-receiving callback.
@@ -169,52 +171,344 @@ void nl_kvp_wrapper(void *data, char *key, char *value, int quoted_value)
 }
 
 /*
- * Calls the given callback with a single key/value pair.
+ * Bits in kvp_class for characters that can end a key or value.  Unquoted
+ * keys and values end at whitespace (as matched by isspace() in the C locale)
+ * or an equal sign.  Quoted keys and values end at a quotation mark, and may
+ * contain escape sequences.  Both end at the terminating zero byte.
  */
-static inline void send_pair(const char *kvp_line, nl_kvp_cb callback, void *cb_data, size_t key_start, size_t key_length, size_t value_start, size_t value_length)
+#define KVP_UNQUOTED 1
+#define KVP_QUOTED 2
+
+static const uint8_t kvp_class[256] = {
+	[0] = KVP_UNQUOTED | KVP_QUOTED,
+	['\t'] = KVP_UNQUOTED, ['\n'] = KVP_UNQUOTED, ['\v'] = KVP_UNQUOTED,
+	['\f'] = KVP_UNQUOTED, ['\r'] = KVP_UNQUOTED, [' '] = KVP_UNQUOTED,
+	['='] = KVP_UNQUOTED,
+	['"'] = KVP_QUOTED, ['\\'] = KVP_QUOTED,
+};
+
+/*
+ * A 64-byte aligned window of the line being parsed, with a bit set in each
+ * mask for every character of the corresponding class.  Once the end of the
+ * line is found, every following bit is set, so searches never go past it.
+ */
+struct kvp_window {
+	const char *base;
+	uint64_t unquoted;
+	uint64_t quoted;
+};
+
+/*
+ * Returns nonzero if c is whitespace.  Equivalent to isspace() in the C
+ * locale, without the locale lookup.
+ */
+static inline int kvp_space(char c)
 {
-	char *key;
-	char *value;
-	int quoted_value = 0;
+	return c == ' ' || (c >= '\t' && c <= '\r');
+}
 
-	key = nl_strndup_term(kvp_line + key_start, key_length);
-	if(key == NULL) {
-		ERROR_OUT("Error duplicating key for de-escaping.\n");
-		return;
+/*
+ * Fills the masks for the window at w->base one byte at a time.  Bytes before
+ * start (which is within the window) are not read.
+ */
+static void kvp_classify_scalar(struct kvp_window *w, const char *start)
+{
+	size_t i;
+
+	w->unquoted = 0;
+	w->quoted = 0;
+
+	for(i = start - w->base; i < 64; i++) {
+		uint8_t c = w->base[i];
+		uint64_t bit = (uint64_t)1 << i;
+
+		if(c == 0) {
+			w->unquoted |= -bit;
+			w->quoted |= -bit;
+			break;
+		}
+
+		if(kvp_class[c] & KVP_UNQUOTED) {
+			w->unquoted |= bit;
+		}
+		if(kvp_class[c] & KVP_QUOTED) {
+			w->quoted |= bit;
+		}
 	}
+}
 
-	value = nl_strndup_term(kvp_line + value_start, value_length);
-	if(value == NULL) {
-		ERROR_OUT("Error duplicating value for de-escaping.\n");
-		free(key);
-		return;
+// The SIMD classifiers only use aligned loads, which never cross a page
+// boundary, and stop loading at the block containing the end of the line.
+// Bytes in the first block before start are ignored when looking for the end
+// of the line, as they may not be part of the line.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+
+/*
+ * Fills the masks for the window at w->base 16 bytes at a time with SSE2.
+ */
+__attribute__((target("sse2")))
+static void kvp_classify_sse2(struct kvp_window *w, const char *start)
+{
+	size_t first = start - w->base;
+
+	w->unquoted = 0;
+	w->quoted = 0;
+
+	for(size_t i = first & ~15; i < 64; i += 16) {
+		__m128i v = _mm_load_si128((const __m128i *)(w->base + i));
+
+		// Whitespace from \t to \r is in range if (v - \t) <= 4 unsigned
+		__m128i ctrl = _mm_sub_epi8(v, _mm_set1_epi8('\t'));
+		__m128i end = _mm_cmpeq_epi8(v, _mm_setzero_si128());
+		__m128i unquoted = _mm_or_si128(
+				_mm_cmpeq_epi8(_mm_min_epu8(ctrl, _mm_set1_epi8(4)), ctrl),
+				_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(v, _mm_set1_epi8('=')))
+				);
+		__m128i quoted = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+		uint64_t end_mask = ((uint64_t)(uint16_t)_mm_movemask_epi8(end) << i) & (~(uint64_t)0 << first);
+
+		w->unquoted |= (uint64_t)(uint16_t)_mm_movemask_epi8(unquoted) << i;
+		w->quoted |= (uint64_t)(uint16_t)_mm_movemask_epi8(quoted) << i;
+
+		if(end_mask) {
+			end_mask = -(end_mask & -end_mask);
+			w->unquoted |= end_mask;
+			w->quoted |= end_mask;
+			break;
+		}
+	}
+}
+
+/*
+ * Fills the masks for the window at w->base 32 bytes at a time with AVX2.
+ */
+__attribute__((target("avx2")))
+static void kvp_classify_avx2(struct kvp_window *w, const char *start)
+{
+	size_t first = start - w->base;
+
+	w->unquoted = 0;
+	w->quoted = 0;
+
+	for(size_t i = first & ~31; i < 64; i += 32) {
+		__m256i v = _mm256_load_si256((const __m256i *)(w->base + i));
+
+		__m256i ctrl = _mm256_sub_epi8(v, _mm256_set1_epi8('\t'));
+		__m256i end = _mm256_cmpeq_epi8(v, _mm256_setzero_si256());
+		__m256i unquoted = _mm256_or_si256(
+				_mm256_cmpeq_epi8(_mm256_min_epu8(ctrl, _mm256_set1_epi8(4)), ctrl),
+				_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('=')))
+				);
+		__m256i quoted = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\')));
+		uint64_t end_mask = ((uint64_t)(uint32_t)_mm256_movemask_epi8(end) << i) & (~(uint64_t)0 << first);
+
+		w->unquoted |= (uint64_t)(uint32_t)_mm256_movemask_epi8(unquoted) << i;
+		w->quoted |= (uint64_t)(uint32_t)_mm256_movemask_epi8(quoted) << i;
+
+		if(end_mask) {
+			end_mask = -(end_mask & -end_mask);
+			w->unquoted |= end_mask;
+			w->quoted |= end_mask;
+			break;
+		}
+	}
+}
+#endif /* x86 */
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+
+/*
+ * Converts a vector of 0x00/0xff comparison results to a 16-bit mask.
+ */
+static inline uint64_t kvp_movemask_neon(uint8x16_t v)
+{
+	static const uint8_t weights[16] = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+	uint8x16_t bits = vandq_u8(v, vld1q_u8(weights));
+	uint8x8_t sum = vpadd_u8(vget_low_u8(bits), vget_high_u8(bits));
+
+	sum = vpadd_u8(sum, sum);
+	sum = vpadd_u8(sum, sum);
+
+	return vget_lane_u8(sum, 0) | (uint64_t)vget_lane_u8(sum, 1) << 8;
+}
+
+/*
+ * Fills the masks for the window at w->base 16 bytes at a time with NEON.
+ */
+static void kvp_classify_neon(struct kvp_window *w, const char *start)
+{
+	size_t first = start - w->base;
+
+	w->unquoted = 0;
+	w->quoted = 0;
+
+	for(size_t i = first & ~15; i < 64; i += 16) {
+		uint8x16_t v = vld1q_u8((const uint8_t *)w->base + i);
+
+		uint8x16_t unquoted = vorrq_u8(
+				vcleq_u8(vsubq_u8(v, vdupq_n_u8('\t')), vdupq_n_u8(4)),
+				vorrq_u8(vceqq_u8(v, vdupq_n_u8(' ')), vceqq_u8(v, vdupq_n_u8('=')))
+				);
+		uint8x16_t quoted = vorrq_u8(vceqq_u8(v, vdupq_n_u8('"')), vceqq_u8(v, vdupq_n_u8('\\')));
+		uint64_t end_mask = (kvp_movemask_neon(vceqq_u8(v, vdupq_n_u8(0))) << i) & (~(uint64_t)0 << first);
+
+		w->unquoted |= kvp_movemask_neon(unquoted) << i;
+		w->quoted |= kvp_movemask_neon(quoted) << i;
+
+		if(end_mask) {
+			end_mask = -(end_mask & -end_mask);
+			w->unquoted |= end_mask;
+			w->quoted |= end_mask;
+			break;
+		}
 	}
+}
+#endif /* __ARM_NEON */
+
+typedef void (*kvp_classify_func)(struct kvp_window *w, const char *start);
+
+static void kvp_classify_init(struct kvp_window *w, const char *start);
+
+// The window classifier used by nl_parse_kvp_slices(), selected at runtime by
+// the first call to kvp_classify_init() or nl_kvp_set_scanner().
+static kvp_classify_func kvp_classify = kvp_classify_init;
+
+/*
+ * Returns the classifier for the given implementation, or NULL if it is not
+ * supported by this build or CPU.
+ */
+static kvp_classify_func kvp_get_classifier(enum nl_kvp_scanner impl)
+{
+	switch(impl) {
+		case NL_KVP_SCAN_AUTO:
+			break;
+
+		case NL_KVP_SCAN_SCALAR:
+			return kvp_classify_scalar;
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+		case NL_KVP_SCAN_SSE2:
+			return nl_cpu_has(NL_CPU_SSE2) ? kvp_classify_sse2 : NULL;
 
-	if(key[0] == '"') {
-		nl_unescape_string(key, 0, ESCAPE_IF_QUOTED);
+		case NL_KVP_SCAN_AVX2:
+			return nl_cpu_has(NL_CPU_AVX2) ? kvp_classify_avx2 : NULL;
+#endif /* x86 */
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+		case NL_KVP_SCAN_NEON:
+			return nl_cpu_has(NL_CPU_NEON) ? kvp_classify_neon : NULL;
+#endif /* __ARM_NEON */
+
+		default:
+			return NULL;
 	}
-	if(value[0] == '"') {
-		nl_unescape_string(value, 0, ESCAPE_IF_QUOTED);
-		quoted_value = 1;
+
+	// Automatic selection picks the widest supported implementation
+	for(int i = NL_KVP_SCAN_NEON; i > NL_KVP_SCAN_SCALAR; i--) {
+		kvp_classify_func classify = kvp_get_classifier(i);
+		if(classify != NULL) {
+			return classify;
+		}
 	}
 
-	callback(cb_data, key, value, quoted_value);
+	return kvp_classify_scalar;
+}
 
-	free(key);
-	free(value);
+/*
+ * Selects the best classifier the first time it's needed, then uses it.
+ */
+static void kvp_classify_init(struct kvp_window *w, const char *start)
+{
+	kvp_classify_func classify = kvp_get_classifier(NL_KVP_SCAN_AUTO);
+	__atomic_store_n(&kvp_classify, classify, __ATOMIC_RELAXED);
+	classify(w, start);
 }
 
 /*
- * Parses optionally quoted key-value pairs.  A key with an equal sign but no
- * value will be ignored.  The given callback will be called for each key-value
- * pair found, with the given callback data.  The callback should not store
- * pointers to the strings it is given, as they will be freed after the
- * callback returns.  The key and value will both be dequoted and unescaped.
- *
- * Example pairs:
- *   a=b "c"=d e=f=g "e"="f=g" "g \"h i j"=" k\"l\"mn "
+ * Returns a pointer to the first character at or after ptr in the given class
+ * (KVP_UNQUOTED or KVP_QUOTED), or to the end of the line.  Moves the window
+ * forward as needed.
  */
-void nl_parse_kvp(const char *kvp_line, nl_kvp_cb callback, void *cb_data)
+static inline const char *kvp_find(struct kvp_window *w, kvp_classify_func classify, const char *ptr, int class)
+{
+	for(;;) {
+		uintptr_t off = (uintptr_t)ptr - (uintptr_t)w->base;
+
+		if(off < 64) {
+			uint64_t mask = (class == KVP_UNQUOTED ? w->unquoted : w->quoted) >> off;
+			if(mask) {
+				return ptr + __builtin_ctzll(mask);
+			}
+			ptr = w->base + 64;
+		}
+
+		w->base = (const char *)((uintptr_t)ptr & ~(uintptr_t)63);
+		classify(w, ptr);
+	}
+}
+
+/*
+ * Selects the implementation used to find the ends of keys and values in
+ * nl_parse_kvp() and related functions.  NL_KVP_SCAN_AUTO (the default) picks
+ * the fastest implementation supported by the CPU.  Output is identical for
+ * every implementation; this is meant for testing and benchmarking.  Returns 0
+ * on success, or -1 if the implementation is not supported by this build or
+ * CPU.
+ */
+int nl_kvp_set_scanner(enum nl_kvp_scanner impl)
+{
+	kvp_classify_func classify = kvp_get_classifier(impl);
+
+	if(classify == NULL) {
+		return -1;
+	}
+
+	__atomic_store_n(&kvp_classify, classify, __ATOMIC_RELAXED);
+
+	return 0;
+}
+
+/*
+ * Builds a slice for the key or value at str with the given raw length
+ * (including quotation marks, if any).  If closed is nonzero, a quoted
+ * string's last character is its closing quotation mark.
+ */
+static inline struct nl_kvp_slice make_slice(const char *str, size_t len, int closed)
+{
+	struct nl_kvp_slice slice = { .str = str, .len = len };
+
+	if(str[0] == '"') {
+		slice.str++;
+		slice.len -= closed ? 2 : 1;
+		slice.quoted = 1;
+		slice.escaped = memchr(slice.str, '\\', slice.len) != NULL;
+	}
+
+	return slice;
+}
+
+/*
+ * Calls the given callback with a single key/value pair.
+ */
+static inline void send_pair(const char *kvp_line, nl_kvp_slice_cb callback, void *cb_data, size_t key_start, size_t key_length, size_t value_start, size_t value_length, int value_closed)
+{
+	// Quoted keys are only accepted with a closing quote
+	callback(
+			cb_data,
+			make_slice(kvp_line + key_start, key_length, 1),
+			make_slice(kvp_line + value_start, value_length, value_closed)
+		);
+}
+
+/*
+ * Parses optionally quoted key-value pairs with the same rules as
+ * nl_parse_kvp(), but without allocating memory or copying the key or value.
+ * The callback receives slices pointing into kvp_line (see struct
+ * nl_kvp_slice), which remain valid for as long as kvp_line does.
+ */
+void nl_parse_kvp_slices(const char *kvp_line, nl_kvp_slice_cb callback, void *cb_data)
 {
 	enum {
 		EXPECT_KEY,	   // Skipping whitespace, looking for key
@@ -234,12 +528,17 @@ void nl_parse_kvp(const char *kvp_line, nl_kvp_cb callback, void *cb_data)
 	size_t value_length = 0;
 
 	const char *ptr = kvp_line;
-	size_t off = 0;
+	struct kvp_window window = { .base = NULL }; // Classified on first search
+	kvp_classify_func classify;
 
 	if(CHECK_NULL(kvp_line) || CHECK_NULL(callback)) {
 		return;
 	}
 
+	classify = __atomic_load_n(&kvp_classify, __ATOMIC_RELAXED);
+
+	// The loops that read keys and values jump to the next character that
+	// could end them (see kvp_class), then skip it if it doesn't.
 	while(*ptr) {
 		switch(state) {
 			case EXPECT_KEY:
@@ -247,8 +546,8 @@ void nl_parse_kvp(const char *kvp_line, nl_kvp_cb callback, void *cb_data)
 				do {
 					if(*ptr == '=') {
 						state = SKIP_KEY;
-					} else if(!isspace(*ptr)) {
-						key_start = off;
+					} else if(!kvp_space(*ptr)) {
+						key_start = ptr - kvp_line;
 						if(*ptr == '"') {
 							state = READ_QUOTED_KEY;
 						} else {
@@ -256,15 +555,14 @@ void nl_parse_kvp(const char *kvp_line, nl_kvp_cb callback, void *cb_data)
 						}
 					}
 					ptr++;
-					off++;
 				} while(state == EXPECT_KEY && *ptr);
 				break;
 
 			case SKIP_KEY:
 				// Skip non-whitespace due to a key name starting with equals.
-				while(!isspace(*ptr) && *ptr) {
-					ptr++;
-					off++;
+				ptr = kvp_find(&window, classify, ptr, KVP_UNQUOTED);
+				while(*ptr == '=') {
+					ptr = kvp_find(&window, classify, ptr + 1, KVP_UNQUOTED);
 				}
 				state = EXPECT_KEY;
 				break;
@@ -272,51 +570,49 @@ void nl_parse_kvp(const char *kvp_line, nl_kvp_cb callback, void *cb_data)
 			case READ_KEY:
 				// Read key characters until equals sign.
 				// Ignore key if whitespace is encountered.
-				do {
-					if(isspace(*ptr)) {
-						state = EXPECT_KEY;
-					} else if(*ptr == '=') {
-						state = EXPECT_VALUE;
-						key_length = off - key_start;
-					}
+				ptr = kvp_find(&window, classify, ptr, KVP_UNQUOTED);
+				if(*ptr == '=') {
+					state = EXPECT_VALUE;
+					key_length = ptr - kvp_line - key_start;
 					ptr++;
-					off++;
-				} while(state == READ_KEY && *ptr);
+				} else if(*ptr) {
+					state = EXPECT_KEY;
+					ptr++;
+				}
 				break;
 
 			case READ_QUOTED_KEY:
 				// Read key characters until non-escaped quote.
-				do {
+				for(ptr = kvp_find(&window, classify, ptr, KVP_QUOTED); *ptr; ptr = kvp_find(&window, classify, ptr, KVP_QUOTED)) {
 					if(*ptr == '"') {
 						state = EXPECT_EQUALS;
+						ptr++;
+						break;
 					} else if(*ptr == '\\' && ptr[1] == '"') {
 						ptr++;
-						off++;
 					}
 					ptr++;
-					off++;
-				} while(state == READ_QUOTED_KEY && *ptr);
+				}
 				break;
 
 			case EXPECT_EQUALS:
 				// Switch to value if equals, expect key otherwise.
 				if(*ptr == '=') {
 					state = EXPECT_VALUE;
-					key_length = off - key_start;
+					key_length = ptr - kvp_line - key_start;
 				} else {
 					state = EXPECT_KEY;
 				}
 				ptr++;
-				off++;
 				break;
 
 			case EXPECT_VALUE:
 				// Switch to key if whitespace, quoted value if
 				// quote, unquoted value otherwise.
-				if(isspace(*ptr)) {
+				if(kvp_space(*ptr)) {
 					state = EXPECT_KEY;
 				} else {
-					value_start = off;
+					value_start = ptr - kvp_line;
 					if(*ptr == '"') {
 						state = READ_QUOTED_VALUE;
 					} else {
@@ -324,45 +620,184 @@ void nl_parse_kvp(const char *kvp_line, nl_kvp_cb callback, void *cb_data)
 					}
 				}
 				ptr++;
-				off++;
 				break;
 
 			case READ_VALUE:
 				// Read value characters until whitespace.
-				do {
-					if(isspace(*ptr)) {
-						value_length = off - value_start;
-						send_pair(kvp_line, callback, cb_data, key_start, key_length, value_start, value_length);
-						state = EXPECT_KEY;
-					}
+				ptr = kvp_find(&window, classify, ptr, KVP_UNQUOTED);
+				while(*ptr == '=') {
+					ptr = kvp_find(&window, classify, ptr + 1, KVP_UNQUOTED);
+				}
+				if(*ptr) {
+					value_length = ptr - kvp_line - value_start;
+					send_pair(kvp_line, callback, cb_data, key_start, key_length, value_start, value_length, 0);
+					state = EXPECT_KEY;
 					ptr++;
-					off++;
-				} while(state == READ_VALUE && *ptr);
+				}
 				break;
 
 			case READ_QUOTED_VALUE:
 				// Read value characters until non-escaped
 				// quote.
-				do {
+				for(ptr = kvp_find(&window, classify, ptr, KVP_QUOTED); *ptr; ptr = kvp_find(&window, classify, ptr, KVP_QUOTED)) {
 					if(*ptr == '"') {
-						value_length = off - value_start + 1;
-						send_pair(kvp_line, callback, cb_data, key_start, key_length, value_start, value_length);
+						value_length = ptr - kvp_line - value_start + 1;
+						send_pair(kvp_line, callback, cb_data, key_start, key_length, value_start, value_length, 1);
 						state = EXPECT_KEY;
+						ptr++;
+						break;
 					} else if(*ptr == '\\' && ptr[1] == '"') {
 						ptr++;
-						off++;
 					}
 					ptr++;
-					off++;
-				} while(state == READ_QUOTED_VALUE && *ptr);
+				}
 				break;
 		}
 	}
 
 	// Handle final pair
 	if(state == READ_VALUE || state == READ_QUOTED_VALUE) {
-		value_length = off - value_start;
-		send_pair(kvp_line, callback, cb_data, key_start, key_length, value_start, value_length);
+		value_length = ptr - kvp_line - value_start;
+		send_pair(kvp_line, callback, cb_data, key_start, key_length, value_start, value_length, 0);
+	}
+}
+
+/*
+ * Copies the given slice into buf as a 0-terminated string, removing escape
+ * sequences if the slice is escaped.  The buffer must have room for at least
+ * slice.len + 3 bytes.  Returns the length of the resulting string, or -1 if
+ * buf is NULL or too small.
+ */
+ssize_t nl_kvp_unescape_slice(struct nl_kvp_slice slice, char *buf, size_t buf_size)
+{
+	size_t raw_len;
+	int count;
+
+	if(CHECK_NULL(buf) || CHECK_NULL(slice.str)) {
+		return -1;
+	}
+
+	if(!slice.escaped) {
+		if(buf_size < slice.len + 1) {
+			ERROR_OUT("Buffer of size %zu is too small for a slice of length %zu\n", buf_size, slice.len);
+			return -1;
+		}
+
+		memcpy(buf, slice.str, slice.len);
+		buf[slice.len] = 0;
+		return slice.len;
+	}
+
+	// Unescape the raw quoted string exactly as nl_parse_kvp() always has,
+	// including the closing quotation mark if there was one.
+	raw_len = slice.len + 1 + (slice.str[slice.len] == '"');
+	if(buf_size < raw_len + 1) {
+		ERROR_OUT("Buffer of size %zu is too small for a slice of length %zu\n", buf_size, slice.len);
+		return -1;
+	}
+
+	memcpy(buf, slice.str - 1, raw_len);
+	buf[raw_len] = 0;
+
+	count = nl_unescape_string(buf, 0, ESCAPE_IF_QUOTED);
+	if(count < 0) {
+		return -1;
+	}
+
+	return raw_len - count;
+}
+
+// Used by nl_parse_kvp_buf() to pass its parameters through nl_parse_kvp_slices()
+struct kvp_buf_info {
+	char *scratch;
+	size_t scratch_size;
+	nl_kvp_cb callback;
+	void *cb_data;
+};
+
+// Unescapes a pair into the scratch buffer for nl_parse_kvp_buf().  The key and
+// value together never need more than their raw length in the line plus two
+// bytes, so a scratch buffer of strlen(kvp_line) + 1 is always enough.
+static void kvp_buf_cb(void *data, struct nl_kvp_slice key, struct nl_kvp_slice value)
+{
+	struct kvp_buf_info *info = data;
+	ssize_t key_len;
+
+	key_len = nl_kvp_unescape_slice(key, info->scratch, info->scratch_size);
+	if(key_len < 0 || nl_kvp_unescape_slice(value, info->scratch + key_len + 1, info->scratch_size - key_len - 1) < 0) {
+		ERROR_OUT("Error unescaping key-value pair.\n");
+		return;
+	}
+
+	info->callback(info->cb_data, info->scratch, info->scratch + key_len + 1, value.quoted);
+}
+
+/*
+ * Parses optionally quoted key-value pairs like nl_parse_kvp(), but uses the
+ * given scratch buffer to hold the dequoted and unescaped key and value given
+ * to the callback, instead of allocating memory.  The scratch buffer must be
+ * at least strlen(kvp_line) + 1 bytes.  Returns 0 on success, or -1 if a
+ * parameter is NULL or the scratch buffer is too small.
+ */
+int nl_parse_kvp_buf(const char *kvp_line, char *scratch, size_t scratch_size, nl_kvp_cb callback, void *cb_data)
+{
+	struct kvp_buf_info info = {
+		.scratch = scratch,
+		.scratch_size = scratch_size,
+		.callback = callback,
+		.cb_data = cb_data,
+	};
+
+	if(CHECK_NULL(kvp_line) || CHECK_NULL(scratch) || CHECK_NULL(callback)) {
+		return -1;
+	}
+
+	if(scratch_size <= strlen(kvp_line)) {
+		ERROR_OUT("Scratch buffer of size %zu is too small for a line of length %zu\n",
+				scratch_size, strlen(kvp_line));
+		return -1;
+	}
+
+	nl_parse_kvp_slices(kvp_line, kvp_buf_cb, &info);
+
+	return 0;
+}
+
+/*
+ * Parses optionally quoted key-value pairs.  A key with an equal sign but no
+ * value will be ignored.  The given callback will be called for each key-value
+ * pair found, with the given callback data.  The callback should not store
+ * pointers to the strings it is given, as they will be freed after the
+ * callback returns.  The key and value will both be dequoted and unescaped.
+ *
+ * Example pairs:
+ *   a=b "c"=d e=f=g "e"="f=g" "g \"h i j"=" k\"l\"mn "
+ */
+void nl_parse_kvp(const char *kvp_line, nl_kvp_cb callback, void *cb_data)
+{
+	char stack_buf[256];
+	char *scratch = stack_buf;
+	size_t len;
+
+	if(CHECK_NULL(kvp_line) || CHECK_NULL(callback)) {
+		return;
+	}
+
+	// Short lines are unescaped on the stack; longer lines need only one
+	// allocation for the whole line.
+	len = strlen(kvp_line);
+	if(len >= sizeof(stack_buf)) {
+		scratch = malloc(len + 1);
+		if(scratch == NULL) {
+			ERROR_OUT("Error allocating scratch buffer for de-escaping.\n");
+			return;
+		}
+	}
+
+	nl_parse_kvp_buf(kvp_line, scratch, len + 1, callback, cb_data);
+
+	if(scratch != stack_buf) {
+		free(scratch);
 	}
 }
 
@@ -400,6 +835,22 @@ void nl_parse_kvp_variant(const char *kvp_line, nl_typed_kvp_cb callback, void *
 	nl_parse_kvp(kvp_line, nl_kvp_wrapper, &(struct nl_kvp_wrap){ .cb = callback, .data = cb_data });
 }
 
+/*
+ * Parses key-value pairs into variants like nl_parse_kvp_variant(), without
+ * allocating memory.  The scratch buffer must be at least strlen(kvp_line) + 1
+ * bytes.  Returns 0 on success, or -1 if a parameter is NULL or the scratch
+ * buffer is too small.
+ */
+int nl_parse_kvp_variant_buf(const char *kvp_line, char *scratch, size_t scratch_size, nl_typed_kvp_cb callback, void *cb_data)
+{
+	if(CHECK_NULL(callback)) {
+		return -1;
+	}
+
+	return nl_parse_kvp_buf(kvp_line, scratch, scratch_size, nl_kvp_wrapper,
+			&(struct nl_kvp_wrap){ .cb = callback, .data = cb_data });
+}
+
 // Callback for use by nl_parse_kvp() in nl_hash_parse()
 static void nl_build_hash_cb(void *h, char *key, char *value, int quoted)
 {
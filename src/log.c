@@ -3,10 +3,786 @@
  * Copyright (C)2012 Mike Bourgeous.  Released under AGPLv3 in 2018.
  */
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/uio.h>
 
 #include "nlutils.h"
+#include "log_internal.h"
+
+#define LOG_LINE_SIZE 512 // Stack buffer for formatting messages; longer messages are malloc()ed
+#define LOG_DEFAULT_RING_SIZE 65536
+#define LOG_MIN_RING_SIZE 4096
+#define LOG_MAX_RING_SIZE 0x40000000
+#define LOG_DEFAULT_FLUSH_USEC 1000
+#define LOG_BLOCK_STEP_USEC 50 // Polling interval for threads waiting for ring buffer space
+#define LOG_IOV_COUNT 256 // Messages per writev()
+#define LOG_CRASH_SPINS 1000 // Yields to wait for the writer in nl_log_crash_flush()
+#define LOG_CACHE_LINE 64
+
+// Asynchronous logging state
+enum log_state {
+	LOG_SYNC,	// Messages are written by the calling thread
+	LOG_ASYNC,	// stdout and stderr messages go through ring buffers
+	LOG_STOPPING,	// nl_log_stop_async() is waiting for the rings to drain
+	LOG_CRASHED,	// nl_log_crash_flush() was called; the writer is idle
+};
+
+// What the writer thread is doing, for deciding when to wake it
+enum writer_state {
+	WRITER_RUNNING,
+	WRITER_NAPPING,	// Collecting a batch; wake only for a half-full ring
+	WRITER_IDLE,	// Sleeping until a message arrives
+};
+
+// Header of a message in a ring buffer, followed by len bytes of text and
+// padding to a multiple of the header size.
+struct log_record {
+	uint32_t len;	// Length of the text
+	int32_t fd;	// Destination file descriptor, or -1 to skip to the start of the ring
+	int64_t ns;	// Timestamp, for ordering messages from different threads
+};
+
+// A single-producer, single-consumer byte ring owned by one logging thread.
+struct log_ring {
+	struct log_ring *next;	// Rings are never removed from log_rings
+	char *buf;
+	size_t mask;
+	unsigned int owned;	// Nonzero while a thread is using this ring
+
+	char pad0[LOG_CACHE_LINE];
+	size_t head;		// Written by the owning thread
+	unsigned int busy;	// Nonzero while the owning thread may be adding a message
+	unsigned long dropped;	// Messages dropped because the ring was full
+	char pad1[LOG_CACHE_LINE];
+	size_t tail;		// Written by the consumer
+	size_t scan;		// Consumer's position within the current batch
+	size_t limit;		// Head position seen at the start of the current batch
+	char pad2[LOG_CACHE_LINE];
+};
+
+// Buffer for assembling a message, tracking the untruncated length.
+struct log_buf {
+	char *buf;
+	size_t size;
+	size_t len;
+};
+
+static struct log_ring *log_rings;
+static unsigned int log_state = LOG_SYNC;
+static unsigned int writer_state = WRITER_RUNNING;
+static unsigned int writer_exit; // 1 to stop the writer, 2 once it has stopped
+static unsigned int log_consumer; // Nonzero while a thread is draining the rings
+static unsigned int flush_waiters;
+static unsigned long drain_passes; // Incremented after each pass of the writer over the rings
+static unsigned long drops_reported;
+
+static size_t ring_size = LOG_DEFAULT_RING_SIZE;
+static unsigned int block_usec;
+static unsigned int flush_usec = LOG_DEFAULT_FLUSH_USEC;
+
+static pthread_t writer_thread;
+static pthread_mutex_t control_lock = PTHREAD_MUTEX_INITIALIZER; // Serializes start and stop
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER; // Used only for sleeping and waking
+static pthread_cond_t writer_cond;
+static pthread_cond_t flush_cond;
+static pthread_key_t ring_key;
+static pthread_once_t log_once = PTHREAD_ONCE_INIT;
+static int log_init_error;
+
+static __thread struct log_ring *thread_ring;
+static __thread unsigned int log_depth; // Nonzero in nested calls and the writer thread
+
+// Per-thread cache of the formatted date and zone for one second
+static __thread struct {
+	time_t sec;
+	char date[32];
+	char zone[8];
+	size_t date_len;
+	size_t zone_len;
+} time_cache;
+
+// Appends formatted text to b, counting (but not storing) text past the end.
+static void __attribute__ ((__format__(__printf__, 2, 0))) log_vappend(struct log_buf *b, const char *fmt, va_list args)
+{
+	size_t off = MIN_NUM(b->len, b->size);
+	int ret = vsnprintf(b->buf + off, b->size - off, fmt, args);
+
+	if(ret > 0) {
+		b->len += ret;
+	}
+}
+
+static void __attribute__ ((__format__(__printf__, 2, 3))) log_append(struct log_buf *b, const char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	log_vappend(b, fmt, args);
+	va_end(args);
+}
+
+// Appends len bytes of str to b.
+static void log_append_str(struct log_buf *b, const char *str, size_t len)
+{
+	if(b->len < b->size) {
+		memcpy(b->buf + b->len, str, MIN_NUM(len, b->size - b->len));
+	}
+	b->len += len;
+}
+
+// Appends the timestamp and thread name prefix for time t and the given
+// thread name.  The date and time zone are formatted once per second per
+// thread.
+static void log_prefix(struct log_buf *b, const struct timespec *t, const char *name)
+{
+	char usec[8];
+	long us = t->tv_nsec / 1000;
+
+	if(t->tv_sec != time_cache.sec || time_cache.date_len == 0) {
+		struct tm tm_result;
+
+		localtime_r(&t->tv_sec, &tm_result);
+		time_cache.date_len = strftime(time_cache.date, sizeof(time_cache.date), "%Y-%m-%d %H:%M:%S", &tm_result);
+		time_cache.zone_len = strftime(time_cache.zone, sizeof(time_cache.zone), "%z", &tm_result);
+		time_cache.sec = t->tv_sec;
+	}
+
+	usec[0] = '.';
+	for(int i = 6; i > 0; i--) {
+		usec[i] = '0' + us % 10;
+		us /= 10;
+	}
+	usec[7] = ' ';
+
+	log_append_str(b, time_cache.date, time_cache.date_len);
+	log_append_str(b, usec, sizeof(usec));
+	log_append_str(b, time_cache.zone, time_cache.zone_len);
+	log_append_str(b, " - ", 3);
+	log_append_str(b, name, strlen(name));
+	log_append_str(b, " - ", 3);
+}
+
+// Formats a complete message into b, as described by nl_fptmf_src().
+static void __attribute__ ((__format__(__printf__, 8, 0))) log_format(struct log_buf *b,
+		const struct timespec *t, int flags, const char *file, int line, const char *func,
+		int err, const char *fmt, va_list args)
+{
+	if(!(flags & NL_PTMF_NOPREFIX)) {
+		log_prefix(b, t, nl_threadname());
+	}
+
+	if(flags & NL_PTMF_BOLD) {
+		log_append_str(b, "\e[0;1m", 6);
+	}
+	if(file != NULL) {
+		log_append(b, "%s:%d: %s():\t", file, line, func);
+	}
+
+	log_vappend(b, fmt, args);
+
+	if(flags & NL_PTMF_ERRNO) {
+		log_append(b, ": %d (%s)", err, strerror(err));
+	}
+	if(flags & NL_PTMF_BOLD) {
+		log_append_str(b, "\e[0m", 4);
+	}
+	if(flags & NL_PTMF_ERRNO) {
+		log_append_str(b, "\n", 1);
+	}
+}
+
+// Writes all of iov to fd, retrying after signals and partial writes.  Uses
+// only async-signal-safe functions.  Returns 0 on success, -1 on error.
+static int log_writev(int fd, struct iovec *iov, int count)
+{
+	while(count > 0) {
+		ssize_t ret = writev(fd, iov, count);
+
+		if(ret < 0) {
+			if(errno == EAGAIN || errno == EWOULDBLOCK) {
+				poll(&(struct pollfd){ .fd = fd, .events = POLLOUT }, 1, -1);
+			} else if(errno != EINTR) {
+				return -1;
+			}
+			continue;
+		}
+
+		while(count > 0 && (size_t)ret >= iov->iov_len) {
+			ret -= iov->iov_len;
+			iov++;
+			count--;
+		}
+		if(count > 0) {
+			iov->iov_base = (char *)iov->iov_base + ret;
+			iov->iov_len -= ret;
+		}
+	}
+
+	return 0;
+}
+
+// Returns the next message in ring r's current batch, skipping padding, or
+// NULL if the batch is finished.
+static struct log_record *ring_peek(struct log_ring *r)
+{
+	while(r->scan != r->limit) {
+		struct log_record *rec = (struct log_record *)(r->buf + (r->scan & r->mask));
+
+		if(rec->fd >= 0) {
+			return rec;
+		}
+
+		r->scan += r->mask + 1 - (r->scan & r->mask);
+	}
+
+	return NULL;
+}
+
+// Writes the queued iovecs, then releases the written space in every ring.
+static void log_commit(struct log_ring *rings, int fd, struct iovec *iov, int count)
+{
+	if(count > 0) {
+		log_writev(fd, iov, count);
+	}
+
+	for(struct log_ring *r = rings; r != NULL; r = r->next) {
+		if(r->scan != r->tail) {
+			__atomic_store_n(&r->tail, r->scan, __ATOMIC_RELEASE);
+		}
+	}
+}
+
+// Writes every message queued in the rings when called, merging threads by
+// timestamp and batching consecutive messages to the same fd into one
+// writev().  The caller must hold log_consumer.  Uses no locks or memory
+// allocation.  Returns the number of messages written.
+static size_t log_drain(void)
+{
+	struct log_ring *rings = __atomic_load_n(&log_rings, __ATOMIC_ACQUIRE);
+	struct iovec iov[LOG_IOV_COUNT];
+	size_t written = 0;
+	int count = 0;
+	int fd = -1;
+
+	for(struct log_ring *r = rings; r != NULL; r = r->next) {
+		r->scan = r->tail;
+		r->limit = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+	}
+
+	for(;;) {
+		struct log_ring *next = NULL;
+		struct log_record *rec = NULL;
+
+		for(struct log_ring *r = rings; r != NULL; r = r->next) {
+			struct log_record *r_rec = ring_peek(r);
+			if(r_rec != NULL && (rec == NULL || r_rec->ns < rec->ns)) {
+				next = r;
+				rec = r_rec;
+			}
+		}
+
+		if(next == NULL) {
+			break;
+		}
+
+		if(count > 0 && (rec->fd != fd || count == LOG_IOV_COUNT)) {
+			log_commit(rings, fd, iov, count);
+			count = 0;
+		}
+
+		fd = rec->fd;
+		iov[count++] = (struct iovec){ .iov_base = rec + 1, .iov_len = rec->len };
+		next->scan += (sizeof(*rec) + rec->len + sizeof(*rec) - 1) & ~(sizeof(*rec) - 1);
+		written++;
+	}
+
+	log_commit(rings, fd, iov, count);
+
+	return written;
+}
+
+// Returns nonzero if any ring holds unwritten messages.
+static int log_pending(void)
+{
+	for(struct log_ring *r = __atomic_load_n(&log_rings, __ATOMIC_ACQUIRE); r != NULL; r = r->next) {
+		if(__atomic_load_n(&r->head, __ATOMIC_ACQUIRE) != __atomic_load_n(&r->tail, __ATOMIC_RELAXED)) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+// Wakes the writer thread if it is sleeping.
+static void log_wake_writer(void)
+{
+	if(__atomic_load_n(&writer_state, __ATOMIC_RELAXED) != WRITER_RUNNING) {
+		pthread_mutex_lock(&log_lock);
+		pthread_cond_signal(&writer_cond);
+		pthread_mutex_unlock(&log_lock);
+	}
+}
+
+// Writes a message about newly dropped messages to stderr.
+static void log_report_drops(void)
+{
+	unsigned long dropped = nl_log_dropped();
+
+	if(dropped != drops_reported) {
+		char buf[LOG_LINE_SIZE];
+		struct log_buf b = { .buf = buf, .size = sizeof(buf) };
+		struct timespec t;
+
+		clock_gettime(CLOCK_REALTIME, &t);
+		log_prefix(&b, &t, nl_threadname());
+		log_append(&b, "%lu log messages dropped; ring buffers were full.\n", dropped - drops_reported);
+		log_writev(STDERR_FILENO, &(struct iovec){ .iov_base = buf, .iov_len = MIN_NUM(b.len, b.size) }, 1);
+
+		drops_reported = dropped;
+	}
+}
+
+// Background thread that writes queued messages.
+static void *log_writer(void *data)
+{
+	(void)data;
+
+	nl_set_threadname("nl_log");
+
+	// The writer's own messages (e.g. errors) are written directly
+	log_depth = 1;
+
+	for(;;) {
+		size_t written = 0;
+		int ret;
+
+		if(!__atomic_exchange_n(&log_consumer, 1, __ATOMIC_ACQUIRE)) {
+			written = log_drain();
+			__atomic_store_n(&log_consumer, 0, __ATOMIC_RELEASE);
+		}
+
+		log_report_drops();
+
+		__atomic_add_fetch(&drain_passes, 1, __ATOMIC_SEQ_CST);
+		if(__atomic_load_n(&flush_waiters, __ATOMIC_SEQ_CST)) {
+			pthread_mutex_lock(&log_lock);
+			pthread_cond_broadcast(&flush_cond);
+			pthread_mutex_unlock(&log_lock);
+		}
+
+		pthread_mutex_lock(&log_lock);
+
+		if(writer_exit && !log_pending()) {
+			writer_exit = 2;
+			pthread_cond_broadcast(&flush_cond);
+			pthread_mutex_unlock(&log_lock);
+			break;
+		}
+
+		if(!flush_waiters && !writer_exit) {
+			if(written && flush_usec) {
+				struct timespec deadline;
+
+				nl_clock_fromnow(CLOCK_MONOTONIC, &deadline,
+						(struct timespec){ .tv_nsec = flush_usec % 1000000 * 1000, .tv_sec = flush_usec / 1000000 });
+				__atomic_store_n(&writer_state, WRITER_NAPPING, __ATOMIC_SEQ_CST);
+				ret = pthread_cond_timedwait(&writer_cond, &log_lock, &deadline);
+			} else if(!written) {
+				// Pairs with the fence in log_async() so that either the
+				// producer sees WRITER_IDLE, or this thread sees the message.
+				__atomic_store_n(&writer_state, WRITER_IDLE, __ATOMIC_SEQ_CST);
+				ret = log_pending() ? 0 : pthread_cond_wait(&writer_cond, &log_lock);
+			} else {
+				ret = 0;
+			}
+
+			if(ret && ret != ETIMEDOUT) {
+				ERROR_OUT("Error waiting for log messages: %d (%s)\n", ret, strerror(ret));
+			}
+			__atomic_store_n(&writer_state, WRITER_RUNNING, __ATOMIC_RELAXED);
+		}
+
+		pthread_mutex_unlock(&log_lock);
+	}
+
+	return NULL;
+}
+
+// Marks an exiting thread's ring as free for reuse by another thread.
+static void ring_release(void *data)
+{
+	struct log_ring *r = data;
+
+	thread_ring = NULL;
+	__atomic_store_n(&r->owned, 0, __ATOMIC_RELEASE);
+}
+
+// Returns the calling thread's ring, reusing a ring left by an exited thread
+// or allocating a new one.  Returns NULL on error.
+static struct log_ring *ring_acquire(void)
+{
+	struct log_ring *r;
+
+	for(r = __atomic_load_n(&log_rings, __ATOMIC_ACQUIRE); r != NULL; r = r->next) {
+		if(!__atomic_load_n(&r->owned, __ATOMIC_RELAXED) && !__atomic_exchange_n(&r->owned, 1, __ATOMIC_ACQUIRE)) {
+			break;
+		}
+	}
+
+	if(r == NULL) {
+		size_t size = __atomic_load_n(&ring_size, __ATOMIC_RELAXED);
+
+		r = calloc(1, sizeof(*r));
+		if(r == NULL) {
+			return NULL;
+		}
+		r->buf = malloc(size);
+		if(r->buf == NULL) {
+			free(r);
+			return NULL;
+		}
+		r->mask = size - 1;
+		r->owned = 1;
+
+		r->next = __atomic_load_n(&log_rings, __ATOMIC_RELAXED);
+		while(!__atomic_compare_exchange_n(&log_rings, &r->next, r, 1, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+		}
+	}
+
+	thread_ring = r;
+	pthread_setspecific(ring_key, r);
+
+	return r;
+}
+
+// Replaces the buffer of the calling thread's empty ring r if the ring size
+// has changed since it was allocated.  The consumer reads the buffer only
+// between the tail and head, so it cannot be using the old buffer.
+static void ring_resize(struct log_ring *r)
+{
+	size_t size = __atomic_load_n(&ring_size, __ATOMIC_RELAXED);
+	char *buf;
+
+	if(size == r->mask + 1 || r->head != __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE)) {
+		return;
+	}
+
+	buf = malloc(size);
+	if(buf == NULL) {
+		return;
+	}
+
+	// Published to the consumer by the next store to r->head
+	free(r->buf);
+	r->buf = buf;
+	r->mask = size - 1;
+}
+
+// Reserves room for need bytes in ring r, adding padding if the ring wraps.
+// Returns the new head position after the message, or 0 if the ring is full.
+static size_t ring_reserve(struct log_ring *r, size_t need)
+{
+	size_t head = r->head;
+	size_t off = head & r->mask;
+	size_t pad = off + need > r->mask + 1 ? r->mask + 1 - off : 0;
+
+	if(head + pad + need - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) > r->mask + 1) {
+		return 0;
+	}
+
+	if(pad) {
+		((struct log_record *)(r->buf + off))->fd = -1;
+	}
+
+	return head + pad + need;
+}
+
+// Adds a formatted message to the calling thread's ring.  Returns 0 if the
+// message was queued or dropped, or -1 if the caller should write it directly.
+static int log_async(int fd, const void *msg, size_t len, const struct timespec *t)
+{
+	struct log_ring *r = thread_ring;
+	struct log_record *rec;
+	size_t need = (sizeof(*rec) + len + sizeof(*rec) - 1) & ~(sizeof(*rec) - 1);
+	size_t head;
+	int ret = 0;
+
+	if(r == NULL) {
+		r = ring_acquire();
+		if(r == NULL) {
+			return -1;
+		}
+	}
+
+	// Pairs with the fence in nl_log_stop_async() so that either the
+	// stopping thread sees this thread is busy, or this thread sees that
+	// asynchronous logging is stopping.
+	__atomic_store_n(&r->busy, 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	if(__atomic_load_n(&log_state, __ATOMIC_RELAXED) != LOG_ASYNC) {
+		ret = -1;
+		goto out;
+	}
+
+	ring_resize(r);
+	if(need > (r->mask + 1) / 4) {
+		ret = -1;
+		goto out;
+	}
+
+	head = ring_reserve(r, need);
+	for(unsigned int waited = 0; head == 0 && waited < block_usec; waited += LOG_BLOCK_STEP_USEC) {
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		log_wake_writer();
+		nl_usleep(LOG_BLOCK_STEP_USEC);
+		head = ring_reserve(r, need);
+	}
+
+	if(head == 0) {
+		__atomic_store_n(&r->dropped, r->dropped + 1, __ATOMIC_RELAXED);
+		goto out;
+	}
+
+	rec = (struct log_record *)(r->buf + ((head - need) & r->mask));
+	*rec = (struct log_record){ .len = len, .fd = fd, .ns = nl_timespec_to_ns(*t) };
+	memcpy(rec + 1, msg, len);
+
+	__atomic_store_n(&r->head, head, __ATOMIC_RELEASE);
+
+	// Pairs with the fence in log_writer() so that either this thread sees
+	// the writer is idle, or the writer sees the message.
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	switch(__atomic_load_n(&writer_state, __ATOMIC_RELAXED)) {
+		case WRITER_IDLE:
+			log_wake_writer();
+			break;
+
+		case WRITER_NAPPING:
+			if(head - __atomic_load_n(&r->tail, __ATOMIC_RELAXED) > (r->mask + 1) / 2) {
+				log_wake_writer();
+			}
+			break;
+	}
+
+out:
+	__atomic_store_n(&r->busy, 0, __ATOMIC_RELEASE);
+	return ret;
+}
+
+// Creates the writer's condition variables.  Returns 0 on success, or an
+// errno-like value on error.
+static int log_init_conds(void)
+{
+	pthread_condattr_t attr;
+	int ret;
+
+	// Writer naps use CLOCK_MONOTONIC deadlines
+	ret = pthread_condattr_init(&attr);
+	if(ret) {
+		return ret;
+	}
+	ret = pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	if(!ret) {
+		ret = pthread_cond_init(&writer_cond, &attr);
+	}
+	if(!ret) {
+		ret = pthread_cond_init(&flush_cond, NULL);
+	}
+	pthread_condattr_destroy(&attr);
+
+	return ret;
+}
+
+// Clears asynchronous logging state in a forked child, which has no writer
+// thread.  The parent is responsible for its queued messages.
+static void log_atfork_child(void)
+{
+	log_state = LOG_SYNC;
+	writer_state = WRITER_RUNNING;
+	writer_exit = 0;
+	log_consumer = 0;
+	flush_waiters = 0;
+
+	for(struct log_ring *r = log_rings; r != NULL; r = r->next) {
+		r->tail = r->head;
+		r->busy = 0;
+		r->owned = r == thread_ring;
+	}
+
+	pthread_mutex_init(&control_lock, NULL);
+	pthread_mutex_init(&log_lock, NULL);
+	log_init_error = log_init_conds();
+}
+
+static void log_atexit(void)
+{
+	nl_log_stop_async();
+}
+
+// Creates the writer's condition variables and registers fork and exit
+// handlers.
+static void log_init(void)
+{
+	int ret;
+
+	ret = pthread_key_create(&ring_key, ring_release);
+	if(ret) {
+		ERROR_OUT("Error creating log ring key: %d (%s)\n", ret, strerror(ret));
+		log_init_error = ret;
+		return;
+	}
+
+	ret = log_init_conds();
+	if(ret) {
+		ERROR_OUT("Error creating log condition variables: %d (%s)\n", ret, strerror(ret));
+		log_init_error = ret;
+		return;
+	}
+
+	ret = pthread_atfork(NULL, NULL, log_atfork_child);
+	if(ret) {
+		ERROR_OUT("Error registering log fork handler: %d (%s)\n", ret, strerror(ret));
+		log_init_error = ret;
+		return;
+	}
+
+	if(atexit(log_atexit)) {
+		ERROR_OUT("Error registering log exit handler\n");
+		log_init_error = ENOMEM;
+	}
+}
+
+// Stops and joins the writer thread.  The caller must hold control_lock.
+static int log_stop_writer(void)
+{
+	int ret;
+
+	pthread_mutex_lock(&log_lock);
+	writer_exit = 1;
+	pthread_cond_signal(&writer_cond);
+	pthread_mutex_unlock(&log_lock);
+
+	ret = pthread_join(writer_thread, NULL);
+	if(ret) {
+		ERROR_OUT("Error joining log writer thread: %d (%s)\n", ret, strerror(ret));
+	}
+
+	__atomic_store_n(&log_state, LOG_SYNC, __ATOMIC_SEQ_CST);
+
+	return ret;
+}
+
+// Formats a message and writes it to out, through the ring buffers in
+// asynchronous mode.  Preserves errno.
+static int __attribute__ ((__format__(__printf__, 6, 0))) log_write(FILE *out, int flags,
+		const char *file, int line, const char *func, const char *fmt, va_list args)
+{
+	char buf[LOG_LINE_SIZE];
+	struct log_buf b = { .buf = buf, .size = sizeof(buf) };
+	int err = errno;
+	struct timespec t;
+	int fd = -1;
+	va_list args2;
+	int ret;
+
+	if(__atomic_load_n(&log_state, __ATOMIC_RELAXED) != LOG_SYNC && (out == stdout || out == stderr)) {
+		fd = fileno(out);
+	}
+
+	clock_gettime(CLOCK_REALTIME, &t);
+
+	va_copy(args2, args);
+	log_format(&b, &t, flags, file, line, func, err, fmt, args2);
+	va_end(args2);
+
+	if(b.len >= b.size) {
+		b.buf = malloc(b.len + 1);
+		if(b.buf == NULL) {
+			// Write the truncated message
+			b.buf = buf;
+			b.len = b.size - 1;
+		} else {
+			b.size = b.len + 1;
+			b.len = 0;
+			log_format(&b, &t, flags, file, line, func, err, fmt, args);
+		}
+	}
+
+	ret = b.len;
+
+	if(fd >= 0) {
+		if(nl_log_write_fd(fd, b.buf, b.len, &t)) {
+			ret = -1;
+		}
+	} else {
+		if(lockf(fileno(out), F_LOCK, 0)) {
+			ERRNO_OUT("lockf lock failed");
+		}
+		if(fwrite(b.buf, 1, b.len, out) != b.len) {
+			ret = -1;
+		}
+		if(lockf(fileno(out), F_ULOCK, 0)) {
+			ERRNO_OUT("lockf unlock failed");
+		}
+	}
+
+	if(b.buf != buf) {
+		free(b.buf);
+	}
+
+	errno = err;
+
+	return ret;
+}
+
+/*
+ * Writes len bytes of data to fd as one message with timestamp t, through the
+ * calling thread's ring buffer if asynchronous logging is running, or
+ * directly otherwise.  Returns 0 on success (including if the message was
+ * dropped), or -1 if a direct write failed.
+ */
+int nl_log_write_fd(int fd, const void *data, size_t len, const struct timespec *t)
+{
+	int ret = 0;
+
+	if(log_depth++ || __atomic_load_n(&log_state, __ATOMIC_RELAXED) == LOG_SYNC || log_async(fd, data, len, t)) {
+		// Nested (e.g. signal handler) or oversized messages, or
+		// asynchronous logging is off or stopping
+		if(log_depth == 1) {
+			nl_log_flush();
+		}
+		ret = log_writev(fd, &(struct iovec){ .iov_base = (void *)data, .iov_len = len }, 1);
+	}
+	log_depth--;
+
+	return ret;
+}
+
+/*
+ * Stores the timestamp and thread name prefix used by nl_fptmf() for the
+ * CLOCK_REALTIME time t and the given thread name in buf, truncating to size
+ * bytes including a NUL terminator.  Returns the untruncated length.
+ */
+size_t nl_log_format_prefix(char *buf, size_t size, const struct timespec *t, const char *name)
+{
+	struct log_buf b = { .buf = buf, .size = size };
+
+	log_prefix(&b, t, name);
+	if(size > 0) {
+		buf[MIN_NUM(b.len, size - 1)] = 0;
+	}
+
+	return b.len;
+}
 
 /*
  * Like printf(), but prepends a timestamp and the name of the current thread
@@ -52,28 +828,218 @@ int __attribute__ ((__format__(__printf__, 2, 3))) nl_fptmf(FILE *out, const cha
  */
 int __attribute__ ((__format__(__printf__, 2, 0))) nl_vfptmf(FILE *out, const char *fmt, va_list args)
 {
-	struct timespec t;
-	struct tm tm_result;
-	char threadname[16];
-	char buf[32];
-	char zone[8];
+	return log_write(out, 0, NULL, 0, NULL, fmt, args);
+}
+
+/*
+ * Like nl_fptmf(), but also prepends the given source file, line, and
+ * function, and applies the NL_PTMF_* flags, writing the whole message at
+ * once.  Used by INFO_OUT(), ERROR_OUT(), and related macros.  Does not
+ * modify errno.
+ */
+int __attribute__ ((__format__(__printf__, 6, 7))) nl_fptmf_src(FILE *out, int flags,
+		const char *file, int line, const char *func, const char *fmt, ...)
+{
+	va_list args;
 	int ret;
 
-	clock_gettime(CLOCK_REALTIME, &t);
-	localtime_r(&t.tv_sec, &tm_result);
-	strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tm_result);
-	strftime(zone, sizeof(zone), "%z", &tm_result);
+	va_start(args, fmt);
+	ret = log_write(out, flags, file, line, func, fmt, args);
+	va_end(args);
+
+	return ret;
+}
+
+/*
+ * Starts asynchronous logging of messages sent to stdout and stderr by the
+ * functions in this file, creating the writer thread.  params may be NULL to
+ * use the defaults.  If a thread's ring buffer is full, its message is
+ * dropped after waiting at most params->block_usec; dropped messages are
+ * counted and reported on stderr.  Messages too large for a quarter of a ring
+ * buffer are written directly after the thread's queued messages.  Queued
+ * messages are written at exit() or nl_log_stop_async().  Returns 0 on
+ * success, EBUSY if asynchronous logging is already running, or another
+ * errno-like value on error.
+ */
+int nl_log_start_async(const struct nl_log_params *params)
+{
+	sigset_t all_signals, old_signals;
+	size_t size = LOG_MIN_RING_SIZE;
+	int ret;
+
+	pthread_once(&log_once, log_init);
+	if(log_init_error) {
+		return log_init_error;
+	}
+
+	if(params != NULL && params->ring_size > LOG_MAX_RING_SIZE) {
+		ERROR_OUT("Log ring size of %zu bytes is too large.\n", params->ring_size);
+		return EINVAL;
+	}
+
+	pthread_mutex_lock(&control_lock);
+
+	switch(__atomic_load_n(&log_state, __ATOMIC_RELAXED)) {
+		case LOG_SYNC:
+			break;
+
+		case LOG_CRASHED:
+			log_stop_writer();
+			break;
+
+		default:
+			pthread_mutex_unlock(&control_lock);
+			return EBUSY;
+	}
+
+	while(size < (params != NULL && params->ring_size ? params->ring_size : LOG_DEFAULT_RING_SIZE)) {
+		size *= 2;
+	}
+	__atomic_store_n(&ring_size, size, __ATOMIC_RELAXED);
+	block_usec = params != NULL ? params->block_usec : 0;
+	flush_usec = params != NULL && params->flush_usec ? params->flush_usec : LOG_DEFAULT_FLUSH_USEC;
+	writer_exit = 0;
+
+	// Anything already buffered by stdio goes before asynchronous messages
+	fflush(stdout);
+	fflush(stderr);
+
+	// Signal handlers should run on the application's threads
+	sigfillset(&all_signals);
+	pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+	ret = pthread_create(&writer_thread, NULL, log_writer, NULL);
+	pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+	if(ret) {
+		ERROR_OUT("Error creating log writer thread: %d (%s)\n", ret, strerror(ret));
+		pthread_mutex_unlock(&control_lock);
+		return ret;
+	}
+
+	__atomic_store_n(&log_state, LOG_ASYNC, __ATOMIC_SEQ_CST);
+
+	pthread_mutex_unlock(&control_lock);
+
+	return 0;
+}
 
-	nl_get_threadname(threadname);
+/*
+ * Writes all queued messages, stops the writer thread, and returns to
+ * synchronous logging.  Ring buffers are kept for reuse by a later call to
+ * nl_log_start_async(), and resized when empty if its ring size differs.
+ * Returns 0 on success (including if asynchronous logging was not running),
+ * or an errno-like value on error.
+ */
+int nl_log_stop_async(void)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&control_lock);
+
+	switch(__atomic_load_n(&log_state, __ATOMIC_RELAXED)) {
+		case LOG_ASYNC:
+			// New messages are written directly once no thread is
+			// still adding to its ring (see log_async()).
+			__atomic_store_n(&log_state, LOG_STOPPING, __ATOMIC_SEQ_CST);
+			for(struct log_ring *r = __atomic_load_n(&log_rings, __ATOMIC_SEQ_CST); r != NULL; r = r->next) {
+				while(__atomic_load_n(&r->busy, __ATOMIC_ACQUIRE)) {
+					sched_yield();
+				}
+			}
+			ret = log_stop_writer();
+			break;
+
+		case LOG_CRASHED:
+			ret = log_stop_writer();
+			break;
+	}
+
+	pthread_mutex_unlock(&control_lock);
+
+	return ret;
+}
+
+/*
+ * Waits until every message logged so far has been written.  Returns
+ * immediately in synchronous mode.  Returns 0 on success, or an errno-like
+ * value on error.  Not safe to call from a signal handler.
+ */
+int nl_log_flush(void)
+{
+	unsigned long target;
+	unsigned int state;
+	int ret = 0;
 
-	if(lockf(fileno(out), F_LOCK, 0)) {
-		ERRNO_OUT("lockf lock failed");
+	state = __atomic_load_n(&log_state, __ATOMIC_SEQ_CST);
+	if((state != LOG_ASYNC && state != LOG_STOPPING) || pthread_equal(pthread_self(), writer_thread)) {
+		return 0;
 	}
-	ret = fprintf(out, "%s.%06ld %s - %s - ", buf, t.tv_nsec / 1000, zone, threadname);
-	ret += vfprintf(out, fmt, args);
-	if(lockf(fileno(out), F_ULOCK, 0)) {
-		ERRNO_OUT("lockf unlock failed");
+
+	pthread_mutex_lock(&log_lock);
+
+	__atomic_add_fetch(&flush_waiters, 1, __ATOMIC_SEQ_CST);
+
+	// The pass in progress may have missed earlier messages, but the one
+	// after it will not.
+	target = __atomic_load_n(&drain_passes, __ATOMIC_SEQ_CST) + 2;
+	pthread_cond_signal(&writer_cond);
+
+	while((long)(__atomic_load_n(&drain_passes, __ATOMIC_SEQ_CST) - target) < 0 && writer_exit != 2) {
+		ret = pthread_cond_wait(&flush_cond, &log_lock);
+		if(ret) {
+			ERROR_OUT("Error waiting for log flush: %d (%s)\n", ret, strerror(ret));
+			break;
+		}
 	}
 
+	__atomic_sub_fetch(&flush_waiters, 1, __ATOMIC_SEQ_CST);
+
+	pthread_mutex_unlock(&log_lock);
+
 	return ret;
 }
+
+/*
+ * Writes all queued messages from the calling thread, then switches to
+ * synchronous logging so that messages logged afterward (e.g. by
+ * nl_print_signal() or NL_PRINT_TRACE()) follow them directly.  Uses no locks
+ * or memory allocation, so it is safe to call at the start of a crash signal
+ * handler.  Messages are not written if the writer thread is stuck writing
+ * them itself.  nl_log_stop_async() or nl_log_start_async() will clean up the
+ * idle writer thread if the process continues.
+ */
+void nl_log_crash_flush(void)
+{
+	unsigned int state = LOG_ASYNC;
+	int err = errno;
+
+	if(!__atomic_compare_exchange_n(&log_state, &state, LOG_CRASHED, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+		return;
+	}
+
+	for(int i = 0; i < LOG_CRASH_SPINS; i++) {
+		if(!__atomic_exchange_n(&log_consumer, 1, __ATOMIC_ACQUIRE)) {
+			log_drain();
+			__atomic_store_n(&log_consumer, 0, __ATOMIC_RELEASE);
+			break;
+		}
+
+		sched_yield();
+	}
+
+	errno = err;
+}
+
+/*
+ * Returns the number of messages dropped because a thread's ring buffer was
+ * full, since the process started.
+ */
+unsigned long nl_log_dropped(void)
+{
+	unsigned long dropped = 0;
+
+	for(struct log_ring *r = __atomic_load_n(&log_rings, __ATOMIC_ACQUIRE); r != NULL; r = r->next) {
+		dropped += __atomic_load_n(&r->dropped, __ATOMIC_RELAXED);
+	}
+
+	return dropped;
+}
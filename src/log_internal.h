@@ -0,0 +1,27 @@
+/*
+ * Helpers shared by the text and binary loggers.  Not installed with the
+ * public headers.
+ * Copyright (C)2026 Mike Bourgeous.  Released under AGPLv3.
+ */
+#ifndef NLUTILS_LOG_INTERNAL_H_
+#define NLUTILS_LOG_INTERNAL_H_
+
+#include <stddef.h>
+#include <time.h>
+
+/*
+ * Writes len bytes of data to fd as one message with timestamp t, through the
+ * calling thread's ring buffer if asynchronous logging is running, or
+ * directly otherwise.  Returns 0 on success (including if the message was
+ * dropped), or -1 if a direct write failed.
+ */
+int nl_log_write_fd(int fd, const void *data, size_t len, const struct timespec *t);
+
+/*
+ * Stores the timestamp and thread name prefix used by nl_fptmf() for the
+ * CLOCK_REALTIME time t and the given thread name in buf, truncating to size
+ * bytes including a NUL terminator.  Returns the untruncated length.
+ */
+size_t nl_log_format_prefix(char *buf, size_t size, const struct timespec *t, const char *name);
+
+#endif /* NLUTILS_LOG_INTERNAL_H_ */
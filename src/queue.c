@@ -0,0 +1,486 @@
+/*
+ * queue.c - A bounded lock-free multi-producer, multi-consumer queue.
+ * Copyright (C)2026 Mike Bourgeous.  Released under AGPLv3.
+ *
+ * This is Dmitry Vyukov's bounded MPMC queue algorithm.  Each cell in a
+ * power-of-two ring has a sequence number that tells producers and consumers
+ * whether the cell is ready for them, so the only contended operations are a
+ * compare-and-swap on the enqueue or dequeue position.
+ *
+ * Threads that need to wait for room or for data register themselves in a
+ * waiter count and sleep on a condition variable.  After a successful lock-
+ * free operation, a thread only takes the mutex to wake the other side if
+ * that count is nonzero, so the mutex is untouched while data is flowing.
+ *
+ * GCC's __atomic builtins are used instead of C11 <stdatomic.h> because the
+ * library is built as C99.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "nlutils.h"
+#include "queue.h"
+
+// Size used to keep the producer and consumer positions on separate cache
+// lines
+#define NL_QUEUE_CACHE_LINE 64
+
+// Number of times the blocking functions retry before going to sleep
+#define NL_QUEUE_SPIN_COUNT 64
+
+// Minimum number of cells (the algorithm requires at least two)
+#define NL_QUEUE_MIN_SIZE 2
+
+struct nl_queue_cell {
+	size_t seq;
+	void *data;
+};
+
+struct nl_queue {
+	struct nl_queue_cell *cells;
+	size_t mask;
+
+	char pad0[NL_QUEUE_CACHE_LINE];
+	size_t enqueue_pos;
+	char pad1[NL_QUEUE_CACHE_LINE - sizeof(size_t)];
+	size_t dequeue_pos;
+	char pad2[NL_QUEUE_CACHE_LINE - sizeof(size_t)];
+
+	// Used only when a thread needs to sleep
+	pthread_mutex_t lock;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+	unsigned int get_waiters;
+	unsigned int put_waiters;
+};
+
+/*
+ * Creates a new empty queue that can hold at least capacity elements (rounded
+ * up to a power of two).  Returns NULL on error.
+ */
+struct nl_queue *nl_queue_create(size_t capacity)
+{
+	pthread_condattr_t attr;
+	struct nl_queue *q;
+	size_t size;
+	int ret;
+
+	for(size = NL_QUEUE_MIN_SIZE; size < capacity; size *= 2) {
+		if(size > SIZE_MAX / 2 / sizeof(struct nl_queue_cell)) {
+			ERROR_OUT("Queue capacity of %zu elements is too large.\n", capacity);
+			return NULL;
+		}
+	}
+
+	q = calloc(1, sizeof(struct nl_queue));
+	if(q == NULL) {
+		ERRNO_OUT("Error allocating new queue");
+		return NULL;
+	}
+
+	q->cells = calloc(size, sizeof(struct nl_queue_cell));
+	if(q->cells == NULL) {
+		ERRNO_OUT("Error allocating %zu queue cells", size);
+		free(q);
+		return NULL;
+	}
+
+	q->mask = size - 1;
+	for(size_t i = 0; i < size; i++) {
+		q->cells[i].seq = i;
+	}
+
+	ret = nl_create_mutex(&q->lock, PTHREAD_MUTEX_NORMAL);
+	if(ret) {
+		ERROR_OUT("Error creating queue mutex: %d (%s)\n", ret, strerror(ret));
+		goto error_cells;
+	}
+
+	// Timed waits use CLOCK_MONOTONIC deadlines
+	ret = pthread_condattr_init(&attr);
+	if(ret) {
+		ERROR_OUT("Error initializing queue condition attributes: %d (%s)\n", ret, strerror(ret));
+		goto error_mutex;
+	}
+	ret = pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	if(ret) {
+		ERROR_OUT("Error setting queue condition clock: %d (%s)\n", ret, strerror(ret));
+		goto error_attr;
+	}
+
+	ret = pthread_cond_init(&q->not_empty, &attr);
+	if(ret) {
+		ERROR_OUT("Error creating queue condition variable: %d (%s)\n", ret, strerror(ret));
+		goto error_attr;
+	}
+	ret = pthread_cond_init(&q->not_full, &attr);
+	if(ret) {
+		ERROR_OUT("Error creating queue condition variable: %d (%s)\n", ret, strerror(ret));
+		goto error_cond;
+	}
+
+	pthread_condattr_destroy(&attr);
+
+	return q;
+
+error_cond:
+	pthread_cond_destroy(&q->not_empty);
+error_attr:
+	pthread_condattr_destroy(&attr);
+error_mutex:
+	pthread_mutex_destroy(&q->lock);
+error_cells:
+	free(q->cells);
+	free(q);
+	return NULL;
+}
+
+/*
+ * Destroys the given queue.  Elements remaining in the queue are not freed.
+ * No other threads may be using the queue.  A NULL queue is ignored.
+ */
+void nl_queue_destroy(struct nl_queue *q)
+{
+	if(q != NULL) {
+		pthread_cond_destroy(&q->not_full);
+		pthread_cond_destroy(&q->not_empty);
+		pthread_mutex_destroy(&q->lock);
+		free(q->cells);
+		free(q);
+	}
+}
+
+/*
+ * Returns the number of elements the queue can hold.
+ */
+size_t nl_queue_capacity(struct nl_queue *q)
+{
+	if(CHECK_NULL(q)) {
+		return 0;
+	}
+
+	return q->mask + 1;
+}
+
+/*
+ * Returns the approximate number of elements in the queue.  The result may
+ * already be out of date if other threads are using the queue.
+ */
+size_t nl_queue_count(struct nl_queue *q)
+{
+	size_t head, tail;
+
+	if(CHECK_NULL(q)) {
+		return 0;
+	}
+
+	head = __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED);
+	tail = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+
+	// The positions are read separately, so clamp the difference
+	if(tail - head > q->mask + 1) {
+		return (ssize_t)(tail - head) < 0 ? 0 : q->mask + 1;
+	}
+
+	return tail - head;
+}
+
+/*
+ * Lock-free enqueue.  Returns 0 on success, EAGAIN if the queue is full.
+ */
+static int nl_queue_push(struct nl_queue *q, void *data)
+{
+	struct nl_queue_cell *cell;
+	size_t pos, seq;
+	intptr_t diff;
+
+	pos = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+	for(;;) {
+		cell = &q->cells[pos & q->mask];
+		seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+		diff = (intptr_t)seq - (intptr_t)pos;
+
+		if(diff == 0) {
+			if(__atomic_compare_exchange_n(&q->enqueue_pos, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				break;
+			}
+		} else if(diff < 0) {
+			return EAGAIN;
+		} else {
+			pos = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+		}
+	}
+
+	cell->data = data;
+	__atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+/*
+ * Lock-free dequeue.  Returns NULL if the queue is empty.
+ */
+static void *nl_queue_pop(struct nl_queue *q)
+{
+	struct nl_queue_cell *cell;
+	size_t pos, seq;
+	intptr_t diff;
+	void *data;
+
+	pos = __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED);
+	for(;;) {
+		cell = &q->cells[pos & q->mask];
+		seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+		diff = (intptr_t)seq - (intptr_t)(pos + 1);
+
+		if(diff == 0) {
+			if(__atomic_compare_exchange_n(&q->dequeue_pos, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				break;
+			}
+		} else if(diff < 0) {
+			return NULL;
+		} else {
+			pos = __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED);
+		}
+	}
+
+	data = cell->data;
+	__atomic_store_n(&cell->seq, pos + q->mask + 1, __ATOMIC_RELEASE);
+
+	return data;
+}
+
+/*
+ * Wakes one thread sleeping on cond if the given waiter count is nonzero.
+ * Must be called without holding q->lock.
+ */
+static void nl_queue_wake(struct nl_queue *q, unsigned int *waiters, pthread_cond_t *cond)
+{
+	// Pairs with the fence in nl_queue_wait() so that either this thread
+	// sees the waiter, or the waiter sees the completed operation.
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	if(__atomic_load_n(waiters, __ATOMIC_RELAXED)) {
+		pthread_mutex_lock(&q->lock);
+		pthread_cond_signal(cond);
+		pthread_mutex_unlock(&q->lock);
+	}
+}
+
+/*
+ * Registers as a waiter and sleeps on cond until op() succeeds or the
+ * absolute CLOCK_MONOTONIC deadline passes (NULL to wait forever).  Returns 0
+ * if op() succeeded, or an errno-like value (e.g. ETIMEDOUT).
+ */
+static int nl_queue_wait(struct nl_queue *q, unsigned int *waiters, pthread_cond_t *cond,
+		int (*op)(struct nl_queue *q, void **data), void **data, const struct timespec *deadline)
+{
+	int ret;
+
+	ret = pthread_mutex_lock(&q->lock);
+	if(ret) {
+		ERROR_OUT("Error locking queue mutex: %d (%s)\n", ret, strerror(ret));
+		return ret;
+	}
+
+	__atomic_add_fetch(waiters, 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	while(op(q, data)) {
+		if(deadline != NULL) {
+			ret = pthread_cond_timedwait(cond, &q->lock, deadline);
+		} else {
+			ret = pthread_cond_wait(cond, &q->lock);
+		}
+
+		if(ret) {
+			// One last try in case the wakeup raced with the timeout
+			if(!op(q, data)) {
+				ret = 0;
+			} else if(ret != ETIMEDOUT) {
+				ERROR_OUT("Error waiting on queue condition: %d (%s)\n", ret, strerror(ret));
+			}
+			break;
+		}
+	}
+
+	__atomic_sub_fetch(waiters, 1, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&q->lock);
+
+	return ret;
+}
+
+// nl_queue_wait() operation for adding an element
+static int nl_queue_put_op(struct nl_queue *q, void **data)
+{
+	return nl_queue_push(q, *data);
+}
+
+// nl_queue_wait() operation for removing an element
+static int nl_queue_get_op(struct nl_queue *q, void **data)
+{
+	*data = nl_queue_pop(q);
+	return *data == NULL ? EAGAIN : 0;
+}
+
+/*
+ * Shared implementation of nl_queue_put() and nl_queue_put_timed().
+ */
+static int nl_queue_put_until(struct nl_queue *q, void *data, const struct timespec *deadline)
+{
+	int ret;
+
+	for(int i = 0; i < NL_QUEUE_SPIN_COUNT; i++) {
+		if(!nl_queue_push(q, data)) {
+			nl_queue_wake(q, &q->get_waiters, &q->not_empty);
+			return 0;
+		}
+	}
+
+	ret = nl_queue_wait(q, &q->put_waiters, &q->not_full, nl_queue_put_op, &data, deadline);
+	if(!ret) {
+		nl_queue_wake(q, &q->get_waiters, &q->not_empty);
+	}
+
+	return ret;
+}
+
+/*
+ * Shared implementation of nl_queue_get() and nl_queue_get_timed().
+ */
+static void *nl_queue_get_until(struct nl_queue *q, const struct timespec *deadline)
+{
+	void *data;
+
+	for(int i = 0; i < NL_QUEUE_SPIN_COUNT; i++) {
+		data = nl_queue_pop(q);
+		if(data != NULL) {
+			nl_queue_wake(q, &q->put_waiters, &q->not_full);
+			return data;
+		}
+	}
+
+	if(nl_queue_wait(q, &q->get_waiters, &q->not_empty, nl_queue_get_op, &data, deadline)) {
+		return NULL;
+	}
+
+	nl_queue_wake(q, &q->put_waiters, &q->not_full);
+
+	return data;
+}
+
+/*
+ * Adds an element to the end of the queue if there is room, without blocking.
+ * Returns 0 on success, EAGAIN if the queue is full, or EINVAL if q or data is
+ * NULL.
+ */
+int nl_queue_try_put(struct nl_queue *q, void *data)
+{
+	if(CHECK_NULL(q) || CHECK_NULL(data)) {
+		return EINVAL;
+	}
+
+	if(nl_queue_push(q, data)) {
+		return EAGAIN;
+	}
+
+	nl_queue_wake(q, &q->get_waiters, &q->not_empty);
+
+	return 0;
+}
+
+/*
+ * Adds an element to the end of the queue, waiting as long as necessary for
+ * room.  Returns 0 on success, or an errno-like value on error (e.g. EINVAL if
+ * q or data is NULL).
+ */
+int nl_queue_put(struct nl_queue *q, void *data)
+{
+	if(CHECK_NULL(q) || CHECK_NULL(data)) {
+		return EINVAL;
+	}
+
+	return nl_queue_put_until(q, data, NULL);
+}
+
+/*
+ * Adds an element to the end of the queue, waiting up to the given relative
+ * timeout for room.  Returns 0 on success, ETIMEDOUT if the queue remained
+ * full, or another errno-like value on error.
+ */
+int nl_queue_put_timed(struct nl_queue *q, void *data, struct timespec timeout)
+{
+	struct timespec deadline;
+	int ret;
+
+	if(CHECK_NULL(q) || CHECK_NULL(data)) {
+		return EINVAL;
+	}
+
+	ret = nl_clock_fromnow(CLOCK_MONOTONIC, &deadline, timeout);
+	if(ret) {
+		ERROR_OUT("Error calculating queue timeout: %d (%s)\n", ret, strerror(ret));
+		return ret;
+	}
+
+	return nl_queue_put_until(q, data, &deadline);
+}
+
+/*
+ * Removes and returns the oldest element from the queue, without blocking.
+ * Returns NULL if the queue is empty or q is NULL.
+ */
+void *nl_queue_try_get(struct nl_queue *q)
+{
+	void *data;
+
+	if(CHECK_NULL(q)) {
+		return NULL;
+	}
+
+	data = nl_queue_pop(q);
+	if(data != NULL) {
+		nl_queue_wake(q, &q->put_waiters, &q->not_full);
+	}
+
+	return data;
+}
+
+/*
+ * Removes and returns the oldest element from the queue, waiting as long as
+ * necessary for an element to be added.  Returns NULL only on error.
+ */
+void *nl_queue_get(struct nl_queue *q)
+{
+	if(CHECK_NULL(q)) {
+		return NULL;
+	}
+
+	return nl_queue_get_until(q, NULL);
+}
+
+/*
+ * Removes and returns the oldest element from the queue, waiting up to the
+ * given relative timeout for an element to be added.  Returns NULL if the
+ * timeout expired or an error occurred.
+ */
+void *nl_queue_get_timed(struct nl_queue *q, struct timespec timeout)
+{
+	struct timespec deadline;
+	int ret;
+
+	if(CHECK_NULL(q)) {
+		return NULL;
+	}
+
+	ret = nl_clock_fromnow(CLOCK_MONOTONIC, &deadline, timeout);
+	if(ret) {
+		ERROR_OUT("Error calculating queue timeout: %d (%s)\n", ret, strerror(ret));
+		return NULL;
+	}
+
+	return nl_queue_get_until(q, &deadline);
+}
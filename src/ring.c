@@ -0,0 +1,384 @@
+/*
+ * ring.c - A generic FIFO implementation using a growable ring buffer.
+ * Copyright (C)2026 Mike Bourgeous.  Released under AGPLv3.
+ *
+ * This is the reallocated array alternative suggested in fifo.c.  Elements
+ * are stored in a power-of-two sized array that wraps around, so adding or
+ * removing at either end is O(1) and never allocates once the array is large
+ * enough.  The array doubles in size when full, and is never shrunk except by
+ * destroying the ring.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+
+#include "nlutils.h"
+#include "ring.h"
+
+// Minimum number of elements allocated when a ring first grows
+#define NL_RING_MIN_SIZE 8
+
+/*
+ * Returns a pointer to the storage for the Nth element in the ring.  The
+ * index must be less than r->size.
+ */
+static inline void **nl_ring_slot(struct nl_ring *r, size_t index)
+{
+	return &r->data[(r->head + index) & (r->size - 1)];
+}
+
+/*
+ * Creates a new empty ring with room for at least the given number of
+ * elements before it must grow (0 to allocate on first use).  Returns NULL on
+ * error.
+ */
+struct nl_ring *nl_ring_create(size_t capacity)
+{
+	struct nl_ring *r;
+
+	r = calloc(1, sizeof(struct nl_ring));
+	if(r == NULL) {
+		ERRNO_OUT("Error allocating new ring");
+		return NULL;
+	}
+
+	if(capacity > 0 && nl_ring_reserve(r, capacity)) {
+		ERROR_OUT("Error allocating initial space for %zu ring elements.\n", capacity);
+		free(r);
+		return NULL;
+	}
+
+	return r;
+}
+
+/*
+ * Removes all elements from and destroys an existing ring.  A NULL ring is
+ * ignored.
+ */
+void nl_ring_destroy(struct nl_ring *r)
+{
+	if(r != NULL) {
+		free(r->data);
+		free(r);
+	}
+}
+
+/*
+ * Makes sure the ring can hold at least capacity elements without allocating
+ * more memory.  Returns 0 on success, -1 on error.
+ */
+int nl_ring_reserve(struct nl_ring *r, size_t capacity)
+{
+	size_t new_size, first;
+	void **data;
+
+	if(CHECK_NULL(r)) {
+		return -1;
+	}
+
+	if(capacity <= r->size) {
+		return 0;
+	}
+
+	for(new_size = r->size ? r->size : NL_RING_MIN_SIZE; new_size < capacity; new_size *= 2) {
+		if(new_size > SIZE_MAX / 2 / sizeof(void *)) {
+			ERROR_OUT("Ring capacity of %zu elements is too large.\n", capacity);
+			return -1;
+		}
+	}
+
+	data = malloc(new_size * sizeof(void *));
+	if(data == NULL) {
+		ERRNO_OUT("Error growing ring to %zu elements", new_size);
+		return -1;
+	}
+
+	// Unwrap existing elements to the start of the new array
+	if(r->count > 0) {
+		first = MIN_NUM(r->count, r->size - r->head);
+		memcpy(data, r->data + r->head, first * sizeof(void *));
+		memcpy(data + first, r->data, (r->count - first) * sizeof(void *));
+	}
+
+	free(r->data);
+	r->data = data;
+	r->size = new_size;
+	r->head = 0;
+
+	return 0;
+}
+
+/*
+ * Checks for NULL parameters and grows the ring if it is full.  For use by
+ * nl_ring_put() and nl_ring_prepend().
+ */
+static int nl_ring_prepare_add(struct nl_ring *r, void *data)
+{
+	if(CHECK_NULL(r) || CHECK_NULL(data)) {
+		return -1;
+	}
+
+	if(r->count == r->size && nl_ring_reserve(r, r->size + 1)) {
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Adds a new element to the end of the ring.  The return value is the number
+ * of elements in the ring after the new element is added, or negative on
+ * error.  NULL data is considered to be an error.
+ */
+ssize_t nl_ring_put(struct nl_ring *r, void *data)
+{
+	if(nl_ring_prepare_add(r, data)) {
+		return -1;
+	}
+
+	*nl_ring_slot(r, r->count) = data;
+	r->count++;
+
+	return r->count;
+}
+
+/*
+ * Prepends an element to the beginning of the ring.  The return value is the
+ * number of elements in the ring after the new element is added, or negative
+ * on error.  NULL data is considered to be an error.
+ */
+ssize_t nl_ring_prepend(struct nl_ring *r, void *data)
+{
+	if(nl_ring_prepare_add(r, data)) {
+		return -1;
+	}
+
+	r->head = (r->head - 1) & (r->size - 1);
+	r->data[r->head] = data;
+	r->count++;
+
+	return r->count;
+}
+
+/*
+ * Removes the least-recently-added element from the ring.  Returns NULL if the
+ * ring is empty or an error occurs.
+ */
+void *nl_ring_get(struct nl_ring *r)
+{
+	void *data;
+
+	if(CHECK_NULL(r)) {
+		return NULL;
+	}
+	if(r->count == 0) {
+		return NULL;
+	}
+
+	data = r->data[r->head];
+	r->head = (r->head + 1) & (r->size - 1);
+	r->count--;
+
+	return data;
+}
+
+/*
+ * Retrieves, but does not remove the least-recently-added element from the
+ * ring.  Returns NULL if the ring is empty or an error occurs.
+ */
+void *nl_ring_peek(struct nl_ring *r)
+{
+	if(CHECK_NULL(r)) {
+		return NULL;
+	}
+	if(r->count == 0) {
+		return NULL;
+	}
+
+	return r->data[r->head];
+}
+
+/*
+ * Retrieves, but does not remove the most-recently-added (last) element from
+ * the ring.  Returns NULL if the ring is empty or an error occurs.
+ */
+void *nl_ring_peek_last(struct nl_ring *r)
+{
+	if(CHECK_NULL(r)) {
+		return NULL;
+	}
+	if(r->count == 0) {
+		return NULL;
+	}
+
+	return *nl_ring_slot(r, r->count - 1);
+}
+
+/*
+ * Retrieves, but does not remove the Nth element in the ring.  If the index is
+ * negative, then indexing starts from the end, with -1 referring to the
+ * most-recently-added (last) element.  This is O(1).
+ *
+ * Returns NULL if the ring is empty, the index is out of range, or an error
+ * occurs.
+ */
+void *nl_ring_peek_index(struct nl_ring *r, ssize_t index)
+{
+	if(CHECK_NULL(r)) {
+		return NULL;
+	}
+	if(r->count == 0) {
+		return NULL;
+	}
+
+	ssize_t normalized_index = index;
+	if(normalized_index < 0) {
+		normalized_index += r->count;
+	}
+
+	if(normalized_index < 0 || (size_t)normalized_index >= r->count) {
+		ERROR_OUT("Index %zd is out of range 0..%zu (or -%zu..-1)\n",
+				index, r->count - 1, r->count);
+		return NULL;
+	}
+
+	return *nl_ring_slot(r, normalized_index);
+}
+
+/*
+ * Removes the least-recently-added instance of the given element from the
+ * ring.  Returns 0 if the element existed and was deleted, -1 if the element
+ * did not exist or an error occurred.  NULL data is an error.
+ */
+int nl_ring_remove(struct nl_ring *r, void *data)
+{
+	size_t i, j;
+
+	if(CHECK_NULL(r) || CHECK_NULL(data)) {
+		return -1;
+	}
+
+	if(r->count == 0) {
+		ERROR_OUT("Cannot remove an element from an empty ring; this is probably a bug.\n");
+		return -1;
+	}
+
+	for(i = 0; i < r->count; i++) {
+		if(*nl_ring_slot(r, i) == data) {
+			break;
+		}
+	}
+	if(i == r->count) {
+		return -1;
+	}
+
+	// Close the gap by moving whichever side of the ring is shorter
+	if(i < r->count / 2) {
+		for(j = i; j > 0; j--) {
+			*nl_ring_slot(r, j) = *nl_ring_slot(r, j - 1);
+		}
+		r->head = (r->head + 1) & (r->size - 1);
+	} else {
+		for(j = i; j < r->count - 1; j++) {
+			*nl_ring_slot(r, j) = *nl_ring_slot(r, j + 1);
+		}
+	}
+
+	r->count--;
+
+	return 0;
+}
+
+/*
+ * Iterates through ring elements without altering the ring.  For the first
+ * call, *iter should be 0.  For subsequent calls, *iter should be unmodified.
+ * The ring must not be modified while iterating.
+ *
+ * Returns NULL at the end of the ring, or on error.
+ */
+void *nl_ring_next(struct nl_ring *r, size_t *iter)
+{
+	if(CHECK_NULL(r) || CHECK_NULL(iter)) {
+		return NULL;
+	}
+
+	if(*iter >= r->count) {
+		return NULL;
+	}
+
+	return *nl_ring_slot(r, (*iter)++);
+}
+
+/*
+ * Removes all elements from the ring.  Note that this does not free the
+ * elements stored in the ring, and does not release the ring's own memory.
+ */
+void nl_ring_clear(struct nl_ring *r)
+{
+	nl_ring_clear_cb(r, NULL, NULL);
+}
+
+/*
+ * Removes all elements from the ring, calling the given callback (if not NULL)
+ * for each element before its removal.  This may be used e.g. to free memory.
+ */
+void nl_ring_clear_cb(struct nl_ring *r, void (*cb)(void *el, void *user_data), void *user_data)
+{
+	if(CHECK_NULL(r)) {
+		return;
+	}
+
+	nl_ring_remove_start(r, r->count, cb, user_data);
+}
+
+/*
+ * Removes the first count elements from the ring, calling the given callback
+ * (if not NULL) for each element before its removal.  Returns the number of
+ * elements remaining after removal, or 0 if the ring was NULL.
+ */
+size_t nl_ring_remove_start(struct nl_ring *r, size_t count, void (*cb)(void *el, void *user_data), void *user_data)
+{
+	if(CHECK_NULL(r)) {
+		return 0;
+	}
+
+	count = MIN_NUM(count, r->count);
+
+	if(cb != NULL) {
+		for(size_t i = 0; i < count; i++) {
+			cb(*nl_ring_slot(r, i), user_data);
+		}
+	}
+
+	if(count > 0) {
+		r->head = (r->head + count) & (r->size - 1);
+		r->count -= count;
+	}
+
+	return r->count;
+}
+
+/*
+ * Removes the last count elements from the ring, calling the given callback
+ * (if not NULL) for each element before its removal.  Returns the number of
+ * elements remaining after removal, or 0 if the ring was NULL.
+ */
+size_t nl_ring_remove_end(struct nl_ring *r, size_t count, void (*cb)(void *el, void *user_data), void *user_data)
+{
+	if(CHECK_NULL(r)) {
+		return 0;
+	}
+
+	count = MIN_NUM(count, r->count);
+
+	if(cb != NULL) {
+		for(size_t i = r->count - count; i < r->count; i++) {
+			cb(*nl_ring_slot(r, i), user_data);
+		}
+	}
+
+	r->count -= count;
+
+	return r->count;
+}
@@ -5,20 +5,195 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <stdint.h>
 #include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
 
 #include "nlutils.h"
 
+// Buffer size for nl_copy_fd()'s read()/write() fallback.
+#define COPY_BUF_SIZE 262144
+
+// Maximum bytes to request from one copy_file_range(), splice(), or
+// sendfile() call (sendfile() transfers at most 0x7ffff000 at a time).
+#define COPY_CHUNK_SIZE 0x40000000
+
+// Kernel copy methods for nl_copy_fd(), in the order they are tried.
+enum copy_method {
+	COPY_FILE_RANGE,
+	COPY_SPLICE,
+	COPY_SENDFILE,
+	COPY_READ_WRITE,
+};
+
+// Returns nonzero if a kernel copy method's error means the method does not
+// support the given file descriptors (so another method should be tried).
+static int copy_unsupported(int err)
+{
+	return err == EINVAL || err == ENOSYS || err == EXDEV || err == EOPNOTSUPP || err == ENOTSUP ||
+		err == EBADF || err == ESPIPE;
+}
+
+// Copies from srcfd to destfd with read() and write() until end-of-file.
+// Returns the number of bytes copied, or -1 on error.
+static ssize_t copy_read_write(int srcfd, int destfd)
+{
+	ssize_t size = 0;
+	ssize_t bytes, ret;
+	char *buf;
+
+	buf = malloc(COPY_BUF_SIZE);
+	if(buf == NULL) {
+		ERRNO_OUT("Error allocating %d byte copy buffer", COPY_BUF_SIZE);
+		return -1;
+	}
+
+	for(;;) {
+		bytes = read(srcfd, buf, COPY_BUF_SIZE);
+		if(bytes == 0) {
+			break;
+		}
+		if(bytes < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			ERRNO_OUT("Error reading from source fd %d", srcfd);
+			size = -1;
+			break;
+		}
+
+		for(ssize_t off = 0; off < bytes; off += ret) {
+			ret = write(destfd, buf + off, bytes - off);
+			if(ret < 0) {
+				if(errno == EINTR) {
+					ret = 0;
+					continue;
+				}
+				ERRNO_OUT("Error writing to destination fd %d", destfd);
+				free(buf);
+				return -1;
+			}
+		}
+
+		size += bytes;
+	}
+
+	free(buf);
+
+	return size;
+}
+
+/*
+ * Copies from srcfd's current offset to end-of-file into destfd, advancing
+ * both file offsets.  Uses copy_file_range() between regular files, splice()
+ * if either descriptor is a pipe, sendfile() from a regular file to anything
+ * else (e.g. a socket), and a large-buffer read()/write() loop if the kernel
+ * copy methods are unavailable or unsupported for the given descriptors.
+ * Returns the number of bytes copied on success, -1 on error (some data may
+ * have been copied).
+ */
+ssize_t nl_copy_fd(int srcfd, int destfd)
+{
+	enum copy_method method = COPY_READ_WRITE;
+	struct stat src_st, dest_st;
+	ssize_t size = 0;
+	ssize_t ret;
+
+	if(fstat(srcfd, &src_st) || fstat(destfd, &dest_st)) {
+		ERRNO_OUT("Error getting file types to copy from fd %d to fd %d", srcfd, destfd);
+		return -1;
+	}
+
+	if(S_ISFIFO(src_st.st_mode) || S_ISFIFO(dest_st.st_mode)) {
+		method = COPY_SPLICE;
+	} else if(S_ISREG(src_st.st_mode)) {
+		method = S_ISREG(dest_st.st_mode) ? COPY_FILE_RANGE : COPY_SENDFILE;
+	}
+
+	while(method != COPY_READ_WRITE) {
+		switch(method) {
+			case COPY_FILE_RANGE:
+				ret = copy_file_range(srcfd, NULL, destfd, NULL, COPY_CHUNK_SIZE, 0);
+				break;
+
+			case COPY_SPLICE:
+				ret = splice(srcfd, NULL, destfd, NULL, COPY_CHUNK_SIZE, SPLICE_F_MOVE | SPLICE_F_MORE);
+				break;
+
+			case COPY_SENDFILE:
+			default:
+				ret = sendfile(destfd, srcfd, NULL, COPY_CHUNK_SIZE);
+				break;
+		}
+
+		if(ret == 0) {
+			return size;
+		}
+
+		if(ret > 0) {
+			size += ret;
+		} else if(errno == EINTR) {
+			continue;
+		} else if(copy_unsupported(errno)) {
+			// Try the next method, picking up from the current offsets
+			DEBUG_OUT("Copy method %d unsupported from fd %d to fd %d: %s\n",
+					method, srcfd, destfd, strerror(errno));
+			method = (method != COPY_SENDFILE && S_ISREG(src_st.st_mode)) ? COPY_SENDFILE : COPY_READ_WRITE;
+		} else {
+			ERRNO_OUT("Error copying from fd %d to fd %d", srcfd, destfd);
+			return -1;
+		}
+	}
+
+	ret = copy_read_write(srcfd, destfd);
+	if(ret == -1) {
+		return -1;
+	}
+
+	return size + ret;
+}
+
 /*
  * Reads from src until feof(src) returns nonzero, writing all data read to
  * destfd.  Use fseek()/ftell() to copy file contents multiple times.  Returns
  * the number of bytes written on success, -1 on error.
+ *
+ * If src is seekable, its data is copied with nl_copy_fd() without passing
+ * through stdio's buffer (src is repositioned past the copied data).
  */
 ssize_t nl_stream_to_fd(FILE *src, int destfd)
 {
 	char buf[32768];
 	ssize_t size = 0;
 	size_t bytes;
+	off_t pos;
+	int c;
+
+	// Skip past stdio's read-ahead buffer by seeking the descriptor to the
+	// stream's logical position
+	pos = ftello(src);
+	if(pos != -1 && fflush(src) == 0 && lseek(fileno(src), pos, SEEK_SET) == pos) {
+		size = nl_copy_fd(fileno(src), destfd);
+		if(size == -1) {
+			ERROR_OUT("nl_stream_to_fd(): Error copying from source file to fd %d\n", destfd);
+			return -1;
+		}
+
+		// Resynchronize the stream, then set its EOF flag (or copy
+		// anything appended during the copy with stdio)
+		if(fseeko(src, pos + size, SEEK_SET)) {
+			ERRNO_OUT("nl_stream_to_fd(): Error seeking source file after copy");
+			return -1;
+		}
+
+		c = fgetc(src);
+		if(c == EOF) {
+			return size;
+		}
+		ungetc(c, src);
+	}
 
 	while(!feof(src)) {
 		bytes = fread(buf, 1, sizeof(buf), src);
@@ -75,19 +250,28 @@ int nl_write_stream(int fd, const struct nl_raw_data * const data)
 	return 0;
 }
 
+// Initial nl_read_stream() buffer size for streams of unknown length.
+#define READ_MIN_SIZE 16384
+
 /*
  * Reads from fd until end-of-file occurs, or until the end of available data
  * if O_NONBLOCK is set.  For added safety, a terminating NUL byte is appended
  * to the data but is not counted in the returned size.  Call nl_destroy_data()
  * on the returned pointer.  The stream is not closed after reading.  Returns
  * the data (includes size and contents) on success, NULL on error.
+ *
+ * Data is read directly into a buffer that doubles in size as it fills.  If
+ * fd is a regular file, the buffer is sized from fstat() to hold the rest of
+ * the file in one read().
  */
 struct nl_raw_data *nl_read_stream(int fd)
 {
 	struct nl_raw_data *data;
-	char readbuf[16384];
+	size_t alloc = READ_MIN_SIZE;
+	struct stat st;
 	char *tmpbuf;
 	ssize_t ret;
+	off_t pos;
 
 	if(fd < 0) {
 		ERROR_OUT("Invalid file descriptor %d\n", fd);
@@ -100,26 +284,48 @@ struct nl_raw_data *nl_read_stream(int fd)
 		return NULL;
 	}
 
-	do {
-		errno = 0;
-		ret = read(fd, readbuf, sizeof(readbuf));
-		if(ret > 0) {
-			tmpbuf = realloc(data->data, data->size + ret + 1);
+	// Leave room for the NUL terminator and a one-byte read() that detects
+	// end-of-file (or growth of the file)
+	if(!fstat(fd, &st) && S_ISREG(st.st_mode) && (pos = lseek(fd, 0, SEEK_CUR)) >= 0 && st.st_size > pos) {
+		alloc = (size_t)(st.st_size - pos) + 2;
+	}
+
+	data->data = malloc(alloc);
+	if(data->data == NULL) {
+		ERRNO_OUT("Error allocating %zu byte read buffer", alloc);
+		goto error;
+	}
+
+	for(;;) {
+		if(alloc - data->size - 1 == 0) {
+			alloc *= 2;
+			tmpbuf = realloc(data->data, alloc);
 			if(tmpbuf == NULL) {
-				ERRNO_OUT("Error growing read buffer");
+				ERRNO_OUT("Error growing read buffer to %zu bytes", alloc);
 				goto error;
 			}
 			data->data = tmpbuf;
+		}
 
-			memmove(data->data + data->size, readbuf, ret);
+		ret = read(fd, data->data + data->size, alloc - data->size - 1);
+		if(ret > 0) {
 			data->size += ret;
-			data->data[data->size] = 0;
+		} else if(ret == 0 || errno == EAGAIN || errno == EWOULDBLOCK) {
+			break;
+		} else if(errno != EINTR) {
+			ERRNO_OUT("Error reading fd %d into a buffer", fd);
+			goto error;
 		}
-	} while(ret > 0);
+	}
 
-	if(errno && errno != EAGAIN && errno != EWOULDBLOCK) {
-		ERRNO_OUT("Error reading fd %d into a buffer", fd);
-		goto error;
+	data->data[data->size] = 0;
+
+	// Return unused space from geometric growth
+	if(alloc - data->size - 1 > READ_MIN_SIZE) {
+		tmpbuf = realloc(data->data, data->size + 1);
+		if(tmpbuf != NULL) {
+			data->data = tmpbuf;
+		}
 	}
 
 	return data;
@@ -157,6 +363,113 @@ struct nl_raw_data *nl_read_file(const char *filename)
 	return data;
 }
 
+// Data returned by nl_map_file().
+struct mapped_data {
+	struct nl_raw_data data; // Must be first (see nl_unmap_data())
+	size_t map_size; // Length of the mapping, or 0 if data was read into memory
+};
+
+/*
+ * Maps the entire contents of the given filename read-only into memory,
+ * returning a struct nl_raw_data that must be released with nl_unmap_data()
+ * (not nl_destroy_data()).  The data is followed by a NUL byte that is not
+ * counted in its size, as with nl_read_file().  Writing to the data will
+ * crash the program.  Files that cannot be mapped (e.g. empty files, pipes,
+ * and devices) are read into memory with nl_read_stream() instead.  Changes
+ * made to the file by other processes while it is mapped may be visible in
+ * the data, and truncating a mapped file causes SIGBUS when the missing part
+ * is accessed, so prefer nl_read_file() for files that may change.  Returns
+ * NULL on error.
+ */
+struct nl_raw_data *nl_map_file(const char *filename)
+{
+	struct mapped_data *mapped = NULL;
+	struct nl_raw_data *data;
+	struct stat st;
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	void *addr;
+	int fd;
+
+	fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if(fd < 0) {
+		ERRNO_OUT("Error opening %s for mapping", filename);
+		return NULL;
+	}
+
+	if(fstat(fd, &st)) {
+		ERRNO_OUT("Error getting the size of %s", filename);
+		goto error;
+	}
+
+	mapped = calloc(1, sizeof(struct mapped_data));
+	if(mapped == NULL) {
+		ERRNO_OUT("Error allocating mapped data structure");
+		goto error;
+	}
+
+	if(S_ISREG(st.st_mode) && st.st_size > 0 && (uintmax_t)st.st_size < SIZE_MAX - page_size) {
+		mapped->data.size = st.st_size;
+
+		// Reserve an extra zero-filled page after the file so the data is
+		// always NUL-terminated, even if the file ends on a page boundary
+		mapped->map_size = (mapped->data.size + page_size) & ~(page_size - 1);
+		addr = mmap(NULL, mapped->map_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(addr == MAP_FAILED) {
+			ERRNO_OUT("Error reserving %zu bytes of address space for %s", mapped->map_size, filename);
+			goto error;
+		}
+
+		if(mmap(addr, mapped->data.size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+			ERRNO_OUT("Error mapping %s", filename);
+			munmap(addr, mapped->map_size);
+			goto error;
+		}
+
+		mapped->data.data = addr;
+	} else {
+		data = nl_read_stream(fd);
+		if(data == NULL) {
+			ERROR_OUT("Error reading contents of %s\n", filename);
+			goto error;
+		}
+
+		mapped->data = *data;
+		free(data);
+	}
+
+	close(fd);
+
+	return &mapped->data;
+
+error:
+	free(mapped);
+	close(fd);
+
+	return NULL;
+}
+
+/*
+ * Releases data returned by nl_map_file().  Does nothing if data is NULL.
+ */
+void nl_unmap_data(struct nl_raw_data *data)
+{
+	struct mapped_data *mapped = (struct mapped_data *)data;
+
+	if(mapped == NULL) {
+		return;
+	}
+
+	if(mapped->map_size) {
+		if(munmap(mapped->data.data, mapped->map_size)) {
+			ERRNO_OUT("Error unmapping %zu bytes of file data", mapped->map_size);
+		}
+	} else {
+		free(mapped->data.data);
+	}
+
+	free(mapped);
+}
+
 /*
  * Sets the FD_CLOEXEC flag on the given file descriptor.  Returns 0 on
  * success, -1 on error
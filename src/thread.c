@@ -12,6 +12,9 @@
 
 // TODO: Use thread-local storage and/or thread info structure to set longer names without affecting process names
 
+// Cached name for nl_threadname(), valid if threadname_cache[0] is nonzero
+static __thread char threadname_cache[16];
+
 /*
  * Sets the name of the current thread or process, truncating to at most 15
  * bytes plus NUL.  Returns 0 on success, or a positive errno-style error code
@@ -36,6 +39,10 @@ int nl_set_threadname(char *name)
 	}
 #endif /* glibc version test */
 
+	if(!ret) {
+		memcpy(threadname_cache, buf, sizeof(threadname_cache));
+	}
+
 	return ret;
 }
 
@@ -65,6 +72,28 @@ int nl_get_threadname(char *name)
 	return ret;
 }
 
+/*
+ * Returns the name of the current thread from a thread-local cache, reading it
+ * with nl_get_threadname() on the first call in each thread.  The cache is
+ * updated by nl_set_threadname(), but not by other ways of renaming a thread
+ * (e.g. calling prctl() directly).  The returned string belongs to the calling
+ * thread and remains valid until the thread exits.
+ */
+const char *nl_threadname(void)
+{
+	if(!threadname_cache[0]) {
+		char name[16];
+
+		if(nl_get_threadname(name) || !name[0]) {
+			return "";
+		}
+
+		memcpy(threadname_cache, name, sizeof(threadname_cache));
+	}
+
+	return threadname_cache;
+}
+
 /*
  * Internal thread execution function.  Sets the thread's name and performs any
  * other housekeeping, then calls the user's thread function.
@@ -109,17 +138,47 @@ struct nl_thread_ctx *nl_create_thread_context()
 }
 
 /*
- * Joins all threads on the given context, then frees the context's memory.
+ * Destroys any thread pools on the given context (finishing their queued
+ * tasks), joins all threads on the context, then frees the context's memory.
+ * If a pool cannot be destroyed (e.g. if called from one of its workers), an
+ * error is printed and the context is left intact.
  */
 void nl_destroy_thread_context(struct nl_thread_ctx *ctx)
 {
+	struct nl_threadpool *pool;
 	char name[16];
+	int failed;
 	int ret;
 
 	if(CHECK_NULL(ctx)) {
 		return;
 	}
 
+	// Pool tasks may create threads, so the lock can't be held while a
+	// pool finishes its tasks
+	while(1) {
+		pthread_mutex_lock(&ctx->lock);
+		pool = ctx->pools;
+		pthread_mutex_unlock(&ctx->lock);
+
+		if(pool == NULL) {
+			break;
+		}
+
+		nl_threadpool_destroy(pool);
+
+		// A pool that could not be destroyed (e.g. when called from
+		// one of its workers) is still on the list
+		pthread_mutex_lock(&ctx->lock);
+		failed = ctx->pools == pool;
+		pthread_mutex_unlock(&ctx->lock);
+
+		if(failed) {
+			ERROR_OUT("Error destroying a thread pool; not destroying thread context.\n");
+			return;
+		}
+	}
+
 	ret = pthread_mutex_lock(&ctx->lock);
 	if(ret) {
 		ERROR_OUT("Warning: error locking thread context mutex: %d (%s)\n", ret, strerror(ret));
@@ -0,0 +1,839 @@
+/*
+ * threadpool.c - A work-stealing thread pool built on nl_thread_ctx.
+ * Copyright (C)2026 Mike Bourgeous.  Released under AGPLv3.
+ *
+ * Each worker owns a Chase-Lev work-stealing deque (using the memory orders
+ * from Le, Pop, Cohen, and Zappa Nardelli's "Correct and Efficient
+ * Work-Stealing for Weak Memory Models").  Only the owner pushes and takes at
+ * the bottom, so those operations need no compare-and-swap except when
+ * racing a thief for the last task.  Thieves take from the top.  Deques grow
+ * by doubling; old arrays are kept until the pool is destroyed because a
+ * thief may still be reading them.
+ *
+ * Threads other than the pool's workers submit tasks to a lock-free
+ * injection stack.  A worker that finds the stack non-empty takes the whole
+ * stack and moves it to its own deque, where other workers can steal it.
+ *
+ * Idle workers spin briefly, then sleep on a condition variable.  As in
+ * queue.c, a waiter count lets submitters skip the mutex entirely while all
+ * workers are busy.
+ *
+ * GCC's __atomic builtins are used instead of C11 <stdatomic.h> because the
+ * library is built as C99.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "nlutils.h"
+#include "threadpool.h"
+
+// Size used to keep each deque's top and bottom on separate cache lines
+#define NL_THREADPOOL_CACHE_LINE 64
+
+// Initial number of tasks each worker's deque can hold (a power of two)
+#define NL_THREADPOOL_DEQUE_SIZE 256
+
+// Number of times an idle worker looks for work before going to sleep
+#define NL_THREADPOOL_SPIN_COUNT 16
+
+struct nl_threadpool_task {
+	nl_threadpool_func func;
+	void *data;
+	void *result;
+
+	struct nl_threadpool *pool;
+	struct nl_threadpool_task *next; // Injection stack link
+
+	int detached; // Freed by the worker instead of nl_threadpool_task_wait()
+	unsigned int done; // Set when result is valid
+};
+
+// A power-of-two ring of deque slots
+struct deque_array {
+	size_t mask;
+	struct deque_array *retired; // Smaller array this one replaced
+	struct nl_threadpool_task *tasks[];
+};
+
+struct pool_worker {
+	struct nl_threadpool *pool;
+	struct nl_thread *thread;
+	uint32_t rng; // Steal victim selection state
+
+	char pad0[NL_THREADPOOL_CACHE_LINE];
+	size_t top; // Thieves take from here
+	char pad1[NL_THREADPOOL_CACHE_LINE - sizeof(size_t)];
+	size_t bottom; // The owner pushes and takes here
+	struct deque_array *array;
+	char pad2[NL_THREADPOOL_CACHE_LINE - sizeof(size_t) - sizeof(struct deque_array *)];
+};
+
+struct nl_threadpool {
+	struct nl_thread_ctx *ctx;
+	struct nl_threadpool *next; // Next pool in ctx->pools
+
+	struct pool_worker *workers;
+	unsigned int worker_count;
+	cpu_set_t default_cpus; // Affinity of the thread that created the pool
+
+	char pad0[NL_THREADPOOL_CACHE_LINE];
+	struct nl_threadpool_task *inject; // Tasks from other threads, newest first
+	char pad1[NL_THREADPOOL_CACHE_LINE - sizeof(struct nl_threadpool_task *)];
+	size_t pending; // Tasks submitted but not yet finished
+	char pad2[NL_THREADPOOL_CACHE_LINE - sizeof(size_t)];
+
+	// Used only when a thread needs to sleep
+	pthread_mutex_t lock;
+	pthread_cond_t work_cond; // Idle workers wait here
+	pthread_cond_t done_cond; // Task and pool waiters wait here
+	unsigned int sleepers;
+	unsigned int done_waiters;
+	unsigned int stopping;
+};
+
+// The pool worker running on this thread, if any
+static __thread struct pool_worker *current_worker;
+
+// Doubles the size of the worker's deque array, copying tasks from top to
+// bottom.  Called only by the owning worker.  Returns NULL on error.
+static struct deque_array *deque_grow(struct pool_worker *w, struct deque_array *old, size_t top, size_t bottom)
+{
+	size_t size = (old->mask + 1) * 2;
+	struct deque_array *array;
+
+	array = malloc(sizeof(struct deque_array) + size * sizeof(struct nl_threadpool_task *));
+	if(array == NULL) {
+		ERRNO_OUT("Error growing thread pool deque to %zu tasks", size);
+		return NULL;
+	}
+
+	array->mask = size - 1;
+	array->retired = old;
+	for(size_t i = top; i != bottom; i++) {
+		array->tasks[i & array->mask] = old->tasks[i & old->mask];
+	}
+
+	__atomic_store_n(&w->array, array, __ATOMIC_RELEASE);
+
+	return array;
+}
+
+// Pushes a task onto the bottom of the worker's deque.  Called only by the
+// owning worker.  Returns 0 on success, ENOMEM if the deque could not grow.
+static int deque_push(struct pool_worker *w, struct nl_threadpool_task *task)
+{
+	size_t bottom = __atomic_load_n(&w->bottom, __ATOMIC_RELAXED);
+	size_t top = __atomic_load_n(&w->top, __ATOMIC_ACQUIRE);
+	struct deque_array *array = __atomic_load_n(&w->array, __ATOMIC_RELAXED);
+
+	if(bottom - top > array->mask) {
+		array = deque_grow(w, array, top, bottom);
+		if(array == NULL) {
+			return ENOMEM;
+		}
+	}
+
+	__atomic_store_n(&array->tasks[bottom & array->mask], task, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&w->bottom, bottom + 1, __ATOMIC_RELAXED);
+
+	return 0;
+}
+
+// Takes the most recently pushed task from the bottom of the worker's deque.
+// Called only by the owning worker.  Returns NULL if the deque is empty.
+static struct nl_threadpool_task *deque_take(struct pool_worker *w)
+{
+	size_t bottom = __atomic_load_n(&w->bottom, __ATOMIC_RELAXED) - 1;
+	struct deque_array *array = __atomic_load_n(&w->array, __ATOMIC_RELAXED);
+	struct nl_threadpool_task *task = NULL;
+	size_t top;
+
+	__atomic_store_n(&w->bottom, bottom, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	top = __atomic_load_n(&w->top, __ATOMIC_RELAXED);
+
+	if((ssize_t)(bottom - top) >= 0) {
+		task = __atomic_load_n(&array->tasks[bottom & array->mask], __ATOMIC_RELAXED);
+		if(bottom == top) {
+			// Last task; a thief may be taking it too
+			if(!__atomic_compare_exchange_n(&w->top, &top, top + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+				task = NULL;
+			}
+			__atomic_store_n(&w->bottom, bottom + 1, __ATOMIC_RELAXED);
+		}
+	} else {
+		__atomic_store_n(&w->bottom, bottom + 1, __ATOMIC_RELAXED);
+	}
+
+	return task;
+}
+
+// Steals the oldest task from the top of another worker's deque.  Returns
+// NULL if the deque is empty or another thread took the task first.
+static struct nl_threadpool_task *deque_steal(struct pool_worker *w)
+{
+	size_t top = __atomic_load_n(&w->top, __ATOMIC_ACQUIRE);
+	struct nl_threadpool_task *task;
+	struct deque_array *array;
+	size_t bottom;
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	bottom = __atomic_load_n(&w->bottom, __ATOMIC_ACQUIRE);
+
+	if((ssize_t)(bottom - top) <= 0) {
+		return NULL;
+	}
+
+	array = __atomic_load_n(&w->array, __ATOMIC_ACQUIRE);
+	task = __atomic_load_n(&array->tasks[top & array->mask], __ATOMIC_RELAXED);
+	if(!__atomic_compare_exchange_n(&w->top, &top, top + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+		return NULL;
+	}
+
+	return task;
+}
+
+// Pushes a task onto the pool's injection stack.
+static void inject_push(struct nl_threadpool *pool, struct nl_threadpool_task *task)
+{
+	struct nl_threadpool_task *head = __atomic_load_n(&pool->inject, __ATOMIC_RELAXED);
+
+	do {
+		task->next = head;
+	} while(!__atomic_compare_exchange_n(&pool->inject, &head, task, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/*
+ * Wakes one (or all, if broadcast is nonzero) threads sleeping on cond if the
+ * given waiter count is nonzero.  Must be called without holding pool->lock.
+ */
+static void pool_wake(struct nl_threadpool *pool, unsigned int *waiters, pthread_cond_t *cond, int broadcast)
+{
+	// Pairs with the fence in worker_sleep() and the wait functions so
+	// that either this thread sees the waiter, or the waiter sees the work
+	// or completion.
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	if(__atomic_load_n(waiters, __ATOMIC_RELAXED)) {
+		pthread_mutex_lock(&pool->lock);
+		if(broadcast) {
+			pthread_cond_broadcast(cond);
+		} else {
+			pthread_cond_signal(cond);
+		}
+		pthread_mutex_unlock(&pool->lock);
+	}
+}
+
+// Moves every task on the injection stack to the worker's own deque (so other
+// workers can steal them) and returns the oldest.  Returns NULL if the stack
+// is empty.
+static struct nl_threadpool_task *take_injected(struct pool_worker *w)
+{
+	struct nl_threadpool *pool = w->pool;
+	struct nl_threadpool_task *list, *next;
+	int pushed = 0;
+
+	if(__atomic_load_n(&pool->inject, __ATOMIC_RELAXED) == NULL) {
+		return NULL;
+	}
+
+	list = __atomic_exchange_n(&pool->inject, NULL, __ATOMIC_ACQUIRE);
+	if(list == NULL) {
+		return NULL;
+	}
+
+	// Pushing newest first leaves older tasks nearer the bottom
+	for(; list->next != NULL; list = next) {
+		next = list->next;
+		if(deque_push(w, list)) {
+			inject_push(pool, list);
+		}
+		pushed = 1;
+	}
+
+	if(pushed) {
+		pool_wake(pool, &pool->sleepers, &pool->work_cond, 0);
+	}
+
+	return list;
+}
+
+// Tries to steal a task from each other worker, starting at a random one.
+static struct nl_threadpool_task *steal_task(struct pool_worker *w)
+{
+	struct nl_threadpool *pool = w->pool;
+	struct nl_threadpool_task *task;
+	unsigned int start;
+
+	// xorshift32
+	w->rng ^= w->rng << 13;
+	w->rng ^= w->rng >> 17;
+	w->rng ^= w->rng << 5;
+	start = w->rng % pool->worker_count;
+
+	for(unsigned int i = 0; i < pool->worker_count; i++) {
+		struct pool_worker *victim = &pool->workers[(start + i) % pool->worker_count];
+
+		if(victim != w) {
+			task = deque_steal(victim);
+			if(task != NULL) {
+				return task;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+// Returns the next task for the worker from its own deque, the injection
+// stack, or another worker, in that order.  Returns NULL if none was found.
+static struct nl_threadpool_task *find_task(struct pool_worker *w)
+{
+	struct nl_threadpool_task *task;
+
+	task = deque_take(w);
+	if(task == NULL) {
+		task = take_injected(w);
+	}
+	if(task == NULL) {
+		task = steal_task(w);
+	}
+
+	return task;
+}
+
+// Returns nonzero if any task is waiting to be started.
+static int pool_has_work(struct nl_threadpool *pool)
+{
+	if(__atomic_load_n(&pool->inject, __ATOMIC_RELAXED) != NULL) {
+		return 1;
+	}
+
+	for(unsigned int i = 0; i < pool->worker_count; i++) {
+		struct pool_worker *w = &pool->workers[i];
+		size_t top = __atomic_load_n(&w->top, __ATOMIC_RELAXED);
+		size_t bottom = __atomic_load_n(&w->bottom, __ATOMIC_RELAXED);
+
+		if((ssize_t)(bottom - top) > 0) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+// Runs a task, publishes its result or frees it, and wakes any waiters.
+static void run_task(struct nl_threadpool *pool, struct nl_threadpool_task *task)
+{
+	void *result = task->func(task->data);
+	int detached = task->detached;
+
+	// The task may be freed by its waiter as soon as done is set
+	if(detached) {
+		free(task);
+	} else {
+		task->result = result;
+		__atomic_store_n(&task->done, 1, __ATOMIC_RELEASE);
+	}
+
+	if(__atomic_sub_fetch(&pool->pending, 1, __ATOMIC_ACQ_REL) == 0 || !detached) {
+		pool_wake(pool, &pool->done_waiters, &pool->done_cond, 1);
+	}
+}
+
+// Registers as a sleeping worker and waits for new work or shutdown.
+static void worker_sleep(struct nl_threadpool *pool)
+{
+	pthread_mutex_lock(&pool->lock);
+
+	__atomic_add_fetch(&pool->sleepers, 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	if(!pool_has_work(pool) && !__atomic_load_n(&pool->stopping, __ATOMIC_RELAXED)) {
+		pthread_cond_wait(&pool->work_cond, &pool->lock);
+	}
+
+	__atomic_sub_fetch(&pool->sleepers, 1, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+// Worker thread main loop.
+static void *worker_main(void *data)
+{
+	struct pool_worker *w = data;
+	struct nl_threadpool *pool = w->pool;
+	struct nl_threadpool_task *task;
+	unsigned int idle = 0;
+
+	current_worker = w;
+
+	while(1) {
+		task = find_task(w);
+		if(task != NULL) {
+			run_task(pool, task);
+			idle = 0;
+			continue;
+		}
+
+		if(__atomic_load_n(&pool->stopping, __ATOMIC_ACQUIRE)) {
+			break;
+		}
+
+		if(++idle < NL_THREADPOOL_SPIN_COUNT) {
+			sched_yield();
+		} else {
+			worker_sleep(pool);
+			idle = 0;
+		}
+	}
+
+	current_worker = NULL;
+
+	return NULL;
+}
+
+// Tells the pool's first count workers to exit once out of work, joins them,
+// and frees the pool.  The pool must already be removed from its context.
+static void pool_free(struct nl_threadpool *pool, unsigned int count)
+{
+	int ret;
+
+	__atomic_store_n(&pool->stopping, 1, __ATOMIC_RELEASE);
+	pthread_mutex_lock(&pool->lock);
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	for(unsigned int i = 0; i < count; i++) {
+		ret = nl_join_thread(pool->workers[i].thread, NULL);
+		if(ret) {
+			ERROR_OUT("Error joining thread pool worker %u: %d (%s)\n", i, ret, strerror(ret));
+		}
+	}
+
+	for(unsigned int i = 0; i < pool->worker_count; i++) {
+		struct deque_array *array = pool->workers[i].array;
+
+		while(array != NULL) {
+			struct deque_array *retired = array->retired;
+			free(array);
+			array = retired;
+		}
+	}
+
+	pthread_cond_destroy(&pool->done_cond);
+	pthread_cond_destroy(&pool->work_cond);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->workers);
+	free(pool);
+}
+
+/*
+ * Creates a thread pool whose workers are threads in the given thread
+ * context.  params may be NULL to use the defaults.  The pool is destroyed by
+ * nl_threadpool_destroy() or nl_destroy_thread_context().  Returns NULL on
+ * error.
+ */
+struct nl_threadpool *nl_threadpool_create(struct nl_thread_ctx *ctx, const struct nl_threadpool_params *params)
+{
+	struct nl_threadpool_params defaults = { .workers = 0 };
+	struct nl_threadpool *pool;
+	unsigned int started;
+	char name[32];
+	int ret;
+
+	if(CHECK_NULL(ctx)) {
+		return NULL;
+	}
+
+	if(params == NULL) {
+		params = &defaults;
+	}
+	if(params->cpus != NULL && params->cpu_count == 0) {
+		ERROR_OUT("A thread pool CPU list must have at least one CPU.\n");
+		return NULL;
+	}
+
+	pool = calloc(1, sizeof(struct nl_threadpool));
+	if(pool == NULL) {
+		ERRNO_OUT("Error allocating thread pool");
+		return NULL;
+	}
+
+	pool->ctx = ctx;
+	pool->worker_count = params->workers;
+	if(pool->worker_count == 0) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		pool->worker_count = cpus > 0 ? cpus : 1;
+	}
+
+	ret = pthread_getaffinity_np(pthread_self(), sizeof(pool->default_cpus), &pool->default_cpus);
+	if(ret) {
+		ERROR_OUT("Error getting CPU affinity for thread pool: %d (%s)\n", ret, strerror(ret));
+		free(pool);
+		return NULL;
+	}
+
+	pool->workers = calloc(pool->worker_count, sizeof(struct pool_worker));
+	if(pool->workers == NULL) {
+		ERRNO_OUT("Error allocating %u thread pool workers", pool->worker_count);
+		free(pool);
+		return NULL;
+	}
+
+	for(unsigned int i = 0; i < pool->worker_count; i++) {
+		struct pool_worker *w = &pool->workers[i];
+
+		w->pool = pool;
+		w->rng = 2463534242u + i * 2654435769u;
+		w->array = malloc(sizeof(struct deque_array) + NL_THREADPOOL_DEQUE_SIZE * sizeof(struct nl_threadpool_task *));
+		if(w->array == NULL) {
+			ERRNO_OUT("Error allocating thread pool deque");
+			goto error_deques;
+		}
+		w->array->mask = NL_THREADPOOL_DEQUE_SIZE - 1;
+		w->array->retired = NULL;
+	}
+
+	ret = nl_create_mutex(&pool->lock, PTHREAD_MUTEX_NORMAL);
+	if(ret) {
+		ERROR_OUT("Error creating thread pool mutex: %d (%s)\n", ret, strerror(ret));
+		goto error_deques;
+	}
+	ret = pthread_cond_init(&pool->work_cond, NULL);
+	if(ret) {
+		ERROR_OUT("Error creating thread pool condition variable: %d (%s)\n", ret, strerror(ret));
+		goto error_mutex;
+	}
+	ret = pthread_cond_init(&pool->done_cond, NULL);
+	if(ret) {
+		ERROR_OUT("Error creating thread pool condition variable: %d (%s)\n", ret, strerror(ret));
+		goto error_cond;
+	}
+
+	for(started = 0; started < pool->worker_count; started++) {
+		snprintf(name, sizeof(name), "%s-%u", params->name ? params->name : "pool", started);
+
+		ret = nl_create_thread(ctx, NULL, worker_main, &pool->workers[started], name, &pool->workers[started].thread);
+		if(ret) {
+			ERROR_OUT("Error starting thread pool worker %u: %d (%s)\n", started, ret, strerror(ret));
+			pool_free(pool, started);
+			return NULL;
+		}
+
+		if(params->cpus != NULL) {
+			ret = nl_threadpool_set_affinity(pool, started, params->cpus[started % params->cpu_count]);
+			if(ret) {
+				pool_free(pool, started + 1);
+				return NULL;
+			}
+		}
+	}
+
+	ret = pthread_mutex_lock(&ctx->lock);
+	if(ret) {
+		ERROR_OUT("Error locking thread context mutex: %d (%s)\n", ret, strerror(ret));
+		pool_free(pool, pool->worker_count);
+		return NULL;
+	}
+	pool->next = ctx->pools;
+	ctx->pools = pool;
+	pthread_mutex_unlock(&ctx->lock);
+
+	return pool;
+
+error_cond:
+	pthread_cond_destroy(&pool->work_cond);
+error_mutex:
+	pthread_mutex_destroy(&pool->lock);
+error_deques:
+	for(unsigned int i = 0; i < pool->worker_count; i++) {
+		free(pool->workers[i].array);
+	}
+	free(pool->workers);
+	free(pool);
+	return NULL;
+}
+
+/*
+ * Waits for all submitted tasks to finish, then stops and joins the pool's
+ * workers and frees the pool.  Tasks submitted with nl_threadpool_submit()
+ * must still be passed to nl_threadpool_task_wait() (which will return
+ * immediately) to free them.  Must not be called from one of the pool's
+ * workers.  A NULL pool is ignored.
+ */
+void nl_threadpool_destroy(struct nl_threadpool *pool)
+{
+	struct nl_threadpool **prev;
+	int ret;
+
+	if(pool == NULL) {
+		return;
+	}
+
+	ret = nl_threadpool_wait(pool);
+	if(ret) {
+		ERROR_OUT("Error waiting for thread pool tasks before destroying the pool: %d (%s)\n", ret, strerror(ret));
+		return;
+	}
+
+	ret = pthread_mutex_lock(&pool->ctx->lock);
+	if(ret) {
+		ERROR_OUT("Warning: error locking thread context mutex: %d (%s)\n", ret, strerror(ret));
+	}
+
+	for(prev = &pool->ctx->pools; *prev != NULL; prev = &(*prev)->next) {
+		if(*prev == pool) {
+			*prev = pool->next;
+			break;
+		}
+	}
+
+	ret = pthread_mutex_unlock(&pool->ctx->lock);
+	if(ret) {
+		ERROR_OUT("Warning: error unlocking thread context mutex: %d (%s)\n", ret, strerror(ret));
+	}
+
+	pool_free(pool, pool->worker_count);
+}
+
+/*
+ * Returns the number of worker threads in the pool.
+ */
+unsigned int nl_threadpool_workers(struct nl_threadpool *pool)
+{
+	if(CHECK_NULL(pool)) {
+		return 0;
+	}
+
+	return pool->worker_count;
+}
+
+// Allocates and queues a task.  Returns NULL on error.
+static struct nl_threadpool_task *pool_submit(struct nl_threadpool *pool, nl_threadpool_func func, void *data, int detached)
+{
+	struct nl_threadpool_task *task;
+	struct pool_worker *w = current_worker;
+
+	if(CHECK_NULL(pool) || CHECK_NULL(func)) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	task = malloc(sizeof(struct nl_threadpool_task));
+	if(task == NULL) {
+		ERRNO_OUT("Error allocating thread pool task");
+		return NULL;
+	}
+
+	*task = (struct nl_threadpool_task){
+		.func = func,
+		.data = data,
+		.pool = pool,
+		.detached = detached,
+	};
+
+	__atomic_add_fetch(&pool->pending, 1, __ATOMIC_RELAXED);
+
+	// Workers keep subtasks on their own deque for locality
+	if(w == NULL || w->pool != pool || deque_push(w, task)) {
+		inject_push(pool, task);
+	}
+
+	pool_wake(pool, &pool->sleepers, &pool->work_cond, 0);
+
+	return task;
+}
+
+/*
+ * Queues func(data) to run on the pool, returning a task handle that must be
+ * passed to nl_threadpool_task_wait() to get the result and free the task.
+ * Returns NULL on error.
+ */
+struct nl_threadpool_task *nl_threadpool_submit(struct nl_threadpool *pool, nl_threadpool_func func, void *data)
+{
+	return pool_submit(pool, func, data, 0);
+}
+
+/*
+ * Queues func(data) to run on the pool without a task handle.  The return
+ * value of func is ignored.  Returns 0 on success, or an errno-like value on
+ * error.
+ */
+int nl_threadpool_run(struct nl_threadpool *pool, nl_threadpool_func func, void *data)
+{
+	if(pool_submit(pool, func, data, 1) == NULL) {
+		return errno ? errno : ENOMEM;
+	}
+
+	return 0;
+}
+
+/*
+ * Returns nonzero if the given task has finished, zero if it is queued or
+ * running.  Does not free the task.
+ */
+int nl_threadpool_task_done(struct nl_threadpool_task *task)
+{
+	if(CHECK_NULL(task)) {
+		return 0;
+	}
+
+	return __atomic_load_n(&task->done, __ATOMIC_ACQUIRE);
+}
+
+// Runs other queued tasks until the given task is done, sleeping only when
+// there is nothing left to run.  Sleeping is safe then because the awaited
+// task must already be running on another worker, which will wake this one
+// when it finishes.  Called by a worker of the task's pool.
+static void worker_wait(struct pool_worker *w, struct nl_threadpool_task *task)
+{
+	struct nl_threadpool *pool = w->pool;
+	struct nl_threadpool_task *other;
+
+	while(!__atomic_load_n(&task->done, __ATOMIC_ACQUIRE)) {
+		other = find_task(w);
+		if(other != NULL) {
+			run_task(pool, other);
+			continue;
+		}
+
+		pthread_mutex_lock(&pool->lock);
+
+		__atomic_add_fetch(&pool->done_waiters, 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+		// A steal can fail while a thief races for the same task, so
+		// check for work again before sleeping
+		if(!__atomic_load_n(&task->done, __ATOMIC_ACQUIRE) && !pool_has_work(pool)) {
+			pthread_cond_wait(&pool->done_cond, &pool->lock);
+		}
+
+		__atomic_sub_fetch(&pool->done_waiters, 1, __ATOMIC_RELAXED);
+		pthread_mutex_unlock(&pool->lock);
+	}
+}
+
+/*
+ * Waits for the given task to finish, frees it, and returns its function's
+ * return value.  When called from one of the pool's workers (e.g. to wait for
+ * a subtask), the worker runs other queued tasks while it waits.  Returns
+ * NULL if task is NULL.
+ */
+void *nl_threadpool_task_wait(struct nl_threadpool_task *task)
+{
+	struct nl_threadpool *pool;
+	struct pool_worker *w = current_worker;
+	void *result;
+
+	if(CHECK_NULL(task)) {
+		return NULL;
+	}
+
+	// A finished task no longer refers to its pool, which may be gone
+	if(!__atomic_load_n(&task->done, __ATOMIC_ACQUIRE)) {
+		pool = task->pool;
+
+		if(w != NULL && w->pool == pool) {
+			worker_wait(w, task);
+		} else {
+			pthread_mutex_lock(&pool->lock);
+
+			__atomic_add_fetch(&pool->done_waiters, 1, __ATOMIC_RELAXED);
+			__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+			while(!__atomic_load_n(&task->done, __ATOMIC_ACQUIRE)) {
+				pthread_cond_wait(&pool->done_cond, &pool->lock);
+			}
+
+			__atomic_sub_fetch(&pool->done_waiters, 1, __ATOMIC_RELAXED);
+			pthread_mutex_unlock(&pool->lock);
+		}
+	}
+
+	result = task->result;
+	free(task);
+
+	return result;
+}
+
+/*
+ * Waits until every task submitted to the pool so far, and any tasks they
+ * submit, has finished.  Returns 0 on success, EDEADLK if called from one of
+ * the pool's workers, or another errno-like value on error.
+ */
+int nl_threadpool_wait(struct nl_threadpool *pool)
+{
+	int ret;
+
+	if(CHECK_NULL(pool)) {
+		return EINVAL;
+	}
+
+	if(current_worker != NULL && current_worker->pool == pool) {
+		ERROR_OUT("A thread pool worker cannot wait for its own pool to finish.\n");
+		return EDEADLK;
+	}
+
+	ret = pthread_mutex_lock(&pool->lock);
+	if(ret) {
+		ERROR_OUT("Error locking thread pool mutex: %d (%s)\n", ret, strerror(ret));
+		return ret;
+	}
+
+	__atomic_add_fetch(&pool->done_waiters, 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	while(__atomic_load_n(&pool->pending, __ATOMIC_ACQUIRE) != 0) {
+		pthread_cond_wait(&pool->done_cond, &pool->lock);
+	}
+
+	__atomic_sub_fetch(&pool->done_waiters, 1, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&pool->lock);
+
+	return 0;
+}
+
+/*
+ * Pins the given worker (0 to nl_threadpool_workers() - 1) to the given CPU,
+ * or restores the affinity of the thread that created the pool if cpu is
+ * negative.  Returns 0 on success, or an errno-like value on error.
+ */
+int nl_threadpool_set_affinity(struct nl_threadpool *pool, unsigned int worker, int cpu)
+{
+	cpu_set_t cpus;
+	int ret;
+
+	if(CHECK_NULL(pool)) {
+		return EINVAL;
+	}
+	if(worker >= pool->worker_count) {
+		ERROR_OUT("Thread pool worker %u is out of range (%u workers).\n", worker, pool->worker_count);
+		return EINVAL;
+	}
+	if(cpu >= CPU_SETSIZE) {
+		ERROR_OUT("CPU %d is out of range.\n", cpu);
+		return EINVAL;
+	}
+
+	if(cpu < 0) {
+		cpus = pool->default_cpus;
+	} else {
+		CPU_ZERO(&cpus);
+		CPU_SET(cpu, &cpus);
+	}
+
+	ret = pthread_setaffinity_np(pool->workers[worker].thread->thread, sizeof(cpus), &cpus);
+	if(ret) {
+		ERROR_OUT("Error setting thread pool worker %u affinity to CPU %d: %d (%s)\n", worker, cpu, ret, strerror(ret));
+		return ret;
+	}
+
+	return 0;
+}
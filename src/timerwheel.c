@@ -0,0 +1,667 @@
+/*
+ * timerwheel.c - A hierarchical timing wheel for many deadlines.
+ * Copyright (C)2026 Mike Bourgeous.  Released under AGPLv3.
+ *
+ * The wheel follows Varghese and Lauck's hierarchical timing wheels, in the
+ * cascading form used by older Linux kernels.  Time is divided into ticks.
+ * Level 0 has one slot per tick for the next 64 ticks; each higher level has
+ * 64 slots that each span 64 slots of the level below.  A timer goes in the
+ * lowest level whose range covers its distance from the current tick, in the
+ * slot selected by the matching bits of its expiration tick.  Whenever the
+ * level 0 index wraps to zero, the current slot of level 1 is redistributed
+ * into level 0 (and so on upward when each level's index wraps), so a timer
+ * moves down at most once per level before it fires.
+ *
+ * Each level keeps a bitmap of non-empty slots, so advancing skips empty
+ * stretches of time a rotation (or more) at a time, and nl_timerwheel_next()
+ * finds the next slot with a count-trailing-zeros instruction instead of a
+ * scan.
+ *
+ * Slot lists are intrusive doubly linked lists through struct nl_timer, so
+ * scheduling and canceling never allocate or search.  Timers from other
+ * threads go through a lock-free stack, as in threadpool.c, which the wheel
+ * takes all at once.  A timerfd lets event loops wait for the next deadline.
+ *
+ * GCC's __atomic builtins are used instead of C11 <stdatomic.h> because the
+ * library is built as C99.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include "nlutils.h"
+#include "timerwheel.h"
+
+#define TW_SLOT_BITS 6
+#define TW_SLOTS (1 << TW_SLOT_BITS)
+#define TW_SLOT_MASK (TW_SLOTS - 1)
+#define TW_LEVELS 8
+
+// Timers further away than this many ticks are placed at this distance, and
+// placed again when they reach the bottom of the wheel
+#define TW_MAX_DELTA ((UINT64_C(1) << (TW_SLOT_BITS * TW_LEVELS)) - 1)
+
+// nl_timer.level of timers on the due list or in the batch being fired
+#define TW_EXPIRED_LEVEL 0xff
+
+// Used to keep the submission stack on its own cache line
+#define TW_CACHE_LINE 64
+
+#define TW_DEFAULT_TICK_NS 1000000
+
+enum timer_state {
+	TIMER_IDLE = 0,
+	TIMER_SCHEDULED,
+	TIMER_SUBMITTED,	// On the submission stack
+};
+
+struct nl_timerwheel {
+	int64_t tick_ns;
+	uint64_t tick; // Next tick to process
+	size_t count; // Timers in slots, on the due list, or being fired
+
+	uint64_t occupied[TW_LEVELS]; // One bit per non-empty slot
+	struct nl_timer *slots[TW_LEVELS][TW_SLOTS];
+	struct nl_timer *due; // Timers whose tick has already been processed
+	struct nl_timer *expired; // Batch being fired
+
+	int fd; // timerfd
+	unsigned int use_fd; // Set by nl_timerwheel_fd()
+	int advancing; // Nonzero while firing timers; the fd is armed afterward
+	uint64_t armed_tick; // Tick for which the fd is armed, or UINT64_MAX
+
+	char pad0[TW_CACHE_LINE];
+	struct nl_timer *submitted; // Timers from other threads, newest first
+	char pad1[TW_CACHE_LINE - sizeof(struct nl_timer *)];
+};
+
+// Returns the first tick at or after the given deadline.
+static uint64_t deadline_to_tick(struct nl_timerwheel *wheel, int64_t deadline)
+{
+	if(deadline <= 0) {
+		return 0;
+	}
+
+	return (uint64_t)(deadline - 1) / (uint64_t)wheel->tick_ns + 1;
+}
+
+// Returns the start of the given tick in nanoseconds, saturating at
+// INT64_MAX.
+static int64_t tick_to_ns(struct nl_timerwheel *wheel, uint64_t tick)
+{
+	if(tick > (uint64_t)(INT64_MAX / wheel->tick_ns)) {
+		return INT64_MAX;
+	}
+
+	return (int64_t)tick * wheel->tick_ns;
+}
+
+// Rotates bits right by count (0 to 63).
+static inline uint64_t rotate_right(uint64_t bits, unsigned int count)
+{
+	return (bits >> count) | (bits << ((TW_SLOTS - count) & TW_SLOT_MASK));
+}
+
+// Adds the timer to the list at head.
+static void timer_push(struct nl_timer **head, struct nl_timer *timer)
+{
+	timer->next = *head;
+	if(timer->next != NULL) {
+		timer->next->pprev = &timer->next;
+	}
+	timer->pprev = head;
+	*head = timer;
+}
+
+// Adds the timer to the slot for its expiration tick, or to the due list if
+// that tick has already been processed.
+static void timer_link(struct nl_timerwheel *wheel, struct nl_timer *timer)
+{
+	uint64_t expiry = timer->expiry;
+	uint64_t delta;
+	unsigned int level = 0;
+	unsigned int slot;
+
+	if(expiry < wheel->tick) {
+		timer_push(&wheel->due, timer);
+		timer->level = TW_EXPIRED_LEVEL;
+		return;
+	}
+
+	delta = expiry - wheel->tick;
+	if(delta > TW_MAX_DELTA) {
+		delta = TW_MAX_DELTA;
+		expiry = wheel->tick + delta;
+	}
+
+	// Level L holds distances below 64^(L + 1)
+	if(delta >= TW_SLOTS) {
+		level = (63 - __builtin_clzll(delta)) / TW_SLOT_BITS;
+	}
+
+	slot = (expiry >> (level * TW_SLOT_BITS)) & TW_SLOT_MASK;
+	timer_push(&wheel->slots[level][slot], timer);
+
+	timer->level = level;
+	timer->slot = slot;
+	wheel->occupied[level] |= UINT64_C(1) << slot;
+}
+
+// Removes the timer from its slot, the due list, or the batch being fired.
+static void timer_unlink(struct nl_timerwheel *wheel, struct nl_timer *timer)
+{
+	*timer->pprev = timer->next;
+	if(timer->next != NULL) {
+		timer->next->pprev = timer->pprev;
+	}
+
+	if(timer->level != TW_EXPIRED_LEVEL && wheel->slots[timer->level][timer->slot] == NULL) {
+		wheel->occupied[timer->level] &= ~(UINT64_C(1) << timer->slot);
+	}
+}
+
+// Empties a slot, returning its list of timers.
+static struct nl_timer *slot_take(struct nl_timerwheel *wheel, unsigned int level, unsigned int slot)
+{
+	struct nl_timer *list = wheel->slots[level][slot];
+
+	wheel->slots[level][slot] = NULL;
+	wheel->occupied[level] &= ~(UINT64_C(1) << slot);
+
+	return list;
+}
+
+// Moves the timers in the current slot of each level whose index has wrapped
+// down to lower levels.  Called when the current tick is a multiple of 64.
+static void wheel_cascade(struct nl_timerwheel *wheel)
+{
+	for(unsigned int level = 1; level < TW_LEVELS; level++) {
+		unsigned int slot = (wheel->tick >> (level * TW_SLOT_BITS)) & TW_SLOT_MASK;
+		struct nl_timer *list, *next;
+
+		for(list = slot_take(wheel, level, slot); list != NULL; list = next) {
+			next = list->next;
+			timer_link(wheel, list);
+		}
+
+		if(slot != 0) {
+			break;
+		}
+	}
+}
+
+// Returns the next tick at which a timer fires or must cascade, or
+// UINT64_MAX if no timers are scheduled.
+static uint64_t wheel_next_tick(struct nl_timerwheel *wheel)
+{
+	uint64_t next = UINT64_MAX;
+
+	if(wheel->count == 0) {
+		return UINT64_MAX;
+	}
+
+	if(wheel->due != NULL) {
+		return wheel->tick - 1;
+	}
+
+	for(unsigned int level = 0; level < TW_LEVELS; level++) {
+		unsigned int shift = level * TW_SLOT_BITS;
+		uint64_t base = wheel->tick >> shift;
+		unsigned int pos = base & TW_SLOT_MASK;
+		uint64_t candidate;
+		unsigned int start;
+
+		if(wheel->occupied[level] == 0) {
+			continue;
+		}
+
+		// The current slot of a higher level is only due now if the
+		// current tick is where that level's index changes; otherwise
+		// it holds timers for the next rotation
+		start = (wheel->tick & ((UINT64_C(1) << shift) - 1)) ? 1 : 0;
+		candidate = (base + start + __builtin_ctzll(rotate_right(wheel->occupied[level], (pos + start) & TW_SLOT_MASK))) << shift;
+
+		next = MIN_NUM(next, candidate);
+	}
+
+	return next;
+}
+
+// Arms the timerfd for the given tick (0 for immediately, UINT64_MAX to
+// disarm).  Arms it immediately instead if timers have been submitted, in
+// case this replaced a submitter's wakeup.
+static void wheel_arm(struct nl_timerwheel *wheel, uint64_t tick)
+{
+	struct itimerspec its = { .it_value = { 0, 0 } };
+
+	if(tick != UINT64_MAX) {
+		int64_t ns = MAX_NUM(tick_to_ns(wheel, tick), 1);
+		its.it_value = nl_ns_to_timespec(ns);
+	}
+
+	if(timerfd_settime(wheel->fd, TFD_TIMER_ABSTIME, &its, NULL)) {
+		ERRNO_OUT("Error arming timer wheel timerfd");
+	}
+	wheel->armed_tick = tick;
+
+	if(tick != 0 && __atomic_load_n(&wheel->submitted, __ATOMIC_SEQ_CST) != NULL) {
+		wheel_arm(wheel, 0);
+	}
+}
+
+// Fires a list of timers taken from a slot or the due list.  Callbacks may
+// cancel timers later in the list.  Returns the number of timers fired.
+static size_t wheel_fire(struct nl_timerwheel *wheel, struct nl_timer *list)
+{
+	struct nl_timer *timer;
+	size_t fired = 0;
+
+	wheel->expired = list;
+	list->pprev = &wheel->expired;
+	for(timer = list; timer != NULL; timer = timer->next) {
+		timer->level = TW_EXPIRED_LEVEL;
+	}
+
+	while((timer = wheel->expired) != NULL) {
+		timer_unlink(wheel, timer);
+		wheel->count--;
+		__atomic_store_n(&timer->state, TIMER_IDLE, __ATOMIC_RELEASE);
+
+		timer->cb(timer, timer->cb_data);
+		fired++;
+	}
+
+	return fired;
+}
+
+// Fires the timers on the due list.  Returns the number of timers fired.
+static size_t wheel_fire_due(struct nl_timerwheel *wheel)
+{
+	struct nl_timer *list = wheel->due;
+
+	if(list == NULL) {
+		return 0;
+	}
+
+	wheel->due = NULL;
+
+	return wheel_fire(wheel, list);
+}
+
+// Schedules every timer on the submission stack.
+static void wheel_take_submitted(struct nl_timerwheel *wheel)
+{
+	struct nl_timer *list, *next;
+
+	if(__atomic_load_n(&wheel->submitted, __ATOMIC_RELAXED) == NULL) {
+		return;
+	}
+
+	list = __atomic_exchange_n(&wheel->submitted, NULL, __ATOMIC_ACQUIRE);
+	for(; list != NULL; list = next) {
+		next = list->submit_next;
+
+		list->expiry = deadline_to_tick(wheel, list->deadline);
+		timer_link(wheel, list);
+		wheel->count++;
+		__atomic_store_n(&list->state, TIMER_SCHEDULED, __ATOMIC_RELAXED);
+	}
+}
+
+/*
+ * Initializes a timer that calls cb(timer, cb_data) when it fires.  Must not
+ * be called on a scheduled timer.
+ */
+void nl_timer_init(struct nl_timer *timer, nl_timer_callback cb, void *cb_data)
+{
+	if(CHECK_NULL(timer)) {
+		return;
+	}
+
+	*timer = (struct nl_timer){
+		.cb = cb,
+		.cb_data = cb_data,
+		.state = TIMER_IDLE,
+	};
+}
+
+/*
+ * Returns nonzero if the timer is scheduled or submitted and has not yet
+ * fired or been canceled.
+ */
+int nl_timer_pending(const struct nl_timer *timer)
+{
+	unsigned int state;
+
+	if(CHECK_NULL(timer)) {
+		return 0;
+	}
+
+	state = __atomic_load_n(&timer->state, __ATOMIC_ACQUIRE);
+
+	return state == TIMER_SCHEDULED || state == TIMER_SUBMITTED;
+}
+
+/*
+ * Creates a timer wheel whose current time is the current CLOCK_MONOTONIC
+ * time.  params may be NULL to use the defaults.  Returns NULL on error.
+ */
+struct nl_timerwheel *nl_timerwheel_create(const struct nl_timerwheel_params *params)
+{
+	struct nl_timerwheel *wheel;
+	int64_t now;
+
+	if(params != NULL && params->tick_ns < 0) {
+		ERROR_OUT("Timer wheel tick must not be negative\n");
+		errno = EINVAL;
+		return NULL;
+	}
+
+	now = nl_clock_ns(CLOCK_MONOTONIC);
+	if(now == INT64_MIN) {
+		ERRNO_OUT("Error getting the time for a timer wheel");
+		return NULL;
+	}
+
+	wheel = calloc(1, sizeof(struct nl_timerwheel));
+	if(wheel == NULL) {
+		ERRNO_OUT("Error allocating timer wheel");
+		return NULL;
+	}
+
+	wheel->tick_ns = params != NULL && params->tick_ns > 0 ? params->tick_ns : TW_DEFAULT_TICK_NS;
+	wheel->tick = now / wheel->tick_ns;
+	wheel->armed_tick = UINT64_MAX;
+
+	wheel->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if(wheel->fd == -1) {
+		ERRNO_OUT("Error creating timer wheel timerfd");
+		free(wheel);
+		return NULL;
+	}
+
+	return wheel;
+}
+
+/*
+ * Destroys a timer wheel.  Timers that are still scheduled are not called,
+ * and may be reused after nl_timer_init().  A NULL wheel is ignored.
+ */
+void nl_timerwheel_destroy(struct nl_timerwheel *wheel)
+{
+	if(wheel == NULL) {
+		return;
+	}
+
+	close(wheel->fd);
+	free(wheel);
+}
+
+/*
+ * Schedules the timer to fire at the given CLOCK_MONOTONIC deadline in
+ * nanoseconds, moving it if it was already scheduled on this wheel.  Deadlines
+ * in the past fire on the next call to nl_timerwheel_advance().  Returns 0 on
+ * success, or EBUSY if the timer was submitted with nl_timerwheel_submit() and
+ * has not yet been taken by the wheel.
+ */
+int nl_timerwheel_schedule(struct nl_timerwheel *wheel, struct nl_timer *timer, int64_t deadline)
+{
+	unsigned int state;
+
+	if(CHECK_NULL(wheel) || CHECK_NULL(timer)) {
+		return EFAULT;
+	}
+
+	state = __atomic_load_n(&timer->state, __ATOMIC_RELAXED);
+	if(state == TIMER_SUBMITTED) {
+		return EBUSY;
+	}
+
+	if(state == TIMER_SCHEDULED) {
+		timer_unlink(wheel, timer);
+	} else {
+		wheel->count++;
+		__atomic_store_n(&timer->state, TIMER_SCHEDULED, __ATOMIC_RELAXED);
+	}
+
+	timer->deadline = deadline;
+	timer->expiry = deadline_to_tick(wheel, deadline);
+	timer_link(wheel, timer);
+
+	if(wheel->use_fd && !wheel->advancing && timer->expiry < wheel->armed_tick) {
+		wheel_arm(wheel, timer->expiry);
+	}
+
+	return 0;
+}
+
+/*
+ * Cancels a scheduled timer.  Returns 0 on success, ENOENT if the timer was
+ * not scheduled, or EBUSY if the timer was submitted with
+ * nl_timerwheel_submit() and has not yet been taken by the wheel.
+ */
+int nl_timerwheel_cancel(struct nl_timerwheel *wheel, struct nl_timer *timer)
+{
+	if(CHECK_NULL(wheel) || CHECK_NULL(timer)) {
+		return EFAULT;
+	}
+
+	switch(__atomic_load_n(&timer->state, __ATOMIC_RELAXED)) {
+		case TIMER_SCHEDULED:
+			timer_unlink(wheel, timer);
+			wheel->count--;
+			__atomic_store_n(&timer->state, TIMER_IDLE, __ATOMIC_RELAXED);
+			return 0;
+
+		case TIMER_SUBMITTED:
+			return EBUSY;
+
+		default:
+			return ENOENT;
+	}
+}
+
+/*
+ * Schedules a timer from any thread.  The timer must not be scheduled, and
+ * must not be used by the wheel's thread, until the wheel takes it during its
+ * next nl_timerwheel_advance() or nl_timerwheel_run().  If the wheel's file
+ * descriptor is in use, it becomes readable so the wheel's thread takes the
+ * timer promptly.  Returns 0 on success, or EBUSY if the timer is already
+ * scheduled or submitted.
+ */
+int nl_timerwheel_submit(struct nl_timerwheel *wheel, struct nl_timer *timer, int64_t deadline)
+{
+	unsigned int idle = TIMER_IDLE;
+	struct nl_timer *head;
+
+	if(CHECK_NULL(wheel) || CHECK_NULL(timer)) {
+		return EFAULT;
+	}
+
+	if(!__atomic_compare_exchange_n(&timer->state, &idle, TIMER_SUBMITTED, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+		return EBUSY;
+	}
+
+	timer->deadline = deadline;
+
+	head = __atomic_load_n(&wheel->submitted, __ATOMIC_RELAXED);
+	do {
+		timer->submit_next = head;
+	} while(!__atomic_compare_exchange_n(&wheel->submitted, &head, timer, 1, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+
+	// Only the first submitter since the wheel last took the stack needs
+	// to wake it
+	if(head == NULL && __atomic_load_n(&wheel->use_fd, __ATOMIC_SEQ_CST)) {
+		struct itimerspec its = { .it_value = { 0, 1 } };
+
+		if(timerfd_settime(wheel->fd, TFD_TIMER_ABSTIME, &its, NULL)) {
+			ERRNO_OUT("Error waking timer wheel");
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Takes submitted timers, then fires every timer whose deadline is at or
+ * before now (in CLOCK_MONOTONIC nanoseconds), one tick's batch at a time.
+ * Callbacks may schedule and cancel any timers.  Timers scheduled by a
+ * callback for a time that has already passed fire with the next tick's
+ * batch, or on the next call if this call has no ticks left.  Returns the
+ * number of timers fired.
+ */
+size_t nl_timerwheel_advance(struct nl_timerwheel *wheel, int64_t now)
+{
+	uint64_t target;
+	size_t fired = 0;
+
+	if(CHECK_NULL(wheel)) {
+		return 0;
+	}
+
+	wheel_take_submitted(wheel);
+
+	if(now < 0) {
+		now = 0;
+	}
+	target = (uint64_t)now / (uint64_t)wheel->tick_ns;
+
+	wheel->advancing++;
+
+	// Timers scheduled for ticks that were already processed
+	fired += wheel_fire_due(wheel);
+
+	while(wheel->tick <= target) {
+		struct nl_timer *list;
+		unsigned int level;
+
+		if(wheel->count == 0) {
+			wheel->tick = target + 1;
+			break;
+		}
+
+		if((wheel->tick & TW_SLOT_MASK) == 0) {
+			wheel_cascade(wheel);
+		}
+
+		list = slot_take(wheel, 0, wheel->tick & TW_SLOT_MASK);
+		wheel->tick++;
+
+		// Callbacks in the previous batch may have scheduled timers
+		// for the past; they go in this batch, before its timers, so a
+		// timer that keeps rescheduling itself can't loop forever
+		fired += wheel_fire_due(wheel);
+
+		if(list != NULL) {
+			fired += wheel_fire(wheel, list);
+		}
+
+		// Skip to the next tick at which the lowest non-empty level
+		// cascades
+		if(wheel->occupied[0] == 0 && wheel->due == NULL) {
+			for(level = 1; level < TW_LEVELS - 1 && wheel->occupied[level] == 0; level++) {
+				// Find the lowest non-empty level
+			}
+
+			uint64_t mask = (UINT64_C(1) << (level * TW_SLOT_BITS)) - 1;
+			wheel->tick = MIN_NUM((wheel->tick + mask) & ~mask, target + 1);
+		}
+	}
+
+	wheel->advancing--;
+
+	if(__atomic_load_n(&wheel->use_fd, __ATOMIC_RELAXED) && !wheel->advancing) {
+		uint64_t next = wheel_next_tick(wheel);
+
+		if(next != wheel->armed_tick) {
+			wheel_arm(wheel, next);
+		}
+	}
+
+	return fired;
+}
+
+/*
+ * Returns the time in CLOCK_MONOTONIC nanoseconds at or before which
+ * nl_timerwheel_advance() should next be called, or INT64_MAX if no timers
+ * are scheduled.  This is the exact (tick-rounded) deadline of the next timer
+ * if it is within 64 ticks, and otherwise the time when more distant timers
+ * must be redistributed within the wheel.  Submitted timers that have not
+ * been taken are not included.
+ */
+int64_t nl_timerwheel_next(struct nl_timerwheel *wheel)
+{
+	uint64_t next;
+
+	if(CHECK_NULL(wheel)) {
+		return INT64_MAX;
+	}
+
+	next = wheel_next_tick(wheel);
+	if(next == UINT64_MAX) {
+		return INT64_MAX;
+	}
+
+	return tick_to_ns(wheel, next);
+}
+
+/*
+ * Returns the number of timers scheduled on the wheel, excluding submitted
+ * timers that have not yet been taken.
+ */
+size_t nl_timerwheel_count(struct nl_timerwheel *wheel)
+{
+	if(CHECK_NULL(wheel)) {
+		return 0;
+	}
+
+	return wheel->count;
+}
+
+/*
+ * Returns a timerfd that is readable when nl_timerwheel_run() should be
+ * called.  After this is called, the wheel keeps the timerfd armed for its
+ * earliest deadline, and nl_timerwheel_submit() makes it readable
+ * immediately.  Returns -1 on error.
+ */
+int nl_timerwheel_fd(struct nl_timerwheel *wheel)
+{
+	if(CHECK_NULL(wheel)) {
+		return -1;
+	}
+
+	if(!wheel->use_fd) {
+		__atomic_store_n(&wheel->use_fd, 1, __ATOMIC_SEQ_CST);
+		wheel_arm(wheel, wheel_next_tick(wheel));
+	}
+
+	return wheel->fd;
+}
+
+/*
+ * Clears the wheel's file descriptor, advances the wheel to the current
+ * CLOCK_MONOTONIC time, and rearms the file descriptor for the next
+ * deadline.  Returns the number of timers fired.
+ */
+size_t nl_timerwheel_run(struct nl_timerwheel *wheel)
+{
+	uint64_t expirations;
+
+	if(CHECK_NULL(wheel)) {
+		return 0;
+	}
+
+	if(read(wheel->fd, &expirations, sizeof(expirations)) == -1 && errno != EAGAIN) {
+		ERRNO_OUT("Error reading timer wheel timerfd");
+	}
+
+	// The fd's expiration was consumed, so it must be armed again even if
+	// the next tick hasn't changed
+	wheel->armed_tick = UINT64_MAX - 1;
+
+	return nl_timerwheel_advance(wheel, nl_clock_ns(CLOCK_MONOTONIC));
+}
@@ -0,0 +1,995 @@
+/*
+ * Binary trace logging with deferred formatting.
+ * Copyright (C)2026 Mike Bourgeous.  Released under AGPLv3.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#include "nlutils.h"
+#include "log_internal.h"
+
+#define TRACE_MAGIC "NLTRACE"
+#define TRACE_VERSION 1
+#define TRACE_BYTE_ORDER 0x01020304
+#define TRACE_TEXT_ID UINT32_MAX // Format ID for formats that are formatted by the caller
+#define TRACE_BUF_SIZE 256 // Stack buffer for records; longer records are malloc()ed
+#define TRACE_MAX_RECORD 0x1000000 // Largest record accepted by the decoder
+
+// Record types
+enum trace_type {
+	TRACE_FORMAT = 1,	// Defines a format string (ID in id)
+	TRACE_THREAD,		// Defines or renames a thread (ID in thread)
+	TRACE_EVENT,		// Raw arguments for format id
+	TRACE_TEXT,		// Message formatted by the caller
+};
+
+// Argument types, stored in the sizes of the writing machine
+enum trace_arg {
+	ARG_INT = 1,		// int, and char or short promoted to int
+	ARG_LONG,
+	ARG_LLONG,
+	ARG_SIZE,
+	ARG_INTMAX,
+	ARG_PTRDIFF,
+	ARG_DOUBLE,
+	ARG_LDOUBLE,
+	ARG_PTR,
+	ARG_STRING,		// uint32_t length (UINT32_MAX for NULL) followed by the bytes
+	ARG_STRING_STAR,	// ARG_STRING limited by the preceding '*' precision
+};
+
+// Start of a trace file.  The sizes of the types used for arguments must
+// match those of the decoding machine.
+struct trace_file_header {
+	char magic[8];
+	uint32_t byte_order;
+	uint16_t version;
+	uint16_t header_size;
+	uint8_t sizes[8];	// long, long long, size_t, intmax_t, ptrdiff_t, double, long double, void *
+	int64_t realtime_ns;	// CLOCK_REALTIME when the file was opened
+	int64_t monotonic_ns;	// CLOCK_MONOTONIC at the same time
+};
+
+// Header of every record, followed by size - sizeof(struct trace_record)
+// bytes of data.
+struct trace_record {
+	uint32_t size;
+	uint16_t type;
+	uint16_t reserved;
+	uint32_t id;
+	uint32_t thread;
+	int64_t ns;		// CLOCK_MONOTONIC
+};
+
+// One conversion in a format string.
+struct trace_spec {
+	const char *end;	// Just past the conversion
+	uint8_t type;		// Argument type, or 0 for %%
+	uint8_t stars;		// Number of '*' int arguments before the value
+};
+
+// Record being assembled, starting on the stack.
+struct trace_buf {
+	char *buf;
+	size_t size;
+	size_t len;
+	char stack[TRACE_BUF_SIZE];
+};
+
+// Part of a format string ending in at most one conversion, for decoding.
+struct trace_piece {
+	char *fmt;	// Literal text (with %% unescaped) if type is 0
+	uint8_t type;
+	uint8_t stars;
+};
+
+struct trace_decoded_format {
+	struct trace_piece *pieces;
+	size_t count;
+};
+
+static const uint8_t trace_sizes[8] = {
+	sizeof(long), sizeof(long long), sizeof(size_t), sizeof(intmax_t),
+	sizeof(ptrdiff_t), sizeof(double), sizeof(long double), sizeof(void *),
+};
+
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static int trace_fd = -1;
+static unsigned int trace_generation; // Incremented by each nl_trace_open()
+static uint32_t trace_next_format;
+static uint32_t trace_next_thread;
+
+static __thread uint32_t trace_thread_id;
+static __thread unsigned int trace_thread_generation;
+static __thread char trace_thread_name[16];
+
+// Returns the current time of the given clock in nanoseconds.
+static int64_t trace_clock(clockid_t clock, struct timespec *t)
+{
+	clock_gettime(clock, t);
+	return nl_timespec_to_ns(*t);
+}
+
+// Parses the conversion starting at the '%' at fmt into spec.  Returns 0 on
+// success, or -1 if the conversion's argument can't be stored for deferred
+// formatting.
+static int trace_parse_spec(const char *fmt, struct trace_spec *spec)
+{
+	const char *p = fmt + 1;
+	int length = 0; // 'h' or 'l' count, or 'L', 'j', 'z', 't'
+	int precision = 0;
+
+	spec->stars = 0;
+	spec->type = 0;
+
+	if(*p == '%') {
+		spec->end = p + 1;
+		return 0;
+	}
+
+	while(*p && strchr("-+ #0'I", *p)) {
+		p++;
+	}
+
+	if(*p == '*') {
+		spec->stars++;
+		p++;
+	}
+	while(isdigit((unsigned char)*p)) {
+		p++;
+	}
+	if(*p == '$') {
+		return -1;
+	}
+
+	if(*p == '.') {
+		p++;
+		if(*p == '*') {
+			spec->stars++;
+			precision = '*';
+			p++;
+		} else {
+			precision = '.';
+			while(isdigit((unsigned char)*p)) {
+				p++;
+			}
+		}
+		if(*p == '$') {
+			return -1;
+		}
+	}
+
+	switch(*p) {
+		case 'h':
+			length = 'h';
+			p += p[1] == 'h' ? 2 : 1;
+			break;
+
+		case 'l':
+			length = p[1] == 'l' ? 'q' : 'l';
+			p += p[1] == 'l' ? 2 : 1;
+			break;
+
+		case 'q':
+		case 'L':
+			length = 'q';
+			p++;
+			break;
+
+		case 'j':
+		case 'z':
+		case 'Z':
+		case 't':
+			length = *p;
+			p++;
+			break;
+	}
+
+	switch(*p) {
+		case 'd':
+		case 'i':
+		case 'o':
+		case 'u':
+		case 'x':
+		case 'X':
+			switch(length) {
+				case 'l':
+					spec->type = ARG_LONG;
+					break;
+				case 'q':
+					spec->type = ARG_LLONG;
+					break;
+				case 'j':
+					spec->type = ARG_INTMAX;
+					break;
+				case 'z':
+				case 'Z':
+					spec->type = ARG_SIZE;
+					break;
+				case 't':
+					spec->type = ARG_PTRDIFF;
+					break;
+				default:
+					spec->type = ARG_INT;
+					break;
+			}
+			break;
+
+		case 'c':
+			if(length) {
+				return -1;
+			}
+			spec->type = ARG_INT;
+			break;
+
+		case 'e':
+		case 'E':
+		case 'f':
+		case 'F':
+		case 'g':
+		case 'G':
+		case 'a':
+		case 'A':
+			spec->type = length == 'q' ? ARG_LDOUBLE : ARG_DOUBLE;
+			break;
+
+		case 's':
+			// A fixed precision allows unterminated strings, whose
+			// length can't be measured here
+			if(length || precision == '.') {
+				return -1;
+			}
+			spec->type = precision == '*' ? ARG_STRING_STAR : ARG_STRING;
+			break;
+
+		case 'p':
+			spec->type = ARG_PTR;
+			break;
+
+		default:
+			return -1;
+	}
+
+	spec->end = p + 1;
+
+	return 0;
+}
+
+// Fills in the argument types of format from fmt.  Returns 0 on success, or
+// -1 if fmt must be formatted by the caller.
+static int trace_parse_format(struct nl_trace_format *format, const char *fmt)
+{
+	struct trace_spec spec;
+	unsigned int count = 0;
+
+	for(const char *p = strchr(fmt, '%'); p != NULL; p = strchr(spec.end, '%')) {
+		if(trace_parse_spec(p, &spec)) {
+			return -1;
+		}
+
+		if(spec.type) {
+			if(count + spec.stars + 1 > NL_TRACE_MAX_ARGS) {
+				return -1;
+			}
+
+			for(unsigned int i = 0; i < spec.stars; i++) {
+				format->args[count++] = ARG_INT;
+			}
+			format->args[count++] = spec.type;
+		}
+	}
+
+	format->arg_count = count;
+
+	return 0;
+}
+
+// Writes all of data to fd directly, bypassing the log ring buffers.
+// Returns 0 on success, -1 on error.
+static int trace_write(int fd, const void *data, size_t len)
+{
+	while(len > 0) {
+		ssize_t ret = write(fd, data, len);
+
+		if(ret < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+
+		data = (const char *)data + ret;
+		len -= ret;
+	}
+
+	return 0;
+}
+
+// Appends len bytes of data to b, moving it to the heap if needed.  Returns
+// 0 on success, -1 on error.
+static int trace_append(struct trace_buf *b, const void *data, size_t len)
+{
+	if(b->len + len > b->size) {
+		size_t size = MAX_NUM(b->size * 2, b->len + len);
+		char *buf = b->buf == b->stack ? malloc(size) : realloc(b->buf, size);
+
+		if(buf == NULL) {
+			return -1;
+		}
+		if(b->buf == b->stack) {
+			memcpy(buf, b->stack, b->len);
+		}
+
+		b->buf = buf;
+		b->size = size;
+	}
+
+	memcpy(b->buf + b->len, data, len);
+	b->len += len;
+
+	return 0;
+}
+
+// Starts a record of the given type in b.
+static void trace_begin(struct trace_buf *b, uint16_t type, uint32_t id, int64_t ns)
+{
+	b->buf = b->stack;
+	b->size = sizeof(b->stack);
+	b->len = sizeof(struct trace_record);
+
+	*(struct trace_record *)b->buf = (struct trace_record){
+		.type = type,
+		.id = id,
+		.thread = trace_thread_id,
+		.ns = ns,
+	};
+}
+
+// Finishes the record in b and writes it directly or through the calling
+// thread's log ring.
+static void trace_end(struct trace_buf *b, int fd, const struct timespec *t, int direct)
+{
+	((struct trace_record *)b->buf)->size = b->len;
+
+	if(direct) {
+		trace_write(fd, b->buf, b->len);
+	} else {
+		nl_log_write_fd(fd, b->buf, b->len, t);
+	}
+
+	if(b->buf != b->stack) {
+		free(b->buf);
+	}
+}
+
+// Assigns an ID and argument types to format if needed, and writes the
+// format string to the trace file for the given generation.  Returns 0 on
+// success, -1 if the trace file was closed.
+static int trace_register_format(struct nl_trace_format *format, const char *fmt, unsigned int generation)
+{
+	struct trace_buf b;
+	struct timespec t;
+	int ret = 0;
+
+	pthread_mutex_lock(&trace_lock);
+
+	if(trace_generation != generation || trace_fd < 0) {
+		ret = -1;
+	} else if(format->generation != generation) {
+		if(format->id == 0) {
+			format->id = trace_parse_format(format, fmt) ? TRACE_TEXT_ID : ++trace_next_format;
+		}
+
+		// Written directly so it precedes any event using the ID
+		if(format->id != TRACE_TEXT_ID) {
+			trace_begin(&b, TRACE_FORMAT, format->id, trace_clock(CLOCK_MONOTONIC, &t));
+			if(trace_append(&b, fmt, strlen(fmt) + 1)) {
+				ERROR_OUT("Error allocating trace format record\n");
+				b.len = sizeof(struct trace_record);
+			}
+			trace_end(&b, trace_fd, &t, 1);
+		}
+
+		__atomic_store_n(&format->generation, generation, __ATOMIC_RELEASE);
+	}
+
+	pthread_mutex_unlock(&trace_lock);
+
+	return ret;
+}
+
+// Writes the calling thread's ID and name to the trace file, through its log
+// ring so that it stays in order with the thread's events.
+static void trace_register_thread(int fd, unsigned int generation, const char *name)
+{
+	struct trace_buf b;
+	struct timespec t;
+
+	if(trace_thread_id == 0) {
+		trace_thread_id = __atomic_add_fetch(&trace_next_thread, 1, __ATOMIC_RELAXED);
+	}
+
+	snprintf(trace_thread_name, sizeof(trace_thread_name), "%s", name);
+	trace_thread_generation = generation;
+
+	trace_begin(&b, TRACE_THREAD, 0, trace_clock(CLOCK_MONOTONIC, &t));
+	trace_append(&b, trace_thread_name, strlen(trace_thread_name) + 1);
+	trace_end(&b, fd, &t, 0);
+}
+
+// Stores the arguments described by format in b.  Returns 0 on success, -1 on
+// error.
+static int trace_store_args(struct trace_buf *b, const struct nl_trace_format *format, va_list args)
+{
+	int last_int = -1;
+	int ret = 0;
+
+	for(unsigned int i = 0; i < format->arg_count && !ret; i++) {
+		switch(format->args[i]) {
+			case ARG_INT:
+				{
+					int v = va_arg(args, int);
+					last_int = v;
+					ret = trace_append(b, &v, sizeof(v));
+				}
+				break;
+
+			case ARG_LONG:
+				{
+					long v = va_arg(args, long);
+					ret = trace_append(b, &v, sizeof(v));
+				}
+				break;
+
+			case ARG_LLONG:
+				{
+					long long v = va_arg(args, long long);
+					ret = trace_append(b, &v, sizeof(v));
+				}
+				break;
+
+			case ARG_SIZE:
+				{
+					size_t v = va_arg(args, size_t);
+					ret = trace_append(b, &v, sizeof(v));
+				}
+				break;
+
+			case ARG_INTMAX:
+				{
+					intmax_t v = va_arg(args, intmax_t);
+					ret = trace_append(b, &v, sizeof(v));
+				}
+				break;
+
+			case ARG_PTRDIFF:
+				{
+					ptrdiff_t v = va_arg(args, ptrdiff_t);
+					ret = trace_append(b, &v, sizeof(v));
+				}
+				break;
+
+			case ARG_DOUBLE:
+				{
+					double v = va_arg(args, double);
+					ret = trace_append(b, &v, sizeof(v));
+				}
+				break;
+
+			case ARG_LDOUBLE:
+				{
+					long double v = va_arg(args, long double);
+					ret = trace_append(b, &v, sizeof(v));
+				}
+				break;
+
+			case ARG_PTR:
+				{
+					void *v = va_arg(args, void *);
+					ret = trace_append(b, &v, sizeof(v));
+				}
+				break;
+
+			case ARG_STRING:
+			case ARG_STRING_STAR:
+				{
+					const char *s = va_arg(args, const char *);
+					uint32_t len = UINT32_MAX;
+
+					if(s != NULL) {
+						len = format->args[i] == ARG_STRING_STAR && last_int >= 0 ? strnlen(s, last_int) : strlen(s);
+					}
+
+					ret = trace_append(b, &len, sizeof(len));
+					if(s != NULL && !ret) {
+						ret = trace_append(b, s, len);
+					}
+				}
+				break;
+		}
+	}
+
+	return ret;
+}
+
+// Formats a message into b for a format that can't be deferred.  Returns 0
+// on success, -1 on error.
+static int __attribute__ ((__format__(__printf__, 2, 0))) trace_store_text(struct trace_buf *b, const char *fmt, va_list args)
+{
+	va_list args2;
+	int len;
+
+	va_copy(args2, args);
+	len = vsnprintf(b->buf + b->len, b->size - b->len, fmt, args2);
+	va_end(args2);
+
+	if(len < 0) {
+		return -1;
+	}
+
+	if((size_t)len >= b->size - b->len) {
+		char *buf = malloc(b->len + len + 1);
+		if(buf == NULL) {
+			return -1;
+		}
+
+		memcpy(buf, b->buf, b->len);
+		b->buf = buf;
+		b->size = b->len + len + 1;
+		vsnprintf(b->buf + b->len, b->size - b->len, fmt, args);
+	}
+
+	b->len += len;
+
+	return 0;
+}
+
+/*
+ * Creates or truncates the given trace file and starts writing NL_TRACE()
+ * records to it.  Returns 0 on success, EBUSY if a trace file is already
+ * open, or another errno-like value on error.
+ */
+int nl_trace_open(const char *filename)
+{
+	struct trace_file_header header = {
+		.magic = TRACE_MAGIC,
+		.byte_order = TRACE_BYTE_ORDER,
+		.version = TRACE_VERSION,
+		.header_size = sizeof(struct trace_file_header),
+	};
+	struct timespec t;
+	int fd;
+	int ret;
+
+	if(CHECK_NULL(filename)) {
+		return EFAULT;
+	}
+
+	pthread_mutex_lock(&trace_lock);
+
+	if(trace_fd >= 0) {
+		pthread_mutex_unlock(&trace_lock);
+		return EBUSY;
+	}
+
+	fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	if(fd < 0) {
+		ret = errno;
+		ERRNO_OUT("Error opening trace file %s", filename);
+		pthread_mutex_unlock(&trace_lock);
+		return ret;
+	}
+
+	memcpy(header.sizes, trace_sizes, sizeof(header.sizes));
+	header.realtime_ns = trace_clock(CLOCK_REALTIME, &t);
+	header.monotonic_ns = trace_clock(CLOCK_MONOTONIC, &t);
+
+	if(trace_write(fd, &header, sizeof(header))) {
+		ret = errno;
+		ERRNO_OUT("Error writing trace file header to %s", filename);
+		close(fd);
+		pthread_mutex_unlock(&trace_lock);
+		return ret;
+	}
+
+	// Formats and threads are written again to each new file
+	__atomic_add_fetch(&trace_generation, 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&trace_fd, fd, __ATOMIC_RELEASE);
+
+	pthread_mutex_unlock(&trace_lock);
+
+	return 0;
+}
+
+/*
+ * Writes any queued trace records and closes the trace file.  Must not be
+ * called while other threads may be calling NL_TRACE().  Returns 0 on success
+ * (including if no trace file was open), or an errno-like value on error.
+ */
+int nl_trace_close(void)
+{
+	int ret = 0;
+	int fd;
+
+	pthread_mutex_lock(&trace_lock);
+
+	fd = trace_fd;
+	if(fd >= 0) {
+		__atomic_store_n(&trace_fd, -1, __ATOMIC_RELEASE);
+
+		nl_log_flush();
+
+		if(close(fd)) {
+			ret = errno;
+			ERRNO_OUT("Error closing trace file");
+		}
+	}
+
+	pthread_mutex_unlock(&trace_lock);
+
+	return ret;
+}
+
+/*
+ * Implementation of NL_TRACE().  The format pointer must be the same for
+ * every call with a given nl_trace_format.
+ */
+void __attribute__ ((__format__(__printf__, 2, 3))) nl_trace(struct nl_trace_format *format, const char *fmt, ...)
+{
+	int fd = __atomic_load_n(&trace_fd, __ATOMIC_ACQUIRE);
+	unsigned int generation;
+	struct trace_buf b;
+	struct timespec t;
+	const char *name;
+	va_list args;
+	int err;
+	int ret;
+
+	if(fd < 0) {
+		return;
+	}
+
+	err = errno;
+	generation = __atomic_load_n(&trace_generation, __ATOMIC_ACQUIRE);
+
+	if(__atomic_load_n(&format->generation, __ATOMIC_ACQUIRE) != generation &&
+			trace_register_format(format, fmt, generation)) {
+		errno = err;
+		return;
+	}
+
+	name = nl_threadname();
+	if(trace_thread_generation != generation || strncmp(name, trace_thread_name, sizeof(trace_thread_name))) {
+		trace_register_thread(fd, generation, name);
+	}
+
+	va_start(args, fmt);
+	if(format->id == TRACE_TEXT_ID) {
+		trace_begin(&b, TRACE_TEXT, 0, trace_clock(CLOCK_MONOTONIC, &t));
+		ret = trace_store_text(&b, fmt, args);
+	} else {
+		trace_begin(&b, TRACE_EVENT, format->id, trace_clock(CLOCK_MONOTONIC, &t));
+		ret = trace_store_args(&b, format, args);
+	}
+	va_end(args);
+
+	if(ret) {
+		// Out of memory for a long string
+		if(b.buf != b.stack) {
+			free(b.buf);
+		}
+	} else {
+		trace_end(&b, fd, &t, 0);
+	}
+
+	errno = err;
+}
+
+// Splits fmt into pieces that each end with at most one conversion.
+// Returns 0 on success, -1 on error.
+static int trace_split_format(struct trace_decoded_format *df, const char *fmt)
+{
+	struct trace_spec spec;
+	const char *start = fmt;
+	size_t count = 1;
+
+	for(const char *p = fmt; *p; p++) {
+		count += *p == '%';
+	}
+
+	df->pieces = calloc(count, sizeof(df->pieces[0]));
+	if(df->pieces == NULL) {
+		ERRNO_OUT("Error allocating trace format pieces");
+		return -1;
+	}
+
+	for(const char *p = strchr(fmt, '%'); p != NULL; p = strchr(spec.end, '%')) {
+		if(trace_parse_spec(p, &spec)) {
+			ERROR_OUT("Trace file contains an unsupported format: %s\n", fmt);
+			return -1;
+		}
+
+		if(spec.type) {
+			struct trace_piece *piece = &df->pieces[df->count++];
+
+			piece->fmt = strndup(start, spec.end - start);
+			piece->type = spec.type;
+			piece->stars = spec.stars;
+			if(piece->fmt == NULL) {
+				ERRNO_OUT("Error copying trace format piece");
+				return -1;
+			}
+
+			start = spec.end;
+		}
+	}
+
+	if(*start) {
+		struct trace_piece *piece = &df->pieces[df->count++];
+		char *out;
+
+		piece->fmt = strdup(start);
+		if(piece->fmt == NULL) {
+			ERRNO_OUT("Error copying trace format piece");
+			return -1;
+		}
+
+		// Unescape %% since the literal is written without printf
+		out = piece->fmt;
+		for(const char *in = start; *in; in++) {
+			*out++ = *in;
+			if(in[0] == '%' && in[1] == '%') {
+				in++;
+			}
+		}
+		*out = 0;
+	}
+
+	return 0;
+}
+
+// Copies size bytes from *data to value, advancing *data.  Returns 0 on
+// success, -1 if that would pass end.
+static int trace_read(const char **data, const char *end, void *value, size_t size)
+{
+	if((size_t)(end - *data) < size) {
+		return -1;
+	}
+
+	memcpy(value, *data, size);
+	*data += size;
+
+	return 0;
+}
+
+// Calls fprintf() with the given piece format, its '*' arguments, and value.
+#define TRACE_PRINT(out, piece, star, value) ( \
+		(piece)->stars == 0 ? fprintf((out), (piece)->fmt, (value)) : \
+		(piece)->stars == 1 ? fprintf((out), (piece)->fmt, (star)[0], (value)) : \
+		fprintf((out), (piece)->fmt, (star)[0], (star)[1], (value)) \
+		)
+
+// Writes the message of an event record using the pieces of its format.
+// Returns 0 on success, -1 if the record is truncated.
+static int trace_print_event(FILE *out, const struct trace_decoded_format *df, const char *data, const char *end)
+{
+	for(size_t i = 0; i < df->count; i++) {
+		const struct trace_piece *piece = &df->pieces[i];
+		int star[2] = { 0, 0 };
+
+		for(unsigned int s = 0; s < piece->stars; s++) {
+			if(trace_read(&data, end, &star[s], sizeof(star[s]))) {
+				return -1;
+			}
+		}
+
+		switch(piece->type) {
+			case 0:
+				fputs(piece->fmt, out);
+				break;
+
+#define TRACE_CASE(arg, type) \
+			case arg: \
+				{ \
+					type v; \
+					if(trace_read(&data, end, &v, sizeof(v))) { \
+						return -1; \
+					} \
+					TRACE_PRINT(out, piece, star, v); \
+				} \
+				break;
+
+			TRACE_CASE(ARG_INT, int)
+			TRACE_CASE(ARG_LONG, long)
+			TRACE_CASE(ARG_LLONG, long long)
+			TRACE_CASE(ARG_SIZE, size_t)
+			TRACE_CASE(ARG_INTMAX, intmax_t)
+			TRACE_CASE(ARG_PTRDIFF, ptrdiff_t)
+			TRACE_CASE(ARG_DOUBLE, double)
+			TRACE_CASE(ARG_LDOUBLE, long double)
+			TRACE_CASE(ARG_PTR, void *)
+
+#undef TRACE_CASE
+
+			case ARG_STRING:
+			case ARG_STRING_STAR:
+				{
+					uint32_t len;
+					char *s = NULL;
+
+					if(trace_read(&data, end, &len, sizeof(len))) {
+						return -1;
+					}
+					if(len != UINT32_MAX) {
+						if((size_t)(end - data) < len) {
+							return -1;
+						}
+						s = strndup(data, len);
+						if(s == NULL) {
+							ERRNO_OUT("Error copying trace string");
+							return -1;
+						}
+						data += len;
+					}
+
+					TRACE_PRINT(out, piece, star, s);
+					free(s);
+				}
+				break;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Reads a trace file written by NL_TRACE() from in, and writes each record to
+ * out as the text that nl_fptmf() would have written, using the local time
+ * zone of the decoding process.  Returns 0 on success, or -1 if in is not a
+ * valid trace file or an error occurs.
+ */
+int nl_trace_decode(FILE *in, FILE *out)
+{
+	struct trace_decoded_format *formats = NULL;
+	size_t format_count = 0;
+	char (*threads)[16] = NULL;
+	size_t thread_count = 0;
+	struct trace_file_header header;
+	char *data = NULL;
+	int ret = -1;
+
+	if(CHECK_NULL(in) || CHECK_NULL(out)) {
+		return -1;
+	}
+
+	if(fread(&header, sizeof(header), 1, in) != 1 || memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic))) {
+		ERROR_OUT("Input is not a trace file\n");
+		return -1;
+	}
+	if(header.byte_order != TRACE_BYTE_ORDER || header.version != TRACE_VERSION ||
+			header.header_size != sizeof(header) || memcmp(header.sizes, trace_sizes, sizeof(trace_sizes))) {
+		ERROR_OUT("Trace file version %u from an incompatible machine\n", header.version);
+		return -1;
+	}
+
+	for(;;) {
+		struct trace_record rec;
+		const char *name = "";
+		struct timespec t;
+		char prefix[128];
+		int64_t ns;
+		char *end;
+
+		if(fread(&rec, sizeof(rec), 1, in) != 1) {
+			if(ferror(in)) {
+				ERRNO_OUT("Error reading trace file");
+			} else {
+				ret = 0;
+			}
+			break;
+		}
+
+		if(rec.size < sizeof(rec) || rec.size > TRACE_MAX_RECORD) {
+			ERROR_OUT("Invalid trace record size %u\n", rec.size);
+			break;
+		}
+
+		free(data);
+		data = malloc(rec.size - sizeof(rec) + 1);
+		if(data == NULL) {
+			ERRNO_OUT("Error allocating trace record");
+			break;
+		}
+		if(fread(data, rec.size - sizeof(rec), 1, in) != 1 && rec.size > sizeof(rec)) {
+			ERROR_OUT("Trace file ends in the middle of a record\n");
+			break;
+		}
+		end = data + rec.size - sizeof(rec);
+		*end = 0;
+
+		switch(rec.type) {
+			case TRACE_FORMAT:
+				if(rec.id >= format_count) {
+					size_t count = MAX_NUM(rec.id + 1, format_count * 2);
+					struct trace_decoded_format *f = realloc(formats, count * sizeof(*f));
+
+					if(f == NULL) {
+						ERRNO_OUT("Error allocating trace formats");
+						goto out;
+					}
+					memset(f + format_count, 0, (count - format_count) * sizeof(*f));
+					formats = f;
+					format_count = count;
+				}
+
+				if(formats[rec.id].pieces == NULL && trace_split_format(&formats[rec.id], data)) {
+					goto out;
+				}
+				continue;
+
+			case TRACE_THREAD:
+				if(rec.thread >= thread_count) {
+					size_t count = MAX_NUM(rec.thread + 1, thread_count * 2);
+					char (*th)[16] = realloc(threads, count * sizeof(*th));
+
+					if(th == NULL) {
+						ERRNO_OUT("Error allocating trace threads");
+						goto out;
+					}
+					memset(th + thread_count, 0, (count - thread_count) * sizeof(*th));
+					threads = th;
+					thread_count = count;
+				}
+
+				snprintf(threads[rec.thread], sizeof(threads[0]), "%s", data);
+				continue;
+
+			case TRACE_EVENT:
+			case TRACE_TEXT:
+				break;
+
+			default:
+				// Skip record types from future versions
+				continue;
+		}
+
+		if(rec.thread < thread_count) {
+			name = threads[rec.thread];
+		}
+
+		ns = header.realtime_ns + (rec.ns - header.monotonic_ns);
+		t = (struct timespec){ .tv_sec = ns / 1000000000, .tv_nsec = ns % 1000000000 };
+		nl_log_format_prefix(prefix, sizeof(prefix), &t, name);
+		fputs(prefix, out);
+
+		if(rec.type == TRACE_TEXT) {
+			fputs(data, out);
+		} else if(rec.id >= format_count || formats[rec.id].pieces == NULL) {
+			fprintf(out, "[unknown trace format %u]\n", rec.id);
+		} else if(trace_print_event(out, &formats[rec.id], data, end)) {
+			ERROR_OUT("Truncated arguments in trace record for format %u\n", rec.id);
+			goto out;
+		}
+	}
+
+out:
+	for(size_t i = 0; i < format_count; i++) {
+		for(size_t j = 0; j < formats[i].count; j++) {
+			free(formats[i].pieces[j].fmt);
+		}
+		free(formats[i].pieces);
+	}
+	free(formats);
+	free(threads);
+	free(data);
+
+	return ret;
+}
@@ -2,7 +2,8 @@
  * Wrapper for the curl (and possibly wget in the future) command.
  *
  * This allows process isolation of web requests, but is slower than using
- * libcurl directly would have been.
+ * libcurl directly.  Contexts created with NL_URL_BACKEND_LIBCURL use the
+ * libcurl backend in url_req_curl.c instead of starting processes.
  *
  * Modified from curl_stdin.c in the learning_libcurl experiment repository.
  *
@@ -20,18 +21,7 @@
 #include <sys/stat.h>
 #include <sys/resource.h>
 
-// C99 lacks u_char
-#define u_char uint8_t
-#include <event.h>
-#undef u_char
-
-#include "nlutils.h"
-
-// TODO: Support streaming responses instead of a single call to a callback
-// (see commit 6b78f209175c4a7bd2ccc59a843390080d46dde1 for a better starting
-// point for the read event code)
-
-// TODO: Implement a response size limit, return an error if the limit is exceeded
+#include "url_req_internal.h"
 
 // TODO: Allow using wget as a backend (wget can be faster)
 // See the -O- and -S options to wget (headers are indented by two spaces on stderr)
@@ -39,104 +29,25 @@
 
 // TODO: Extract a generic libevent+nl_popen3 combination wrapper
 
-// TODO: Add a cancel_req() function?  Would need to provide a way for callers
-// to identify requests.
-
 // TODO: Consider supporting a chroot jail for curl/wget process
 
-// TODO: Find a natural way to split this into multiple files?
-
 // TODO: Support specifying the content-type for multipart form data, and
 // prevent unwanted content types from sneaking in through form parameters
 
-// TODO: maybe just switch to using libcurl directly and forego process isolation
-
-
-// Timeout for initial DNS lookup and connection, in milliseconds
-#define DEFAULT_CONNECT_TIMEOUT 30000
-
-// Timeout for curl/wget to finish the entire request, in milliseconds
-// The read timeout for libevent is based on this value
-#define DEFAULT_REQUEST_TIMEOUT 30000
 
 // Timeout for the library to start talking to the curl process, in milliseconds
 #define CURL_OPTION_FIFO_TIMEOUT 1000
 
 
-// Library-global handles for libevent, threads, control pipe, etc.
-struct nl_url_req;
-struct nl_url_ctx {
-	// Thread management
-	struct nl_thread_ctx *thread_ctx; // nl_thread thread tracking context
-	struct nl_thread *event_thread; // event processing thread
-	pthread_mutex_t lock; // struct nl_url_ctx access lock
-
-	// libevent event loop
-	struct event_base *evloop;
-
-	// Pipe for sending requests to the event thread
-	struct event pipe_ev; // Pipe processing event handle for event loop
-	int ev_pipe_readfd; // Read by event thread
-	int ev_pipe_writefd; // Written by control functions
-
-	// List of active requests
-	struct nl_fifo *reqlist;
-
-	// Library state tracking
-	unsigned int running:1; // Set to 1 while event thread is running
-	unsigned int stopping:1; // Set to 1 if nl_url_req_stop() has been called
-	unsigned int shutdown_when_done:1; // Set to 1 when final request termination should cause loop shutdown
-};
-
-
-// Request-specific internal data
-struct nl_url_req {
-	struct nl_url_ctx *ctx; // URL request context
-
-	int read_timeout; // libevent read timeout in seconds (based on request timeout)
-
-	nl_url_callback cb; // Completion callback - will be called from event thread with context lock held
-	void *cb_data; // User data passed to callback
-
-	// PID of shell that calls curl process
-	pid_t pid;
-
-	// File handles and libevent buffers for reading from curl
-	struct bufferevent *outbuf;
-	struct bufferevent *errbuf;
-	int readfd;
-	int errfd;
-
-	// Request parameters from the caller (cloned, owned by url_req, freed by free_params())
-	struct nl_url_params params;
-
-	// Request results
-	struct nl_url_result result;
-
-	// Internal state keeping
-	unsigned int has_body:1; // Whether the request has a body (allows zero-sized bodies)
-	unsigned int out_eof:1; // Whether the process's STDOUT has encountered EOF
-	unsigned int err_eof:1; // Whether the process's STDERR has encountered EOF
-};
-
-
 static void nl_url_req_stop(struct nl_url_ctx *ctx);
 static void free_req(struct nl_url_req *req);
+static void check_process(struct nl_url_req *req);
+static void start_queued(struct nl_url_ctx *ctx);
 
 
-// Wraps ctx_lock_impl to provide file/line information for debugging
-#define ctx_lock(ctx) do { \
-	ctx_lock_impl(ctx, __FILE__, __LINE__); \
-} while(0);
-
-// Wraps ctx_unlock_impl to provide file/line information for debugging
-#define ctx_unlock(ctx) do { \
-	ctx_unlock_impl(ctx, __FILE__, __LINE__); \
-} while(0);
-
 // Locks the given struct nl_url_ctx's access lock.  Aborts the application if
 // locking fails.
-static void ctx_lock_impl(struct nl_url_ctx *ctx, char *file, int line)
+void url_req_lock_impl(struct nl_url_ctx *ctx, char *file, int line)
 {
 	int ret;
 
@@ -150,7 +61,7 @@ static void ctx_lock_impl(struct nl_url_ctx *ctx, char *file, int line)
 
 // Unlocks the given struct nl_url_ctx's access lock.  Aborts the application
 // if unlocking fails.
-static void ctx_unlock_impl(struct nl_url_ctx *ctx, char *file, int line)
+void url_req_unlock_impl(struct nl_url_ctx *ctx, char *file, int line)
 {
 	int ret;
 
@@ -162,16 +73,68 @@ static void ctx_unlock_impl(struct nl_url_ctx *ctx, char *file, int line)
 	}
 }
 
+// Parses a "Name: value" header line (without any "> " or "< " prefix or line
+// ending) into the given hash.  An HTTP status line sets the request's result
+// code if it has not been set yet.  Returns 0 on success, -1 on error.
+int url_req_parse_header(struct nl_url_req *req, struct nl_hash *headers, struct nl_raw_data line)
+{
+	char *key;
+	char *value;
+
+	value = memchr(line.data, ':', line.size);
+
+	if(value != NULL) {
+		key = nl_strndup_term(line.data, value - line.data);
+		if(key == NULL) {
+			ERROR_OUT("Error duplicating header key.\n");
+			return -1;
+		}
+
+		// Skip the separating character and any spaces
+		value++;
+		while(value - line.data < (ptrdiff_t)line.size && *value == ' ') {
+			value++;
+		}
+
+		value = nl_strndup_term(value, line.size - (value - line.data));
+		if(value == NULL) {
+			ERROR_OUT("Error duplicating header %s value.\n", key);
+			free(key);
+			return -1;
+		}
+
+		if(nl_hash_set(headers, key, value)) {
+			ERROR_OUT("Error adding header %s to list of headers.\n", key);
+			free(key);
+			free(value);
+			return -1;
+		}
+
+		free(key);
+		free(value);
+	} else if(headers == req->result.response_headers && line.size >= 5 &&
+			!memcmp(line.data, "HTTP/", 5) && req->result.code == 0) {
+		value = memchr(line.data, ' ', line.size);
+		if(value != NULL) {
+			// strtol() is OK here because the line can be assumed to be
+			// terminated by a newline character or a NUL byte
+			req->result.code = strtol(value, NULL, 10);
+		} else {
+			ERROR_OUT("Missing HTTP response code in HTTP response line.\n");
+		}
+	}
+
+	return 0;
+}
+
 // Called indirectly by check_process() for each line in the curl/wget output
 static int header_line_callback(struct nl_raw_data line, void *cb_data)
 {
 	struct nl_url_req *req = cb_data;
 	struct nl_hash *headers = NULL;
-	char *key;
-	char *value;
 
 	// TODO: wget support is different here
-	if(line.size > 0) {
+	if(line.size >= 2) {
 		if(line.data[0] == '>') {
 			headers = req->result.request_headers;
 		} else if(line.data[0] == '<') {
@@ -179,50 +142,13 @@ static int header_line_callback(struct nl_raw_data line, void *cb_data)
 		}
 	}
 
-	// Add header name and value to appropriate list of headers
+	// Add header name and value to appropriate list of headers, skipping
+	// the first two bytes for "> " or "< "
 	if(headers) {
-		// Skip first two bytes for "> " or "< ", then find ':'
-		value = memchr(line.data + 2, ':', line.size - 2);
-
-		if(value != NULL) {
-			key = nl_strndup_term(line.data + 2, value - line.data - 2);
-			if(key == NULL) {
-				ERROR_OUT("Error duplicating header key.\n");
-				return -1;
-			}
-
-			// Skip the separating character and any spaces
-			value++;
-			while(*value == ' ' && value - line.data < (ptrdiff_t)line.size) {
-				value++;
-			}
-
-			value = nl_strndup_term(value, line.size - (value - line.data));
-			if(value == NULL) {
-				ERROR_OUT("Error duplicating header %s value.\n", key);
-				free(key);
-				return -1;
-			}
-
-			if(nl_hash_set(headers, key, value)) {
-				ERROR_OUT("Error adding header %s to list of headers.\n", key);
-				free(key);
-				free(value);
-				return -1;
-			}
-
-			free(key);
-			free(value);
-		} else if(!nl_strstart(line.data, "< HTTP/") && req->result.code == 0) {
-			value = memchr(line.data + 2, ' ', line.size - 2);
-			if(value != NULL) {
-				// atoi() is OK here because the line can be assumed to be
-				// terminated by a newline character or a NUL byte
-				req->result.code = atoi(value);
-			} else {
-				ERROR_OUT("Missing HTTP response code in HTTP response line.\n");
-			}
-		}
+		return url_req_parse_header(req, headers, (struct nl_raw_data){
+				.data = line.data + 2,
+				.size = line.size - 2
+				});
 	}
 
 	// TODO: possibly track request state using non-header messages (see
@@ -237,8 +163,8 @@ static int header_line_callback(struct nl_raw_data line, void *cb_data)
 }
 
 // Stores information about the CURL error indicated by retcode into a string.
-// The curl(1) manual page lists errors.
-static void store_curl_error(char *str, size_t maxlen, int retcode)
+// The curl(1) manual page lists errors, which match libcurl's CURLcode values.
+void url_req_store_curl_error(char *str, size_t maxlen, int retcode)
 {
 	char *msg;
 
@@ -283,6 +209,10 @@ static void store_curl_error(char *str, size_t maxlen, int retcode)
 			msg = "Network error";
 			break;
 
+		case 63:
+			msg = "Maximum response size exceeded";
+			break;
+
 		case 67:
 			msg = "Login failed";
 			break;
@@ -300,14 +230,27 @@ static void store_curl_error(char *str, size_t maxlen, int retcode)
 }
 
 // Kills a request's curl process (if any) and waits for it to exit.  Returns
-// the return value of nl_wait_get_return(), or 0 if pid was <= 0.  Sets the
-// request's pid to 0 afterward.
+// the return value of nl_wait_get_return() (or the value stored by the reaper
+// if the process already exited), or 0 if pid was <= 0.  Sets the request's
+// pid to 0 afterward.
 static int kill_req_and_wait(struct nl_url_req *req)
 {
+	if(req->exited) {
+		req->exited = 0;
+		req->pid = 0;
+		return req->exit_ret;
+	}
+
 	if(req->pid <= 0) {
 		return 0;
 	}
 
+	// The reaper must not reap a process that is waited for here
+	if(req->watched) {
+		nl_reaper_unwatch(req->ctx->reaper, req->pid);
+		req->watched = 0;
+	}
+
 	if(kill(req->pid, SIGKILL)) {
 		ERRNO_OUT("Error killing request process %ld for %s", (long)req->pid, GUARD_NULL(req->result.url));
 	}
@@ -326,13 +269,13 @@ static int kill_req_and_wait(struct nl_url_req *req)
 // the request callback and frees the request if the request has completed.
 static void check_process(struct nl_url_req *req)
 {
-	struct nl_url_ctx *ctx = req->ctx;
 	struct evbuffer *stdout_evbuf = EVBUFFER_INPUT(req->outbuf);
 	struct evbuffer *stderr_evbuf = EVBUFFER_INPUT(req->errbuf);
 	long pid;
 	int ret;
 
-	if(req->result.timeout || req->result.error || (req->out_eof && req->err_eof)) {
+	// A watched process's exit status arrives through process_exited()
+	if(req->result.timeout || req->result.error || (req->out_eof && req->err_eof && !req->watched)) {
 		DEBUG_OUT("Request %s finished.  Checking status.\n", req->result.url);
 
 		// Ensure the process has exited (e.g. in case of timeout).
@@ -346,15 +289,20 @@ static void check_process(struct nl_url_req *req)
 			ret = -(ret + 100);
 			ERROR_OUT("Request process %ld was killed by signal %d (%s) for %s\n",
 					pid, ret, strsignal(ret), req->result.url);
-			snprintf(req->result.errmsg, sizeof(req->result.errmsg), "Request interrupted by signal %d (%s)",
-					ret, strsignal(ret));
+			if(req->result.errmsg[0] == 0) {
+				snprintf(req->result.errmsg, sizeof(req->result.errmsg), "Request interrupted by signal %d (%s)",
+						ret, strsignal(ret));
+			}
 			req->result.error = 1;
 		} else if(ret == 28) {
 			ERROR_OUT("Request timed out by curl for %s\n", req->result.url);
 			snprintf(req->result.errmsg, sizeof(req->result.errmsg), "Request timed out");
 			req->result.timeout = 1;
+		} else if(ret == 63) {
+			// curl rejected the response's Content-Length (--max-filesize)
+			url_req_too_large(req);
 		} else if(ret > 0) {
-			store_curl_error(req->result.errmsg, sizeof(req->result.errmsg), ret);
+			url_req_store_curl_error(req->result.errmsg, sizeof(req->result.errmsg), ret);
 			ERROR_OUT("Request process %ld had curl error (%s) for %s\n",
 					pid, req->result.errmsg, req->result.url);
 			req->result.error = 1;
@@ -368,6 +316,11 @@ static void check_process(struct nl_url_req *req)
 		evbuffer_unfreeze(stdout_evbuf, 0);
 #endif /* LIBEVENT_VERSION_NUMBER */
 
+		// Discard a partial body that exceeded a size limit or was cancelled
+		if(req->result.too_large || req->result.cancelled) {
+			evbuffer_drain(stdout_evbuf, EVBUFFER_LENGTH(stdout_evbuf));
+		}
+
 		// Ensure buffers are 0-terminated, then parse headers and save body if successful
 		if(evbuffer_add(stderr_evbuf, "", 1) || evbuffer_add(stdout_evbuf, "", 1)) {
 			ERROR_OUT("Error adding terminating 0 byte to url_req libevent data buffers\n");
@@ -391,22 +344,366 @@ static void check_process(struct nl_url_req *req)
 		evbuffer_freeze(stdout_evbuf, 0);
 #endif /* LIBEVENT_VERSION_NUMBER */
 
-		// Call the request callback, if any
-		if(req->cb != NULL) {
-			req->cb(&req->result, req->cb_data);
+		url_req_finish(req);
+	}
+}
+
+// Called by the context's reaper when a request's curl process exits.
+static void process_exited(pid_t pid, int ret, void *cb_data)
+{
+	struct nl_url_req *req = cb_data;
+
+	(void)pid; // only used for debugging
+	DEBUG_OUT("Request process %ld for %s exited with %d\n", (long)pid, req->result.url, ret);
+
+	req->watched = 0;
+	req->exited = 1;
+	req->exit_ret = ret;
+
+	check_process(req);
+}
+
+// Called by libevent when the context's reaper has exited processes to reap.
+static void reaper_handler(int fd, short evtype, void *cbdata)
+{
+	struct nl_url_ctx *ctx = cbdata;
+
+	(void)fd; // unused parameter
+	(void)evtype; // unused parameter
+
+	nl_reaper_reap(ctx->reaper);
+}
+
+// Calls a streaming request's headers callback, if it has one and it has not
+// been called yet.
+void url_req_headers_ready(struct nl_url_req *req)
+{
+	if(!req->headers_done) {
+		req->headers_done = 1;
+
+		if(req->params.headers_cb != NULL) {
+			req->params.headers_cb(&req->result, req->cb_data);
 		}
+	}
+}
+
+// Sets the result's error, too_large, and message for a response that
+// exceeded the request's max_response_size.
+void url_req_too_large(struct nl_url_req *req)
+{
+	ERROR_OUT("Response from %s exceeded the %zu byte limit\n", req->result.url, req->params.max_response_size);
+	snprintf(req->result.errmsg, sizeof(req->result.errmsg), "Response exceeded the %zu byte size limit",
+			req->params.max_response_size);
+	req->result.too_large = 1;
+	req->result.error = 1;
+}
+
+// Counts size more bytes of response body against the request's size limit
+// and, if stored is nonzero (the bytes stay in memory until the request
+// finishes), the context's memory budget.  Returns 0 if the request may
+// continue, or -1 with the result's error, too_large, and message set if it
+// must be stopped.
+int url_req_count_body(struct nl_url_req *req, size_t size, int stored)
+{
+	struct nl_url_ctx *ctx = req->ctx;
 
-		free_req(req);
+	if(req->params.max_response_size && req->body_bytes + size > req->params.max_response_size) {
+		url_req_too_large(req);
+		return -1;
+	}
+	req->body_bytes += size;
 
-		// Shut down the event loop if this was the last request and
-		// shutdown was requested.
+	if(stored) {
 		ctx_lock(ctx);
-		if(ctx->shutdown_when_done && ctx->reqlist->count == 0) {
-			DEBUG_OUT("Last request finished; url_req exiting.\n");
-			nl_url_req_stop(ctx);
+
+		if(ctx->memory_budget && ctx->buffered + size > ctx->memory_budget) {
+			ctx_unlock(ctx);
+
+			ERROR_OUT("Response from %s exceeded the url_req memory budget of %zu bytes\n",
+					req->result.url, ctx->memory_budget);
+			snprintf(req->result.errmsg, sizeof(req->result.errmsg),
+					"Response exceeded the %zu byte url_req memory budget", ctx->memory_budget);
+			req->result.too_large = 1;
+			req->result.error = 1;
+			return -1;
 		}
+
+		ctx->buffered += size;
+		req->buffered += size;
+
 		ctx_unlock(ctx);
 	}
+
+	return 0;
+}
+
+// Passes a chunk of a streaming request's body to its data callback.  Returns
+// the callback's enum nl_url_stream_status value.  Sets the request's paused
+// flag if the callback was busy, or the result's error and message if it
+// aborted.
+int url_req_stream_data(struct nl_url_req *req, const char *data, size_t size)
+{
+	int ret;
+
+	url_req_headers_ready(req);
+
+	// Check the size limit before the callback sees the data, but count the
+	// data only once it is consumed
+	if(req->params.max_response_size && req->body_bytes + size > req->params.max_response_size) {
+		url_req_too_large(req);
+		return NL_URL_STREAM_ABORT;
+	}
+
+	ret = req->params.data_cb(&req->result, data, size, req->cb_data);
+	switch(ret) {
+		case NL_URL_STREAM_OK:
+			url_req_count_body(req, size, 0);
+			break;
+
+		case NL_URL_STREAM_BUSY:
+			// nl_url_req_resume() may be called from another thread
+			ctx_lock(req->ctx);
+			req->paused = 1;
+			ctx_unlock(req->ctx);
+			break;
+
+		default:
+			if(ret != NL_URL_STREAM_ABORT) {
+				ERROR_OUT("Invalid data callback return value %d for %s; aborting\n", ret, req->result.url);
+			}
+
+			snprintf(req->result.errmsg, sizeof(req->result.errmsg), "Response aborted by data callback");
+			req->result.error = 1;
+			ret = NL_URL_STREAM_ABORT;
+			break;
+	}
+
+	return ret;
+}
+
+// Calls the request callback, frees the request, and stops the event loop if
+// this was the last request after nl_url_req_shutdown().  Must be called from
+// the event thread without the context lock held.
+void url_req_finish(struct nl_url_req *req)
+{
+	struct nl_url_ctx *ctx = req->ctx;
+
+	// A streaming request with an empty body still gets its headers callback
+	if(req->params.data_cb != NULL && !req->result.error && !req->result.timeout) {
+		url_req_headers_ready(req);
+	}
+
+	// Call the request callback, if any
+	if(req->cb != NULL) {
+		req->cb(&req->result, req->cb_data);
+	}
+
+	free_req(req);
+
+	// Give the request's slot to the next queued request, if any
+	start_queued(ctx);
+
+	// Shut down the event loop if this was the last request and
+	// shutdown was requested.
+	ctx_lock(ctx);
+	if(ctx->shutdown_when_done && ctx->reqlist->count == 0) {
+		DEBUG_OUT("Last request finished; url_req exiting.\n");
+		nl_url_req_stop(ctx);
+	}
+	ctx_unlock(ctx);
+}
+
+// nl_split_lines() callback for the response headers that precede a streaming
+// request's body in curl's --include output.
+static int stream_header_line(struct nl_raw_data line, void *cb_data)
+{
+	struct nl_url_req *req = cb_data;
+
+	if(line.size == 0) {
+		return 0;
+	}
+
+	return url_req_parse_header(req, req->result.response_headers, line);
+}
+
+// Parses response headers from, then passes body data in, a streaming
+// request's curl stdout buffer.  Pauses reading if the data callback is busy.
+// Frees the request if the data callback aborts it.
+static void stream_process_output(struct nl_url_req *req)
+{
+	struct evbuffer *evbuf = EVBUFFER_INPUT(req->outbuf);
+	size_t len;
+
+	// Non-HTTP URLs have no headers in curl's output
+	while(!req->headers_done && !nl_strstart(req->result.url, "http")) {
+		unsigned char *end = evbuffer_find(evbuf, (unsigned char *)"\r\n\r\n", 4);
+		if(end == NULL) {
+			// Wait for the rest of the headers
+			return;
+		}
+
+		// Each 1xx informational response has its own header block
+		len = end - EVBUFFER_DATA(evbuf);
+		req->result.code = 0;
+		nl_split_lines((struct nl_raw_data){.data = (char *)EVBUFFER_DATA(evbuf), .size = len}, stream_header_line, req);
+		evbuffer_drain(evbuf, len + 4);
+
+		if(req->result.code < 100 || req->result.code >= 200) {
+			url_req_headers_ready(req);
+		}
+	}
+
+	while(!req->paused && (len = EVBUFFER_LENGTH(evbuf)) > 0) {
+		switch(url_req_stream_data(req, (char *)EVBUFFER_DATA(evbuf), len)) {
+			case NL_URL_STREAM_OK:
+				evbuffer_drain(evbuf, len);
+				break;
+
+			case NL_URL_STREAM_BUSY:
+				// curl blocks writing to the pipe until reading
+				// resumes, so neither its --max-time nor the stderr
+				// read timeout can fire; timeout_ev still does
+				bufferevent_disable(req->outbuf, EV_READ);
+				bufferevent_settimeout(req->errbuf, 0, 0);
+				return;
+
+			default:
+				check_process(req);
+				return;
+		}
+	}
+}
+
+// Called by libevent when a non-streaming request's curl process writes to
+// stdout.  Stops the request early if the body exceeds a size limit.
+static void body_read(struct bufferevent *buf, void *cbdata)
+{
+	struct nl_url_req *req = cbdata;
+	size_t len = EVBUFFER_LENGTH(EVBUFFER_INPUT(buf));
+
+	if(len > req->body_bytes && url_req_count_body(req, len - req->body_bytes, 1)) {
+		check_process(req);
+	}
+}
+
+// Called by libevent when a streaming request's curl process writes to stdout.
+static void stream_read(struct bufferevent *buf, void *cbdata)
+{
+	(void)buf; // unused parameter
+
+	stream_process_output(cbdata);
+}
+
+// Resumes reading a streaming request paused by its data callback.  Called on
+// the event thread.
+static void resume_req(struct nl_url_req *req)
+{
+	DEBUG_OUT("Resuming %s\n", req->result.url);
+
+	if(req->curl) {
+		url_req_curl_resume(req);
+		return;
+	}
+
+	bufferevent_settimeout(req->errbuf, req->read_timeout, 0);
+	if(bufferevent_enable(req->outbuf, EV_READ)) {
+		ERROR_OUT("Error re-enabling read events on request %s stdout bufferevent.\n", req->result.url);
+		req->result.error = 1;
+		check_process(req);
+		return;
+	}
+
+	// Pass data that was buffered when the data callback was busy
+	stream_process_output(req);
+}
+
+// Stops a request cancelled by nl_url_req_cancel(), then calls its callback and
+// frees it.  Called on the event thread without the context lock held.
+static void cancel_req(struct nl_url_req *req)
+{
+	DEBUG_OUT("Cancelling %s\n", req->result.url);
+
+	req->result.error = 1;
+	req->result.cancelled = 1;
+	snprintf(req->result.errmsg, sizeof(req->result.errmsg), "Request cancelled");
+
+	if(req->curl) {
+		url_req_curl_cancel(req);
+	} else if(req->outbuf && req->errbuf) {
+		// Kills the curl process and discards its output
+		check_process(req);
+	} else {
+		// Cancelled before it was started
+		req->result.response_body = (struct nl_raw_data){ .data = "", .size = 0 };
+		url_req_finish(req);
+	}
+}
+
+// Returns 1 if req is in the context's list of requests, 0 otherwise.  The
+// context lock must be held.
+static int find_req(struct nl_url_ctx *ctx, struct nl_url_req *req)
+{
+	const struct nl_fifo_element *iter = NULL;
+	struct nl_url_req *r;
+
+	while((r = nl_fifo_next(ctx->reqlist, &iter)) != NULL) {
+		if(r == req) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+// Returns the request with the given handle, or NULL if it is not in the
+// context's list of requests.  The context lock must be held.
+static struct nl_url_req *find_handle(struct nl_url_ctx *ctx, uint64_t handle)
+{
+	const struct nl_fifo_element *iter = NULL;
+	struct nl_url_req *r;
+
+	while((r = nl_fifo_next(ctx->reqlist, &iter)) != NULL) {
+		if(r->handle == handle) {
+			return r;
+		}
+	}
+
+	return NULL;
+}
+
+// Marks a request as cancelled and tells the event thread to stop it.  The
+// context lock must be held.  Returns 0 on success (or if the request was
+// already being cancelled), EIO on error.
+static int request_cancel(struct nl_url_req *req)
+{
+	if(req->cancel_pending) {
+		return 0;
+	}
+
+	// The control pipe handler cancels requests with cancel_pending set
+	req->cancel_pending = 1;
+	if(write(req->ctx->ev_pipe_writefd, &req, sizeof(struct nl_url_req *)) != sizeof(struct nl_url_req *)) {
+		ERRNO_OUT("Error writing cancellation of %s to control pipe", req->result.url);
+		req->cancel_pending = 0;
+		return EIO;
+	}
+
+	return 0;
+}
+
+// Called by libevent when a curl process outlives its request timeout (e.g.
+// while blocked writing to a paused streaming request).
+static void request_timeout(int fd, short evtype, void *cbdata)
+{
+	struct nl_url_req *req = cbdata;
+
+	(void)fd; // unused parameter
+	(void)evtype; // unused parameter
+
+	snprintf(req->result.errmsg, sizeof(req->result.errmsg), "Request timed out");
+	req->result.timeout = 1;
+
+	check_process(req);
 }
 
 // Called by libevent when a request process's input fds have an error.
@@ -512,6 +809,9 @@ static void free_params(struct nl_url_params *params)
 	if(params->form) {
 		nl_hash_destroy(params->form);
 	}
+
+	free((char *)params->tag);
+	params->tag = NULL;
 }
 
 // Frees a request's memory, terminates its process, and releases resources.
@@ -522,6 +822,10 @@ static void free_req(struct nl_url_req *req)
 
 		kill_req_and_wait(req);
 
+		if(req->curl) {
+			url_req_curl_free_req(req);
+		}
+
 		if(req->readfd >= 0 && close(req->readfd)) {
 			ERRNO_OUT("Error closing STDOUT for %s", GUARD_NULL(req->result.url));
 		}
@@ -533,6 +837,26 @@ static void free_req(struct nl_url_req *req)
 			ERROR_OUT("Error removing request %s from request list.\n", req->result.url);
 		}
 
+		req->ctx->buffered -= req->buffered;
+		req->buffered = 0;
+
+		if(req->started) {
+			req->ctx->stats.in_flight--;
+			req->started = 0;
+		}
+
+		if(req->queued) {
+			if(nl_fifo_remove(req->ctx->pending[req->params.priority - NL_URL_PRIORITY_LOW], req)) {
+				ERROR_OUT("Error removing request %s from pending queue.\n", req->result.url);
+			}
+			req->ctx->stats.queued--;
+			req->queued = 0;
+		}
+
+		if(event_initialized(&req->timeout_ev)) {
+			evtimer_del(&req->timeout_ev);
+		}
+
 		if(req->outbuf) {
 			bufferevent_free(req->outbuf);
 			req->outbuf = NULL;
@@ -725,26 +1049,35 @@ error:
 	return -1;
 }
 
-// Securely creates a temporary directory and FIFO, storing the paths in string
-// pointers pointed to by parameters.  Both paths must be unlinked and their
-// strings free()d by the caller.  See fifo(7) and mkfifo(3) for more info.
+// Securely creates a temporary directory under $TMPDIR (or /tmp) and a FIFO in
+// it, storing the paths in string pointers pointed to by parameters.  Both
+// paths must be unlinked and their strings free()d by the caller.  See fifo(7)
+// and mkfifo(3) for more info.
 // TODO: move to stream.c
 static int temp_fifo(char **dir, char **fifo)
 {
 	char *fifo_name = NULL;
 	char *dir_name = NULL;
+	const char *tmpdir;
 	int dir_created = 0;
 
 	if(CHECK_NULL(dir) || CHECK_NULL(fifo)) {
 		return -1;
 	}
 
-	dir_name = strdup("/tmp/url.XXXXXX");
+	tmpdir = getenv("TMPDIR");
+	if(tmpdir == NULL || *tmpdir == 0) {
+		tmpdir = "/tmp";
+	}
+
+	dir_name = malloc(strlen(tmpdir) + sizeof("/url.XXXXXX"));
 	if(dir_name == NULL) {
 		ERRNO_OUT("Error allocating temporary directory name buffer");
 		goto error;
 	}
 
+	sprintf(dir_name, "%s/url.XXXXXX", tmpdir);
+
 	fifo_name = malloc(strlen(dir_name) + 10);
 	if(fifo_name == NULL) {
 		ERRNO_OUT("Error allocating temporary FIFO name buffer");
@@ -782,17 +1115,6 @@ error:
 	return -1;
 }
 
-// Sets the current thread's scheduler to SCHED_OTHER and the current process's
-// niceness to 0 if it is negative (for nl_url_req_add()).
-static void drop_priority_cb(void)
-{
-	// TODO: These two lines could be a useful function to put in exec.c
-	nl_set_thread_priority(NULL, SCHED_OTHER, 0);
-	setpriority(PRIO_PROCESS, 0, MAX_NUM(0, getpriority(PRIO_PROCESS, 0)));
-
-	// TODO: drop all possible privileges (need to give the nobody user access to the FIFO)
-}
-
 // Clones the given parameter structure into the request structure.  This uses
 // more memory and more allocations, but allows curl startup to occur on the
 // event thread.
@@ -829,6 +1151,18 @@ static int clone_params(struct nl_url_req *req, const struct nl_url_params *para
 	req->params.form_type = params->form_type;
 	req->params.connect_timeout = params->connect_timeout;
 	req->params.request_timeout = params->request_timeout;
+	req->params.headers_cb = params->headers_cb;
+	req->params.data_cb = params->data_cb;
+	req->params.max_response_size = params->max_response_size;
+	req->params.priority = params->priority;
+
+	if(params->tag) {
+		req->params.tag = strdup(params->tag);
+		if(req->params.tag == NULL) {
+			ERRNO_OUT("Error copying request tag");
+			return -1;
+		}
+	}
 
 	return 0;
 }
@@ -844,6 +1178,18 @@ static int clone_params(struct nl_url_req *req, const struct nl_url_params *para
  * URLs must start with http://, https://, or ftp://.
  */
 int nl_url_req_add(struct nl_url_ctx *ctx, nl_url_callback cb, void *cb_data, const struct nl_url_params * const params)
+{
+	return nl_url_req_add_ex(ctx, cb, cb_data, params, NULL);
+}
+
+/*
+ * Like nl_url_req_add(), but also stores a handle for the new request in
+ * *handle (if handle is not NULL) for use with nl_url_req_cancel().  Handles
+ * are never 0 and are not reused by a context.  Returns 0 on success, an
+ * errno-like value on error.
+ */
+int nl_url_req_add_ex(struct nl_url_ctx *ctx, nl_url_callback cb, void *cb_data, const struct nl_url_params * const params,
+		uint64_t *handle)
 {
 	struct nl_url_req *req;
 
@@ -855,7 +1201,7 @@ int nl_url_req_add(struct nl_url_ctx *ctx, nl_url_callback cb, void *cb_data, co
 		return EINVAL;
 	}
 
-	if(CHECK_NULL(params->url)) {
+	if(CHECK_NULL(params) || CHECK_NULL(params->url)) {
 		return EFAULT;
 	}
 	if(nl_strstart(params->url, "http://") && nl_strstart(params->url, "https://") && nl_strstart(params->url, "ftp://")) {
@@ -874,11 +1220,19 @@ int nl_url_req_add(struct nl_url_ctx *ctx, nl_url_callback cb, void *cb_data, co
 		ERROR_OUT("Form data type must be NL_ON_URL if a request body is specified\n");
 		return EINVAL;
 	}
+	if(params->headers_cb && !params->data_cb) {
+		ERROR_OUT("A headers callback requires a data callback (streaming mode)\n");
+		return EINVAL;
+	}
 	if((int)params->form_type < 0 || params->form_type > NL_FORM_TYPE_MAX) {
 		// ARM treats enums as unsigned, so need to cast to int
 		ERROR_OUT("Invalid form type %d\n", params->form_type);
 		return EINVAL;
 	}
+	if((int)params->priority < NL_URL_PRIORITY_LOW || (int)params->priority > NL_URL_PRIORITY_HIGH) {
+		ERROR_OUT("Invalid request priority %d\n", params->priority);
+		return EINVAL;
+	}
 
 
 	req = calloc(1, sizeof(struct nl_url_req));
@@ -890,6 +1244,8 @@ int nl_url_req_add(struct nl_url_ctx *ctx, nl_url_callback cb, void *cb_data, co
 	ctx_lock(ctx);
 
 	req->ctx = ctx;
+	req->handle = ++ctx->next_handle;
+	clock_gettime(CLOCK_MONOTONIC, &req->added);
 	req->cb = cb;
 	req->cb_data = cb_data;
 	req->readfd = -1;
@@ -920,6 +1276,10 @@ int nl_url_req_add(struct nl_url_ctx *ctx, nl_url_callback cb, void *cb_data, co
 
 	DEBUG_OUT("Created %s request to %s\n", req->result.method, req->result.url);
 
+	if(handle) {
+		*handle = req->handle;
+	}
+
 	ctx_unlock(ctx);
 
 	return 0;
@@ -929,6 +1289,127 @@ error:
 	return EBUSY;
 }
 
+/*
+ * Resumes reading a streaming request that was paused by its data callback
+ * returning NL_URL_STREAM_BUSY.  Pass the result pointer given to the data
+ * callback.  May be called from any thread, including from the data callback
+ * before it returns NL_URL_STREAM_BUSY.  Returns 0 on success, ENOENT if the
+ * request has already finished, or another errno-like value on error.
+ */
+int nl_url_req_resume(struct nl_url_ctx *ctx, const struct nl_url_result *result)
+{
+	struct nl_url_req *req;
+	int ret = 0;
+
+	if(CHECK_NULL(ctx) || CHECK_NULL(result)) {
+		return EFAULT;
+	}
+
+	// The request is only dereferenced after it is found in the list
+	req = (struct nl_url_req *)((char *)result - offsetof(struct nl_url_req, result));
+
+	ctx_lock(ctx);
+
+	if(!find_req(ctx, req)) {
+		ret = ENOENT;
+	} else if(!req->resume_pending) {
+		// The control pipe handler resumes requests that are already started
+		req->resume_pending = 1;
+		if(write(ctx->ev_pipe_writefd, &req, sizeof(struct nl_url_req *)) != sizeof(struct nl_url_req *)) {
+			ERRNO_OUT("Error writing resume request for %s to control pipe", req->result.url);
+			req->resume_pending = 0;
+			ret = EIO;
+		}
+	}
+
+	ctx_unlock(ctx);
+
+	return ret;
+}
+
+/*
+ * Stops the request with the given handle from nl_url_req_add_ex(), killing
+ * its curl process or closing its libcurl transfer and freeing its buffers.
+ * The request's callback is still called (from the event thread) with error
+ * and cancelled set in the result.  May be called from any thread, including
+ * from request callbacks.  Returns 0 on success, ENOENT if the request has
+ * already finished, or another errno-like value on error.
+ */
+int nl_url_req_cancel(struct nl_url_ctx *ctx, uint64_t handle)
+{
+	struct nl_url_req *req;
+	int ret;
+
+	if(CHECK_NULL(ctx)) {
+		return EFAULT;
+	}
+
+	ctx_lock(ctx);
+
+	req = find_handle(ctx, handle);
+	if(req == NULL) {
+		ret = ENOENT;
+	} else {
+		ret = request_cancel(req);
+	}
+
+	ctx_unlock(ctx);
+
+	return ret;
+}
+
+/*
+ * Stops all of the context's requests whose tag parameter matches the given
+ * tag, as with nl_url_req_cancel().  Returns the number of requests cancelled
+ * (0 if none matched), or -1 on error.
+ */
+int nl_url_req_cancel_tag(struct nl_url_ctx *ctx, const char *tag)
+{
+	const struct nl_fifo_element *iter = NULL;
+	struct nl_url_req *req;
+	int count = 0;
+
+	if(CHECK_NULL(ctx) || CHECK_NULL(tag)) {
+		return -1;
+	}
+
+	ctx_lock(ctx);
+
+	while((req = nl_fifo_next(ctx->reqlist, &iter)) != NULL) {
+		if(req->params.tag == NULL || strcmp(req->params.tag, tag)) {
+			continue;
+		}
+
+		if(request_cancel(req)) {
+			count = -1;
+			break;
+		}
+
+		count++;
+	}
+
+	ctx_unlock(ctx);
+
+	return count;
+}
+
+/*
+ * Copies the context's current request queueing statistics into *stats.
+ * Returns 0 on success, an errno-like value on error.
+ */
+int nl_url_req_get_stats(struct nl_url_ctx *ctx, struct nl_url_stats *stats)
+{
+	if(CHECK_NULL(ctx) || CHECK_NULL(stats)) {
+		return EFAULT;
+	}
+
+	ctx_lock(ctx);
+	*stats = ctx->stats;
+	ctx_unlock(ctx);
+
+	return 0;
+}
+
 // libevent event handling thread
 static void *url_event_thread(void *data)
 {
@@ -964,7 +1445,7 @@ static void *url_event_thread(void *data)
 
 // Compatibility shim for libevent 1.4 through libevent 2.x
 // See https://github.com/libevent/libevent/pull/678
-static struct bufferevent *create_bufferevent(struct nl_url_req *req, int fd)
+static struct bufferevent *create_bufferevent(struct nl_url_req *req, int fd, evbuffercb readcb)
 {
 	struct bufferevent *newbuf;
 
@@ -972,18 +1453,19 @@ static struct bufferevent *create_bufferevent(struct nl_url_req *req, int fd)
 	// libevent 2 (libevent 2.1 introduced a segfault in bufferevent_new())
 	newbuf = bufferevent_socket_new(req->ctx->evloop, fd, 0);
 	if(newbuf != NULL) {
-		bufferevent_setcb(newbuf, NULL, NULL, bufev_error, req);
+		bufferevent_setcb(newbuf, readcb, NULL, bufev_error, req);
 	}
 #else
 	// libevent 1.4
-	newbuf = bufferevent_new(fd, NULL, NULL, bufev_error, req);
+	newbuf = bufferevent_new(fd, readcb, NULL, bufev_error, req);
 #endif
 
 	return newbuf;
 }
 
 // Helper function to start curl in the control pipe handler (extracted from
-// nl_url_req_add()).
+// nl_url_req_add()).  Returns EBUSY on error, leaving the request for the
+// caller to free.
 static int start_curl(struct nl_url_req *req)
 {
 	char parambuf[512];
@@ -1005,7 +1487,12 @@ static int start_curl(struct nl_url_req *req)
 	// -K -- read options from FIFO
 	// -s -- silent (disables progress meter)
 	// -v -- verbose (enables verbose output without progress meter)
-	req->pid = nl_popen3vec(
+	//
+	// curl runs with SCHED_OTHER and a niceness of at least 0, even if the
+	// event thread has a raised priority.
+	//
+	// TODO: drop all possible privileges (need to give the nobody user access to the FIFO)
+	req->pid = nl_popen3vea(
 			&bodyfd, &req->readfd, &req->errfd,
 			"/usr/bin/curl",
 			(char *[]){
@@ -1021,13 +1508,25 @@ static int start_curl(struct nl_url_req *req)
 				NULL
 			},
 			environ,
-			drop_priority_cb
+			(struct nl_spawn_action[]){
+				// Best effort, e.g. in containers that restrict
+				// scheduling changes
+				{ .type = NL_SPAWN_SCHED_OTHER, .ignore_errors = 1 },
+				{ .type = NL_SPAWN_NICE_MIN, .value = 0, .ignore_errors = 1 },
+				{ .type = NL_SPAWN_END },
+			}
 			);
 	if(req->pid <= 0) {
 		ERROR_OUT("Error starting request process for %s.\n", req->params.url);
 		goto error;
 	}
 
+	// Without the reaper, check_process() waits for the process when its
+	// output ends
+	if(req->ctx->reaper && !nl_reaper_watch(req->ctx->reaper, req->pid, process_exited, req)) {
+		req->watched = 1;
+	}
+
 	// TODO: it could be nice to check pending requests on a timer, instead
 	// of waiting for curl to open the option fifo.  But it would be even
 	// better to switch to using libcurl directly.
@@ -1048,6 +1547,20 @@ static int start_curl(struct nl_url_req *req)
 		goto error;
 	}
 
+	// Let curl reject responses with a Content-Length over the size limit
+	if(req->params.max_response_size) {
+		snprintf(parambuf, sizeof(parambuf), "%zu", req->params.max_response_size);
+		if(write_option(writefd, "max-filesize", 0, parambuf, 0, NULL)) {
+			goto error;
+		}
+	}
+
+	// Streaming requests read response headers ahead of the body on stdout,
+	// so the headers callback can be called before the first chunk
+	if(req->params.data_cb && !nl_strstart(req->result.url, "http") && write_option(writefd, "include", 0, NULL)) {
+		goto error;
+	}
+
 	// Send timeouts to curl
 	int connect_timeout = req->params.connect_timeout > 0 ? req->params.connect_timeout : DEFAULT_CONNECT_TIMEOUT;
 	int request_timeout = req->params.request_timeout > 0 ? req->params.request_timeout : DEFAULT_REQUEST_TIMEOUT;
@@ -1133,13 +1646,13 @@ static int start_curl(struct nl_url_req *req)
 	temp_dir = NULL;
 
 	// Connect curl output to libevent
-	req->outbuf = create_bufferevent(req, req->readfd);
+	req->outbuf = create_bufferevent(req, req->readfd, req->params.data_cb ? stream_read : body_read);
 	if(req->outbuf == NULL) {
 		ERROR_OUT("Error creating bufferevent for request %s stdout.\n", req->result.url);
 		goto error;
 	}
 
-	req->errbuf = create_bufferevent(req, req->errfd);
+	req->errbuf = create_bufferevent(req, req->errfd, NULL);
 	if(req->errbuf == NULL) {
 		ERROR_OUT("Error creating bufferevent for request %s stderr.\n", req->result.url);
 		goto error;
@@ -1190,17 +1703,131 @@ error:
 		do {
 			ret = read(req->errfd, err_buf, sizeof(err_buf));
 			if(ret > 0) {
-				ERROR_OUT("Error output from CURL: ");
-				fwrite(err_buf, 1, ret, stderr);
-				ERROR_OUT_EX("\n");
+				ERROR_OUT("Error output from CURL: %.*s\n", ret, err_buf);
 			}
 		} while(ret > 0);
 	}
 
-	free_req(req);
 	return EBUSY;
 }
 
+// Starts a request's curl process or libcurl transfer.  Called on the event
+// thread without the context lock held, after mark_started().  Frees the
+// request and returns -1 on error.
+static int start_req(struct nl_url_req *req)
+{
+	struct nl_url_ctx *ctx = req->ctx;
+
+	// ctx cannot be freed while the event thread is running, so no need to
+	// hold the ctx lock while starting curl.
+	if(ctx->backend == NL_URL_BACKEND_LIBCURL) {
+		if(url_req_curl_start(req)) {
+			ERROR_OUT("Error starting libcurl request for %s\n", req->result.url);
+			goto error;
+		}
+
+		DEBUG_OUT("Started %s request to %s with libcurl\n", req->result.method, req->result.url);
+		return 0;
+	}
+
+	if(start_curl(req)) {
+		ERROR_OUT("Error starting curl for %s\n", req->result.url);
+		goto error;
+	}
+
+	if(bufferevent_base_set(ctx->evloop, req->outbuf)) {
+		ERROR_OUT("Error assigning request %s stdout bufferevent to event loop.\n", req->result.url);
+		goto error;
+	}
+	bufferevent_settimeout(req->outbuf, req->read_timeout, 0);
+	if(bufferevent_enable(req->outbuf, EV_READ)) {
+		ERROR_OUT("Error enabling read events on request %s stdout bufferevent.\n", req->result.url);
+		goto error;
+	}
+
+	if(bufferevent_base_set(ctx->evloop, req->errbuf)) {
+		ERROR_OUT("Error assigning request %s stderr bufferevent to event loop.\n", req->result.url);
+		goto error;
+	}
+	bufferevent_settimeout(req->errbuf, req->read_timeout, 0);
+	if(bufferevent_enable(req->errbuf, EV_READ)) {
+		ERROR_OUT("Error enabling read events on request %s stderr bufferevent.\n", req->result.url);
+		goto error;
+	}
+
+	evtimer_set(&req->timeout_ev, request_timeout, req);
+	if(event_base_set(ctx->evloop, &req->timeout_ev) ||
+			evtimer_add(&req->timeout_ev, &(struct timeval){ .tv_sec = req->read_timeout })) {
+		ERROR_OUT("Error scheduling request %s timeout.\n", req->result.url);
+		goto error;
+	}
+
+	DEBUG_OUT("Started %s request to %s\n", req->result.method, req->result.url);
+
+	return 0;
+
+error:
+	free_req(req);
+	return -1;
+}
+
+
+// Marks a request as running and updates the context's wait time statistics.
+// The context lock must be held.
+static void mark_started(struct nl_url_req *req)
+{
+	struct nl_url_stats *stats = &req->ctx->stats;
+	struct timespec now;
+	int64_t wait_ns;
+
+	req->started = 1;
+	stats->in_flight++;
+	stats->started++;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	wait_ns = nl_timespec_to_ns(now) - nl_timespec_to_ns(req->added);
+	if(wait_ns > 0) {
+		stats->total_wait_ns += wait_ns;
+		if((uint64_t)wait_ns > stats->max_wait_ns) {
+			stats->max_wait_ns = wait_ns;
+		}
+	}
+}
+
+// Starts queued requests, highest priority first, while the context has fewer
+// than max_in_flight requests running.  Called on the event thread without the
+// context lock held.
+static void start_queued(struct nl_url_ctx *ctx)
+{
+	struct nl_url_req *req;
+	int i;
+
+	do {
+		req = NULL;
+
+		ctx_lock(ctx);
+
+		if(!ctx->stopping && (ctx->max_in_flight == 0 || ctx->stats.in_flight < ctx->max_in_flight)) {
+			for(i = ARRAY_SIZE(ctx->pending) - 1; i >= 0 && req == NULL; i--) {
+				req = nl_fifo_get(ctx->pending[i]);
+			}
+		}
+
+		if(req != NULL) {
+			req->queued = 0;
+			ctx->stats.queued--;
+			mark_started(req);
+		}
+
+		ctx_unlock(ctx);
+
+		// start_req() frees the request if it fails, releasing its slot
+		if(req != NULL) {
+			start_req(req);
+		}
+	} while(req != NULL);
+}
+
 // Control pipe request handler; reads request pointers from control pipe,
 // starts request processes.
 static void control_pipe_handler(int fd, short evtype, void *cbdata)
@@ -1259,51 +1886,127 @@ static void control_pipe_handler(int fd, short evtype, void *cbdata)
 		return;
 	}
 
-	ctx_unlock(ctx);
-
-	// ctx cannot be freed while the event thread is running, so no need to
-	// hold the ctx lock while starting curl.
-	if(start_curl(rip.req)) {
-		ERROR_OUT("Error starting curl for %s\n", rip.req->result.url);
-		goto error;
+	// Pointers to requests that have already started come from
+	// nl_url_req_resume() and nl_url_req_cancel().  A request may finish
+	// before its message is handled.
+	if(!find_req(ctx, rip.req)) {
+		DEBUG_OUT("Ignoring control message for a finished request.\n");
+		ctx_unlock(ctx);
+		return;
 	}
 
-	if(bufferevent_base_set(ctx->evloop, rip.req->outbuf)) {
-		ERROR_OUT("Error assigning request %s stdout bufferevent to event loop.\n", rip.req->result.url);
-		goto error;
+	// A request cancelled before it started is never started
+	if(rip.req->cancel_pending) {
+		rip.req->resume_pending = 0;
+		ctx_unlock(ctx);
+		cancel_req(rip.req);
+		return;
 	}
-	bufferevent_settimeout(rip.req->outbuf, rip.req->read_timeout, 0);
-	if(bufferevent_enable(rip.req->outbuf, EV_READ)) {
-		ERROR_OUT("Error enabling read events on request %s stdout bufferevent.\n", rip.req->result.url);
-		goto error;
+
+	if(rip.req->started) {
+		int resume = rip.req->paused && rip.req->resume_pending;
+
+		rip.req->resume_pending = 0;
+		if(resume) {
+			rip.req->paused = 0;
+		}
+
+		ctx_unlock(ctx);
+
+		if(resume) {
+			resume_req(rip.req);
+		}
+		return;
 	}
 
-	if(bufferevent_base_set(ctx->evloop, rip.req->errbuf)) {
-		ERROR_OUT("Error assigning request %s stderr bufferevent to event loop.\n", rip.req->result.url);
-		goto error;
+	if(rip.req->queued) {
+		// A resume that arrives before the request starts has nothing
+		// to resume, and must not block later resumes
+		DEBUG_OUT("Ignoring control message for a queued request.\n");
+		rip.req->resume_pending = 0;
+		ctx_unlock(ctx);
+		return;
 	}
-	bufferevent_settimeout(rip.req->errbuf, rip.req->read_timeout, 0);
-	if(bufferevent_enable(rip.req->errbuf, EV_READ)) {
-		ERROR_OUT("Error enabling read events on request %s stderr bufferevent.\n", rip.req->result.url);
-		goto error;
+
+	// Requests only wait when all slots are busy, so a free slot means
+	// the queue is empty
+	if(ctx->max_in_flight != 0 && ctx->stats.in_flight >= ctx->max_in_flight) {
+		if(nl_fifo_put(ctx->pending[rip.req->params.priority - NL_URL_PRIORITY_LOW], rip.req) < 0) {
+			ERROR_OUT("Error queueing request %s.\n", rip.req->result.url);
+			ctx_unlock(ctx);
+			free_req(rip.req);
+			return;
+		}
+
+		rip.req->queued = 1;
+		ctx->stats.queued++;
+		if(ctx->stats.queued > ctx->stats.max_queued) {
+			ctx->stats.max_queued = ctx->stats.queued;
+		}
+
+		DEBUG_OUT("Queued %s request to %s\n", rip.req->result.method, rip.req->result.url);
+		ctx_unlock(ctx);
+		return;
 	}
 
-	DEBUG_OUT("Started %s request to %s\n", rip.req->result.method, rip.req->result.url);
+	mark_started(rip.req);
 
-	return;
+	ctx_unlock(ctx);
 
-error:
-	if(rip.req) {
-		free_req(rip.req);
+	if(start_req(rip.req)) {
+		start_queued(ctx);
+	}
+}
+
+/*
+ * Returns 1 if the given request backend was compiled into nlutils, 0
+ * otherwise.
+ */
+int nl_url_req_has_backend(enum nl_url_backend backend)
+{
+	switch(backend) {
+		case NL_URL_BACKEND_PROCESS:
+			return 1;
+
+		case NL_URL_BACKEND_LIBCURL:
+#ifdef NL_HAVE_LIBCURL
+			return 1;
+#else /* NL_HAVE_LIBCURL */
+			return 0;
+#endif /* NL_HAVE_LIBCURL */
 	}
+
+	return 0;
 }
 
+// Destroys the context's pending request queues.  The requests in them must
+// have been freed already.
+static void destroy_pending(struct nl_url_ctx *ctx)
+{
+	for(size_t i = 0; i < ARRAY_SIZE(ctx->pending); i++) {
+		if(ctx->pending[i] != NULL) {
+			nl_fifo_destroy(ctx->pending[i]);
+			ctx->pending[i] = NULL;
+		}
+	}
+}
 
 /*
  * Initializes a URL request context.  Uses thread_ctx, if given, to create the
  * URL event processing thread.  Returns NULL on error.
  */
 struct nl_url_ctx *nl_url_req_init(struct nl_thread_ctx *thread_ctx)
+{
+	return nl_url_req_init_ex(thread_ctx, NULL);
+}
+
+/*
+ * Initializes a URL request context with the given parameters (NULL for
+ * defaults).  Uses thread_ctx, if given, to create the URL event processing
+ * thread.  Returns NULL on error, including when the requested backend is not
+ * available.
+ */
+struct nl_url_ctx *nl_url_req_init_ex(struct nl_thread_ctx *thread_ctx, const struct nl_url_ctx_params *params)
 {
 	struct nl_url_ctx *ctx;
 	int pipefds[2];
@@ -1311,26 +2014,61 @@ struct nl_url_ctx *nl_url_req_init(struct nl_thread_ctx *thread_ctx)
 
 	// FIXME: deallocate structure on init error
 
+	if(params != NULL && !nl_url_req_has_backend(params->backend)) {
+		ERROR_OUT("The requested url_req backend %d is not available.\n", params->backend);
+		return NULL;
+	}
+
 	ctx = calloc(1, sizeof(struct nl_url_ctx));
 	if(ctx == NULL) {
 		ERRNO_OUT("Error allocating url_req context structure");
 		return NULL;
 	}
 
+	if(params != NULL) {
+		ctx->backend = params->backend;
+		ctx->memory_budget = params->memory_budget;
+		ctx->max_in_flight = params->max_in_flight;
+		ctx->record_request_headers = !!params->record_request_headers;
+	}
+
 	ctx->reqlist = nl_fifo_create();
 	if(CHECK_NULL(ctx->reqlist)) {
 		free(ctx);
 		return NULL;
 	}
 
+	for(size_t i = 0; i < ARRAY_SIZE(ctx->pending); i++) {
+		ctx->pending[i] = nl_fifo_create();
+		if(CHECK_NULL(ctx->pending[i])) {
+			destroy_pending(ctx);
+			nl_fifo_destroy(ctx->reqlist);
+			free(ctx);
+			return NULL;
+		}
+	}
+
 	ctx->evloop = event_base_new();
 	if(CHECK_NULL(ctx->evloop)) {
+		destroy_pending(ctx);
 		nl_fifo_destroy(ctx->reqlist);
 		free(ctx);
 		return NULL;
 	}
 	DEBUG_OUT("Using libevent's %s polling method\n", event_base_get_method(ctx->evloop));
 
+	if(ctx->backend == NL_URL_BACKEND_LIBCURL) {
+		ret = url_req_curl_init(ctx);
+		if(ret) {
+			ERROR_OUT("Error initializing url_req libcurl backend: %s\n", strerror(ret));
+			event_base_free(ctx->evloop);
+			destroy_pending(ctx);
+			nl_fifo_destroy(ctx->reqlist);
+			free(ctx);
+			return NULL;
+		}
+	}
+
 	// Create access lock
 	ret = nl_create_mutex(&ctx->lock, -1);
 	if(ret) {
@@ -1366,6 +2104,21 @@ struct nl_url_ctx *nl_url_req_init(struct nl_thread_ctx *thread_ctx)
 		return NULL;
 	}
 
+	// Reap curl processes in batches as they exit, if pidfds are available
+	if(ctx->backend == NL_URL_BACKEND_PROCESS) {
+		ctx->reaper = nl_reaper_create();
+		if(ctx->reaper == NULL) {
+			INFO_OUT("Waiting for each url_req curl process instead of using a reaper.\n");
+		} else {
+			event_set(&ctx->reaper_ev, nl_reaper_fd(ctx->reaper), EV_PERSIST | EV_READ, reaper_handler, ctx);
+			if(event_base_set(ctx->evloop, &ctx->reaper_ev) || event_add(&ctx->reaper_ev, NULL)) {
+				ERROR_OUT("Error adding process reaper event to the event loop.\n");
+				nl_reaper_destroy(ctx->reaper);
+				ctx->reaper = NULL;
+			}
+		}
+	}
+
 
 	// Create a threading context if one was not provided
 	if(thread_ctx == NULL) {
@@ -1455,15 +2208,12 @@ void nl_url_req_deinit(struct nl_url_ctx *ctx)
 		ERROR_OUT("Error removing URL request control pipe event.\n");
 	}
 
-	if(ctx->evloop != NULL) {
-		struct event_base *evloop = ctx->evloop;
-		ctx->evloop = NULL;
-
-		ctx_unlock(ctx);
-		event_base_free(evloop);
-		ctx_lock(ctx);
+	if(ctx->reaper != NULL && event_del(&ctx->reaper_ev)) {
+		ERROR_OUT("Error removing URL request process reaper event.\n");
 	}
 
+	// Requests' timeout events, bufferevents, and libcurl's socket and
+	// timer events must be removed from the event loop before it is freed
 	if(ctx->reqlist != NULL) {
 		const struct nl_fifo_element *iter = NULL;
 		struct nl_url_req *req = NULL, *prev = NULL;
@@ -1484,6 +2234,27 @@ void nl_url_req_deinit(struct nl_url_ctx *ctx)
 		ctx->reqlist = NULL;
 	}
 
+	if(ctx->curl != NULL) {
+		url_req_curl_deinit(ctx);
+	}
+
+	if(ctx->evloop != NULL) {
+		struct event_base *evloop = ctx->evloop;
+		ctx->evloop = NULL;
+
+		ctx_unlock(ctx);
+		event_base_free(evloop);
+		ctx_lock(ctx);
+	}
+
+	destroy_pending(ctx);
+
+	// Requests unwatch their processes when freed
+	if(ctx->reaper != NULL) {
+		nl_reaper_destroy(ctx->reaper);
+		ctx->reaper = NULL;
+	}
+
 	if(close(ctx->ev_pipe_readfd)) {
 		ERRNO_OUT("Error closing read side of control pipe");
 	}
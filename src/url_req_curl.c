@@ -0,0 +1,823 @@
+/*
+ * libcurl backend for url_req.  Drives a libcurl multi handle from the url_req
+ * context's libevent event loop, so requests share the context's event thread
+ * and connections to the same host are reused between requests.
+ * Copyright (C)2026 Mike Bourgeous.  Released under AGPLv3.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "url_req_internal.h"
+
+#ifdef NL_HAVE_LIBCURL
+
+#include <curl/curl.h>
+
+// libcurl state for a url_req context
+struct url_curl_ctx {
+	CURLM *multi; // Shared by all requests, holds the connection cache
+	struct event timer_ev; // Fires when libcurl asks for a timeout
+};
+
+// libcurl state for a single request
+struct url_curl_req {
+	CURL *easy;
+	struct curl_slist *headers; // Request headers passed to libcurl
+	curl_mime *mime; // Multipart form body, if any
+	char *url; // URL with NL_ON_URL form parameters appended, if any
+	size_t body_alloc; // Allocated size of the response body buffer
+	char errbuf[CURL_ERROR_SIZE];
+};
+
+// A socket that libcurl asked to watch, assigned with curl_multi_assign()
+struct url_curl_sock {
+	struct event ev;
+	struct nl_url_ctx *ctx;
+};
+
+// Callback data for form_join_callback()
+struct form_join {
+	char *str; // Joined and encoded form parameters
+	size_t len;
+};
+
+
+static pthread_once_t curl_init_once = PTHREAD_ONCE_INIT;
+static CURLcode curl_init_result;
+
+// Initializes libcurl's global state once for the process.
+static void curl_global_init_once(void)
+{
+	curl_init_result = curl_global_init(CURL_GLOBAL_ALL);
+}
+
+// Prepares a finished or cancelled request's response body, then calls
+// url_req_finish() to call its callback and free it.
+static void finish_req(struct nl_url_req *req)
+{
+	// The response body is always allocated and 0-terminated, like the
+	// process backend's body
+	if(req->result.response_body.data == NULL) {
+		req->result.response_body.data = calloc(1, 1);
+		req->curl->body_alloc = 1;
+		if(req->result.response_body.data == NULL) {
+			ERRNO_OUT("Error allocating empty response body for %s", req->result.url);
+			req->result.error = 1;
+		}
+	} else if(req->result.too_large || req->result.cancelled) {
+		// Discard the partial body, like the process backend
+		req->result.response_body.size = 0;
+		req->result.response_body.data[0] = 0;
+	}
+
+	url_req_finish(req);
+}
+
+// Passes completed transfers to url_req_finish().
+static void check_multi_info(struct nl_url_ctx *ctx)
+{
+	struct nl_url_req *req;
+	CURLMsg *msg;
+	CURLcode result;
+	long code;
+	int pending;
+
+	while((msg = curl_multi_info_read(ctx->curl->multi, &pending)) != NULL) {
+		if(msg->msg != CURLMSG_DONE) {
+			continue;
+		}
+
+		// msg is invalidated when the handle is removed by free_req()
+		result = msg->data.result;
+		if(curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&req) != CURLE_OK || req == NULL) {
+			ERROR_OUT("BUG: Finished libcurl transfer has no url_req request\n");
+			continue;
+		}
+
+		if(curl_easy_getinfo(req->curl->easy, CURLINFO_RESPONSE_CODE, &code) == CURLE_OK && code != 0) {
+			req->result.code = code;
+		}
+
+		if(result == CURLE_FILESIZE_EXCEEDED) {
+			// libcurl rejected the response's Content-Length
+			url_req_too_large(req);
+		} else if(result == CURLE_OPERATION_TIMEDOUT) {
+			ERROR_OUT("Request timed out by libcurl for %s\n", req->result.url);
+			snprintf(req->result.errmsg, sizeof(req->result.errmsg), "Request timed out");
+			req->result.timeout = 1;
+		} else if(result != CURLE_OK) {
+			// Keep the message from an aborting data callback
+			if(!req->result.error) {
+				url_req_store_curl_error(req->result.errmsg, sizeof(req->result.errmsg), result);
+			}
+			ERROR_OUT("libcurl error (%s: %s) for %s\n",
+					req->result.errmsg, req->curl->errbuf[0] ? req->curl->errbuf : curl_easy_strerror(result),
+					req->result.url);
+			req->result.error = 1;
+		} else {
+			DEBUG_OUT("libcurl request succeeded for %s\n", req->result.url);
+		}
+
+		finish_req(req);
+	}
+}
+
+// Called by libevent when a socket watched for libcurl is ready.
+static void socket_event(evutil_socket_t fd, short evtype, void *cbdata)
+{
+	struct nl_url_ctx *ctx = cbdata;
+	int action = 0;
+	int running;
+
+	if(evtype & EV_READ) {
+		action |= CURL_CSELECT_IN;
+	}
+	if(evtype & EV_WRITE) {
+		action |= CURL_CSELECT_OUT;
+	}
+
+	curl_multi_socket_action(ctx->curl->multi, fd, action, &running);
+	check_multi_info(ctx);
+}
+
+// Called by libevent when libcurl's requested timeout expires.
+static void timer_event(evutil_socket_t fd, short evtype, void *cbdata)
+{
+	struct nl_url_ctx *ctx = cbdata;
+	int running;
+
+	(void)fd; // unused parameter
+	(void)evtype; // unused parameter
+
+	curl_multi_socket_action(ctx->curl->multi, CURL_SOCKET_TIMEOUT, 0, &running);
+	check_multi_info(ctx);
+}
+
+// CURLMOPT_SOCKETFUNCTION callback; adds, changes, or removes the libevent
+// event for a socket.
+static int socket_callback(CURL *easy, curl_socket_t fd, int what, void *userp, void *socketp)
+{
+	struct nl_url_ctx *ctx = userp;
+	struct url_curl_sock *sock = socketp;
+	short flags = EV_PERSIST;
+
+	(void)easy; // unused parameter
+
+	if(what == CURL_POLL_REMOVE) {
+		if(sock != NULL) {
+			event_del(&sock->ev);
+			free(sock);
+		}
+		return 0;
+	}
+
+	if(sock == NULL) {
+		sock = calloc(1, sizeof(struct url_curl_sock));
+		if(sock == NULL) {
+			ERRNO_OUT("Error allocating libcurl socket event");
+			return -1;
+		}
+		sock->ctx = ctx;
+
+		if(curl_multi_assign(ctx->curl->multi, fd, sock) != CURLM_OK) {
+			ERROR_OUT("Error assigning event to libcurl socket %d\n", (int)fd);
+			free(sock);
+			return -1;
+		}
+	} else {
+		event_del(&sock->ev);
+	}
+
+	if(what & CURL_POLL_IN) {
+		flags |= EV_READ;
+	}
+	if(what & CURL_POLL_OUT) {
+		flags |= EV_WRITE;
+	}
+
+	event_set(&sock->ev, fd, flags, socket_event, ctx);
+	if(event_base_set(ctx->evloop, &sock->ev) || event_add(&sock->ev, NULL)) {
+		ERROR_OUT("Error adding libcurl socket %d to the event loop\n", (int)fd);
+
+		// The socket's event is freed here instead of on
+		// CURL_POLL_REMOVE, which libcurl may never send after an error
+		curl_multi_assign(ctx->curl->multi, fd, NULL);
+		free(sock);
+		return -1;
+	}
+
+	return 0;
+}
+
+// CURLMOPT_TIMERFUNCTION callback; schedules or cancels the timer event.
+static int timer_callback(CURLM *multi, long timeout_ms, void *userp)
+{
+	struct nl_url_ctx *ctx = userp;
+
+	(void)multi; // unused parameter
+
+	if(timeout_ms < 0) {
+		evtimer_del(&ctx->curl->timer_ev);
+		return 0;
+	}
+
+	struct timeval tv = {
+		.tv_sec = timeout_ms / 1000,
+		.tv_usec = (timeout_ms % 1000) * 1000
+	};
+
+	if(evtimer_add(&ctx->curl->timer_ev, &tv)) {
+		ERROR_OUT("Error scheduling libcurl timer\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+// CURLOPT_WRITEFUNCTION callback; appends to the 0-terminated response body,
+// or passes data to a streaming request's data callback.
+static size_t write_callback(char *data, size_t size, size_t nmemb, void *userdata)
+{
+	struct nl_url_req *req = userdata;
+	struct nl_raw_data *body = &req->result.response_body;
+	size_t len = size * nmemb;
+
+	if(req->params.data_cb) {
+		switch(url_req_stream_data(req, data, len)) {
+			case NL_URL_STREAM_OK:
+				return len;
+
+			case NL_URL_STREAM_BUSY:
+				// libcurl passes the same data again after unpausing
+				return CURL_WRITEFUNC_PAUSE;
+
+			default:
+				return 0;
+		}
+	}
+
+	// Returning less than len stops the transfer with CURLE_WRITE_ERROR
+	if(url_req_count_body(req, len, 1)) {
+		return 0;
+	}
+
+	if(body->size + len + 1 > req->curl->body_alloc) {
+		size_t new_alloc = MAX_NUM(4096, req->curl->body_alloc * 2);
+		while(new_alloc < body->size + len + 1) {
+			new_alloc *= 2;
+		}
+
+		char *new_data = realloc(body->data, new_alloc);
+		if(new_data == NULL) {
+			ERRNO_OUT("Error growing response body for %s to %zu bytes", req->result.url, new_alloc);
+			return 0;
+		}
+
+		body->data = new_data;
+		req->curl->body_alloc = new_alloc;
+	}
+
+	memcpy(body->data + body->size, data, len);
+	body->size += len;
+	body->data[body->size] = 0;
+
+	return len;
+}
+
+// Returns the length of the given data without any trailing CR or LF.
+static size_t trim_line(const char *data, size_t size)
+{
+	while(size > 0 && (data[size - 1] == '\r' || data[size - 1] == '\n')) {
+		size--;
+	}
+
+	return size;
+}
+
+// CURLOPT_HEADERFUNCTION callback; parses one response header line.  The
+// blank line after the headers ends a header block.
+static size_t header_callback(char *data, size_t size, size_t nitems, void *userdata)
+{
+	struct nl_url_req *req = userdata;
+	struct nl_raw_data line = { .data = data, .size = trim_line(data, size * nitems) };
+
+	if(line.size > 0) {
+		if(url_req_parse_header(req, req->result.response_headers, line)) {
+			return 0;
+		}
+	} else if(req->result.code >= 100 && req->result.code < 200) {
+		// Each 1xx informational response has its own header block
+		req->result.code = 0;
+	} else if(req->params.data_cb) {
+		url_req_headers_ready(req);
+	}
+
+	return size * nitems;
+}
+
+// nl_split_lines() callback for request headers passed to debug_callback().
+static int request_header_callback(struct nl_raw_data line, void *cb_data)
+{
+	struct nl_url_req *req = cb_data;
+
+	if(line.size == 0) {
+		return 0;
+	}
+
+	return url_req_parse_header(req, req->result.request_headers, line);
+}
+
+// CURLOPT_DEBUGFUNCTION callback; records the request headers sent by libcurl.
+static int debug_callback(CURL *easy, curl_infotype type, char *data, size_t size, void *userptr)
+{
+	(void)easy; // unused parameter
+
+	if(type == CURLINFO_HEADER_OUT) {
+		nl_split_lines((struct nl_raw_data){.data = data, .size = size}, request_header_callback, userptr);
+	}
+
+	return 0;
+}
+
+// Callback for nl_hash_iterate() to add request headers to the request's
+// curl_slist.  Frees the list and sets it to NULL on error.
+static int header_hash_callback(void *data, char *key, char *value)
+{
+	struct url_curl_req *creq = data;
+	struct curl_slist *list;
+	size_t len = strlen(key) + strlen(value) + 3;
+	char header[len];
+
+	snprintf(header, len, "%s: %s", key, value);
+
+	list = curl_slist_append(creq->headers, header);
+	if(list == NULL) {
+		ERROR_OUT("Error adding request header %s\n", key);
+		curl_slist_free_all(creq->headers);
+		creq->headers = NULL;
+		return -1;
+	}
+	creq->headers = list;
+
+	return 0;
+}
+
+// Callback for nl_hash_iterate() to find a Content-Type header.
+static int content_type_callback(void *data, char *key, char *value)
+{
+	(void)value; // unused parameter
+
+	if(!strcasecmp(key, "Content-Type")) {
+		*(int *)data = 1;
+		return -1;
+	}
+
+	return 0;
+}
+
+// Callback for nl_hash_iterate() to join url-encoded form parameters.
+static int form_join_callback(void *data, char *key, char *value)
+{
+	struct form_join *join = data;
+	char *encoded_key = NULL;
+	char *encoded_value = NULL;
+	char *new_str;
+	size_t new_len;
+
+	if(CHECK_NULL(encoded_key = nl_url_encode(key, 1, 0)) ||
+			CHECK_NULL(encoded_value = nl_url_encode(value, 1, 0))) {
+		goto error;
+	}
+
+	new_len = join->len + !!join->len + strlen(encoded_key) + 1 + strlen(encoded_value);
+	new_str = realloc(join->str, new_len + 1);
+	if(new_str == NULL) {
+		ERRNO_OUT("Error growing form parameter string");
+		goto error;
+	}
+
+	snprintf(new_str + join->len, new_len + 1 - join->len, "%s%s=%s",
+			join->len ? "&" : "", encoded_key, encoded_value);
+	join->str = new_str;
+	join->len = new_len;
+
+	free(encoded_key);
+	free(encoded_value);
+
+	return 0;
+
+error:
+	ERROR_OUT("Error encoding form parameter %s\n", key);
+
+	if(encoded_key) {
+		free(encoded_key);
+	}
+	if(encoded_value) {
+		free(encoded_value);
+	}
+
+	free(join->str);
+	join->str = NULL;
+	return -1;
+}
+
+// Returns the request's form parameters url-encoded and joined with '&', or
+// NULL on error.  The caller must free() the string.
+static char *join_form(struct nl_url_req *req)
+{
+	struct form_join join = { .str = strdup(""), .len = 0 };
+
+	if(join.str == NULL) {
+		ERRNO_OUT("Error allocating form parameter string");
+		return NULL;
+	}
+
+	nl_hash_iterate(req->params.form, form_join_callback, &join);
+
+	return join.str;
+}
+
+// Callback for nl_hash_iterate() to add multipart form parameters to the
+// request's curl_mime.  Frees the mime structure and sets it to NULL on error.
+static int form_mime_callback(void *data, char *key, char *value)
+{
+	struct url_curl_req *creq = data;
+	curl_mimepart *part;
+
+	part = curl_mime_addpart(creq->mime);
+	if(part == NULL || curl_mime_name(part, key) != CURLE_OK ||
+			curl_mime_data(part, value, CURL_ZERO_TERMINATED) != CURLE_OK) {
+		ERROR_OUT("Error adding multipart form parameter %s\n", key);
+		curl_mime_free(creq->mime);
+		creq->mime = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+// Sets the URL, body, form, and header options on the request's easy handle.
+static int set_request_options(struct nl_url_req *req)
+{
+	struct url_curl_req *creq = req->curl;
+	CURL *easy = creq->easy;
+	int content_type = 0;
+	char *form = NULL;
+
+	if(req->params.form) {
+		form = join_form(req);
+		if(form == NULL) {
+			return -1;
+		}
+	}
+
+	if(form && req->params.form_type == NL_ON_URL) {
+		size_t len = strlen(req->result.url) + strlen(form) + 2;
+
+		creq->url = malloc(len);
+		if(creq->url == NULL) {
+			ERRNO_OUT("Error allocating URL with form parameters");
+			goto error;
+		}
+
+		snprintf(creq->url, len, "%s%s%s", req->result.url, strchr(req->result.url, '?') ? "&" : "?", form);
+	}
+
+	if(curl_easy_setopt(easy, CURLOPT_URL, creq->url ? creq->url : req->result.url) != CURLE_OK) {
+		ERROR_OUT("Error setting libcurl URL %s\n", req->result.url);
+		goto error;
+	}
+
+	if(form && req->params.form_type == NL_URLENCODED) {
+		if(curl_easy_setopt(easy, CURLOPT_COPYPOSTFIELDS, form) != CURLE_OK) {
+			ERROR_OUT("Error setting urlencoded form body for %s\n", req->result.url);
+			goto error;
+		}
+	} else if(req->params.form && req->params.form_type == NL_MULTIPART) {
+		creq->mime = curl_mime_init(easy);
+		if(creq->mime == NULL) {
+			ERROR_OUT("Error creating multipart form for %s\n", req->result.url);
+			goto error;
+		}
+
+		nl_hash_iterate(req->params.form, form_mime_callback, creq);
+
+		if(creq->mime == NULL || curl_easy_setopt(easy, CURLOPT_MIMEPOST, creq->mime) != CURLE_OK) {
+			ERROR_OUT("Error setting multipart form body for %s\n", req->result.url);
+			goto error;
+		}
+	} else if(req->has_body) {
+		// params.body is owned by the request and outlives the transfer
+		if(curl_easy_setopt(easy, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)req->params.body.size) != CURLE_OK ||
+				curl_easy_setopt(easy, CURLOPT_POSTFIELDS,
+					req->params.body.data ? req->params.body.data : "") != CURLE_OK) {
+			ERROR_OUT("Error setting request body for %s\n", req->result.url);
+			goto error;
+		}
+	}
+
+	free(form);
+	form = NULL;
+
+	// Match the process backend's headers; a raw body has no content type
+	// unless the caller provides one
+	if(CHECK_NULL(creq->headers = curl_slist_append(NULL, "Expect:")) ||
+			CHECK_NULL(creq->headers = curl_slist_append(creq->headers, "Transfer-Encoding:"))) {
+		goto error;
+	}
+
+	if(req->params.headers) {
+		nl_hash_iterate(req->params.headers, content_type_callback, &content_type);
+
+		nl_hash_iterate(req->params.headers, header_hash_callback, creq);
+
+		if(creq->headers == NULL) {
+			ERROR_OUT("Error passing request headers to libcurl\n");
+			goto error;
+		}
+	}
+
+	if(req->has_body && !content_type && req->params.form_type == NL_ON_URL) {
+		struct curl_slist *list = curl_slist_append(creq->headers, "Content-Type:");
+		if(CHECK_NULL(list)) {
+			goto error;
+		}
+		creq->headers = list;
+	}
+
+	if(curl_easy_setopt(easy, CURLOPT_HTTPHEADER, creq->headers) != CURLE_OK) {
+		ERROR_OUT("Error setting request headers for %s\n", req->result.url);
+		goto error;
+	}
+
+	return 0;
+
+error:
+	free(form);
+	return -1;
+}
+
+/*
+ * Creates a libcurl easy handle for the request and adds it to the context's
+ * multi handle.  Called on the event thread.  Returns 0 on success, -1 on
+ * error.
+ */
+int url_req_curl_start(struct nl_url_req *req)
+{
+	struct url_curl_req *creq;
+	CURL *easy;
+
+	int connect_timeout = req->params.connect_timeout > 0 ? req->params.connect_timeout : DEFAULT_CONNECT_TIMEOUT;
+	int request_timeout = req->params.request_timeout > 0 ? req->params.request_timeout : DEFAULT_REQUEST_TIMEOUT;
+
+	creq = calloc(1, sizeof(struct url_curl_req));
+	if(creq == NULL) {
+		ERRNO_OUT("Error allocating libcurl request data for %s", req->result.url);
+		return -1;
+	}
+	req->curl = creq;
+
+	req->result.request_headers = nl_hash_create();
+	req->result.response_headers = nl_hash_create();
+	if(req->result.request_headers == NULL || req->result.response_headers == NULL) {
+		ERROR_OUT("Error allocating request and response header hashes.\n");
+		return -1;
+	}
+
+	easy = curl_easy_init();
+	if(easy == NULL) {
+		ERROR_OUT("Error creating libcurl easy handle for %s\n", req->result.url);
+		return -1;
+	}
+	creq->easy = easy;
+
+	if(curl_easy_setopt(easy, CURLOPT_PRIVATE, req) ||
+			curl_easy_setopt(easy, CURLOPT_ERRORBUFFER, creq->errbuf) ||
+			curl_easy_setopt(easy, CURLOPT_NOSIGNAL, 1L) ||
+#if LIBCURL_VERSION_NUM >= 0x075500
+			curl_easy_setopt(easy, CURLOPT_PROTOCOLS_STR, "http,https,ftp") ||
+#else /* LIBCURL_VERSION_NUM */
+			curl_easy_setopt(easy, CURLOPT_PROTOCOLS, (long)(CURLPROTO_HTTP | CURLPROTO_HTTPS | CURLPROTO_FTP)) ||
+#endif /* LIBCURL_VERSION_NUM */
+			curl_easy_setopt(easy, CURLOPT_CUSTOMREQUEST, req->result.method) ||
+			curl_easy_setopt(easy, CURLOPT_ACCEPT_ENCODING, "") ||
+			curl_easy_setopt(easy, CURLOPT_CONNECTTIMEOUT_MS, (long)connect_timeout) ||
+			curl_easy_setopt(easy, CURLOPT_TIMEOUT_MS, (long)request_timeout) ||
+			curl_easy_setopt(easy, CURLOPT_WRITEFUNCTION, write_callback) ||
+			curl_easy_setopt(easy, CURLOPT_WRITEDATA, req) ||
+			curl_easy_setopt(easy, CURLOPT_HEADERFUNCTION, header_callback) ||
+			curl_easy_setopt(easy, CURLOPT_HEADERDATA, req) ||
+			curl_easy_setopt(easy, CURLOPT_MAXFILESIZE_LARGE, (curl_off_t)req->params.max_response_size)) {
+		ERROR_OUT("Error setting libcurl options for %s\n", req->result.url);
+		return -1;
+	}
+
+	// libcurl only reports the headers it sends through its debug trace,
+	// which adds overhead to every transfer
+	if(req->ctx->record_request_headers && (
+				curl_easy_setopt(easy, CURLOPT_DEBUGFUNCTION, debug_callback) ||
+				curl_easy_setopt(easy, CURLOPT_DEBUGDATA, req) ||
+				curl_easy_setopt(easy, CURLOPT_VERBOSE, 1L))) {
+		ERROR_OUT("Error enabling request header recording for %s\n", req->result.url);
+		return -1;
+	}
+
+	if(set_request_options(req)) {
+		return -1;
+	}
+
+	if(curl_multi_add_handle(req->ctx->curl->multi, easy) != CURLM_OK) {
+		ERROR_OUT("Error adding libcurl request for %s\n", req->result.url);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Removes the request from the context's multi handle and frees its libcurl
+ * resources.  Called by free_req() with the context lock held.
+ */
+void url_req_curl_free_req(struct nl_url_req *req)
+{
+	struct url_curl_req *creq = req->curl;
+
+	if(creq->easy) {
+		curl_multi_remove_handle(req->ctx->curl->multi, creq->easy);
+		curl_easy_cleanup(creq->easy);
+	}
+
+	// The mime structure must outlive the easy handle
+	if(creq->mime) {
+		curl_mime_free(creq->mime);
+	}
+	if(creq->headers) {
+		curl_slist_free_all(creq->headers);
+	}
+
+	free(creq->url);
+	free(creq);
+	req->curl = NULL;
+
+	free(req->result.response_body.data);
+	req->result.response_body.data = NULL;
+	req->result.response_body.size = 0;
+}
+
+/*
+ * Unpauses a streaming request paused by its data callback.  Called on the
+ * event thread.
+ */
+void url_req_curl_resume(struct nl_url_req *req)
+{
+	CURLcode ret = curl_easy_pause(req->curl->easy, CURLPAUSE_CONT);
+	if(ret != CURLE_OK) {
+		ERROR_OUT("Error unpausing libcurl request for %s: %s\n", req->result.url, curl_easy_strerror(ret));
+	}
+}
+
+/*
+ * Stops a libcurl request cancelled by nl_url_req_cancel(), calls its
+ * callback, and frees it.  Called on the event thread without the context
+ * lock held.
+ */
+void url_req_curl_cancel(struct nl_url_req *req)
+{
+	// free_req() removes the easy handle from the multi handle
+	finish_req(req);
+}
+
+/*
+ * Creates the libcurl multi handle for the context and attaches it to the
+ * context's event loop.  Returns 0 on success, ENOTSUP if libcurl support was
+ * not compiled in, or another errno-like value on error.
+ */
+int url_req_curl_init(struct nl_url_ctx *ctx)
+{
+	struct url_curl_ctx *cctx;
+
+	pthread_once(&curl_init_once, curl_global_init_once);
+	if(curl_init_result != CURLE_OK) {
+		ERROR_OUT("Error initializing libcurl: %s\n", curl_easy_strerror(curl_init_result));
+		return EIO;
+	}
+
+	cctx = calloc(1, sizeof(struct url_curl_ctx));
+	if(cctx == NULL) {
+		ERRNO_OUT("Error allocating url_req libcurl state");
+		return ENOMEM;
+	}
+
+	cctx->multi = curl_multi_init();
+	if(cctx->multi == NULL) {
+		ERROR_OUT("Error creating libcurl multi handle\n");
+		free(cctx);
+		return ENOMEM;
+	}
+
+	evtimer_set(&cctx->timer_ev, timer_event, ctx);
+	if(event_base_set(ctx->evloop, &cctx->timer_ev)) {
+		ERROR_OUT("Error assigning event loop to libcurl timer event.\n");
+		curl_multi_cleanup(cctx->multi);
+		free(cctx);
+		return EINVAL;
+	}
+
+	if(curl_multi_setopt(cctx->multi, CURLMOPT_SOCKETFUNCTION, socket_callback) ||
+			curl_multi_setopt(cctx->multi, CURLMOPT_SOCKETDATA, ctx) ||
+			curl_multi_setopt(cctx->multi, CURLMOPT_TIMERFUNCTION, timer_callback) ||
+			curl_multi_setopt(cctx->multi, CURLMOPT_TIMERDATA, ctx)) {
+		ERROR_OUT("Error setting libcurl multi handle callbacks\n");
+		curl_multi_cleanup(cctx->multi);
+		free(cctx);
+		return EINVAL;
+	}
+
+	ctx->curl = cctx;
+
+	return 0;
+}
+
+/*
+ * Releases the context's libcurl multi handle and its timer event.  All
+ * requests must have been freed first.
+ */
+void url_req_curl_deinit(struct nl_url_ctx *ctx)
+{
+	if(ctx->curl == NULL) {
+		return;
+	}
+
+	// Closes cached connections, which removes their socket events
+	curl_multi_cleanup(ctx->curl->multi);
+	evtimer_del(&ctx->curl->timer_ev);
+
+	free(ctx->curl);
+	ctx->curl = NULL;
+}
+
+#else /* NL_HAVE_LIBCURL */
+
+/*
+ * Creates the libcurl multi handle for the context and attaches it to the
+ * context's event loop.  Returns 0 on success, ENOTSUP if libcurl support was
+ * not compiled in, or another errno-like value on error.
+ */
+int url_req_curl_init(struct nl_url_ctx *ctx)
+{
+	(void)ctx; // unused parameter
+	ERROR_OUT("nlutils was built without libcurl.\n");
+	return ENOTSUP;
+}
+
+/*
+ * Releases the context's libcurl multi handle and its timer event.  All
+ * requests must have been freed first.
+ */
+void url_req_curl_deinit(struct nl_url_ctx *ctx)
+{
+	(void)ctx; // unused parameter
+}
+
+/*
+ * Creates a libcurl easy handle for the request and adds it to the context's
+ * multi handle.  Called on the event thread.  Returns 0 on success, -1 on
+ * error.
+ */
+int url_req_curl_start(struct nl_url_req *req)
+{
+	(void)req; // unused parameter
+	return -1;
+}
+
+/*
+ * Removes the request from the context's multi handle and frees its libcurl
+ * resources.  Called by free_req() with the context lock held.
+ */
+void url_req_curl_free_req(struct nl_url_req *req)
+{
+	(void)req; // unused parameter
+}
+
+/*
+ * Unpauses a streaming request paused by its data callback.  Called on the
+ * event thread.
+ */
+void url_req_curl_resume(struct nl_url_req *req)
+{
+	(void)req; // unused parameter
+}
+
+/*
+ * Stops a libcurl request cancelled by nl_url_req_cancel(), calls its
+ * callback, and frees it.  Called on the event thread without the context
+ * lock held.
+ */
+void url_req_curl_cancel(struct nl_url_req *req)
+{
+	(void)req; // unused parameter
+}
+
+#endif /* NL_HAVE_LIBCURL */
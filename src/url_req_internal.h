@@ -0,0 +1,218 @@
+/*
+ * Structures and helpers shared by the url_req request backends.  Not
+ * installed with the public headers.
+ * Copyright (C)2026 Mike Bourgeous.  Released under AGPLv3.
+ */
+#ifndef NLUTILS_URL_REQ_INTERNAL_H_
+#define NLUTILS_URL_REQ_INTERNAL_H_
+
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+#include <pthread.h>
+
+// C99 lacks u_char
+#define u_char uint8_t
+#include <event.h>
+#undef u_char
+
+#include "nlutils.h"
+
+
+// Timeout for initial DNS lookup and connection, in milliseconds
+#define DEFAULT_CONNECT_TIMEOUT 30000
+
+// Timeout for curl/wget to finish the entire request, in milliseconds
+// The read timeout for libevent is based on this value
+#define DEFAULT_REQUEST_TIMEOUT 30000
+
+
+struct url_curl_ctx;
+struct url_curl_req;
+
+// Library-global handles for libevent, threads, control pipe, etc.
+struct nl_url_req;
+struct nl_url_ctx {
+	// Thread management
+	struct nl_thread_ctx *thread_ctx; // nl_thread thread tracking context
+	struct nl_thread *event_thread; // event processing thread
+	pthread_mutex_t lock; // struct nl_url_ctx access lock
+
+	// libevent event loop
+	struct event_base *evloop;
+
+	// Pipe for sending requests to the event thread
+	struct event pipe_ev; // Pipe processing event handle for event loop
+	int ev_pipe_readfd; // Read by event thread
+	int ev_pipe_writefd; // Written by control functions
+
+	// List of active requests
+	struct nl_fifo *reqlist;
+
+	// Reaps curl processes as they exit (NL_URL_BACKEND_PROCESS, NULL if
+	// pidfds are unavailable)
+	struct nl_reaper *reaper;
+	struct event reaper_ev;
+
+	// Request backend and options selected by nl_url_req_init_ex()
+	enum nl_url_backend backend;
+	unsigned int record_request_headers; // See struct nl_url_ctx_params
+
+	// Response body memory accounting
+	size_t memory_budget; // Maximum of buffered (0 for no limit)
+	size_t buffered; // Response body bytes held by all requests
+	struct url_curl_ctx *curl; // libcurl multi handle state (NL_URL_BACKEND_LIBCURL)
+
+	uint64_t next_handle; // Handle for the next request from nl_url_req_add_ex()
+
+	// Concurrency limiting
+	unsigned int max_in_flight; // Maximum running requests (0 for no limit)
+	struct nl_fifo *pending[NL_URL_PRIORITY_HIGH - NL_URL_PRIORITY_LOW + 1]; // Queued requests by priority (lowest first)
+	struct nl_url_stats stats; // Queue depth and wait time statistics
+
+	// Library state tracking
+	unsigned int running:1; // Set to 1 while event thread is running
+	unsigned int stopping:1; // Set to 1 if nl_url_req_stop() has been called
+	unsigned int shutdown_when_done:1; // Set to 1 when final request termination should cause loop shutdown
+};
+
+
+// Request-specific internal data
+struct nl_url_req {
+	struct nl_url_ctx *ctx; // URL request context
+	uint64_t handle; // Handle returned by nl_url_req_add_ex()
+	struct timespec added; // CLOCK_MONOTONIC time of nl_url_req_add(), for wait statistics
+
+	int read_timeout; // libevent read timeout in seconds (based on request timeout)
+
+	nl_url_callback cb; // Completion callback - will be called from event thread with context lock held
+	void *cb_data; // User data passed to callback
+
+	// PID of shell that calls curl process
+	pid_t pid;
+	int exit_ret; // Return value of the process, once exited is set
+
+	// File handles and libevent buffers for reading from curl
+	struct bufferevent *outbuf;
+	struct bufferevent *errbuf;
+	int readfd;
+	int errfd;
+	struct event timeout_ev; // Fires if curl outlives the request timeout
+
+	// libcurl easy handle state (NL_URL_BACKEND_LIBCURL)
+	struct url_curl_req *curl;
+
+	// Response body size accounting
+	size_t body_bytes; // Response body bytes received (or streamed) so far
+	size_t buffered; // Response body bytes counted against the context's budget
+
+	// Request parameters from the caller (cloned, owned by url_req, freed by free_params())
+	struct nl_url_params params;
+
+	// Request results
+	struct nl_url_result result;
+
+	// Internal state keeping
+	unsigned int has_body:1; // Whether the request has a body (allows zero-sized bodies)
+	unsigned int out_eof:1; // Whether the process's STDOUT has encountered EOF
+	unsigned int err_eof:1; // Whether the process's STDERR has encountered EOF
+	unsigned int started:1; // Set by the control pipe handler once the request has started
+	unsigned int headers_done:1; // Whether a streaming request's headers callback has been called
+	unsigned int queued:1; // Set while the request waits in a pending queue for max_in_flight
+
+	// Written by process_exited() and kill_req_and_wait() without the
+	// context lock, so they have their own fields
+	unsigned int watched; // Set while the context's reaper is watching the process
+	unsigned int exited; // Set when the reaper has reaped the process (see exit_ret)
+
+	// Written with the context lock held by nl_url_req_resume() and
+	// nl_url_req_cancel() on other threads, so these can't share a bitfield
+	// word with flags that the event thread writes without the lock
+	unsigned int paused; // Set while a streaming request's data callback is busy
+	unsigned int resume_pending; // Set by nl_url_req_resume() until the event thread handles it
+	unsigned int cancel_pending; // Set by nl_url_req_cancel() until the event thread handles it
+};
+
+
+// Wraps url_req_lock_impl to provide file/line information for debugging
+#define ctx_lock(ctx) do { \
+	url_req_lock_impl(ctx, __FILE__, __LINE__); \
+} while(0);
+
+// Wraps url_req_unlock_impl to provide file/line information for debugging
+#define ctx_unlock(ctx) do { \
+	url_req_unlock_impl(ctx, __FILE__, __LINE__); \
+} while(0);
+
+// Locks the given struct nl_url_ctx's access lock.  Aborts the application if
+// locking fails.
+void url_req_lock_impl(struct nl_url_ctx *ctx, char *file, int line);
+
+// Unlocks the given struct nl_url_ctx's access lock.  Aborts the application
+// if unlocking fails.
+void url_req_unlock_impl(struct nl_url_ctx *ctx, char *file, int line);
+
+// Parses a "Name: value" header line (without any "> " or "< " prefix or line
+// ending) into the given hash.  An HTTP status line sets the request's result
+// code if it has not been set yet.  Returns 0 on success, -1 on error.
+int url_req_parse_header(struct nl_url_req *req, struct nl_hash *headers, struct nl_raw_data line);
+
+// Stores information about the CURL error indicated by retcode into a string.
+// The curl(1) manual page lists errors, which match libcurl's CURLcode values.
+void url_req_store_curl_error(char *str, size_t maxlen, int retcode);
+
+// Calls a streaming request's headers callback, if it has one and it has not
+// been called yet.
+void url_req_headers_ready(struct nl_url_req *req);
+
+// Counts size more bytes of response body against the request's size limit
+// and, if stored is nonzero (the bytes stay in memory until the request
+// finishes), the context's memory budget.  Returns 0 if the request may
+// continue, or -1 with the result's error, too_large, and message set if it
+// must be stopped.
+int url_req_count_body(struct nl_url_req *req, size_t size, int stored);
+
+// Sets the result's error, too_large, and message for a response that
+// exceeded the request's max_response_size.
+void url_req_too_large(struct nl_url_req *req);
+
+// Passes a chunk of a streaming request's body to its data callback.  Returns
+// the callback's enum nl_url_stream_status value.  Sets the request's paused
+// flag if the callback was busy, or the result's error and message if it
+// aborted.
+int url_req_stream_data(struct nl_url_req *req, const char *data, size_t size);
+
+// Calls the request callback, frees the request, and stops the event loop if
+// this was the last request after nl_url_req_shutdown().  Must be called from
+// the event thread without the context lock held.
+void url_req_finish(struct nl_url_req *req);
+
+
+// Creates the libcurl multi handle for the context and attaches it to the
+// context's event loop.  Returns 0 on success, ENOTSUP if libcurl support was
+// not compiled in, or another errno-like value on error.
+int url_req_curl_init(struct nl_url_ctx *ctx);
+
+// Releases the context's libcurl multi handle and its timer event.  All
+// requests must have been freed first.
+void url_req_curl_deinit(struct nl_url_ctx *ctx);
+
+// Creates a libcurl easy handle for the request and adds it to the context's
+// multi handle.  Called on the event thread.  Returns 0 on success, -1 on
+// error.
+int url_req_curl_start(struct nl_url_req *req);
+
+// Removes the request from the context's multi handle and frees its libcurl
+// resources.  Called by free_req() with the context lock held.
+void url_req_curl_free_req(struct nl_url_req *req);
+
+// Unpauses a streaming request paused by its data callback.  Called on the
+// event thread.
+void url_req_curl_resume(struct nl_url_req *req);
+
+// Stops a libcurl request cancelled by nl_url_req_cancel(), calls its
+// callback, and frees it.  Called on the event thread without the context
+// lock held.
+void url_req_curl_cancel(struct nl_url_req *req);
+
+#endif /* NLUTILS_URL_REQ_INTERNAL_H_ */
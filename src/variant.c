@@ -7,6 +7,7 @@
 #include <limits.h>	// for INT_MIN etc.
 #include <ctype.h>	// for isdigit()
 #include <math.h>	// for INFINITY
+#include <float.h>	// for FLT_MAX
 
 #include "nlutils.h"
 
@@ -218,206 +219,627 @@ union nl_varvalue nl_clamp_varvalue(enum nl_vartype type, union nl_varvalue valu
 	return value;
 }
 
-/*
- * Prints the given variant value to output, formatted for lossless textual
- * serialization.  Raw data values are not printed.  Prints "Unknown type %d"
- * if the value's type is invalid.  Returns the number of bytes written on
- * success, negative on error.
- */
-int nl_fprint_variant(FILE *output, struct nl_variant value)
+// Longest formatted non-string variant, including the terminating NUL byte
+// (e.g. "-" plus 39 integer digits, ".", and 6 decimals for -FLT_MAX)
+#define SCALAR_FORMAT_SIZE 64
+
+// Digit pairs "00" through "99" for two-digits-at-a-time integer formatting
+static const char digit_pairs[201] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+static const uint64_t pow10_u64[20] = {
+	1ull, 10ull, 100ull, 1000ull, 10000ull, 100000ull, 1000000ull, 10000000ull,
+	100000000ull, 1000000000ull, 10000000000ull, 100000000000ull,
+	1000000000000ull, 10000000000000ull, 100000000000000ull,
+	1000000000000000ull, 10000000000000000ull, 100000000000000000ull,
+	1000000000000000000ull, 10000000000000000000ull,
+};
+
+// Powers of ten that are exact in a double
+static const double pow10_double[23] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+// Writes the decimal digits of v backward, ending just before end.  Returns a
+// pointer to the first digit.
+static char *format_u64(char *end, uint64_t v)
 {
-	union nl_varvalue data = value.value;
+	uint32_t v32;
+
+	// Stay in 32-bit arithmetic once possible for 32-bit targets
+	while(v > UINT32_MAX) {
+		unsigned int i = (v % 100) * 2;
+		v /= 100;
+		*--end = digit_pairs[i + 1];
+		*--end = digit_pairs[i];
+	}
 
-	switch(value.type) {
-		case ANY:
-			return fprintf(output, "0x%08lx", (unsigned long)data.any);
+	v32 = v;
+	while(v32 >= 100) {
+		unsigned int i = (v32 % 100) * 2;
+		v32 /= 100;
+		*--end = digit_pairs[i + 1];
+		*--end = digit_pairs[i];
+	}
 
-		case INTEGER:
-			return fprintf(output, "%d", data.integer);
+	if(v32 >= 10) {
+		*--end = digit_pairs[v32 * 2 + 1];
+		*--end = digit_pairs[v32 * 2];
+	} else {
+		*--end = '0' + v32;
+	}
 
-		case FLOAT:
-			if((data.floating < 0.001 && data.floating > -0.001) || 
-					data.floating <= -1000 || data.floating >= 1000) {
-				return fprintf(output, "%.12e", data.floating);
-			}
-			return fprintf(output, "%.15f", data.floating);
+	return end;
+}
 
-		case STRING:
-			if(data.string != NULL) {
-				char *tmp;
-				size_t len;
-				int ret;
-
-				tmp = nl_strdup(data.string);
-				if(tmp == NULL) {
-					ERROR_OUT("Error duplicating string\n");
-					return -1;
-				}
-				len = strlen(tmp);
+// Writes exactly count decimal digits of v (zero-padded) backward, ending just
+// before end.  Returns a pointer to the first digit.
+static char *format_digits(char *end, uint64_t v, int count)
+{
+	for(; count >= 2; count -= 2) {
+		unsigned int i = (v % 100) * 2;
+		v /= 100;
+		*--end = digit_pairs[i + 1];
+		*--end = digit_pairs[i];
+	}
 
-				if(nl_escape_string(&tmp, &len)) {
-					ERROR_OUT("Error escaping string\n");
-					free(tmp);
-					return -1;
-				}
+	if(count) {
+		*--end = '0' + v % 10;
+	}
+
+	return end;
+}
+
+// Writes "0x%08lx" of v backward, ending just before end.  Returns a pointer
+// to the "0x" prefix.
+static char *format_hex(char *end, unsigned long v)
+{
+	char *start = end - 8;
+
+	do {
+		*--end = "0123456789abcdef"[v & 15];
+		v >>= 4;
+	} while(v);
+
+	while(end > start) {
+		*--end = '0';
+	}
+
+	*--end = 'x';
+	*--end = '0';
+
+	return end;
+}
+
+// Splits finite f into an integer mantissa and binary exponent so that |f| is
+// exactly *m * 2^*e.  Returns -1 for infinity and NaN.
+static int float_parts(float f, uint64_t *m, int *e)
+{
+	uint32_t bits;
+	int exp;
+
+	memcpy(&bits, &f, sizeof(bits));
+	exp = (bits >> 23) & 0xff;
+
+	if(exp == 0xff) {
+		return -1;
+	}
+
+	if(exp == 0) {
+		// Subnormal
+		*m = bits & 0x7fffff;
+		*e = -149;
+	} else {
+		*m = (bits & 0x7fffff) | 0x800000;
+		*e = exp - 150;
+	}
+
+	return 0;
+}
+
+// Stores m * 2^e * 10^p in *n, rounded to the nearest integer with ties to
+// even, as printf() rounds exactly representable halfway values.  m must be
+// below 2^24 (a float mantissa).  Returns 0 on success, or -1 if the result
+// or an intermediate value would not fit in 64 bits.
+static int scale_round(uint64_t m, int e, int p, uint64_t *n)
+{
+	uint64_t q, rem, half;
+	int shift;
+
+	if(m == 0) {
+		*n = 0;
+		return 0;
+	}
+
+	if(p < 0) {
+		// Divide an integer by a power of ten
+		if(e < 0 || e > 39 || p < -19) {
+			return -1;
+		}
+
+		m <<= e;
+		q = m / pow10_u64[-p];
+		rem = m % pow10_u64[-p];
+		half = pow10_u64[-p] / 2;
+	} else {
+		// m * 10^p == (m * 5^p) * 2^p, and m * 5^17 still fits
+		if(p > 17) {
+			return -1;
+		}
 
-				ret = fprintf(output, "%s", tmp);
-				free(tmp);
-				return ret;
+		m *= pow10_u64[p] >> p;
+		shift = e + p;
+
+		if(shift >= 0) {
+			if(shift >= 64 || m > UINT64_MAX >> shift) {
+				return -1;
 			}
-			return fprintf(output, "\\0");
+			*n = m << shift;
+			return 0;
+		}
 
-		case DATA:
-			// TODO: Store data
-			if(data.data == NULL) {
-				return fprintf(output, "[NULL raw data]");
+		shift = -shift;
+		if(shift > 64) {
+			*n = 0;
+			return 0;
+		} else if(shift == 64) {
+			q = 0;
+			rem = m;
+		} else {
+			q = m >> shift;
+			rem = m & ((1ull << shift) - 1);
+		}
+		half = 1ull << (shift - 1);
+	}
+
+	if(rem > half || (rem == half && (q & 1))) {
+		q++;
+	}
+
+	*n = q;
+	return 0;
+}
+
+// Formats f exactly as printf("%.*f", decimals, f) would into out, which must
+// hold at least SCALAR_FORMAT_SIZE bytes.  decimals must be between 1 and 17.
+// Returns the length of the result, or -1 if f must be formatted by snprintf().
+static int format_fixed(char *out, float f, int decimals)
+{
+	char buf[SCALAR_FORMAT_SIZE];
+	char *end = buf + sizeof(buf);
+	char *start;
+	uint64_t m, n;
+	int e;
+
+	if(float_parts(f, &m, &e) || scale_round(m, e, decimals, &n)) {
+		return -1;
+	}
+
+	start = format_digits(end, n % pow10_u64[decimals], decimals);
+	*--start = '.';
+	start = format_u64(start, n / pow10_u64[decimals]);
+	if(signbit(f)) {
+		*--start = '-';
+	}
+
+	memcpy(out, start, end - start);
+	return end - start;
+}
+
+// Formats f exactly as printf("%.*e", decimals, f) would into out, which must
+// hold at least SCALAR_FORMAT_SIZE bytes.  decimals must be between 1 and 18.
+// Returns the length of the result, or -1 if f must be formatted by snprintf().
+static int format_exp(char *out, float f, int decimals)
+{
+	char buf[SCALAR_FORMAT_SIZE];
+	char *end = buf + sizeof(buf);
+	char *start;
+	uint64_t m, n = 0;
+	int e, exp10 = 0;
+
+	if(float_parts(f, &m, &e)) {
+		return -1;
+	}
+
+	if(m != 0) {
+		// Estimate the decimal exponent from the binary exponent, then
+		// correct it until the rounded mantissa has decimals + 1 digits
+		exp10 = ((e + 63 - __builtin_clzll(m)) * 1233) >> 12;
+		while(1) {
+			if(scale_round(m, e, decimals - exp10, &n)) {
+				return -1;
 			}
-			if(data.data->data == NULL) {
-				return fprintf(output, "[NULL raw data of length %zu]", data.data->size);
+
+			if(n >= pow10_u64[decimals + 1]) {
+				exp10++;
+			} else if(n < pow10_u64[decimals]) {
+				exp10--;
+			} else {
+				break;
 			}
-			return fprintf(output, "[Raw data of length %zu]", data.data->size);
+		}
+	}
 
-		default:
-			return fprintf(output, "Unknown type %d", value.type);
+	// Float decimal exponents never need more than two digits
+	start = format_digits(end, exp10 < 0 ? -exp10 : exp10, 2);
+	*--start = exp10 < 0 ? '-' : '+';
+	*--start = 'e';
+	start = format_digits(start, n % pow10_u64[decimals], decimals);
+	*--start = '.';
+	*--start = '0' + n / pow10_u64[decimals];
+	if(signbit(f)) {
+		*--start = '-';
 	}
+
+	memcpy(out, start, end - start);
+	return end - start;
 }
 
-/*
- * Prints the given variant value to output, formatted for display.
- */
-void nl_display_variant(FILE *output, struct nl_variant value)
+// Formats a non-string variant value into out, which must hold at least
+// SCALAR_FORMAT_SIZE bytes.  Uses the display format of nl_display_variant()
+// if serialize is zero, or the lossless format of nl_fprint_variant()
+// otherwise.  Returns the length of the result (no NUL byte is written).
+static int format_scalar(char *out, struct nl_variant value, int serialize)
 {
 	union nl_varvalue data = value.value;
+	char *end = out + SCALAR_FORMAT_SIZE;
+	char *start;
+	int ret;
 
 	switch(value.type) {
 		case ANY:
-			fprintf(output, "0x%08lx", (unsigned long)data.any);
+			start = format_hex(end, (unsigned long)data.any);
 			break;
 
 		case INTEGER:
-			fprintf(output, "%d", data.integer);
+			start = format_u64(end, data.integer < 0 ? -(uint64_t)data.integer : (uint64_t)data.integer);
+			if(data.integer < 0) {
+				*--start = '-';
+			}
 			break;
 
 		case FLOAT:
-			fprintf(output, "%f", data.floating);
-			break;
-
-		case STRING:
-			fprintf(output, "%s", data.string == NULL ? "(null)" : data.string);
-			break;
+			if(!serialize) {
+				ret = format_fixed(out, data.floating, 6);
+				if(ret < 0) {
+					ret = snprintf(out, SCALAR_FORMAT_SIZE, "%f", data.floating);
+				}
+			} else if((data.floating < 0.001 && data.floating > -0.001) ||
+					data.floating <= -1000 || data.floating >= 1000) {
+				ret = format_exp(out, data.floating, 12);
+				if(ret < 0) {
+					ret = snprintf(out, SCALAR_FORMAT_SIZE, "%.12e", data.floating);
+				}
+			} else {
+				ret = format_fixed(out, data.floating, 15);
+				if(ret < 0) {
+					ret = snprintf(out, SCALAR_FORMAT_SIZE, "%.15f", data.floating);
+				}
+			}
+			return ret;
 
 		case DATA:
 			if(data.data == NULL) {
-				fprintf(output, "[NULL raw data]");
+				memcpy(out, "[NULL raw data]", 15);
+				return 15;
+			}
+
+			end[-1] = ']';
+			start = format_u64(end - 1, data.data->size);
+			if(data.data->data == NULL) {
+				start -= 25;
+				memcpy(start, "[NULL raw data of length ", 25);
 			} else {
-				if(data.data->data == NULL) {
-					fprintf(output, "[NULL raw data of length %zu]", data.data->size);
-				} else {
-					fprintf(output, "[Raw data of length %zu]", data.data->size);
-				}
+				start -= 20;
+				memcpy(start, "[Raw data of length ", 20);
 			}
 			break;
 
 		default:
-			fprintf(output, "Unknown type %d", value.type);
-			break;
+			return snprintf(out, SCALAR_FORMAT_SIZE, "Unknown type %d", value.type);
 	}
+
+	memmove(out, start, end - start);
+	return end - start;
 }
 
 /*
- * Stores up to length bytes of the string representation of the given variant
- * value in the given string, including the terminating null byte.  Returns the
- * full length of the string that would be stored if there were enough room,
- * including the terminating NUL byte.  Pass NULL for str and 0 for length to
- * measure the length without writing (e.g. for allocating a buffer).
+ * Prints the given variant value to output, formatted for lossless textual
+ * serialization.  Raw data values are not printed.  Prints "Unknown type %d"
+ * if the value's type is invalid.  Returns the number of bytes written on
+ * success, negative on error.
  */
-static int nl_store_variant(char *str, int length, struct nl_variant value)
+int nl_fprint_variant(FILE *output, struct nl_variant value)
 {
-	union nl_varvalue data = value.value;
-	int ret; // Using ret variable instead of return to allow adding 1 at end
+	char buf[256];
+	char *out = buf;
+	size_t len;
+	int ret = -1;
 
-	switch(value.type) {
-		case ANY:
-			ret = snprintf(str, length, "0x%08lx", (unsigned long)data.any);
-			break;
+	if(value.type == STRING) {
+		const struct nl_escape_table *table = nl_escape_string_table();
+		const char *str = value.value.string;
+		size_t str_len;
 
-		case INTEGER:
-			ret = snprintf(str, length, "%d", data.integer);
-			break;
+		if(str == NULL) {
+			return fprintf(output, "\\0");
+		}
 
-		case FLOAT:
-			ret = snprintf(str, length, "%f", data.floating);
-			break;
+		// Escape into the stack buffer, or a heap buffer for long strings
+		str_len = strlen(str);
+		len = nl_escape_table_into(table, str, str_len, buf, sizeof(buf));
+		if(len > sizeof(buf)) {
+			out = malloc(len);
+			if(out == NULL) {
+				ERRNO_OUT("Error allocating %zu bytes to escape string", len);
+				return -1;
+			}
+			nl_escape_table_into(table, str, str_len, out, len);
+		}
+	} else {
+		len = format_scalar(buf, value, 1);
+	}
 
-		case STRING:
-			// FIXME: ambiguous "(null)" vs. NULL
-			ret = snprintf(str, length, "%s", data.string == NULL ? "(null)" : data.string);
-			break;
+	if(len <= INT_MAX && fwrite(out, 1, len, output) == len) {
+		ret = len;
+	}
 
-		case DATA:
-			if(data.data == NULL) {
-				ret = snprintf(str, length, "[NULL raw data]");
-			} else {
-				if(data.data->data == NULL) {
-					ret = snprintf(str, length, "[NULL raw data of length %zu]", data.data->size);
-				} else {
-					ret = snprintf(str, length, "[Raw data of length %zu]", data.data->size);
-				}
-			}
-			break;
+	if(out != buf) {
+		free(out);
+	}
 
-		default:
-			ret = snprintf(str, length, "Unknown type %d", value.type);
-			break;
+	return ret;
+}
+
+/*
+ * Prints the given variant value to output, formatted for display.
+ */
+void nl_display_variant(FILE *output, struct nl_variant value)
+{
+	char buf[SCALAR_FORMAT_SIZE];
+
+	if(value.type == STRING) {
+		fputs(value.value.string == NULL ? "(null)" : value.value.string, output);
+	} else {
+		fwrite(buf, 1, format_scalar(buf, value, 0), output);
 	}
+}
+
+/*
+ * Formats the given variant value for display into buf, exactly as
+ * nl_variant_to_string() would, without allocating memory.  Writes at most len
+ * bytes, including a terminating NUL byte if len is not zero.  Returns the
+ * full length of the formatted value, excluding the NUL byte, like snprintf(),
+ * so the output was truncated if the return value is len or more.  Returns -1
+ * on error.
+ */
+int nl_variant_format_into(char *buf, size_t len, struct nl_variant value)
+{
+	char scalar[SCALAR_FORMAT_SIZE];
+	const char *str;
+	size_t str_len;
 
-	if(ret < 0) {
-		ERRNO_OUT("Error storing %s variant in buffer", NL_VARTYPE_NAME(value.type));
-		return ret;
+	if(buf == NULL && len != 0) {
+		ERROR_OUT("Cannot format a variant into a null buffer.\n");
+		return -1;
 	}
 
-	return ret + 1;
+	if(value.type == STRING) {
+		// FIXME: ambiguous "(null)" vs. NULL
+		str = value.value.string == NULL ? "(null)" : value.value.string;
+		str_len = strlen(str);
+		if(str_len > INT_MAX) {
+			ERROR_OUT("String variant of length %zu is too long to format\n", str_len);
+			return -1;
+		}
+	} else {
+		str = scalar;
+		str_len = format_scalar(scalar, value, 0);
+	}
+
+	if(len != 0) {
+		len = MIN_NUM(str_len, len - 1);
+		memcpy(buf, str, len);
+		buf[len] = 0;
+	}
+
+	return str_len;
 }
 
 /*
  * Stores the given data in a newly-allocated string, formatted for display.
- * The data is formatted twice: once to calculate the length of the string, and
- * again to store the data in the string.  Returns NULL if a new string could
- * not be allocated or written.  The returned buffer must be free()d.
+ * Returns NULL if a new string could not be allocated.  The returned buffer
+ * must be free()d.
  */
 char *nl_variant_to_string(struct nl_variant value)
 {
+	char scalar[SCALAR_FORMAT_SIZE];
 	char *buf;
 	int length;
 
-	length = nl_store_variant(NULL, 0, value);
-	if(length < 0) {
-		return NULL;
+	if(value.type == STRING) {
+		buf = nl_strdup(value.value.string == NULL ? "(null)" : value.value.string);
+		if(buf == NULL) {
+			ERRNO_OUT("Error allocating memory for variant to string conversion");
+		}
+		return buf;
 	}
 
-	buf = malloc(length);
+	length = format_scalar(scalar, value, 0);
+
+	buf = malloc(length + 1);
 	if(buf == NULL) {
 		ERRNO_OUT("Error allocating memory for variant to string conversion");
 		return NULL;
 	}
 
-	if(nl_store_variant(buf, length, value) < 0) {
-		free(buf);
-		return NULL;
-	}
+	memcpy(buf, scalar, length);
+	buf[length] = 0;
 
 	return buf;
 }
 
+// Parses a plain base 10 (with optional sign) or base 16 integer as
+// strtol(str, NULL, base) would.  Returns -1 if str must be parsed by strtol()
+// instead (too many digits, out of range for a long, no digits, or a prefix
+// strtol() would also accept).
+static int parse_long(const char *str, int base, long *value)
+{
+	uint64_t v = 0;
+	int neg = 0;
+	int digits;
+
+	if(base == 16) {
+		if(str[0] == '0' && (str[1] == 'x' || str[1] == 'X')) {
+			return -1;
+		}
+
+		for(digits = 0; isxdigit(str[digits]); digits++) {
+			unsigned int c = str[digits];
+			v = (v << 4) | (c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10);
+		}
+
+		if(digits == 0 || digits > 15 || v > LONG_MAX) {
+			return -1;
+		}
+
+		*value = v;
+		return 0;
+	}
+
+	if(str[0] == '-' || str[0] == '+') {
+		neg = str[0] == '-';
+		str++;
+	}
+
+	for(digits = 0; isdigit(str[digits]); digits++) {
+		v = v * 10 + (str[digits] - '0');
+	}
+
+	if(digits == 0 || digits > 18 || v > (uint64_t)LONG_MAX + neg) {
+		return -1;
+	}
+
+	*value = neg ? (long)-v : (long)v;
+	return 0;
+}
+
+// Parses a decimal number with up to 19 significant digits and a power of ten
+// within a double's exact range as strtof(str, NULL) would.  The double
+// result of one correctly rounded operation can only round differently to
+// float than the exact value if it lands exactly halfway between two floats,
+// so those cases fall back to strtof().  Returns -1 if str must be parsed by
+// strtof() instead (hex, inf, nan, subnormal or out-of-range results, etc.).
+static int parse_float(const char *str, float *value)
+{
+	uint64_t mantissa = 0, bits;
+	int neg = 0, digits = 0, any_digits = 0;
+	int exp10 = 0, exp;
+	double d;
+
+	// Extended precision evaluation would round twice
+	if(FLT_EVAL_METHOD != 0) {
+		return -1;
+	}
+
+	if(str[0] == '-' || str[0] == '+') {
+		neg = str[0] == '-';
+		str++;
+	}
+
+	if(str[0] == '0' && (str[1] == 'x' || str[1] == 'X')) {
+		return -1;
+	}
+
+	for(; isdigit(*str); str++) {
+		any_digits = 1;
+		if(mantissa != 0 || *str != '0') {
+			mantissa = mantissa * 10 + (*str - '0');
+			digits++;
+		}
+	}
+
+	if(*str == '.') {
+		for(str++; isdigit(*str); str++) {
+			any_digits = 1;
+			if(mantissa != 0 || *str != '0') {
+				mantissa = mantissa * 10 + (*str - '0');
+				digits++;
+			}
+			exp10--;
+		}
+	}
+
+	if(!any_digits || digits > 19) {
+		return -1;
+	}
+
+	if(*str == 'e' || *str == 'E') {
+		const char *e = str + 1;
+		int exp_neg = 0;
+
+		if(*e == '-' || *e == '+') {
+			exp_neg = *e == '-';
+			e++;
+		}
+
+		// Without exponent digits, strtof() stops before the 'e'
+		if(isdigit(*e)) {
+			for(exp = 0; isdigit(*e) && exp < 10000; e++) {
+				exp = exp * 10 + (*e - '0');
+			}
+			if(isdigit(*e)) {
+				return -1;
+			}
+			exp10 += exp_neg ? -exp : exp;
+		}
+	}
+
+	if(mantissa == 0) {
+		*value = neg ? -0.0f : 0.0f;
+		return 0;
+	}
+
+	if(mantissa > (1ull << 53) || exp10 < -22 || exp10 > 22) {
+		return -1;
+	}
+
+	if(exp10 < 0) {
+		d = (double)mantissa / pow10_double[-exp10];
+	} else {
+		d = (double)mantissa * pow10_double[exp10];
+	}
+
+	// The 29 low mantissa bits are those dropped when rounding to float
+	memcpy(&bits, &d, sizeof(bits));
+	if(d < FLT_MIN || d > FLT_MAX || (bits & 0x1fffffff) == 0x10000000) {
+		return -1;
+	}
+
+	*value = neg ? -(float)d : (float)d;
+	return 0;
+}
+
 /*
  * Attempts to convert the given string to the given variant type.  Stores the
  * result in *result and returns 0 on success.  Returns -1 and does not modify
  * *result on error.  Integer values are treated as base 16 if prefixed with
  * 0x, base 10 otherwise (leading zeros are ignored).  For integer values, the
  * string "true" is treated as 1, "false" as 0.  Initial whitespace is skipped
- * for numeric types.  Conversion of numeric types is performed by strtol and
- * strtof.  Conversion of string types stops at the first newline or carriage
- * return, or at the end of the string.  Strings are de-escaped using
+ * for numeric types.  Numeric types are converted exactly as strtol() and
+ * strtof() would, using those functions for inputs not handled by faster
+ * internal parsers.  Conversion of string types stops at the first newline or
+ * carriage return, or at the end of the string.  Strings are de-escaped using
  * nl_unescape_string().  If the considered part of str contains exactly "\\0",
  * then a NULL string is stored in *result.  Invalid integer and floating point
  * values will not be converted.  String and data values must later be freed
@@ -426,6 +848,7 @@ char *nl_variant_to_string(struct nl_variant value)
 int nl_string_to_varvalue(enum nl_vartype type, const char *str, union nl_varvalue *result)
 {
 	union nl_varvalue tmp = { .any = 0 };
+	long lvalue;
 	size_t len;
 
 	if(str == NULL) {
@@ -463,21 +886,28 @@ int nl_string_to_varvalue(enum nl_vartype type, const char *str, union nl_varval
 			}
 
 			if(str[0] == '0' && str[1] == 'x') {
-				tmp.integer = strtol(str + 2, NULL, 16);
+				if(parse_long(str + 2, 16, &lvalue)) {
+					lvalue = strtol(str + 2, NULL, 16);
+				}
 			} else {
-				tmp.integer = strtol(str, NULL, 10);
+				if(parse_long(str, 10, &lvalue)) {
+					lvalue = strtol(str, NULL, 10);
+				}
 			}
 			if(errno) {
 				ERROR_OUT("Error parsing string '%s' as integer: %s\n", str, strerror(errno));
 				return -1;
 			}
+			tmp.integer = lvalue;
 			break;
 
 		case FLOAT:
 			str += strspn(str, " \t\v\f");
 			errno = 0;
 
-			tmp.floating = strtof(str, NULL);
+			if(parse_float(str, &tmp.floating)) {
+				tmp.floating = strtof(str, NULL);
+			}
 			if(errno) {
 				ERROR_OUT("Error parsing string '%s' as floating point: %s\n", str, strerror(errno));
 				return -1;
@@ -0,0 +1,156 @@
+/*
+ * Measures file-to-file and file-to-pipe copy throughput in MB/s for
+ * nl_copy_fd() and the 32KB stdio loop nl_stream_to_fd() used before it
+ * switched to nl_copy_fd().
+ * Copyright (C)2026 Mike Bourgeous.  Released under AGPLv3.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "nlutils.h"
+
+#define COPY_COUNT 5
+
+// The previous nl_stream_to_fd() algorithm.
+static ssize_t legacy_stream_to_fd(FILE *src, int destfd)
+{
+	char buf[32768];
+	ssize_t size = 0;
+	size_t bytes;
+
+	while(!feof(src)) {
+		bytes = fread(buf, 1, sizeof(buf), src);
+		if(bytes == 0 && ferror(src)) {
+			return -1;
+		}
+
+		if(write(destfd, buf, bytes) != (ssize_t)bytes) {
+			return -1;
+		}
+
+		size += bytes;
+	}
+
+	return size;
+}
+
+// Reads and discards everything from the pipe read fd in arg.
+static void *drain_pipe(void *arg)
+{
+	int fd = *(int *)arg;
+	char *buf = malloc(1048576);
+
+	while(read(fd, buf, 1048576) > 0) {
+	}
+
+	free(buf);
+
+	return NULL;
+}
+
+// Copies the source file to destfd (a regular file if pipe_out is zero, or a
+// pipe drained by another thread) COPY_COUNT times with nl_copy_fd()
+// (use_copy_fd nonzero) or the legacy loop.  Returns MB/s.
+static double bench_copy(const char *filename, size_t size, int use_copy_fd, int pipe_out)
+{
+	char destname[] = "/tmp/copy_benchmark_dest_XXXXXX";
+	pthread_t drain_thread;
+	int pipefds[2];
+	int64_t start, elapsed = 0;
+	int destfd;
+
+	if(pipe_out) {
+		if(pipe(pipefds) || pthread_create(&drain_thread, NULL, drain_pipe, &pipefds[0])) {
+			ERRNO_OUT("Error creating drained pipe");
+			abort();
+		}
+		destfd = pipefds[1];
+	} else {
+		destfd = mkstemp(destname);
+		if(destfd < 0) {
+			ERRNO_OUT("Error creating destination file");
+			abort();
+		}
+		unlink(destname);
+	}
+
+	for(int i = 0; i < COPY_COUNT; i++) {
+		FILE *src = fopen(filename, "rb");
+		ssize_t copied;
+
+		if(src == NULL || (!pipe_out && (ftruncate(destfd, 0) || lseek(destfd, 0, SEEK_SET)))) {
+			ERRNO_OUT("Error preparing copy");
+			abort();
+		}
+
+		start = nl_clock_ns(CLOCK_MONOTONIC);
+		if(use_copy_fd) {
+			copied = nl_copy_fd(fileno(src), destfd);
+		} else {
+			copied = legacy_stream_to_fd(src, destfd);
+		}
+		elapsed += nl_clock_ns(CLOCK_MONOTONIC) - start;
+
+		if(copied != (ssize_t)size) {
+			ERROR_OUT("Copied %zd of %zu bytes\n", copied, size);
+			abort();
+		}
+
+		fclose(src);
+	}
+
+	close(destfd);
+	if(pipe_out) {
+		pthread_join(drain_thread, NULL);
+		close(pipefds[0]);
+	}
+
+	return (double)size * COPY_COUNT * 1000.0 / elapsed;
+}
+
+int main(int argc, char *argv[])
+{
+	char filename[] = "/tmp/copy_benchmark_XXXXXX";
+	size_t size = 256 << 20;
+	char block[65536];
+	int fd;
+
+	if(argc == 2) {
+		size = strtoull(argv[1], NULL, 10);
+	} else if(argc > 2) {
+		printf("Usage: %s [file_bytes (default: 268435456)]\n", argv[0]);
+		return 1;
+	}
+
+	fd = mkstemp(filename);
+	if(fd < 0) {
+		ERRNO_OUT("Error creating temporary file");
+		return -1;
+	}
+
+	memset(block, 'x', sizeof(block));
+	for(size_t written = 0; written < size; written += sizeof(block)) {
+		size_t len = MIN_NUM(sizeof(block), size - written);
+		if(write(fd, block, len) != (ssize_t)len) {
+			ERRNO_OUT("Error writing temporary file");
+			unlink(filename);
+			return -1;
+		}
+	}
+	close(fd);
+
+	INFO_OUT("Copying %zu bytes %d times per test\n", size, COPY_COUNT);
+	INFO_OUT("file to file:  legacy %9.1f MB/s    nl_copy_fd %9.1f MB/s\n",
+			bench_copy(filename, size, 0, 0), bench_copy(filename, size, 1, 0));
+	INFO_OUT("file to pipe:  legacy %9.1f MB/s    nl_copy_fd %9.1f MB/s\n",
+			bench_copy(filename, size, 0, 1), bench_copy(filename, size, 1, 1));
+
+	unlink(filename);
+
+	return 0;
+}
@@ -0,0 +1,181 @@
+/*
+ * Measures escaping throughput in MB/s for nl_escape_string(),
+ * nl_escape_data(), and nl_escape_table_into() with each scanner supported by
+ * the CPU, compared with the linear-search escaping used before the lookup
+ * tables, on mostly-clean and escape-heavy input.
+ * Copyright (C)2026 Mike Bourgeous.  Released under AGPLv3.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "nlutils.h"
+
+#define TIME_LIMIT 200000000 // 0.2 seconds per test
+
+static const char * const scanner_names[] = {
+	[NL_ESCAPE_SCAN_AUTO] = "automatic",
+	[NL_ESCAPE_SCAN_SCALAR] = "scalar",
+	[NL_ESCAPE_SCAN_SSSE3] = "SSSE3",
+	[NL_ESCAPE_SCAN_AVX2] = "AVX2",
+	[NL_ESCAPE_SCAN_NEON] = "NEON",
+};
+
+static const size_t sizes[] = { 64, 4096, 1048576 };
+
+static const char legacy_chars[] = {
+	'\t', 't', '\n', 'n', '\r', 'r', '\v', 'v', '\f', 'f', ':', ':', '"', '"', '\\', '\\',
+};
+
+// The previous linear search through the escape table.
+static inline char legacy_get_escape(char c)
+{
+	for(size_t i = 0; i < ARRAY_SIZE(legacy_chars); i += 2) {
+		if(legacy_chars[i] == c) {
+			return legacy_chars[i + 1];
+		}
+	}
+
+	return 0;
+}
+
+// The previous nl_escape_string(): count, grow, copy to a temporary buffer,
+// then escape back into the string.
+static int legacy_escape_string(char **str, size_t *size)
+{
+	size_t len = strlen(*str) + 1;
+	char *tmp, *ptr, *ptr2;
+
+	for(ptr = *str; *ptr; ptr++) {
+		if(legacy_get_escape(*ptr)) {
+			len++;
+		}
+	}
+	if(len > *size) {
+		tmp = realloc(*str, len);
+		if(tmp == NULL) {
+			return -1;
+		}
+		*str = tmp;
+		*size = len;
+	}
+
+	tmp = strdup(*str);
+	if(tmp == NULL) {
+		return -1;
+	}
+	for(ptr = *str, ptr2 = tmp; *ptr2; ptr2++) {
+		char replace = legacy_get_escape(*ptr2);
+		if(replace) {
+			*ptr++ = '\\';
+			*ptr++ = replace;
+		} else {
+			*ptr++ = *ptr2;
+		}
+	}
+	*ptr = 0;
+	free(tmp);
+
+	return 0;
+}
+
+// Fills buf with len bytes of printable text, with a character that needs
+// escaping every 100 bytes (heavy zero) or every 4 bytes (heavy nonzero).
+static void fill_input(char *buf, size_t len, int heavy)
+{
+	static const char specials[] = "\n\t\":\\";
+
+	for(size_t i = 0; i < len; i++) {
+		if(i % (heavy ? 4 : 100) == 3) {
+			buf[i] = specials[(i / 4) % (sizeof(specials) - 1)];
+		} else {
+			buf[i] = 'a' + i % 26;
+		}
+	}
+}
+
+// Escapes size bytes of input repeatedly with the given method (0 for the
+// legacy nl_escape_string(), 1 for nl_escape_string(), 2 for
+// nl_escape_data(), 3 for nl_escape_table_into()) for TIME_LIMIT, returning
+// input MB/s.
+static double bench_escape(const char *input, size_t size, int method)
+{
+	const struct nl_escape_table *table = nl_escape_string_table();
+	size_t buf_size = size * 4 + 1;
+	char *buf = malloc(buf_size);
+	int64_t start = nl_clock_ns(CLOCK_MONOTONIC), elapsed;
+	size_t iterations = 0;
+	size_t data_size;
+
+	if(buf == NULL) {
+		ERRNO_OUT("Error allocating escape buffer");
+		abort();
+	}
+
+	do {
+		switch(method) {
+			case 0:
+				memcpy(buf, input, size + 1);
+				legacy_escape_string(&buf, &buf_size);
+				break;
+			case 1:
+				memcpy(buf, input, size + 1);
+				nl_escape_string(&buf, &buf_size);
+				break;
+			case 2:
+				memcpy(buf, input, size);
+				data_size = size;
+				nl_escape_data(&buf, &data_size, &buf_size, 0);
+				break;
+			default:
+				nl_escape_table_into(table, input, size, buf, buf_size);
+				break;
+		}
+
+		iterations++;
+		elapsed = nl_clock_ns(CLOCK_MONOTONIC) - start;
+	} while(elapsed < TIME_LIMIT);
+
+	free(buf);
+
+	return (double)size * iterations * 1000.0 / elapsed;
+}
+
+int main(void)
+{
+	size_t max_size = sizes[ARRAY_SIZE(sizes) - 1];
+	char *input = malloc(max_size + 1);
+
+	if(input == NULL) {
+		ERRNO_OUT("Error allocating benchmark input");
+		return -1;
+	}
+
+	for(int heavy = 0; heavy < 2; heavy++) {
+		INFO_OUT("%s input:\n", heavy ? "Escape-heavy (1 in 4)" : "Mostly clean (1 in 100)");
+
+		for(size_t i = 0; i < ARRAY_SIZE(sizes); i++) {
+			fill_input(input, sizes[i], heavy);
+			input[sizes[i]] = 0;
+
+			INFO_OUT("%8zu bytes: legacy string %8.1f MB/s\n", sizes[i], bench_escape(input, sizes[i], 0));
+
+			for(int impl = NL_ESCAPE_SCAN_SCALAR; impl <= NL_ESCAPE_SCAN_NEON; impl++) {
+				if(nl_escape_set_scanner(impl)) {
+					continue;
+				}
+
+				INFO_OUT("%8zu bytes: %-9s string %8.1f MB/s    data %8.1f MB/s    into %8.1f MB/s\n",
+						sizes[i], scanner_names[impl],
+						bench_escape(input, sizes[i], 1),
+						bench_escape(input, sizes[i], 2),
+						bench_escape(input, sizes[i], 3));
+			}
+		}
+	}
+
+	free(input);
+
+	return 0;
+}
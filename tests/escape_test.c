@@ -66,6 +66,157 @@ void check_unescape(char *check, char *expect, char *failmessage, int include_ze
 	free(result);
 }
 
+// The original one-byte-at-a-time escaping rules, for comparison.  Data
+// escaping leaves colons alone and escapes unprintable bytes as hexadecimal.
+static size_t reference_escape(const char *data, size_t len, char *out, int data_mode)
+{
+	static const char pairs[] = "\tt\nn\rr\vv\ff::\"\"\\\\";
+	char *start = out;
+	size_t i, j;
+
+	for(i = 0; i < len; i++) {
+		unsigned char c = data[i];
+
+		for(j = 0; j < sizeof(pairs) - 1; j += 2) {
+			if(c == (unsigned char)pairs[j] && !(data_mode && c == ':')) {
+				break;
+			}
+		}
+
+		if(j < sizeof(pairs) - 1) {
+			*out++ = '\\';
+			*out++ = pairs[j + 1];
+		} else if(data_mode && (c < 0x20 || c > 0x7e)) {
+			out += sprintf(out, "\\x%02x", c);
+		} else {
+			*out++ = c;
+		}
+	}
+
+	return out - start;
+}
+
+// Compares every escaping function with reference_escape() on pseudorandom
+// data of many lengths, mostly clean and escape-heavy, using the currently
+// selected scanner.
+static int check_random_escapes(const char *scanner)
+{
+	static char input[1200], expected[4 * sizeof(input) + 1], output[4 * sizeof(input) + 1];
+	uint32_t seed = 1;
+
+	for(int heavy = 0; heavy < 2; heavy++) {
+		for(size_t len = 0; len < sizeof(input); len += len < 100 ? 1 : 97) {
+			for(size_t i = 0; i < len; i++) {
+				seed = seed * 1103515245 + 12345;
+				if(heavy || (seed >> 16) % 97 == 0) {
+					input[i] = seed >> 16;
+				} else {
+					input[i] = 'a' + (seed >> 20) % 26;
+				}
+			}
+
+			for(int data_mode = 0; data_mode < 2; data_mode++) {
+				const struct nl_escape_table *table = data_mode ? nl_escape_data_table() : nl_escape_string_table();
+				size_t in_len = len;
+				size_t exp_len, out_len;
+
+				// Strings stop at the first zero byte
+				if(!data_mode) {
+					in_len = strnlen(input, len);
+				}
+
+				exp_len = reference_escape(input, in_len, expected, data_mode);
+
+				if(nl_escape_table_count(table, input, in_len) != exp_len - in_len) {
+					ERROR_OUT("%s: wrong count for %zu bytes (data %d, heavy %d)\n", scanner, in_len, data_mode, heavy);
+					return -1;
+				}
+
+				out_len = nl_escape_table_into(table, input, in_len, output, sizeof(output));
+				if(out_len != exp_len || memcmp(output, expected, exp_len)) {
+					ERROR_OUT("%s: wrong escape into buffer for %zu bytes (data %d, heavy %d)\n", scanner, in_len, data_mode, heavy);
+					return -1;
+				}
+
+				// A short buffer gets a whole number of escape sequences
+				memset(output, 0, sizeof(output));
+				out_len = nl_escape_table_into(table, input, in_len, output, exp_len / 2);
+				if(out_len != exp_len || memcmp(output, expected, strnlen(output, exp_len / 2)) ||
+						exp_len / 2 - strnlen(output, exp_len / 2) > 3) {
+					ERROR_OUT("%s: wrong escape into short buffer for %zu bytes (data %d, heavy %d)\n", scanner, in_len, data_mode, heavy);
+					return -1;
+				}
+
+				if(data_mode) {
+					size_t data_size = in_len;
+					size_t buf_size = in_len + 1;
+					char *buf = malloc(buf_size);
+					memcpy(buf, input, in_len);
+
+					if(nl_escape_data(&buf, &data_size, &buf_size, 1) || data_size != exp_len + 1 ||
+							memcmp(buf, expected, exp_len) || buf[exp_len] != 0) {
+						ERROR_OUT("%s: wrong nl_escape_data() result for %zu bytes (heavy %d)\n", scanner, in_len, heavy);
+						return -1;
+					}
+					free(buf);
+				} else {
+					size_t size = in_len + 1;
+					char *buf = malloc(size);
+					memcpy(buf, input, in_len);
+					buf[in_len] = 0;
+
+					if(nl_count_escapes(buf) != (int)(exp_len - in_len) || nl_escape_string(&buf, &size) ||
+							strlen(buf) != exp_len || memcmp(buf, expected, exp_len)) {
+						ERROR_OUT("%s: wrong nl_escape_string() result for %zu bytes (heavy %d)\n", scanner, in_len, heavy);
+						return -1;
+					}
+					free(buf);
+				}
+			}
+		}
+	}
+
+	return 0;
+}
+
+// Escapes and unescapes with a custom table.
+static int check_custom_table(void)
+{
+	struct nl_escape_table table;
+	char output[64];
+	size_t len;
+	int ret;
+
+	if(!nl_escape_table_init(&table, '%', ",c", 1, 0)) {
+		ERROR_OUT("nl_escape_table_init() should've failed for an odd pair count\n");
+		return -1;
+	}
+	if(!nl_escape_table_init(&table, '%', "\nx", 2, 1)) {
+		ERROR_OUT("nl_escape_table_init() should've failed for an 'x' replacement with hex\n");
+		return -1;
+	}
+
+	if(nl_escape_table_init(&table, '%', ",c;s", 4, 1)) {
+		ERROR_OUT("nl_escape_table_init() failed for a valid table\n");
+		return -1;
+	}
+
+	len = nl_escape_table_into(&table, "a,b;c%d\n\\", 9, output, sizeof(output));
+	output[len] = 0;
+	if(strcmp(output, "a%cb%sc%%d%x0a\\")) {
+		ERROR_OUT("Custom table escape: expected '%s', got '%s'\n", "a%cb%sc%%d%x0a\\", output);
+		return -1;
+	}
+
+	ret = nl_unescape_table_string(&table, output, 0, ESCAPE_NO_DEQUOTE);
+	if(ret != 6 || strcmp(output, "a,b;c%d\n\\")) {
+		ERROR_OUT("Custom table unescape: got '%s' (%d characters removed)\n", output, ret);
+		return -1;
+	}
+
+	return 0;
+}
+
 int main()
 {
 	char *result;
@@ -212,6 +363,29 @@ int main()
 	check_unescape("Escape\\x20without\\x20quotes\"", "Escape\\x20without\\x20quotes\"", "Error on quote-conditional unescape", 0, ESCAPE_IF_QUOTED);
 	check_unescape("\\\"Escaped\\tquote\\x20without\\x20quotes\"", "\\\"Escaped\\tquote\\x20without\\x20quotes\"", "Error on quote-conditional unescape", 0, ESCAPE_IF_QUOTED);
 
+	// Generic tables
+	if(check_custom_table()) {
+		return -1;
+	}
+
+	// Every scanner against the original escaping rules
+	static const char * const scanner_names[] = {
+		[NL_ESCAPE_SCAN_AUTO] = "automatic",
+		[NL_ESCAPE_SCAN_SCALAR] = "scalar",
+		[NL_ESCAPE_SCAN_SSSE3] = "SSSE3",
+		[NL_ESCAPE_SCAN_AVX2] = "AVX2",
+		[NL_ESCAPE_SCAN_NEON] = "NEON",
+	};
+	for(int impl = NL_ESCAPE_SCAN_AUTO; impl <= NL_ESCAPE_SCAN_NEON; impl++) {
+		if(nl_escape_set_scanner(impl)) {
+			DEBUG_OUT("%s escape scanner not supported\n", scanner_names[impl]);
+			continue;
+		}
+		if(check_random_escapes(scanner_names[impl])) {
+			return -1;
+		}
+	}
+
 	INFO_OUT("String escape tests: success\n");
 
 	return 0;
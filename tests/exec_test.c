@@ -7,6 +7,7 @@
 #include <stdlib.h>
 #include <sys/types.h>
 #include <signal.h>
+#include <poll.h>
 
 #include "nlutils.h"
 
@@ -220,11 +221,359 @@ int test_popen3(void)
 	return 0;
 }
 
+// Tests nl_popen3vea() spawn actions and exec failure reporting.
+int test_popen3vea(void)
+{
+	struct nl_raw_data *raw_data;
+	int readfd;
+	pid_t pid;
+	int ret;
+
+	INFO_OUT("Testing nl_popen3vea() spawn actions\n");
+
+	pid = nl_popen3vea(NULL, &readfd, NULL, "/bin/sh", (char *[]){"/bin/sh", "-c", "ulimit -n; nice", NULL}, environ,
+			(struct nl_spawn_action[]){
+				{ .type = NL_SPAWN_RLIMIT, .value = RLIMIT_NOFILE, .limit = { 64, 64 } },
+				{ .type = NL_SPAWN_NICE, .value = 7 },
+				{ .type = NL_SPAWN_NICE_MIN, .value = 3 },
+				{ .type = NL_SPAWN_SCHED_OTHER },
+				{ .type = NL_SPAWN_END },
+			});
+	if(pid <= 0) {
+		ERROR_OUT("Error running spawn action test command\n");
+		return -1;
+	}
+
+	if(CHECK_NULL(raw_data = nl_read_stream(readfd))) {
+		return -1;
+	}
+	if(strcmp(raw_data->data, "64\n7\n")) {
+		ERROR_OUT("Expected file limit 64 and niceness 7 from spawn actions, got '%s'\n", raw_data->data);
+		return -1;
+	}
+	nl_destroy_data(raw_data);
+	close(readfd);
+
+	ret = nl_wait_get_return(pid);
+	if(ret) {
+		ERROR_OUT("Expected spawn action test command to return 0, got %d\n", ret);
+		return -1;
+	}
+
+	// Failures in the child are returned without a child PID
+	pid = nl_popen3vea(NULL, NULL, NULL, "/bin/true", (char *[]){"/bin/true", NULL}, environ,
+			(struct nl_spawn_action[]){ { .type = 12345 }, { .type = NL_SPAWN_END } });
+	if(pid != -1 || errno != EINVAL) {
+		ERROR_OUT("Expected EINVAL for an invalid spawn action, got PID %d\n", pid);
+		return -1;
+	}
+
+	pid = nl_popen3vea(NULL, NULL, NULL, "/bin/true", (char *[]){"/bin/true", NULL}, environ,
+			(struct nl_spawn_action[]){ { .type = 12345, .ignore_errors = 1 }, { .type = NL_SPAWN_END } });
+	if(pid == -1) {
+		ERRNO_OUT("Expected an ignored spawn action failure to run the command");
+		return -1;
+	}
+
+	ret = nl_wait_get_return(pid);
+	if(ret) {
+		ERROR_OUT("Expected a command with an ignored spawn action failure to return 0, got %d\n", ret);
+		return -1;
+	}
+
+	// access() allows a directory, but execve() does not
+	pid = nl_popen3vea(NULL, NULL, NULL, "/", (char *[]){"/", NULL}, environ, NULL);
+	if(pid != -1 || errno != EACCES) {
+		ERROR_OUT("Expected EACCES executing a directory, got PID %d\n", pid);
+		return -1;
+	}
+
+	// The fork() path reports exec failure through its status pipe
+	pid = nl_popen3vec(NULL, NULL, NULL, "/", (char *[]){"/", NULL}, environ, NULL);
+	if(pid != -1 || errno != EACCES) {
+		ERROR_OUT("Expected EACCES executing a directory with nl_popen3vec(), got PID %d\n", pid);
+		return -1;
+	}
+
+	return 0;
+}
+
+// Tests concurrent stdin/stdout/stderr handling in nl_popenve_capture().
+int test_capture(void)
+{
+	struct nl_raw_data input = { .size = 4 << 20 };
+	struct nl_capture_buf out = { .data = { .size = 0 } };
+	struct nl_capture_buf err = { .data = { .size = 0 } };
+	struct timespec start, end;
+	int ret;
+
+	INFO_OUT("Testing nl_popenve_capture()\n");
+
+	input.data = malloc(input.size);
+	if(input.data == NULL) {
+		ERRNO_OUT("Error allocating capture test input");
+		return -1;
+	}
+	for(size_t i = 0; i < input.size; i++) {
+		input.data[i] = 'a' + i % 26;
+	}
+
+	// Input and output far larger than a pipe buffer, plus stderr
+	ret = nl_popenve_capture("/bin/sh", (char *[]){"/bin/sh", "-c", "cat; echo Error >&2; exit 3", NULL}, environ,
+			&input, &out, &err, 0);
+	if(ret != 3) {
+		ERROR_OUT("Expected large capture to return 3, got %d\n", ret);
+		return -1;
+	}
+	if(out.data.size != input.size || memcmp(out.data.data, input.data, input.size) || out.truncated) {
+		ERROR_OUT("Captured stdout does not match input (got %zu of %zu bytes)\n", out.data.size, input.size);
+		return -1;
+	}
+	if(strcmp(err.data.data, "Error\n") || err.data.size != 6 || err.truncated) {
+		ERROR_OUT("Expected stderr 'Error\\n', got '%s'\n", err.data.data);
+		return -1;
+	}
+	free(out.data.data);
+	free(err.data.data);
+
+	// Size limit with a small preallocated buffer
+	out = (struct nl_capture_buf){ .data = { .size = 0, .data = malloc(16) }, .alloc = 16, .limit = 100000 };
+	ret = nl_popenve_capture("/bin/cat", (char *[]){"/bin/cat", NULL}, environ, &input, &out, NULL, 0);
+	if(ret != 0 || out.data.size != 100000 || !out.truncated || out.alloc > 100001 ||
+			memcmp(out.data.data, input.data, 100000) || out.data.data[100000]) {
+		ERROR_OUT("Expected 100000 truncated bytes from limited capture, got %zu (ret %d, truncated %d, alloc %zu)\n",
+				out.data.size, ret, out.truncated, out.alloc);
+		return -1;
+	}
+	free(out.data.data);
+
+	// A command that exits without reading its input
+	out = (struct nl_capture_buf){ .data = { .size = 0 } };
+	ret = nl_popenve_capture("/bin/true", (char *[]){"/bin/true", NULL}, environ, &input, &out, NULL, 0);
+	if(ret != 0 || out.data.size != 0 || out.data.data == NULL || out.data.data[0]) {
+		ERROR_OUT("Expected empty successful capture from /bin/true, got %d\n", ret);
+		return -1;
+	}
+	free(out.data.data);
+	free(input.data);
+
+	// Timeout
+	out = (struct nl_capture_buf){ .data = { .size = 0 } };
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	ret = nl_popenve_capture("/bin/sleep", (char *[]){"/bin/sleep", "5", NULL}, environ, NULL, &out, NULL, 200);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if(ret != -1 || errno != ETIMEDOUT) {
+		ERROR_OUT("Expected ETIMEDOUT from capture timeout, got %d\n", ret);
+		return -1;
+	}
+	if(end.tv_sec - start.tv_sec > 2) {
+		ERROR_OUT("Capture timeout took %ld seconds\n", (long)(end.tv_sec - start.tv_sec));
+		return -1;
+	}
+	free(out.data.data);
+
+	return 0;
+}
+
+// Records a child's return value (see test_reaper()).
+static void reaper_cb(pid_t pid, int ret, void *cb_data)
+{
+	int *rets = cb_data;
+
+	(void)pid; // unused parameter
+
+	// Each child exits with its index plus 10, or is killed
+	if(ret >= 10 && ret < 13) {
+		rets[ret - 10] = ret;
+	} else {
+		rets[3] = ret;
+	}
+}
+
+// Tests watching and reaping children with an nl_reaper.
+int test_reaper(void)
+{
+	struct nl_reaper *reaper;
+	int rets[4] = { 0, 0, 0, 0 };
+	pid_t pids[4];
+	pid_t unwatched;
+	int count = 0;
+	int ret;
+
+	INFO_OUT("Testing nl_reaper\n");
+
+	reaper = nl_reaper_create();
+	if(reaper == NULL) {
+		if(errno == ENOSYS) {
+			INFO_OUT("Skipping nl_reaper tests; pidfd_open() is unavailable\n");
+			return 0;
+		}
+		ERROR_OUT("Error creating reaper\n");
+		return -1;
+	}
+
+	for(int i = 0; i < 3; i++) {
+		char cmd[32];
+		snprintf(cmd, sizeof(cmd), "exit %d", i + 10);
+		pids[i] = nl_popen3ve(NULL, NULL, NULL, "/bin/sh", (char *[]){"/bin/sh", "-c", cmd, NULL}, environ);
+	}
+	pids[3] = nl_popen3ve(NULL, NULL, NULL, "/bin/sleep", (char *[]){"/bin/sleep", "5", NULL}, environ);
+	unwatched = nl_popen3ve(NULL, NULL, NULL, "/bin/sleep", (char *[]){"/bin/sleep", "5", NULL}, environ);
+
+	for(int i = 0; i < 4; i++) {
+		if(pids[i] <= 0 || nl_reaper_watch(reaper, pids[i], reaper_cb, rets)) {
+			ERROR_OUT("Error starting or watching reaper test child %d\n", i);
+			return -1;
+		}
+	}
+	if(unwatched <= 0 || nl_reaper_watch(reaper, unwatched, reaper_cb, rets) ||
+			nl_reaper_unwatch(reaper, unwatched) || nl_reaper_unwatch(reaper, unwatched) != ENOENT) {
+		ERROR_OUT("Error testing nl_reaper_unwatch()\n");
+		return -1;
+	}
+
+	kill(pids[3], SIGKILL);
+	kill(unwatched, SIGKILL);
+
+	while(count < 4) {
+		struct pollfd pfd = { .fd = nl_reaper_fd(reaper), .events = POLLIN };
+		if(poll(&pfd, 1, 5000) != 1) {
+			ERROR_OUT("Timed out waiting for reaper after %d children\n", count);
+			return -1;
+		}
+
+		ret = nl_reaper_reap(reaper);
+		if(ret < 0) {
+			ERROR_OUT("Error reaping children\n");
+			return -1;
+		}
+		count += ret;
+	}
+
+	if(count != 4 || rets[0] != 10 || rets[1] != 11 || rets[2] != 12 || rets[3] != -(SIGKILL + 100)) {
+		ERROR_OUT("Expected reaped return values 10, 11, 12, %d; got %d, %d, %d, %d\n",
+				-(SIGKILL + 100), rets[0], rets[1], rets[2], rets[3]);
+		return -1;
+	}
+
+	// The unwatched child is left for its owner
+	ret = nl_wait_get_return(unwatched);
+	if(ret != -(SIGKILL + 100)) {
+		ERROR_OUT("Expected unwatched child to be killed, got %d\n", ret);
+		return -1;
+	}
+
+	nl_reaper_destroy(reaper);
+
+	return 0;
+}
+
+#define REAPER_MANY 200
+
+// Counts reaped children, checking that each is reaped once (see
+// test_reaper_many()).
+static void reaper_many_cb(pid_t pid, int ret, void *cb_data)
+{
+	pid_t *pids = cb_data;
+
+	for(int i = 0; i < REAPER_MANY; i++) {
+		if(pids[i] == pid) {
+			pids[i] = ret == 0 ? 0 : -1;
+			return;
+		}
+	}
+
+	ERROR_OUT("Reaper callback called for unknown or already reaped PID %ld\n", (long)pid);
+}
+
+// Tests reaping enough children to grow the reaper and unwatching some of
+// them between reaps.
+int test_reaper_many(void)
+{
+	struct nl_reaper *reaper;
+	pid_t pids[REAPER_MANY];
+	pid_t unwatched[REAPER_MANY / 4];
+	int count = 0;
+	int ret;
+
+	INFO_OUT("Testing nl_reaper with %d children\n", REAPER_MANY);
+
+	reaper = nl_reaper_create();
+	if(reaper == NULL) {
+		if(errno == ENOSYS) {
+			INFO_OUT("Skipping nl_reaper tests; pidfd_open() is unavailable\n");
+			return 0;
+		}
+		ERROR_OUT("Error creating reaper\n");
+		return -1;
+	}
+
+	for(int i = 0; i < REAPER_MANY; i++) {
+		pids[i] = nl_popen3ve(NULL, NULL, NULL, "/bin/true", (char *[]){"/bin/true", NULL}, environ);
+		if(pids[i] <= 0 || nl_reaper_watch(reaper, pids[i], reaper_many_cb, pids)) {
+			ERROR_OUT("Error starting or watching reaper test child %d\n", i);
+			return -1;
+		}
+		if(nl_reaper_watch(reaper, pids[i], reaper_many_cb, pids) != EEXIST) {
+			ERROR_OUT("Expected EEXIST when watching reaper test child %d twice\n", i);
+			return -1;
+		}
+	}
+
+	// Every fourth child is unwatched and waited for separately
+	for(int i = 0; i < REAPER_MANY / 4; i++) {
+		unwatched[i] = pids[i * 4];
+		pids[i * 4] = 0;
+		if(nl_reaper_unwatch(reaper, unwatched[i])) {
+			ERROR_OUT("Error unwatching reaper test child %d\n", i * 4);
+			return -1;
+		}
+	}
+
+	while(count < REAPER_MANY - REAPER_MANY / 4) {
+		struct pollfd pfd = { .fd = nl_reaper_fd(reaper), .events = POLLIN };
+		if(poll(&pfd, 1, 5000) != 1) {
+			ERROR_OUT("Timed out waiting for reaper after %d children\n", count);
+			return -1;
+		}
+
+		ret = nl_reaper_reap(reaper);
+		if(ret < 0) {
+			ERROR_OUT("Error reaping children\n");
+			return -1;
+		}
+		count += ret;
+	}
+
+	if(count != REAPER_MANY - REAPER_MANY / 4) {
+		ERROR_OUT("Expected %d children to be reaped, got %d\n", REAPER_MANY - REAPER_MANY / 4, count);
+		return -1;
+	}
+	for(int i = 0; i < REAPER_MANY; i++) {
+		if(pids[i] != 0) {
+			ERROR_OUT("Reaper test child %d was not reaped successfully\n", i);
+			return -1;
+		}
+	}
+	for(int i = 0; i < REAPER_MANY / 4; i++) {
+		ret = nl_wait_get_return(unwatched[i]);
+		if(ret != 0) {
+			ERROR_OUT("Expected unwatched child %d to return 0, got %d\n", i * 4, ret);
+			return -1;
+		}
+	}
+
+	nl_reaper_destroy(reaper);
+
+	return 0;
+}
+
 int main(void)
 {
 	INFO_OUT("Testing program execution functions.\n");
 
-	if(test_wait_return() || test_popen3()) {
+	if(test_wait_return() || test_popen3() || test_popen3vea() || test_capture() || test_reaper() ||
+			test_reaper_many()) {
 		ERROR_OUT("Program execution tests failed.\n");
 		return -1;
 	}
@@ -0,0 +1,80 @@
+/*
+ * Compares the speed of the linked list nl_fifo and the ring buffer nl_ring.
+ * Copyright (C)2026 Mike Bourgeous.  Released under AGPLv3.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "nlutils.h"
+
+#define TIME_LIMIT 500000000 // half a second per test
+
+// Runs the given expression repeatedly for TIME_LIMIT, storing the average
+// nanoseconds per operation (ops_per_loop operations per evaluation) in result.
+#define BENCH(result, ops_per_loop, expr) do { \
+	int64_t start, elapsed; \
+	size_t iterations; \
+	for(start = nl_clock_ns(CLOCK_MONOTONIC), iterations = 0, elapsed = 0; elapsed < TIME_LIMIT; \
+			elapsed = nl_clock_ns(CLOCK_MONOTONIC) - start) { \
+		for(int bench_i = 0; bench_i < 1000; bench_i++, iterations += (ops_per_loop)) { \
+			expr; \
+		} \
+	} \
+	(result) = (double)elapsed / iterations; \
+} while(0)
+
+static void bench_depth(size_t depth)
+{
+	struct nl_fifo *f = nl_fifo_create();
+	struct nl_ring *r = nl_ring_create(0);
+	double f_time, r_time;
+	size_t i;
+
+	if(CHECK_NULL(f) || CHECK_NULL(r)) {
+		abort();
+	}
+
+	for(i = 1; i <= depth; i++) {
+		nl_fifo_put(f, (void *)(uintptr_t)i);
+		nl_ring_put(r, (void *)(uintptr_t)i);
+	}
+
+	INFO_OUT("Queue depth %zu:\n", depth);
+
+	// Steady state: each operation adds one element and removes another
+	BENCH(f_time, 1, nl_fifo_put(f, nl_fifo_get(f)));
+	BENCH(r_time, 1, nl_ring_put(r, nl_ring_get(r)));
+	INFO_OUT("  get+put:     nl_fifo %8.2f ns/op    nl_ring %8.2f ns/op\n", f_time, r_time);
+
+	// Random access (the fifo is limited to the first 64 elements to keep
+	// it from taking forever at large depths)
+	BENCH(f_time, 1, nl_fifo_peek_index(f, (bench_i * 7) % MIN_NUM(depth, 64)));
+	BENCH(r_time, 1, nl_ring_peek_index(r, (bench_i * 7919) % depth));
+	INFO_OUT("  peek_index:  nl_fifo %8.2f ns/op    nl_ring %8.2f ns/op (fifo limited to first 64)\n", f_time, r_time);
+
+	// Iteration over every element
+	BENCH(f_time, depth, {
+		const struct nl_fifo_element *iter = NULL;
+		while(nl_fifo_next(f, &iter)) {}
+	});
+	BENCH(r_time, depth, {
+		size_t iter = 0;
+		while(nl_ring_next(r, &iter)) {}
+	});
+	INFO_OUT("  next:        nl_fifo %8.2f ns/el    nl_ring %8.2f ns/el\n", f_time, r_time);
+
+	nl_fifo_destroy(f);
+	nl_ring_destroy(r);
+}
+
+int main(void)
+{
+	static const size_t depths[] = { 1, 16, 1024, 65536 };
+
+	for(size_t i = 0; i < ARRAY_SIZE(depths); i++) {
+		bench_depth(depths[i]);
+	}
+
+	return 0;
+}
@@ -0,0 +1,46 @@
+#!/bin/bash
+# Generates a v3 firmware image whose data is split into two concatenated gzip
+# members, with the first member ending one byte before do_firmware's 64KiB
+# read boundary, so the second member's gzip magic straddles two reads.
+# Copyright (C)2026 Mike Bourgeous.  Released under AGPLv3.
+
+set -e
+
+if [ "$1" = "" ]; then
+	echo "Usage: $0 destination"
+	exit 1
+fi
+
+# Must match READ_SIZE in programs/do_firmware.c
+READ_SIZE=65536
+
+TMPDIR_SPLIT=$(mktemp -d --tmpdir split_firmware.XXXXXX)
+trap 'rm -rf "$TMPDIR_SPLIT"' EXIT
+
+# The first member exits before bash reaches its random padding.  Random data
+# is stored uncompressed by gzip, so each padding byte adds exactly one byte
+# to the member; the padding is sized from a trial run to hit the boundary.
+printf '#!/bin/bash\necho "Test firmware split across gzip members."\nexit 0\n' > "$TMPDIR_SPLIT/head"
+PAD=$((READ_SIZE - 1 - $(gzip < "$TMPDIR_SPLIT/head" | wc -c)))
+for try in 1 2 3 4; do
+	cat "$TMPDIR_SPLIT/head" > "$TMPDIR_SPLIT/part1"
+	head -c $PAD /dev/urandom >> "$TMPDIR_SPLIT/part1"
+	gzip < "$TMPDIR_SPLIT/part1" > "$TMPDIR_SPLIT/part1.gz"
+	SIZE=$(wc -c < "$TMPDIR_SPLIT/part1.gz")
+	[ "$SIZE" -eq $((READ_SIZE - 1)) ] && break
+	PAD=$((PAD + READ_SIZE - 1 - SIZE))
+done
+
+if [ "$SIZE" -ne $((READ_SIZE - 1)) ]; then
+	echo "Unable to size the first gzip member (got $SIZE bytes)." >&2
+	exit 1
+fi
+
+printf 'Second gzip member\n' > "$TMPDIR_SPLIT/part2"
+
+printf "NLFW_03\n\n\n" > "$1"
+cat "$TMPDIR_SPLIT/part1" "$TMPDIR_SPLIT/part2" | sha1sum | egrep -o '[0-9a-f]{40}' >> "$1"
+cat "$TMPDIR_SPLIT/part1.gz" >> "$1"
+gzip < "$TMPDIR_SPLIT/part2" >> "$1"
+
+exit 0
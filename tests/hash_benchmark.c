@@ -0,0 +1,136 @@
+/*
+ * Compares the speed of the nl_hash hash table with the linear array lookup
+ * it replaced, at various table sizes.
+ * Copyright (C)2026 Mike Bourgeous.  Released under AGPLv3.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "nlutils.h"
+
+#define TIME_LIMIT 500000000 // half a second per test
+
+// The previous nl_hash implementation: an unordered list of entries searched
+// with strcmp().
+static struct nl_hash_entry *linear_find(struct nl_fifo *table, const char *key)
+{
+	const struct nl_fifo_element *iter = NULL;
+	struct nl_hash_entry *entry;
+
+	while((entry = nl_fifo_next(table, &iter))) {
+		if(!strcmp(entry->key, key)) {
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
+// Builds an array of count keys that look like HTTP header or config names.
+static char **make_keys(size_t count)
+{
+	char **keys = calloc(count, sizeof(char *));
+	char buf[64];
+
+	if(CHECK_NULL(keys)) {
+		abort();
+	}
+
+	for(size_t i = 0; i < count; i++) {
+		snprintf(buf, sizeof(buf), "X-Config-Key-%zu", i * 2654435761U % 1000003);
+		if(CHECK_NULL(keys[i] = nl_strdup(buf))) {
+			abort();
+		}
+	}
+
+	return keys;
+}
+
+static void bench_size(size_t count)
+{
+	char **keys = make_keys(count);
+	struct nl_hash *hash;
+	struct nl_fifo *table;
+	struct nl_hash_entry *entries;
+	int64_t start, elapsed;
+	size_t iterations;
+	size_t i;
+
+	INFO_OUT("%zu keys:\n", count);
+
+	// Hash table: insertion
+	hash = nl_hash_create();
+	start = nl_clock_ns(CLOCK_MONOTONIC);
+	for(i = 0; i < count; i++) {
+		if(nl_hash_set(hash, keys[i], keys[i])) {
+			ERROR_OUT("Error setting key %zu\n", i);
+			abort();
+		}
+	}
+	elapsed = nl_clock_ns(CLOCK_MONOTONIC) - start;
+	INFO_OUT("  nl_hash set:     %12.1f ns/op\n", (double)elapsed / count);
+
+	// Hash table: lookups
+	for(start = nl_clock_ns(CLOCK_MONOTONIC), iterations = 0, elapsed = 0; elapsed < TIME_LIMIT;
+			elapsed = nl_clock_ns(CLOCK_MONOTONIC) - start) {
+		for(i = 0; i < count; i++, iterations++) {
+			if(nl_hash_get(hash, keys[i]) != NULL && nl_hash_get(hash, "X-Missing") != NULL) {
+				ERROR_OUT("Found a missing key\n");
+				abort();
+			}
+		}
+	}
+	INFO_OUT("  nl_hash get:     %12.1f ns/op (hit + miss)\n", (double)elapsed / iterations / 2);
+
+	// Hash table: removal
+	start = nl_clock_ns(CLOCK_MONOTONIC);
+	for(i = 0; i < count; i++) {
+		nl_hash_remove(hash, keys[i]);
+	}
+	elapsed = nl_clock_ns(CLOCK_MONOTONIC) - start;
+	INFO_OUT("  nl_hash remove:  %12.1f ns/op\n", (double)elapsed / count);
+	nl_hash_destroy(hash);
+
+	// Linear list: insertion is O(1) if duplicates are not checked, so
+	// only lookups are compared
+	table = nl_fifo_create();
+	entries = calloc(count, sizeof(struct nl_hash_entry));
+	for(i = 0; i < count; i++) {
+		entries[i].key = keys[i];
+		entries[i].value = keys[i];
+		nl_fifo_put(table, &entries[i]);
+	}
+
+	for(start = nl_clock_ns(CLOCK_MONOTONIC), iterations = 0, elapsed = 0; elapsed < TIME_LIMIT;
+			elapsed = nl_clock_ns(CLOCK_MONOTONIC) - start) {
+		// Stride through the keys so large tables finish within the time limit
+		for(i = iterations % count; i < count; i += count / 100 + 1, iterations++) {
+			if(linear_find(table, keys[i]) != NULL && linear_find(table, "X-Missing") != NULL) {
+				ERROR_OUT("Found a missing key\n");
+				abort();
+			}
+		}
+	}
+	INFO_OUT("  linear get:      %12.1f ns/op (hit + miss)\n", (double)elapsed / iterations / 2);
+
+	nl_fifo_clear(table);
+	nl_fifo_destroy(table);
+	free(entries);
+
+	for(i = 0; i < count; i++) {
+		free(keys[i]);
+	}
+	free(keys);
+}
+
+int main(void)
+{
+	static const size_t sizes[] = { 10, 100, 1000, 10000, 100000 };
+
+	for(size_t i = 0; i < ARRAY_SIZE(sizes); i++) {
+		bench_size(sizes[i]);
+	}
+
+	return 0;
+}
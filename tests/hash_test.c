@@ -147,6 +147,150 @@ static int run_iterator_tests(struct nl_hash *hash)
 	return ret;
 }
 
+// Number of keys used by test_many_keys()
+#define MANY_KEYS 20000
+
+// nl_hash_iterate() callback that verifies entries are visited in insertion
+// order, skipping removed keys (see test_many_keys())
+static int order_callback(void *cb_data, char *key, char *value)
+{
+	int *next = cb_data;
+	char expected[32];
+
+	snprintf(expected, sizeof(expected), "key%d", *next);
+	if(strcmp(key, expected) || strcmp(value, expected + 3)) {
+		ERROR_OUT("Expected key %s during iteration, got %s=%s\n", expected, key, value);
+		*next = -1;
+		return 1;
+	}
+
+	// Every odd key from 1..limit/2 was removed
+	*next += *next < MANY_KEYS / 2 ? 2 : 1;
+
+	return 0;
+}
+
+// Adds, looks up, removes, and re-adds enough keys to force the table to grow
+// and compact itself several times.
+static int test_many_keys(void)
+{
+	struct nl_hash *hash;
+	char key[32], value[32];
+	const char *result;
+	int i;
+
+	nl_ptmf("Test many keys\n");
+
+	hash = nl_hash_create();
+	if(hash == NULL) {
+		ERROR_OUT("Error creating a hash table.\n");
+		return -1;
+	}
+
+	for(i = 0; i < MANY_KEYS; i++) {
+		snprintf(key, sizeof(key), "key%d", i);
+		snprintf(value, sizeof(value), "%d", i);
+		if(nl_hash_set(hash, key, value)) {
+			ERROR_OUT("Error setting key %s\n", key);
+			return -1;
+		}
+	}
+	if(hash->count != MANY_KEYS) {
+		ERROR_OUT("Expected %d keys, got %zu\n", MANY_KEYS, hash->count);
+		return -1;
+	}
+
+	for(i = 0; i < MANY_KEYS; i++) {
+		snprintf(key, sizeof(key), "key%d", i);
+		snprintf(value, sizeof(value), "%d", i);
+		result = nl_hash_get(hash, key);
+		if(result == NULL || strcmp(result, value)) {
+			ERROR_OUT("Expected %s for key %s, got %s\n", value, key, GUARD_NULL(result));
+			return -1;
+		}
+	}
+
+	if(nl_hash_get(hash, "key-1") != NULL || nl_hash_get(hash, "") != NULL) {
+		ERROR_OUT("Found a value for a nonexistent key\n");
+		return -1;
+	}
+
+	// Remove odd keys from the first half, and all keys from the second half
+	for(i = 0; i < MANY_KEYS; i++) {
+		if(i < MANY_KEYS / 2 && !(i & 1)) {
+			continue;
+		}
+
+		snprintf(key, sizeof(key), "key%d", i);
+		if(nl_hash_remove(hash, key)) {
+			ERROR_OUT("Error removing key %s\n", key);
+			return -1;
+		}
+	}
+	if(hash->count != MANY_KEYS / 4) {
+		ERROR_OUT("Expected %d keys after removal, got %zu\n", MANY_KEYS / 4, hash->count);
+		return -1;
+	}
+
+	for(i = 0; i < MANY_KEYS; i++) {
+		snprintf(key, sizeof(key), "key%d", i);
+		result = nl_hash_get(hash, key);
+		if((i < MANY_KEYS / 2 && !(i & 1)) != (result != NULL)) {
+			ERROR_OUT("Key %s should%s exist after removal\n", key, result ? " not" : "");
+			return -1;
+		}
+	}
+
+	// Re-add the second half; this should reuse and compact the entry array
+	for(i = MANY_KEYS / 2; i < MANY_KEYS; i++) {
+		snprintf(key, sizeof(key), "key%d", i);
+		snprintf(value, sizeof(value), "%d", i);
+		if(nl_hash_set(hash, key, value)) {
+			ERROR_OUT("Error re-adding key %s\n", key);
+			return -1;
+		}
+	}
+
+	int next = 0;
+	nl_hash_iterate(hash, order_callback, &next);
+	if(next != MANY_KEYS) {
+		ERROR_OUT("Iteration order was incorrect or stopped early (next %d)\n", next);
+		return -1;
+	}
+
+	// Overwrite existing values
+	for(i = 0; i < MANY_KEYS; i += 2) {
+		snprintf(key, sizeof(key), "key%d", i);
+		if(nl_hash_set(hash, key, "overwritten")) {
+			ERROR_OUT("Error overwriting key %s\n", key);
+			return -1;
+		}
+	}
+	if(hash->count != MANY_KEYS * 3 / 4) {
+		ERROR_OUT("Expected %d keys after overwriting, got %zu\n", MANY_KEYS * 3 / 4, hash->count);
+		return -1;
+	}
+	result = nl_hash_get(hash, "key10000");
+	if(result == NULL || strcmp(result, "overwritten")) {
+		ERROR_OUT("Expected overwritten value, got %s\n", GUARD_NULL(result));
+		return -1;
+	}
+
+	nl_hash_clear(hash);
+	if(hash->count != 0 || nl_hash_get(hash, "key0") != NULL) {
+		ERROR_OUT("Hash should be empty after clearing\n");
+		return -1;
+	}
+	if(nl_hash_set(hash, "key0", "0") || strcmp(nl_hash_get(hash, "key0"), "0")) {
+		ERROR_OUT("Error reusing a cleared hash\n");
+		return -1;
+	}
+
+	nl_hash_destroy(hash);
+
+	return 0;
+}
+
 int main(void)
 {
 	struct nl_hash *hash, *cloned;
@@ -253,6 +397,10 @@ int main(void)
 	nl_hash_destroy(hash);
 	nl_hash_destroy(cloned);
 
+	if(test_many_keys()) {
+		return -1;
+	}
+
 	INFO_OUT("\e[32mAssociative array/hash table tests succeeded.\e[0m\n");
 
 	return 0;
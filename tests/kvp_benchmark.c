@@ -0,0 +1,108 @@
+/*
+ * Measures key-value pair parsing throughput in MB/s for the allocating
+ * string/variant parsers and the zero-allocation slice/scratch parsers, and
+ * for each structural character scanner.
+ * Copyright (C)2026 Mike Bourgeous.  Released under AGPLv3.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "nlutils.h"
+
+#define TIME_LIMIT 500000000 // half a second per test
+
+static const char * const lines[] = {
+	// Typical status line
+	"xmin=-1807 ymin=-398 zmin=3430 xmax=-1564 ymax=-11 zmax=3710 px_xmin=573 px_ymin=241 px_zmin=990 px_xmax=637 px_ymax=309 px_zmax=998 occupied=0 pop=0 maxpop=4352 xc=0 yc=0 zc=0 sa=0 name=\"Name\"",
+
+	// Quoted and escaped strings
+	"\"a key\"=\"a value\" name=\"Zone \\\"1\\\"\" path=\"C:\\\\dir\\\\file\" msg=\"line1\\nline2\\tend\" ok=true",
+
+	// Long quoted values
+	"msg=\"The quick brown fox jumps over the lazy dog, then takes a long nap in the afternoon sun.\" "
+		"path=\"/usr/local/share/nitrogenlogic/firmware/depth_camera_controller_v2.bin\" "
+		"description=\"A much longer free-form description field of the kind that shows up in log lines.\"",
+
+	// Short line
+	"a=1 b=2.5 c=0x1f",
+};
+
+static const char * const scanner_names[] = {
+	[NL_KVP_SCAN_AUTO] = "automatic",
+	[NL_KVP_SCAN_SCALAR] = "scalar",
+	[NL_KVP_SCAN_SSE2] = "SSE2",
+	[NL_KVP_SCAN_AVX2] = "AVX2",
+	[NL_KVP_SCAN_NEON] = "NEON",
+};
+
+// Runs the given expression repeatedly for TIME_LIMIT, storing the average
+// throughput in MB/s (line_len bytes per evaluation) in result.
+#define BENCH(result, line_len, expr) do { \
+	int64_t start, elapsed; \
+	size_t iterations; \
+	for(start = nl_clock_ns(CLOCK_MONOTONIC), iterations = 0, elapsed = 0; elapsed < TIME_LIMIT; \
+			elapsed = nl_clock_ns(CLOCK_MONOTONIC) - start) { \
+		for(int bench_i = 0; bench_i < 1000; bench_i++, iterations++) { \
+			expr; \
+		} \
+	} \
+	(result) = (double)(line_len) * iterations * 1000.0 / elapsed; \
+} while(0)
+
+static void string_cb(void *cb_data, char *key, char *value, int quoted_value)
+{
+	*(size_t *)cb_data += strlen(key) + strlen(value) + quoted_value;
+}
+
+static void variant_cb(void *cb_data, char *key, char *strvalue, struct nl_variant value)
+{
+	*(size_t *)cb_data += strlen(key) + strlen(strvalue) + value.type;
+}
+
+static void slice_cb(void *cb_data, struct nl_kvp_slice key, struct nl_kvp_slice value)
+{
+	*(size_t *)cb_data += key.len + value.len + value.quoted;
+}
+
+static void bench_line(const char *line)
+{
+	size_t len = strlen(line);
+	char scratch[len + 1];
+	double string_mbps, variant_mbps, slice_mbps, buf_mbps, variant_buf_mbps;
+	size_t sum = 0;
+
+	INFO_OUT("%zu byte line: %.40s...\n", len, line);
+
+	BENCH(string_mbps, len, nl_parse_kvp(line, string_cb, &sum));
+	BENCH(variant_mbps, len, nl_parse_kvp_variant(line, variant_cb, &sum));
+	INFO_OUT("  nl_parse_kvp           %8.1f MB/s    nl_parse_kvp_variant     %8.1f MB/s\n",
+			string_mbps, variant_mbps);
+
+	BENCH(slice_mbps, len, nl_parse_kvp_slices(line, slice_cb, &sum));
+	BENCH(buf_mbps, len, nl_parse_kvp_buf(line, scratch, sizeof(scratch), string_cb, &sum));
+	BENCH(variant_buf_mbps, len, nl_parse_kvp_variant_buf(line, scratch, sizeof(scratch), variant_cb, &sum));
+	INFO_OUT("  nl_parse_kvp_slices    %8.1f MB/s    nl_parse_kvp_variant_buf %8.1f MB/s    nl_parse_kvp_buf %8.1f MB/s\n",
+			slice_mbps, variant_buf_mbps, buf_mbps);
+
+	for(int impl = NL_KVP_SCAN_SCALAR; impl <= NL_KVP_SCAN_NEON; impl++) {
+		if(nl_kvp_set_scanner(impl)) {
+			continue;
+		}
+
+		BENCH(slice_mbps, len, nl_parse_kvp_slices(line, slice_cb, &sum));
+		INFO_OUT("  %-9s scanner:     %8.1f MB/s (nl_parse_kvp_slices)\n", scanner_names[impl], slice_mbps);
+	}
+	nl_kvp_set_scanner(NL_KVP_SCAN_AUTO);
+
+	DEBUG_OUT("Checksum %zu\n", sum);
+}
+
+int main(void)
+{
+	for(size_t i = 0; i < ARRAY_SIZE(lines); i++) {
+		bench_line(lines[i]);
+	}
+
+	return 0;
+}
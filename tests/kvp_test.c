@@ -326,6 +326,57 @@ static void kvp_test_cb(void *cb_data, char *key, char *strvalue, struct nl_vari
 	test->offset++;
 }
 
+static void kvp_slice_test_cb(void *cb_data, struct nl_kvp_slice key, struct nl_kvp_slice value)
+{
+	struct kvp_test *test = cb_data;
+	int idx = test->offset;
+	char keybuf[key.len + 3];
+	char valuebuf[value.len + 3];
+	ssize_t len;
+
+	if(idx >= test->count) {
+		ERROR_OUT("Received unexpected slice pair %d (%.*s=%.*s) for '%s'\n",
+				idx + 1, (int)key.len, key.str, (int)value.len, value.str, test->desc);
+		exit(1);
+	}
+
+	struct kvpair *pair = &test->pairs[idx];
+
+	// Slices must point into the original line without copying
+	if(key.str < test->data || key.str + key.len > test->data + strlen(test->data) ||
+			value.str < test->data || value.str + value.len > test->data + strlen(test->data)) {
+		ERROR_OUT("Slices for pair %d point outside the original line for '%s'\n", idx, test->desc);
+		exit(1);
+	}
+
+	if((key.escaped && !key.quoted) || (value.escaped && !value.quoted)) {
+		ERROR_OUT("Unquoted slice marked as escaped on pair %d for '%s'\n", idx, test->desc);
+		exit(1);
+	}
+
+	if(!key.escaped && (key.len != strlen(pair->key) || memcmp(key.str, pair->key, key.len))) {
+		ERROR_OUT("Unescaped key slice mismatch (got %.*s, expected %s) on pair %d for '%s'\n",
+				(int)key.len, key.str, pair->key, idx, test->desc);
+		exit(1);
+	}
+
+	len = nl_kvp_unescape_slice(key, keybuf, sizeof(keybuf));
+	if(len != (ssize_t)strlen(pair->key) || strcmp(keybuf, pair->key)) {
+		ERROR_OUT("Key slice mismatch (got %s length %zd, expected %s) on pair %d for '%s'\n",
+				keybuf, len, pair->key, idx, test->desc);
+		exit(1);
+	}
+
+	len = nl_kvp_unescape_slice(value, valuebuf, sizeof(valuebuf));
+	if(len != (ssize_t)strlen(pair->strvalue) || strcmp(valuebuf, pair->strvalue)) {
+		ERROR_OUT("Value slice mismatch (got %s length %zd, expected %s) on pair %d for '%s'\n",
+				valuebuf, len, pair->strvalue, idx, test->desc);
+		exit(1);
+	}
+
+	test->offset++;
+}
+
 static void do_kvp_test(struct kvp_test *test)
 {
 	printf("Checking: %s\n", test->desc);
@@ -339,16 +390,126 @@ static void do_kvp_test(struct kvp_test *test)
 		exit(1);
 	}
 
+	if(test->data == NULL) {
+		return;
+	}
+
+	char scratch[strlen(test->data) + 1];
+
+	test->offset = 0;
+	if(nl_parse_kvp_variant_buf(test->data, scratch, sizeof(scratch), kvp_test_cb, test) ||
+			test->offset != test->count) {
+		ERROR_OUT("Test %s produced %d pairs with a scratch buffer, expected %d.\n",
+				test->desc, test->offset, test->count);
+		exit(1);
+	}
+
+	test->offset = 0;
+	nl_parse_kvp_slices(test->data, kvp_slice_test_cb, test);
+	if(test->offset != test->count) {
+		ERROR_OUT("Test %s produced %d slice pairs, expected %d.\n",
+				test->desc, test->offset, test->count);
+		exit(1);
+	}
+
 	// TODO: test nl_parse_kvp_hash()
 }
 
+static const char * const scanner_names[] = {
+	[NL_KVP_SCAN_AUTO] = "automatic",
+	[NL_KVP_SCAN_SCALAR] = "scalar",
+	[NL_KVP_SCAN_SSE2] = "SSE2",
+	[NL_KVP_SCAN_AVX2] = "AVX2",
+	[NL_KVP_SCAN_NEON] = "NEON",
+};
+
+// Appends each pair to the string buffer in cb_data.
+static void kvp_append_cb(void *cb_data, char *key, char *value, int quoted_value)
+{
+	char *out = cb_data;
+	size_t len = strlen(out);
+
+	snprintf(out + len, 4096 - len, "[%s|%s|%d]", key, value, quoted_value);
+}
+
+/*
+ * Parses random lines of structural and ordinary characters at every
+ * alignment with every supported scanner, comparing the results to the scalar
+ * scanner.
+ */
+static void do_scanner_crosscheck(void)
+{
+	static const char alphabet[] = "ab=\" \t\\xn0";
+	char storage[256] __attribute__((aligned(64)));
+	char expected[4096];
+	char actual[4096];
+
+	srand(0);
+
+	for(int i = 0; i < 20000; i++) {
+		size_t offset = i % 64;
+		size_t len = rand() % (sizeof(storage) - 64);
+		char *line = storage + offset;
+
+		// Zero bytes before the line must not be mistaken for its end
+		memset(storage, 0, sizeof(storage));
+		for(size_t j = 0; j < len; j++) {
+			line[j] = alphabet[rand() % (sizeof(alphabet) - 1)];
+		}
+		line[len] = 0;
+
+		nl_kvp_set_scanner(NL_KVP_SCAN_SCALAR);
+		expected[0] = 0;
+		nl_parse_kvp(line, kvp_append_cb, expected);
+
+		for(int impl = NL_KVP_SCAN_SSE2; impl <= NL_KVP_SCAN_NEON; impl++) {
+			if(nl_kvp_set_scanner(impl)) {
+				continue;
+			}
+
+			actual[0] = 0;
+			nl_parse_kvp(line, kvp_append_cb, actual);
+			if(strcmp(expected, actual)) {
+				ERROR_OUT("%s scanner mismatch at offset %zu for line '%s':\n\t%s\n\t%s\n",
+						scanner_names[impl], offset, line, expected, actual);
+				exit(1);
+			}
+		}
+	}
+
+	nl_kvp_set_scanner(NL_KVP_SCAN_AUTO);
+}
+
 int main()
 {
 	printf("Making sure a NULL callback doesn't crash.\n");
 	nl_parse_kvp("", NULL, NULL);
 
-	for(size_t i = 0; i < ARRAY_SIZE(kvptests); i++) {
-		do_kvp_test(&kvptests[i]);
+	for(int impl = NL_KVP_SCAN_AUTO; impl <= NL_KVP_SCAN_NEON; impl++) {
+		if(nl_kvp_set_scanner(impl)) {
+			printf("Skipping unsupported %s scanner.\n", scanner_names[impl]);
+			continue;
+		}
+
+		printf("Testing %s scanner.\n", scanner_names[impl]);
+		for(size_t i = 0; i < ARRAY_SIZE(kvptests); i++) {
+			do_kvp_test(&kvptests[i]);
+		}
+	}
+	nl_kvp_set_scanner(NL_KVP_SCAN_AUTO);
+
+	printf("Comparing scanners on random lines.\n");
+	do_scanner_crosscheck();
+
+	printf("Making sure a short scratch buffer is rejected.\n");
+	char scratch[3];
+	if(nl_parse_kvp_variant_buf("a=b", scratch, sizeof(scratch), kvp_test_cb, NULL) != -1) {
+		ERROR_OUT("Expected an error for a scratch buffer shorter than the line.\n");
+		return 1;
+	}
+	if(nl_kvp_unescape_slice((struct nl_kvp_slice){ .str = "abc", .len = 3 }, scratch, sizeof(scratch)) != -1) {
+		ERROR_OUT("Expected an error for an unescape buffer shorter than the slice.\n");
+		return 1;
 	}
 
 	return 0;
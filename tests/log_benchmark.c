@@ -0,0 +1,137 @@
+/*
+ * Measures nanoseconds per log message for the previous nl_fptmf()
+ * implementation, synchronous logging, and asynchronous logging, with output
+ * sent to /dev/null.
+ * Copyright (C)2026 Mike Bourgeous.  Released under AGPLv3.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include "nlutils.h"
+
+#define MESSAGE_COUNT 200000 // Messages per thread
+
+enum bench_mode {
+	LEGACY,
+	SYNC,
+	ASYNC,
+};
+
+static enum bench_mode mode;
+static FILE *devnull;
+
+// The previous nl_fptmf().
+static int __attribute__ ((__format__(__printf__, 2, 3))) legacy_fptmf(FILE *out, const char *fmt, ...)
+{
+	struct timespec t;
+	struct tm tm_result;
+	char threadname[16];
+	char buf[32];
+	char zone[8];
+	va_list args;
+	int ret;
+
+	clock_gettime(CLOCK_REALTIME, &t);
+	localtime_r(&t.tv_sec, &tm_result);
+	strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tm_result);
+	strftime(zone, sizeof(zone), "%z", &tm_result);
+
+	nl_get_threadname(threadname);
+
+	lockf(fileno(out), F_LOCK, 0);
+	ret = fprintf(out, "%s.%06ld %s - %s - ", buf, t.tv_nsec / 1000, zone, threadname);
+	va_start(args, fmt);
+	ret += vfprintf(out, fmt, args);
+	va_end(args);
+	lockf(fileno(out), F_ULOCK, 0);
+
+	return ret;
+}
+
+static void *log_thread(void *data)
+{
+	(void)data;
+
+	for(int i = 0; i < MESSAGE_COUNT; i++) {
+		if(mode == LEGACY) {
+			legacy_fptmf(stderr, "Benchmark message %d with a value of %f\n", i, i * 0.5);
+		} else {
+			nl_fptmf(stderr, "Benchmark message %d with a value of %f\n", i, i * 0.5);
+		}
+	}
+
+	return NULL;
+}
+
+// Logs MESSAGE_COUNT messages from each of the given number of threads,
+// returning nanoseconds per message including the time to write them all.
+static double bench_mode(enum bench_mode m, unsigned int threads)
+{
+	struct nl_thread_ctx *ctx;
+	int64_t start;
+
+	mode = m;
+
+	ctx = nl_create_thread_context();
+	if(ctx == NULL) {
+		ERROR_OUT("Error creating thread context\n");
+		exit(1);
+	}
+
+	if(m == ASYNC && nl_log_start_async(&(struct nl_log_params){ .block_usec = 1000000 })) {
+		ERROR_OUT("Error starting asynchronous logging\n");
+		exit(1);
+	}
+
+	start = nl_clock_ns(CLOCK_MONOTONIC);
+
+	for(unsigned int i = 0; i < threads; i++) {
+		if(nl_create_thread(ctx, NULL, log_thread, NULL, "log_bench", NULL)) {
+			ERROR_OUT("Error creating logging thread\n");
+			exit(1);
+		}
+	}
+	nl_destroy_thread_context(ctx);
+
+	if(m == ASYNC) {
+		nl_log_stop_async();
+	}
+	fflush(stderr);
+
+	return (double)(nl_clock_ns(CLOCK_MONOTONIC) - start) / ((double)MESSAGE_COUNT * threads);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int max_threads = argc > 1 ? atoi(argv[1]) : 4;
+	int saved_stderr;
+
+	devnull = fopen("/dev/null", "w");
+	if(devnull == NULL) {
+		ERRNO_OUT("Error opening /dev/null");
+		return -1;
+	}
+
+	// Log messages go to /dev/null; results go to stdout
+	fflush(stderr);
+	saved_stderr = dup(STDERR_FILENO);
+	dup2(fileno(devnull), STDERR_FILENO);
+
+	for(unsigned int threads = 1; threads <= max_threads; threads *= 2) {
+		double legacy_ns = bench_mode(LEGACY, threads);
+		double sync_ns = bench_mode(SYNC, threads);
+		double async_ns = bench_mode(ASYNC, threads);
+
+		INFO_OUT("%u thread(s):  legacy %7.1f ns    sync %7.1f ns    async %7.1f ns per message\n",
+				threads, legacy_ns, sync_ns, async_ns);
+	}
+
+	dup2(saved_stderr, STDERR_FILENO);
+	close(saved_stderr);
+	fclose(devnull);
+
+	return 0;
+}
@@ -0,0 +1,540 @@
+/*
+ * Tests synchronous and asynchronous logging.
+ * Copyright (C)2026 Mike Bourgeous.  Released under AGPLv3.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <signal.h>
+#include <regex.h>
+#include <sys/wait.h>
+
+#include "nlutils.h"
+
+#define THREAD_COUNT 4
+#define THREAD_LINES 5000
+#define DROP_LINES 5000
+
+// Timestamp and thread name prefix written by nl_ptmf() and friends
+#define PREFIX_REGEX "^[0-9]{4}-[0-9]{2}-[0-9]{2} [0-9]{2}:[0-9]{2}:[0-9]{2}\\.[0-9]{6} [+-][0-9]{4} - ([^ ]+) - "
+
+static regex_t prefix_regex;
+static int saved_fds[2];
+
+// Redirects stdout and stderr to a new temporary file, which is returned.
+static FILE *capture_start(void)
+{
+	FILE *f = tmpfile();
+
+	if(f == NULL) {
+		ERRNO_OUT("Error creating temporary file");
+		return NULL;
+	}
+
+	fflush(stdout);
+	fflush(stderr);
+	saved_fds[0] = dup(STDOUT_FILENO);
+	saved_fds[1] = dup(STDERR_FILENO);
+	dup2(fileno(f), STDOUT_FILENO);
+	dup2(fileno(f), STDERR_FILENO);
+
+	return f;
+}
+
+// Restores stdout and stderr, then returns the captured output.
+static struct nl_raw_data *capture_end(FILE *f)
+{
+	struct nl_raw_data *result;
+
+	fflush(stdout);
+	fflush(stderr);
+	dup2(saved_fds[0], STDOUT_FILENO);
+	dup2(saved_fds[1], STDERR_FILENO);
+	close(saved_fds[0]);
+	close(saved_fds[1]);
+
+	rewind(f);
+	result = nl_read_stream(fileno(f));
+	fclose(f);
+
+	if(result == NULL) {
+		ERROR_OUT("Error reading captured output\n");
+	}
+
+	return result;
+}
+
+// Checks the prefix of a line, returning a pointer to the message after it,
+// or NULL if the prefix is invalid.  The thread name is stored in name.
+static char *check_prefix(char *line, char *name)
+{
+	regmatch_t match[2];
+
+	if(regexec(&prefix_regex, line, ARRAY_SIZE(match), match, 0)) {
+		ERROR_OUT("Invalid log prefix on line '%s'\n", line);
+		return NULL;
+	}
+
+	snprintf(name, 16, "%.*s", (int)(match[1].rm_eo - match[1].rm_so), line + match[1].rm_so);
+
+	return line + match[0].rm_eo;
+}
+
+static int test_sync_format(void)
+{
+	char expect[256];
+	struct nl_raw_data *result;
+	char name[16];
+	int line_count = 0;
+	int errno_line, info_line;
+	int err;
+	FILE *f;
+
+	f = capture_start();
+	if(f == NULL) {
+		return -1;
+	}
+
+	nl_fptmf(stderr, "Plain message %d\n", 1);
+	errno = ENOENT;
+	errno_line = __LINE__; ERRNO_OUT("Errno message %d", 2);
+	err = errno;
+	info_line = __LINE__; INFO_OUT("Info message %d\n", 3);
+
+	result = capture_end(f);
+	if(result == NULL) {
+		return -1;
+	}
+
+	if(err != ENOENT) {
+		ERROR_OUT("ERRNO_OUT() changed errno from %d to %d\n", ENOENT, err);
+		nl_destroy_data(result);
+		return -1;
+	}
+
+	for(char *line = strtok(result->data, "\n"); line != NULL; line = strtok(NULL, "\n")) {
+		char *msg = check_prefix(line, name);
+
+		if(msg == NULL || strcmp(name, "log_test")) {
+			ERROR_OUT("Invalid prefix or thread name on line '%s'\n", line);
+			nl_destroy_data(result);
+			return -1;
+		}
+
+		switch(line_count++) {
+			case 0:
+				snprintf(expect, sizeof(expect), "Plain message 1");
+				break;
+
+			case 1:
+				snprintf(expect, sizeof(expect), "\e[0;1m%s:%d: test_sync_format():\tErrno message 2: %d (%s)\e[0m",
+						__FILE__, errno_line, ENOENT, strerror(ENOENT));
+				break;
+
+			case 2:
+				snprintf(expect, sizeof(expect), "%s:%d: test_sync_format():\tInfo message 3", __FILE__, info_line);
+				break;
+		}
+
+		if(strcmp(msg, expect)) {
+			ERROR_OUT("Expected message '%s', got '%s'\n", expect, msg);
+			nl_destroy_data(result);
+			return -1;
+		}
+	}
+
+	nl_destroy_data(result);
+
+	if(line_count != 3) {
+		ERROR_OUT("Expected 3 lines, got %d\n", line_count);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void *log_thread(void *data)
+{
+	uintptr_t id = (uintptr_t)data;
+
+	for(int i = 0; i < THREAD_LINES; i++) {
+		nl_fptmf(i % 2 ? stderr : stdout, "thread %u line %d\n", (unsigned int)id, i);
+	}
+
+	return NULL;
+}
+
+static int test_async_threads(void)
+{
+	struct nl_thread_ctx *ctx;
+	struct nl_raw_data *result;
+	int next_line[THREAD_COUNT] = { 0 };
+	unsigned long dropped = nl_log_dropped();
+	int ret = 0;
+	FILE *f;
+
+	ctx = nl_create_thread_context();
+	if(ctx == NULL) {
+		ERROR_OUT("Error creating thread context\n");
+		return -1;
+	}
+
+	f = capture_start();
+	if(f == NULL) {
+		return -1;
+	}
+
+	ret = nl_log_start_async(&(struct nl_log_params){ .ring_size = 4096, .block_usec = 10000000 });
+	if(!ret) {
+		if(nl_log_start_async(NULL) != EBUSY) {
+			ret = -2;
+		}
+
+		for(uintptr_t i = 0; i < THREAD_COUNT; i++) {
+			char name[16];
+			snprintf(name, sizeof(name), "log_%u", (unsigned int)i);
+			nl_create_thread(ctx, NULL, log_thread, (void *)i, name, NULL);
+		}
+		nl_destroy_thread_context(ctx);
+
+		nl_log_stop_async();
+	}
+
+	result = capture_end(f);
+	if(result == NULL) {
+		return -1;
+	}
+
+	if(ret) {
+		ERROR_OUT("Error %d starting asynchronous logging, or second start did not fail\n", ret);
+		nl_destroy_data(result);
+		return -1;
+	}
+
+	for(char *line = strtok(result->data, "\n"); line != NULL; line = strtok(NULL, "\n")) {
+		char name[16], *msg;
+		unsigned int id;
+		int n;
+
+		msg = check_prefix(line, name);
+		if(msg == NULL || sscanf(msg, "thread %u line %d", &id, &n) != 2 || id >= THREAD_COUNT) {
+			ERROR_OUT("Invalid line '%s'\n", line);
+			ret = -1;
+			break;
+		}
+
+		if(strncmp(name, "log_", 4) || (unsigned int)atoi(name + 4) != id) {
+			ERROR_OUT("Line from thread %u has thread name %s\n", id, name);
+			ret = -1;
+			break;
+		}
+
+		if(n != next_line[id]) {
+			ERROR_OUT("Thread %u line %d was out of order (expected %d)\n", id, n, next_line[id]);
+			ret = -1;
+			break;
+		}
+
+		next_line[id]++;
+	}
+
+	for(int i = 0; i < THREAD_COUNT && !ret; i++) {
+		if(next_line[i] != THREAD_LINES) {
+			ERROR_OUT("Got %d lines from thread %d, expected %d\n", next_line[i], i, THREAD_LINES);
+			ret = -1;
+		}
+	}
+
+	if(nl_log_dropped() != dropped) {
+		ERROR_OUT("%lu messages were dropped while blocking was enabled\n", nl_log_dropped() - dropped);
+		ret = -1;
+	}
+
+	nl_destroy_data(result);
+
+	return ret;
+}
+
+static int test_async_drops(void)
+{
+	unsigned long dropped = nl_log_dropped();
+	unsigned long reported = 0;
+	struct nl_raw_data *result;
+	int lines = 0;
+	int ret;
+	FILE *f;
+
+	f = capture_start();
+	if(f == NULL) {
+		return -1;
+	}
+
+	ret = nl_log_start_async(&(struct nl_log_params){ .ring_size = 4096, .flush_usec = 200000 });
+	if(!ret) {
+		for(int i = 0; i < DROP_LINES; i++) {
+			nl_ptmf("drop test line %d\n", i);
+		}
+		nl_log_stop_async();
+	}
+
+	result = capture_end(f);
+	if(result == NULL) {
+		return -1;
+	}
+
+	if(ret) {
+		ERROR_OUT("Error %d starting asynchronous logging\n", ret);
+		nl_destroy_data(result);
+		return -1;
+	}
+
+	dropped = nl_log_dropped() - dropped;
+
+	for(char *line = strtok(result->data, "\n"); line != NULL; line = strtok(NULL, "\n")) {
+		char name[16], *msg;
+		unsigned long count;
+
+		msg = check_prefix(line, name);
+		if(msg == NULL) {
+			ret = -1;
+			break;
+		}
+
+		if(!nl_strstart(msg, "drop test line ")) {
+			lines++;
+		} else if(sscanf(msg, "%lu log messages dropped", &count) == 1) {
+			reported += count;
+		} else {
+			ERROR_OUT("Unexpected line '%s'\n", line);
+			ret = -1;
+			break;
+		}
+	}
+
+	nl_destroy_data(result);
+
+	if(ret) {
+		return ret;
+	}
+
+	if(dropped == 0 || lines + dropped != DROP_LINES || reported != dropped) {
+		ERROR_OUT("Wrote %d lines, dropped %lu, and reported %lu dropped, expected %d total with some dropped\n",
+				lines, dropped, reported, DROP_LINES);
+		return -1;
+	}
+
+	return 0;
+}
+
+// Messages too big for the rings are written after earlier queued messages.
+static int test_async_oversized(void)
+{
+	static char big[3000];
+	struct nl_raw_data *result;
+	char *before, *big_line, *after;
+	int ret;
+	FILE *f;
+
+	memset(big, 'x', sizeof(big) - 1);
+
+	f = capture_start();
+	if(f == NULL) {
+		return -1;
+	}
+
+	ret = nl_log_start_async(&(struct nl_log_params){ .ring_size = 4096, .block_usec = 10000000, .flush_usec = 200000 });
+	if(!ret) {
+		nl_ptmf("before\n");
+		nl_ptmf("%s\n", big);
+		nl_ptmf("after\n");
+		nl_log_stop_async();
+	}
+
+	result = capture_end(f);
+	if(result == NULL) {
+		return -1;
+	}
+
+	before = strstr(result->data, "before\n");
+	big_line = strstr(result->data, big);
+	after = strstr(result->data, "after\n");
+
+	if(ret || before == NULL || big_line == NULL || after == NULL || before > big_line || big_line > after) {
+		ERROR_OUT("Oversized message was missing or out of order (start error %d)\n", ret);
+		ret = -1;
+	}
+
+	nl_destroy_data(result);
+
+	return ret;
+}
+
+// Continuations from INFO_OUT_EX() and ERROR_OUT_EX() follow the message
+// they continue.
+static int test_async_continuation(void)
+{
+	struct nl_raw_data *result;
+	int ret;
+	FILE *f;
+
+	f = capture_start();
+	if(f == NULL) {
+		return -1;
+	}
+
+	ret = nl_log_start_async(&(struct nl_log_params){ .flush_usec = 200000 });
+	if(!ret) {
+		INFO_OUT("info start");
+		INFO_OUT_EX(" and info continuation %d\n", 1);
+		ERROR_OUT("error start");
+		ERROR_OUT_EX(" and error continuation %d\n", 2);
+		nl_log_stop_async();
+	}
+
+	result = capture_end(f);
+	if(result == NULL) {
+		return -1;
+	}
+
+	if(ret || strstr(result->data, "info start and info continuation 1\n") == NULL ||
+			strstr(result->data, "error start\e[0m\e[0;1m and error continuation 2\n\e[0m") == NULL) {
+		ERROR_OUT("Continuation output was missing or out of order (start error %d)\n", ret);
+		ret = -1;
+	}
+
+	nl_destroy_data(result);
+
+	return ret;
+}
+
+static void crash_handler(int signum, siginfo_t *info, void *context)
+{
+	(void)signum;
+	(void)context;
+
+	nl_log_crash_flush();
+	nl_print_signal(stdout, "Crashing due to", info);
+	_exit(0);
+}
+
+// Logs asynchronously in a child process that crashes before the writer
+// thread would normally write the messages.
+static int test_crash_flush(void)
+{
+	struct nl_raw_data *result;
+	char *pos;
+	pid_t pid;
+	int status;
+	FILE *f;
+
+	f = tmpfile();
+	if(f == NULL) {
+		ERRNO_OUT("Error creating temporary file");
+		return -1;
+	}
+
+	fflush(stdout);
+	fflush(stderr);
+
+	pid = fork();
+	if(pid < 0) {
+		ERRNO_OUT("Error forking crash test process");
+		fclose(f);
+		return -1;
+	}
+
+	if(pid == 0) {
+		struct sigaction sa = { .sa_sigaction = crash_handler, .sa_flags = SA_SIGINFO };
+
+		dup2(fileno(f), STDOUT_FILENO);
+		dup2(fileno(f), STDERR_FILENO);
+		sigaction(SIGSEGV, &sa, NULL);
+
+		if(nl_log_start_async(&(struct nl_log_params){ .flush_usec = 10000000 })) {
+			_exit(1);
+		}
+		for(int i = 0; i < 100; i++) {
+			nl_ptmf("crash test line %d\n", i);
+		}
+
+		raise(SIGSEGV);
+		_exit(1);
+	}
+
+	if(waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		ERROR_OUT("Crash test process failed\n");
+		fclose(f);
+		return -1;
+	}
+
+	rewind(f);
+	result = nl_read_stream(fileno(f));
+	fclose(f);
+	if(result == NULL) {
+		ERROR_OUT("Error reading crash test output\n");
+		return -1;
+	}
+
+	pos = result->data;
+	for(int i = 0; i < 100 && pos != NULL; i++) {
+		char expect[64];
+		snprintf(expect, sizeof(expect), "crash test line %d\n", i);
+		pos = strstr(pos, expect);
+	}
+	if(pos == NULL || strstr(pos, "Crashing due to") == NULL) {
+		ERROR_OUT("Crash test output was incomplete or out of order:\n%s\n", result->data);
+		nl_destroy_data(result);
+		return -1;
+	}
+
+	nl_destroy_data(result);
+
+	return 0;
+}
+
+static int test_threadname_cache(void)
+{
+	if(nl_set_threadname("cached_name") || strcmp(nl_threadname(), "cached_name")) {
+		ERROR_OUT("Cached thread name was '%s', expected 'cached_name'\n", nl_threadname());
+		return -1;
+	}
+
+	return nl_set_threadname("log_test");
+}
+
+int main(void)
+{
+	int ret = 0;
+
+	nl_set_threadname("log_test");
+
+	if(regcomp(&prefix_regex, PREFIX_REGEX, REG_EXTENDED)) {
+		ERROR_OUT("Error compiling prefix regex\n");
+		return 1;
+	}
+
+	printf("Testing synchronous message format\n");
+	ret |= test_sync_format();
+
+	printf("Testing asynchronous logging from multiple threads\n");
+	ret |= test_async_threads();
+
+	printf("Testing asynchronous logging with full rings\n");
+	ret |= test_async_drops();
+
+	printf("Testing oversized asynchronous messages\n");
+	ret |= test_async_oversized();
+
+	printf("Testing asynchronous continuation output\n");
+	ret |= test_async_continuation();
+
+	printf("Testing crash flush\n");
+	ret |= test_crash_flush();
+
+	printf("Testing thread name cache\n");
+	ret |= test_threadname_cache();
+
+	regfree(&prefix_regex);
+
+	return !!ret;
+}
@@ -0,0 +1,167 @@
+/*
+ * Compares cross-thread handoff through nl_queue with handoff through a
+ * mutex-protected nl_fifo, at increasing numbers of producer and consumer
+ * threads.
+ * Copyright (C)2026 Mike Bourgeous.  Released under AGPLv3.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "nlutils.h"
+
+#define ITEMS_PER_THREAD 500000
+#define QUEUE_SIZE 1024
+
+// Marks the end of the items for a consumer
+#define STOP_ITEM ((void *)~(uintptr_t)0)
+
+// A mutex-protected nl_fifo, as commonly used before nl_queue existed
+struct locked_fifo {
+	pthread_mutex_t lock;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+	struct nl_fifo *fifo;
+};
+
+struct bench_thread {
+	struct nl_queue *q;
+	struct locked_fifo *lf;
+};
+
+static void locked_put(struct locked_fifo *lf, void *data)
+{
+	pthread_mutex_lock(&lf->lock);
+	while(lf->fifo->count >= QUEUE_SIZE) {
+		pthread_cond_wait(&lf->not_full, &lf->lock);
+	}
+	nl_fifo_put(lf->fifo, data);
+	pthread_cond_signal(&lf->not_empty);
+	pthread_mutex_unlock(&lf->lock);
+}
+
+static void *locked_get(struct locked_fifo *lf)
+{
+	void *data;
+
+	pthread_mutex_lock(&lf->lock);
+	while(lf->fifo->count == 0) {
+		pthread_cond_wait(&lf->not_empty, &lf->lock);
+	}
+	data = nl_fifo_get(lf->fifo);
+	pthread_cond_signal(&lf->not_full);
+	pthread_mutex_unlock(&lf->lock);
+
+	return data;
+}
+
+static void *producer_thread(void *data)
+{
+	struct bench_thread *t = data;
+
+	for(uintptr_t i = 1; i <= ITEMS_PER_THREAD; i++) {
+		if(t->q) {
+			nl_queue_put(t->q, (void *)i);
+		} else {
+			locked_put(t->lf, (void *)i);
+		}
+	}
+
+	return NULL;
+}
+
+static void *consumer_thread(void *data)
+{
+	struct bench_thread *t = data;
+
+	if(t->q) {
+		while(nl_queue_get(t->q) != STOP_ITEM) {}
+	} else {
+		while(locked_get(t->lf) != STOP_ITEM) {}
+	}
+
+	return NULL;
+}
+
+// Returns nanoseconds per item for nthreads producers and nthreads consumers.
+static double run_bench(int nthreads, struct nl_queue *q, struct locked_fifo *lf)
+{
+	struct bench_thread t = { .q = q, .lf = lf };
+	struct nl_thread_ctx *ctx = nl_create_thread_context();
+	struct nl_thread *producers[nthreads];
+	int64_t start, elapsed;
+	int i;
+
+	if(CHECK_NULL(ctx)) {
+		abort();
+	}
+
+	start = nl_clock_ns(CLOCK_MONOTONIC);
+
+	for(i = 0; i < nthreads; i++) {
+		if(nl_create_thread(ctx, NULL, consumer_thread, &t, "bench_consumer", NULL) ||
+				nl_create_thread(ctx, NULL, producer_thread, &t, "bench_producer", &producers[i])) {
+			ERROR_OUT("Error creating threads\n");
+			abort();
+		}
+	}
+
+	for(i = 0; i < nthreads; i++) {
+		nl_join_thread(producers[i], NULL);
+	}
+	for(i = 0; i < nthreads; i++) {
+		if(q) {
+			nl_queue_put(q, STOP_ITEM);
+		} else {
+			locked_put(lf, STOP_ITEM);
+		}
+	}
+
+	nl_destroy_thread_context(ctx);
+
+	elapsed = nl_clock_ns(CLOCK_MONOTONIC) - start;
+
+	return (double)elapsed / ((double)ITEMS_PER_THREAD * nthreads);
+}
+
+int main(int argc, char *argv[])
+{
+	struct locked_fifo lf;
+	struct nl_queue *q;
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int max_threads = CLAMP(1, 16, ncpus);
+
+	if(argc == 2) {
+		max_threads = CLAMP(1, 256, atoi(argv[1]));
+	} else if(argc > 2) {
+		printf("Usage: %s [max_threads (default: CPU count up to 16)]\n", argv[0]);
+		return 1;
+	}
+
+	q = nl_queue_create(QUEUE_SIZE);
+	lf.fifo = nl_fifo_create();
+	if(CHECK_NULL(q) || CHECK_NULL(lf.fifo) || nl_create_mutex(&lf.lock, PTHREAD_MUTEX_NORMAL) ||
+			pthread_cond_init(&lf.not_empty, NULL) || pthread_cond_init(&lf.not_full, NULL)) {
+		ERROR_OUT("Error creating queues\n");
+		return -1;
+	}
+
+	INFO_OUT("%ld CPUs online; %d items per producer\n", ncpus, ITEMS_PER_THREAD);
+
+	for(int n = 1; n <= max_threads; n *= 2) {
+		double q_time = run_bench(n, q, NULL);
+		double lf_time = run_bench(n, NULL, &lf);
+
+		INFO_OUT("%2d producers, %2d consumers:  nl_queue %8.1f ns/item    locked nl_fifo %8.1f ns/item\n",
+				n, n, q_time, lf_time);
+	}
+
+	nl_queue_destroy(q);
+	nl_fifo_destroy(lf.fifo);
+	pthread_cond_destroy(&lf.not_full);
+	pthread_cond_destroy(&lf.not_empty);
+	pthread_mutex_destroy(&lf.lock);
+
+	return 0;
+}
@@ -0,0 +1,226 @@
+/*
+ * Tests struct nl_queue, including handoff between multiple threads.
+ * Copyright (C)2026 Mike Bourgeous.  Released under AGPLv3.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "nlutils.h"
+
+#define NUM_PRODUCERS 4
+#define NUM_CONSUMERS 4
+#define ITEMS_PER_PRODUCER 50000
+
+// Each producer adds values (producer_index << 24) + 1..ITEMS_PER_PRODUCER
+struct thread_test {
+	struct nl_queue *q;
+	unsigned int index;
+
+	// Consumer output: the last value seen from each producer, to verify
+	// FIFO ordering per producer, and the number of items received
+	unsigned int last[NUM_PRODUCERS];
+	unsigned int received;
+	int error;
+};
+
+static void *producer_thread(void *data)
+{
+	struct thread_test *t = data;
+
+	for(unsigned int i = 1; i <= ITEMS_PER_PRODUCER; i++) {
+		uintptr_t value = ((uintptr_t)t->index << 24) + i;
+
+		// Mix blocking and timed puts
+		int ret = (i & 1) ? nl_queue_put(t->q, (void *)value) :
+			nl_queue_put_timed(t->q, (void *)value, (struct timespec){.tv_sec = 10});
+		if(ret) {
+			ERROR_OUT("Producer %u failed to add item %u: %d (%s)\n", t->index, i, ret, strerror(ret));
+			t->error = 1;
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+static void *consumer_thread(void *data)
+{
+	struct thread_test *t = data;
+	void *item;
+
+	while((item = nl_queue_get(t->q)) != (void *)~(uintptr_t)0) {
+		uintptr_t value = (uintptr_t)item;
+		unsigned int producer = value >> 24;
+		unsigned int seq = value & 0xffffff;
+
+		if(producer >= NUM_PRODUCERS || seq <= t->last[producer]) {
+			ERROR_OUT("Consumer %u got out-of-order or invalid item 0x%08zx\n", t->index, (size_t)value);
+			t->error = 1;
+		} else {
+			t->last[producer] = seq;
+		}
+
+		t->received++;
+	}
+
+	return NULL;
+}
+
+static int test_threads(void)
+{
+	struct thread_test producers[NUM_PRODUCERS];
+	struct thread_test consumers[NUM_CONSUMERS];
+	struct nl_thread_ctx *ctx;
+	struct nl_thread *threads[NUM_PRODUCERS];
+	struct nl_queue *q;
+	unsigned int total = 0;
+	int ret = 0;
+	int i;
+
+	INFO_OUT("Testing %d producers and %d consumers.\n", NUM_PRODUCERS, NUM_CONSUMERS);
+
+	// A small queue forces both producers and consumers to sleep
+	q = nl_queue_create(16);
+	ctx = nl_create_thread_context();
+	if(CHECK_NULL(q) || CHECK_NULL(ctx)) {
+		return -1;
+	}
+
+	for(i = 0; i < NUM_CONSUMERS; i++) {
+		consumers[i] = (struct thread_test){ .q = q, .index = i };
+		if(nl_create_thread(ctx, NULL, consumer_thread, &consumers[i], "queue_consumer", NULL)) {
+			ERROR_OUT("Error creating consumer thread %d\n", i);
+			return -1;
+		}
+	}
+	for(i = 0; i < NUM_PRODUCERS; i++) {
+		producers[i] = (struct thread_test){ .q = q, .index = i };
+		if(nl_create_thread(ctx, NULL, producer_thread, &producers[i], "queue_producer", &threads[i])) {
+			ERROR_OUT("Error creating producer thread %d\n", i);
+			return -1;
+		}
+	}
+
+	for(i = 0; i < NUM_PRODUCERS; i++) {
+		nl_join_thread(threads[i], NULL);
+		if(producers[i].error) {
+			ret = -1;
+		}
+	}
+
+	// Tell the consumers to exit
+	for(i = 0; i < NUM_CONSUMERS; i++) {
+		nl_queue_put(q, (void *)~(uintptr_t)0);
+	}
+
+	nl_destroy_thread_context(ctx);
+
+	for(i = 0; i < NUM_CONSUMERS; i++) {
+		total += consumers[i].received;
+		if(consumers[i].error) {
+			ret = -1;
+		}
+	}
+
+	if(total != NUM_PRODUCERS * ITEMS_PER_PRODUCER) {
+		ERROR_OUT("Consumers received %u items, expected %u\n", total, NUM_PRODUCERS * ITEMS_PER_PRODUCER);
+		ret = -1;
+	}
+
+	if(nl_queue_count(q) != 0) {
+		ERROR_OUT("Queue should be empty after consumers exit, has %zu items\n", nl_queue_count(q));
+		ret = -1;
+	}
+
+	nl_queue_destroy(q);
+
+	return ret;
+}
+
+int main(void)
+{
+	struct nl_queue *q;
+	int64_t start, elapsed;
+	uintptr_t i;
+
+	INFO_OUT("Testing basic queue operations and errors.\n");
+
+	nl_queue_destroy(NULL);
+
+	q = nl_queue_create(5);
+	if(CHECK_NULL(q)) {
+		return -1;
+	}
+	if(nl_queue_capacity(q) != 8) {
+		ERROR_OUT("Expected capacity 5 to be rounded up to 8, got %zu\n", nl_queue_capacity(q));
+		return -1;
+	}
+
+	if(nl_queue_try_put(q, NULL) != EINVAL || nl_queue_try_put(NULL, q) != EINVAL ||
+			nl_queue_put(q, NULL) != EINVAL || nl_queue_try_get(NULL) != NULL) {
+		ERROR_OUT("Expected errors for NULL parameters\n");
+		return -1;
+	}
+
+	if(nl_queue_try_get(q) != NULL) {
+		ERROR_OUT("Got an element from an empty queue\n");
+		return -1;
+	}
+
+	for(i = 1; i <= 8; i++) {
+		if(nl_queue_try_put(q, (void *)i)) {
+			ERROR_OUT("Error adding element %zu\n", (size_t)i);
+			return -1;
+		}
+	}
+	if(nl_queue_count(q) != 8) {
+		ERROR_OUT("Expected 8 elements in the queue, got %zu\n", nl_queue_count(q));
+		return -1;
+	}
+	if(nl_queue_try_put(q, (void *)i) != EAGAIN) {
+		ERROR_OUT("Expected EAGAIN adding to a full queue\n");
+		return -1;
+	}
+
+	INFO_OUT("Testing timeouts.\n");
+	start = nl_clock_ns(CLOCK_MONOTONIC);
+	if(nl_queue_put_timed(q, (void *)i, (struct timespec){.tv_nsec = 100000000}) != ETIMEDOUT) {
+		ERROR_OUT("Expected ETIMEDOUT adding to a full queue\n");
+		return -1;
+	}
+	elapsed = nl_clock_ns(CLOCK_MONOTONIC) - start;
+	if(elapsed < 100000000) {
+		ERROR_OUT("Timed put returned after %lld ns, before its 100ms timeout\n", (long long)elapsed);
+		return -1;
+	}
+
+	for(i = 1; i <= 8; i++) {
+		void *result = (i & 1) ? nl_queue_try_get(q) : nl_queue_get_timed(q, (struct timespec){.tv_sec = 1});
+		if(result != (void *)i) {
+			ERROR_OUT("Expected element %zu, got %p\n", (size_t)i, result);
+			return -1;
+		}
+	}
+
+	start = nl_clock_ns(CLOCK_MONOTONIC);
+	if(nl_queue_get_timed(q, (struct timespec){.tv_nsec = 100000000}) != NULL) {
+		ERROR_OUT("Got an element from an empty queue with a timeout\n");
+		return -1;
+	}
+	elapsed = nl_clock_ns(CLOCK_MONOTONIC) - start;
+	if(elapsed < 100000000) {
+		ERROR_OUT("Timed get returned after %lld ns, before its 100ms timeout\n", (long long)elapsed);
+		return -1;
+	}
+
+	nl_queue_destroy(q);
+
+	if(test_threads()) {
+		return -1;
+	}
+
+	INFO_OUT("Queue tests completed successfully.\n");
+
+	return 0;
+}
@@ -0,0 +1,161 @@
+/*
+ * Measures whole-file read throughput in MB/s for nl_read_file(),
+ * nl_map_file(), and the fixed-chunk realloc() loop nl_read_stream() used
+ * before it switched to geometric growth, over file sizes from 1KB to 1GB.
+ * Copyright (C)2026 Mike Bourgeous.  Released under AGPLv3.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include "nlutils.h"
+
+#define TIME_LIMIT 300000000 // 0.3 seconds per test
+
+// The previous nl_read_stream() algorithm: read into a 16KB stack buffer,
+// then grow the result by exactly the amount read and copy it in.
+static struct nl_raw_data *legacy_read_file(const char *filename)
+{
+	struct nl_raw_data *data;
+	char readbuf[16384];
+	char *tmpbuf;
+	ssize_t ret;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if(fd < 0) {
+		return NULL;
+	}
+
+	data = calloc(1, sizeof(struct nl_raw_data));
+	if(data == NULL) {
+		close(fd);
+		return NULL;
+	}
+
+	while((ret = read(fd, readbuf, sizeof(readbuf))) > 0) {
+		tmpbuf = realloc(data->data, data->size + ret + 1);
+		if(tmpbuf == NULL) {
+			nl_destroy_data(data);
+			close(fd);
+			return NULL;
+		}
+		data->data = tmpbuf;
+
+		memmove(data->data + data->size, readbuf, ret);
+		data->size += ret;
+		data->data[data->size] = 0;
+	}
+
+	close(fd);
+
+	return data;
+}
+
+// Touches every page of the data so mapped files pay for their page faults.
+static size_t touch_pages(const struct nl_raw_data *data)
+{
+	size_t sum = 0;
+
+	for(size_t i = 0; i < data->size; i += 4096) {
+		sum += (unsigned char)data->data[i];
+	}
+
+	return sum;
+}
+
+// Reads filename repeatedly with the given method (0 for the legacy loop, 1
+// for nl_read_file(), 2 for nl_map_file()) for TIME_LIMIT, returning MB/s.
+static double bench_file(const char *filename, size_t size, int method)
+{
+	struct nl_raw_data *data;
+	int64_t start = nl_clock_ns(CLOCK_MONOTONIC), elapsed;
+	size_t iterations = 0;
+	size_t sum = 0;
+
+	do {
+		switch(method) {
+			case 0:
+				data = legacy_read_file(filename);
+				break;
+			case 1:
+				data = nl_read_file(filename);
+				break;
+			default:
+				data = nl_map_file(filename);
+				break;
+		}
+
+		if(data == NULL || data->size != size) {
+			ERROR_OUT("Error reading %zu bytes from %s with method %d\n", size, filename, method);
+			abort();
+		}
+
+		sum += touch_pages(data);
+
+		if(method == 2) {
+			nl_unmap_data(data);
+		} else {
+			nl_destroy_data(data);
+		}
+
+		iterations++;
+		elapsed = nl_clock_ns(CLOCK_MONOTONIC) - start;
+	} while(elapsed < TIME_LIMIT);
+
+	DEBUG_OUT("Checksum %zu\n", sum);
+
+	return (double)size * iterations * 1000.0 / elapsed;
+}
+
+int main(int argc, char *argv[])
+{
+	char filename[] = "/tmp/read_benchmark_XXXXXX";
+	size_t max_size = 1 << 30;
+	char block[65536];
+	size_t size = 0;
+	int fd;
+
+	if(argc == 2) {
+		max_size = strtoull(argv[1], NULL, 10);
+	} else if(argc > 2) {
+		printf("Usage: %s [max_bytes (default: 1073741824)]\n", argv[0]);
+		return 1;
+	}
+
+	fd = mkstemp(filename);
+	if(fd < 0) {
+		ERRNO_OUT("Error creating temporary file");
+		return -1;
+	}
+
+	memset(block, 'x', sizeof(block));
+
+	for(size_t target = 1024; target <= max_size; target *= 32) {
+		// Extend the file to the target size
+		while(size < target) {
+			size_t len = MIN_NUM(sizeof(block), target - size);
+			if(write(fd, block, len) != (ssize_t)len) {
+				ERRNO_OUT("Error writing %zu bytes to %s", target, filename);
+				unlink(filename);
+				return -1;
+			}
+			size += len;
+		}
+
+		double legacy = bench_file(filename, size, 0);
+		double read = bench_file(filename, size, 1);
+		double mapped = bench_file(filename, size, 2);
+
+		INFO_OUT("%10zu bytes:  legacy %9.1f MB/s    nl_read_file %9.1f MB/s    nl_map_file %9.1f MB/s\n",
+				size, legacy, read, mapped);
+	}
+
+	close(fd);
+	unlink(filename);
+
+	return 0;
+}
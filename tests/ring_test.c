@@ -0,0 +1,299 @@
+/*
+ * Tests struct nl_ring, comparing its behavior to struct nl_fifo.
+ * Copyright (C)2026 Mike Bourgeous.  Released under AGPLv3.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "nlutils.h"
+
+// Compares every element of the ring and the fifo using all of the ring's
+// element access functions.
+static int compare_ring(struct nl_ring *r, struct nl_fifo *f, const char *desc)
+{
+	const struct nl_fifo_element *fiter = NULL;
+	size_t riter = 0;
+	void *expected, *result;
+	size_t i;
+
+	if(r->count != f->count) {
+		ERROR_OUT("%s: ring has %zu elements, fifo has %u\n", desc, r->count, f->count);
+		return -1;
+	}
+
+	for(i = 0; (expected = nl_fifo_next(f, &fiter)) != NULL; i++) {
+		result = nl_ring_next(r, &riter);
+		if(result != expected) {
+			ERROR_OUT("%s: ring iteration %zu returned %p, expected %p\n", desc, i, result, expected);
+			return -1;
+		}
+
+		result = nl_ring_peek_index(r, i);
+		if(result != expected) {
+			ERROR_OUT("%s: ring index %zu returned %p, expected %p\n", desc, i, result, expected);
+			return -1;
+		}
+
+		result = nl_ring_peek_index(r, (ssize_t)i - (ssize_t)r->count);
+		if(result != expected) {
+			ERROR_OUT("%s: ring index %zd returned %p, expected %p\n",
+					desc, (ssize_t)i - (ssize_t)r->count, result, expected);
+			return -1;
+		}
+	}
+
+	if(nl_ring_next(r, &riter) != NULL) {
+		ERROR_OUT("%s: ring iteration did not end with the fifo\n", desc);
+		return -1;
+	}
+
+	if(nl_ring_peek(r) != nl_fifo_peek(f) || nl_ring_peek_last(r) != nl_fifo_peek_last(f)) {
+		ERROR_OUT("%s: first or last element differs\n", desc);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void count_cb(void *el, void *user_data)
+{
+	(void)el;
+	(*(size_t *)user_data)++;
+}
+
+// Applies the same random operations to a ring and a fifo, comparing them
+// after each operation.
+static int test_random_ops(void)
+{
+	struct nl_ring *r = nl_ring_create(0);
+	struct nl_fifo *f = nl_fifo_create();
+	size_t r_calls = 0, f_calls = 0;
+	char desc[64];
+	void *data;
+	int ret = 0;
+
+	INFO_OUT("Testing random operations against nl_fifo.\n");
+
+	if(CHECK_NULL(r) || CHECK_NULL(f)) {
+		return -1;
+	}
+
+	srand(42);
+
+	for(int i = 0; i < 20000 && ret == 0; i++) {
+		int op = rand() % 10;
+
+		// Small values so nl_ring_remove() finds duplicates
+		data = (void *)(uintptr_t)(rand() % 50 + 1);
+
+		snprintf(desc, sizeof(desc), "Operation %d (type %d)", i, op);
+
+		switch(op) {
+			case 0:
+			case 1:
+			case 2:
+				if(nl_ring_put(r, data) != nl_fifo_put(f, data)) {
+					ERROR_OUT("%s: nl_ring_put() result differs\n", desc);
+					ret = -1;
+				}
+				break;
+
+			case 3:
+			case 4:
+				if(nl_ring_prepend(r, data) != nl_fifo_prepend(f, data)) {
+					ERROR_OUT("%s: nl_ring_prepend() result differs\n", desc);
+					ret = -1;
+				}
+				break;
+
+			case 5:
+			case 6:
+				if(nl_ring_get(r) != nl_fifo_get(f)) {
+					ERROR_OUT("%s: nl_ring_get() result differs\n", desc);
+					ret = -1;
+				}
+				break;
+
+			case 7:
+				if(f->count > 0 && nl_ring_remove(r, data) != nl_fifo_remove(f, data)) {
+					ERROR_OUT("%s: nl_ring_remove() result differs\n", desc);
+					ret = -1;
+				}
+				break;
+
+			case 8:
+				{
+					int count = rand() % 3;
+					if(nl_ring_remove_start(r, count, count_cb, &r_calls) !=
+							nl_fifo_remove_start(f, count, count_cb, &f_calls)) {
+						ERROR_OUT("%s: nl_ring_remove_start() result differs\n", desc);
+						ret = -1;
+					}
+				}
+				break;
+
+			case 9:
+				{
+					int count = rand() % 3;
+					if(nl_ring_remove_end(r, count, count_cb, &r_calls) !=
+							nl_fifo_remove_end(f, count, count_cb, &f_calls)) {
+						ERROR_OUT("%s: nl_ring_remove_end() result differs\n", desc);
+						ret = -1;
+					}
+				}
+				break;
+		}
+
+		if(r_calls != f_calls) {
+			ERROR_OUT("%s: removal callback counts differ\n", desc);
+			ret = -1;
+		}
+
+		if(ret == 0 && compare_ring(r, f, desc)) {
+			ret = -1;
+		}
+	}
+
+	nl_ring_destroy(r);
+	nl_fifo_destroy(f);
+
+	return ret;
+}
+
+int main(void)
+{
+	char *str1 = "Test 1";
+	char *str2 = "Test 2";
+	char *str3 = "Test 3";
+	struct nl_ring *r;
+	size_t iter, calls;
+	void **old_data;
+	int i;
+
+	INFO_OUT("Testing basic ring operations and errors.\n");
+
+	// Destruction of an unmodified or NULL ring
+	r = nl_ring_create(0);
+	if(CHECK_NULL(r)) {
+		return -1;
+	}
+	nl_ring_destroy(r);
+	nl_ring_destroy(NULL);
+
+	r = nl_ring_create(3);
+	if(CHECK_NULL(r)) {
+		return -1;
+	}
+	if(r->size < 3) {
+		ERROR_OUT("Ring created with capacity 3 only has room for %zu\n", r->size);
+		return -1;
+	}
+
+	if(nl_ring_put(r, NULL) >= 0 || nl_ring_put(NULL, str1) >= 0 || nl_ring_prepend(r, NULL) >= 0) {
+		ERROR_OUT("No error adding NULL data or adding to a NULL ring.\n");
+		return -1;
+	}
+	if(nl_ring_get(r) != NULL || nl_ring_get(NULL) != NULL || nl_ring_peek(r) != NULL ||
+			nl_ring_peek_last(r) != NULL || nl_ring_peek_index(r, 0) != NULL) {
+		ERROR_OUT("Non-NULL result from an empty or NULL ring.\n");
+		return -1;
+	}
+	if(!nl_ring_remove(r, str1) || !nl_ring_remove(NULL, str1) || !nl_ring_remove(r, NULL)) {
+		ERROR_OUT("No error removing from an empty ring.\n");
+		return -1;
+	}
+	iter = 0;
+	if(nl_ring_next(r, &iter) != NULL || nl_ring_next(NULL, &iter) != NULL || nl_ring_next(r, NULL) != NULL) {
+		ERROR_OUT("Non-NULL result iterating an empty ring.\n");
+		return -1;
+	}
+
+	if(nl_ring_put(r, str1) != 1 || nl_ring_put(r, str2) != 2 || nl_ring_prepend(r, str3) != 3) {
+		ERROR_OUT("Incorrect count adding elements to the ring.\n");
+		return -1;
+	}
+	if(nl_ring_peek(r) != str3 || nl_ring_peek_last(r) != str2 || nl_ring_peek_index(r, 1) != str1 ||
+			nl_ring_peek_index(r, -3) != str3) {
+		ERROR_OUT("Incorrect elements peeked from the ring.\n");
+		return -1;
+	}
+	if(nl_ring_peek_index(r, 3) != NULL || nl_ring_peek_index(r, -4) != NULL) {
+		ERROR_OUT("Non-NULL result peeking out of range.\n");
+		return -1;
+	}
+	if(nl_ring_remove(r, str1) || nl_ring_get(r) != str3 || nl_ring_get(r) != str2 || r->count != 0) {
+		ERROR_OUT("Incorrect results removing elements from the ring.\n");
+		return -1;
+	}
+
+	INFO_OUT("Testing wrapping and growth.\n");
+
+	// Walk the head around the array several times without growing
+	old_data = r->data;
+	for(i = 0; i < 100; i++) {
+		if(nl_ring_put(r, str1) != 1 || nl_ring_put(r, str2) != 2 ||
+				nl_ring_get(r) != str1 || nl_ring_get(r) != str2) {
+			ERROR_OUT("Error cycling elements through the ring on iteration %d.\n", i);
+			return -1;
+		}
+	}
+	if(r->data != old_data) {
+		ERROR_OUT("Ring reallocated its storage without growing.\n");
+		return -1;
+	}
+
+	// Grow while wrapped around the end of the array
+	for(i = 1; i <= 1000; i++) {
+		if(nl_ring_put(r, (void *)(uintptr_t)i) != i) {
+			ERROR_OUT("Error adding element %d.\n", i);
+			return -1;
+		}
+	}
+	for(i = 1; i <= 1000; i++) {
+		if(nl_ring_peek_index(r, i - 1) != (void *)(uintptr_t)i) {
+			ERROR_OUT("Element %d is out of order after growth.\n", i);
+			return -1;
+		}
+	}
+
+	calls = 0;
+	if(nl_ring_remove_start(r, 10, count_cb, &calls) != 990 || calls != 10 || nl_ring_peek(r) != (void *)11) {
+		ERROR_OUT("Error removing elements from the start of the ring.\n");
+		return -1;
+	}
+	calls = 0;
+	if(nl_ring_remove_end(r, 10, count_cb, &calls) != 980 || calls != 10 || nl_ring_peek_last(r) != (void *)990) {
+		ERROR_OUT("Error removing elements from the end of the ring.\n");
+		return -1;
+	}
+	calls = 0;
+	if(nl_ring_remove_end(r, 5000, count_cb, &calls) != 0 || calls != 980) {
+		ERROR_OUT("Error removing more elements than the ring contains.\n");
+		return -1;
+	}
+	if(nl_ring_remove_start(NULL, 1, NULL, NULL) != 0 || nl_ring_remove_end(NULL, 1, NULL, NULL) != 0) {
+		ERROR_OUT("Nonzero result removing elements from a NULL ring.\n");
+		return -1;
+	}
+
+	calls = 0;
+	for(i = 0; i < 100; i++) {
+		nl_ring_put(r, str1);
+	}
+	nl_ring_clear_cb(r, count_cb, &calls);
+	if(r->count != 0 || calls != 100) {
+		ERROR_OUT("Error clearing the ring with a callback.\n");
+		return -1;
+	}
+	nl_ring_clear(NULL);
+
+	nl_ring_destroy(r);
+
+	if(test_random_ops()) {
+		return -1;
+	}
+
+	INFO_OUT("Ring tests completed successfully.\n");
+
+	return 0;
+}
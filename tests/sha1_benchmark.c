@@ -0,0 +1,118 @@
+/*
+ * Measures SHA-1 throughput in MB/s for each block transform implementation
+ * supported by the CPU, over several message sizes, and the message rate of
+ * each nl_sha1_multi() implementation for batches of small messages.
+ * Copyright (C)2026 Mike Bourgeous.  Released under AGPLv3.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "nlutils.h"
+
+#define TIME_LIMIT 300000000 // 0.3 seconds per test
+
+static const char * const impl_names[] = {
+	[NL_SHA1_AUTO] = "automatic",
+	[NL_SHA1_SCALAR] = "scalar",
+	[NL_SHA1_SSSE3] = "SSSE3",
+	[NL_SHA1_AVX2] = "AVX2",
+	[NL_SHA1_SHANI] = "SHA-NI",
+	[NL_SHA1_ARMV8] = "ARMv8",
+};
+
+static const char * const multi_impl_names[] = {
+	[NL_SHA1_MULTI_AUTO] = "automatic",
+	[NL_SHA1_MULTI_SERIAL] = "serial",
+	[NL_SHA1_MULTI_SSE2] = "SSE2",
+	[NL_SHA1_MULTI_AVX2] = "AVX2",
+	[NL_SHA1_MULTI_NEON] = "NEON",
+};
+
+static const size_t sizes[] = { 64, 1024, 65536, 1048576 };
+static const size_t multi_sizes[] = { 16, 55, 64, 200, 1024 };
+
+#define MULTI_COUNT 256
+
+// Hashes size bytes of data repeatedly for TIME_LIMIT, returning MB/s.
+static double bench_size(const uint8_t *data, size_t size)
+{
+	uint8_t digest[SHA1_DIGEST_SIZE];
+	struct nl_sha1_ctx ctx;
+	int64_t start = nl_clock_ns(CLOCK_MONOTONIC), elapsed;
+	size_t iterations = 0;
+
+	do {
+		for(int i = 0; i < 16; i++, iterations++) {
+			nl_sha1_init(&ctx);
+			nl_sha1_update(&ctx, data, size);
+			nl_sha1_final(&ctx, digest);
+		}
+		elapsed = nl_clock_ns(CLOCK_MONOTONIC) - start;
+	} while(elapsed < TIME_LIMIT);
+
+	return (double)size * iterations * 1000.0 / elapsed;
+}
+
+// Hashes MULTI_COUNT messages of size bytes each with nl_sha1_multi()
+// repeatedly for TIME_LIMIT, returning millions of messages per second.
+static double bench_multi(const uint8_t *data, size_t size)
+{
+	static struct nl_sha1_msg msgs[MULTI_COUNT];
+	static char hex[MULTI_COUNT][SHA1_HEX_SIZE];
+	int64_t start = nl_clock_ns(CLOCK_MONOTONIC), elapsed;
+	size_t iterations = 0;
+
+	for(size_t i = 0; i < MULTI_COUNT; i++) {
+		msgs[i].data = data + i * size;
+		msgs[i].len = size;
+	}
+
+	do {
+		nl_sha1_multi(msgs, MULTI_COUNT, NULL, hex);
+		iterations++;
+		elapsed = nl_clock_ns(CLOCK_MONOTONIC) - start;
+	} while(elapsed < TIME_LIMIT);
+
+	return (double)MULTI_COUNT * iterations * 1000.0 / elapsed;
+}
+
+int main(void)
+{
+	uint8_t *data = malloc(sizes[ARRAY_SIZE(sizes) - 1]);
+
+	if(data == NULL) {
+		ERRNO_OUT("Error allocating benchmark data");
+		return -1;
+	}
+	for(size_t i = 0; i < sizes[ARRAY_SIZE(sizes) - 1]; i++) {
+		data[i] = i * 7;
+	}
+
+	for(int impl = NL_SHA1_SCALAR; impl <= NL_SHA1_ARMV8; impl++) {
+		if(nl_sha1_set_impl(impl)) {
+			INFO_OUT("%-9s not supported\n", impl_names[impl]);
+			continue;
+		}
+
+		for(size_t i = 0; i < ARRAY_SIZE(sizes); i++) {
+			INFO_OUT("%-9s %8zu bytes: %8.1f MB/s\n", impl_names[impl], sizes[i], bench_size(data, sizes[i]));
+		}
+	}
+
+	for(int impl = NL_SHA1_MULTI_SERIAL; impl <= NL_SHA1_MULTI_NEON; impl++) {
+		if(nl_sha1_multi_set_impl(impl)) {
+			INFO_OUT("multi %-9s not supported\n", multi_impl_names[impl]);
+			continue;
+		}
+
+		for(size_t i = 0; i < ARRAY_SIZE(multi_sizes); i++) {
+			INFO_OUT("multi %-9s %3d x %4zu bytes: %8.2f M msg/s\n", multi_impl_names[impl],
+					MULTI_COUNT, multi_sizes[i], bench_multi(data, multi_sizes[i]));
+		}
+	}
+
+	free(data);
+
+	return 0;
+}
@@ -35,7 +35,144 @@ static void digest_to_hex(const uint8_t digest[SHA1_DIGEST_SIZE], char *output)
 	}
 }
 
-int main()
+static const char * const impl_names[] = {
+	[NL_SHA1_AUTO] = "automatic",
+	[NL_SHA1_SCALAR] = "scalar",
+	[NL_SHA1_SSSE3] = "SSSE3",
+	[NL_SHA1_AVX2] = "AVX2",
+	[NL_SHA1_SHANI] = "SHA-NI",
+	[NL_SHA1_ARMV8] = "ARMv8",
+};
+
+/*
+ * Hashes pseudorandom data of every length up to a few blocks, fed in
+ * pieces of varying size, and compares the digests with the scalar
+ * implementation.
+ */
+static int cross_check(enum nl_sha1_impl impl)
+{
+	uint8_t data[1000];
+	uint8_t expected[SHA1_DIGEST_SIZE], digest[SHA1_DIGEST_SIZE];
+	struct nl_sha1_ctx context;
+	uint32_t seed = 1;
+
+	for (size_t i = 0; i < sizeof(data); i++) {
+		seed = seed * 1103515245 + 12345;
+		data[i] = seed >> 16;
+	}
+
+	for (size_t len = 0; len <= sizeof(data); len += len < 300 ? 1 : 37) {
+		nl_sha1_set_impl(NL_SHA1_SCALAR);
+		nl_sha1_init(&context);
+		nl_sha1_update(&context, data, len);
+		nl_sha1_final(&context, expected);
+
+		nl_sha1_set_impl(impl);
+		nl_sha1_init(&context);
+		for (size_t off = 0, piece = 1; off < len; off += piece, piece = piece * 7 % 263 + 1) {
+			nl_sha1_update(&context, data + off, MIN_NUM(piece, len - off));
+		}
+		nl_sha1_final(&context, digest);
+
+		if (memcmp(digest, expected, sizeof(digest))) {
+			fprintf(stdout, "FAIL\n");
+			fprintf(stderr, "* %s hash of %zu random bytes does not match scalar\n", impl_names[impl], len);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static const char * const multi_impl_names[] = {
+	[NL_SHA1_MULTI_AUTO] = "automatic",
+	[NL_SHA1_MULTI_SERIAL] = "serial",
+	[NL_SHA1_MULTI_SSE2] = "SSE2",
+	[NL_SHA1_MULTI_AVX2] = "AVX2",
+	[NL_SHA1_MULTI_NEON] = "NEON",
+};
+
+#define MULTI_COUNT 300
+
+/*
+ * Hashes MULTI_COUNT pseudorandom messages of different lengths (so lanes
+ * finish and refill at different times) with nl_sha1_multi(), then compares
+ * every raw and hex digest with nl_sha1_init()/update()/final().
+ */
+static int test_multi(enum nl_sha1_multi_impl impl)
+{
+	static uint8_t data[2000];
+	static struct nl_sha1_msg msgs[MULTI_COUNT];
+	static uint8_t digests[MULTI_COUNT][SHA1_DIGEST_SIZE];
+	static char hex[MULTI_COUNT][SHA1_HEX_SIZE];
+	uint8_t expected[SHA1_DIGEST_SIZE];
+	char expected_hex[SHA1_HEX_SIZE];
+	struct nl_sha1_ctx context;
+	uint32_t seed = 7;
+
+	fprintf(stdout, "verifying multi-buffer SHA-1 implementation... ");
+
+	for (size_t i = 0; i < sizeof(data); i++) {
+		seed = seed * 1103515245 + 12345;
+		data[i] = seed >> 16;
+	}
+
+	for (size_t count = 0; count <= MULTI_COUNT; count += count < 20 ? 1 : 140) {
+		for (size_t i = 0; i < count; i++) {
+			// Mostly short messages around the one- and two-block padding
+			// boundaries, with an occasional long one
+			msgs[i].data = data + i % 97;
+			msgs[i].len = i % 23 == 5 ? 1000 + i : (i * 13) % 150;
+		}
+
+		memset(digests, 0, sizeof(digests));
+		memset(hex, 0, sizeof(hex));
+		nl_sha1_multi(msgs, count, digests, hex);
+
+		for (size_t i = 0; i < count; i++) {
+			nl_sha1_init(&context);
+			nl_sha1_update(&context, msgs[i].data, msgs[i].len);
+			nl_sha1_final(&context, expected);
+			digest_to_hex(expected, expected_hex);
+
+			if (memcmp(digests[i], expected, SHA1_DIGEST_SIZE) || strcmp(hex[i], expected_hex)) {
+				fprintf(stdout, "FAIL\n");
+				fprintf(stderr, "* %s hash of message %zu of %zu (%zu bytes) incorrect:\n",
+						multi_impl_names[impl], i, count, msgs[i].len);
+				fprintf(stderr, "\t%s returned\n", hex[i]);
+				fprintf(stderr, "\t%s is correct\n", expected_hex);
+				return -1;
+			}
+		}
+	}
+
+	// Either output may be omitted
+	msgs[0].data = (const uint8_t *)test_data[1];
+	msgs[0].len = strlen(test_data[1]);
+	nl_sha1_multi(msgs, 1, NULL, hex);
+	nl_sha1_multi(msgs, 1, digests, NULL);
+	digest_to_hex(digests[0], expected_hex);
+	if (strcmp(hex[0], test_results[1]) || strcmp(expected_hex, test_results[1])) {
+		fprintf(stdout, "FAIL\n");
+		fprintf(stderr, "* %s hash with one output omitted incorrect\n", multi_impl_names[impl]);
+		return -1;
+	}
+
+	// Empty messages may have NULL data
+	msgs[0].data = NULL;
+	msgs[0].len = 0;
+	nl_sha1_multi(msgs, 1, NULL, hex);
+	if (strcmp(hex[0], "da39a3ee5e6b4b0d3255bfef95601890afd80709")) {
+		fprintf(stdout, "FAIL\n");
+		fprintf(stderr, "* %s hash of an empty message with NULL data incorrect\n", multi_impl_names[impl]);
+		return -1;
+	}
+
+	fprintf(stdout, "ok\n");
+	return 0;
+}
+
+static int test_impl(enum nl_sha1_impl impl)
 {
 	size_t k;
 	struct nl_sha1_ctx context;
@@ -90,7 +227,48 @@ int main()
 		return -1;
 	}
 
+	if (cross_check(impl)) {
+		return -1;
+	}
+
 	/* success */
 	fprintf(stdout, "ok\n");
 	return 0;
 }
+
+int main()
+{
+	for (int impl = NL_SHA1_SCALAR; impl <= NL_SHA1_ARMV8; impl++) {
+		if (nl_sha1_set_impl(impl)) {
+			fprintf(stdout, "%s SHA-1 implementation not supported\n", impl_names[impl]);
+			continue;
+		}
+
+		fprintf(stdout, "%s: ", impl_names[impl]);
+		if (test_impl(impl)) {
+			return -1;
+		}
+	}
+
+	nl_sha1_set_impl(NL_SHA1_AUTO);
+	fprintf(stdout, "%s: ", impl_names[NL_SHA1_AUTO]);
+	if (test_impl(NL_SHA1_AUTO)) {
+		return -1;
+	}
+
+	for (int impl = NL_SHA1_MULTI_SERIAL; impl <= NL_SHA1_MULTI_NEON; impl++) {
+		if (nl_sha1_multi_set_impl(impl)) {
+			fprintf(stdout, "%s multi-buffer SHA-1 implementation not supported\n", multi_impl_names[impl]);
+			continue;
+		}
+
+		fprintf(stdout, "%s: ", multi_impl_names[impl]);
+		if (test_multi(impl)) {
+			return -1;
+		}
+	}
+
+	nl_sha1_multi_set_impl(NL_SHA1_MULTI_AUTO);
+	fprintf(stdout, "%s: ", multi_impl_names[NL_SHA1_MULTI_AUTO]);
+	return test_multi(NL_SHA1_MULTI_AUTO);
+}
@@ -0,0 +1,94 @@
+/*
+ * Compares process start latency of the fork()-based nl_popen3vec() with the
+ * vfork()-based nl_popen3vea() as the parent's resident memory grows.
+ * Copyright (C)2026 Mike Bourgeous.  Released under AGPLv3.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "nlutils.h"
+
+#define SPAWN_COUNT 200
+
+// Passing a callback forces nl_popen3vec() to fork().
+static void noop_cb(void)
+{
+}
+
+// Returns the average microseconds for nl_popen3vec() (use_fork nonzero) or
+// nl_popen3vea() to return, and stores the average microseconds to start and
+// reap /bin/true in *total_us.
+static double run_bench(int use_fork, double *total_us)
+{
+	char *const argv[] = { "/bin/true", NULL };
+	int64_t spawn_ns = 0, start, now;
+	int64_t total_start = nl_clock_ns(CLOCK_MONOTONIC);
+	pid_t pid;
+
+	for(int i = 0; i < SPAWN_COUNT; i++) {
+		start = nl_clock_ns(CLOCK_MONOTONIC);
+		if(use_fork) {
+			pid = nl_popen3vec(NULL, NULL, NULL, argv[0], argv, environ, noop_cb);
+		} else {
+			pid = nl_popen3vea(NULL, NULL, NULL, argv[0], argv, environ, NULL);
+		}
+		now = nl_clock_ns(CLOCK_MONOTONIC);
+
+		if(pid <= 0) {
+			ERROR_OUT("Error starting /bin/true\n");
+			abort();
+		}
+		spawn_ns += now - start;
+
+		nl_wait_get_return(pid);
+	}
+
+	*total_us = (nl_clock_ns(CLOCK_MONOTONIC) - total_start) / 1000.0 / SPAWN_COUNT;
+	return spawn_ns / 1000.0 / SPAWN_COUNT;
+}
+
+int main(int argc, char *argv[])
+{
+	size_t max_mb = 1024;
+	size_t rss_mb = 0;
+	char *mem = NULL;
+
+	if(argc == 2) {
+		max_mb = strtoul(argv[1], NULL, 10);
+	} else if(argc > 2) {
+		printf("Usage: %s [max_rss_mb (default: 1024)]\n", argv[0]);
+		return 1;
+	}
+
+	INFO_OUT("%d spawns of /bin/true per test; times in microseconds\n", SPAWN_COUNT);
+
+	while(1) {
+		double fork_total, vfork_total;
+		double fork_spawn = run_bench(1, &fork_total);
+		double vfork_spawn = run_bench(0, &vfork_total);
+
+		INFO_OUT("%5zu MB touched:  fork %8.1f us (%8.1f with wait)    vfork %8.1f us (%8.1f with wait)\n",
+				rss_mb, fork_spawn, fork_total, vfork_spawn, vfork_total);
+
+		if(rss_mb >= max_mb) {
+			break;
+		}
+
+		// Grow the parent's resident memory, touching every page
+		rss_mb = rss_mb ? MIN_NUM(rss_mb * 4, max_mb) : MIN_NUM(64, max_mb);
+		free(mem);
+		mem = malloc(rss_mb << 20);
+		if(mem == NULL) {
+			ERRNO_OUT("Error allocating %zu MB", rss_mb);
+			return -1;
+		}
+		memset(mem, 1, rss_mb << 20);
+	}
+
+	free(mem);
+
+	return 0;
+}
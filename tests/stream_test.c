@@ -3,6 +3,7 @@
  * Copyright (C)2015 Mike Bourgeous.  Released under AGPLv3 in 2018.
  */
 #include <stdio.h>
+#include <stdlib.h>
 #include <fcntl.h>
 
 #include "nlutils.h"
@@ -94,6 +95,218 @@ int test_read_file(char *input_file)
 	return ret;
 }
 
+// Tests nl_read_stream() on pipes and partially read files.
+int test_read_stream(char *input_file)
+{
+	struct nl_raw_data *whole, *data;
+	size_t size;
+	char *buf;
+	int fd;
+
+	INFO_OUT("Testing nl_read_stream().\n");
+
+	buf = nl_popen_readall("dd if=/dev/zero bs=1048576 count=3 2>/dev/null", &size);
+	if(buf == NULL || size != 3 << 20 || buf[size] != 0) {
+		ERROR_OUT("Expected 3MB NUL-terminated read from a pipe, got %zu bytes\n", buf ? size : 0);
+		return -1;
+	}
+	free(buf);
+
+	whole = nl_read_file(input_file);
+	if(whole == NULL) {
+		ERROR_OUT("Error reading %s\n", input_file);
+		return -1;
+	}
+
+	fd = open(input_file, O_RDONLY);
+	if(fd < 0 || lseek(fd, whole->size / 2, SEEK_SET) < 0) {
+		ERRNO_OUT("Error opening and seeking %s", input_file);
+		return -1;
+	}
+
+	data = nl_read_stream(fd);
+	close(fd);
+	if(data == NULL) {
+		ERROR_OUT("Error reading the second half of %s\n", input_file);
+		return -1;
+	}
+	if(data->size != whole->size - whole->size / 2 || data->data[data->size] != 0 ||
+			memcmp(data->data, whole->data + whole->size / 2, data->size)) {
+		ERROR_OUT("Second half of %s does not match (got %zu bytes)\n", input_file, data->size);
+		return -1;
+	}
+
+	nl_destroy_data(data);
+	nl_destroy_data(whole);
+
+	return 0;
+}
+
+// Compares nl_map_file() with nl_read_file() for the given file.
+static int check_map_file(const char *filename)
+{
+	struct nl_raw_data *read, *mapped;
+	int ret = 0;
+
+	read = nl_read_file(filename);
+	mapped = nl_map_file(filename);
+	if(read == NULL || mapped == NULL) {
+		ERROR_OUT("Error reading or mapping %s\n", filename);
+		return -1;
+	}
+
+	if(mapped->size != read->size || memcmp(mapped->data, read->data, read->size)) {
+		ERROR_OUT("Mapped %s does not match (got %zu of %zu bytes)\n", filename, mapped->size, read->size);
+		ret = -1;
+	}
+	if(mapped->data == NULL || mapped->data[mapped->size] != 0) {
+		ERROR_OUT("Mapped %s is not NUL-terminated\n", filename);
+		ret = -1;
+	}
+
+	nl_unmap_data(mapped);
+	nl_destroy_data(read);
+
+	return ret;
+}
+
+// Tests nl_map_file() with regular files of various sizes.
+int test_map_file(char *input_file)
+{
+	char filename[] = "/tmp/stream_test_XXXXXX";
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	char buf[page_size * 2];
+	int ret = 0;
+	int fd;
+
+	INFO_OUT("Testing nl_map_file().\n");
+
+	if(check_map_file(input_file)) {
+		return -1;
+	}
+
+	fd = mkstemp(filename);
+	if(fd < 0) {
+		ERRNO_OUT("Error creating temporary file for nl_map_file() test");
+		return -1;
+	}
+
+	// Empty file (not mappable), then a file ending on a page boundary
+	if(check_map_file(filename)) {
+		ret = -1;
+	}
+
+	memset(buf, 'x', sizeof(buf));
+	if(write(fd, buf, sizeof(buf)) != (ssize_t)sizeof(buf)) {
+		ERRNO_OUT("Error writing temporary file for nl_map_file() test");
+		ret = -1;
+	} else if(check_map_file(filename)) {
+		ret = -1;
+	}
+
+	close(fd);
+	unlink(filename);
+
+	if(nl_map_file("/nonexistent/file") != NULL) {
+		ERROR_OUT("Expected mapping a nonexistent file to fail\n");
+		ret = -1;
+	}
+
+	return ret;
+}
+
+// Checks that the file at fd contains the given data, starting at offset 0.
+static int check_fd_contents(int fd, const struct nl_raw_data *expected)
+{
+	struct nl_raw_data *data;
+	int ret = 0;
+
+	if(lseek(fd, 0, SEEK_SET) != 0 || (data = nl_read_stream(fd)) == NULL) {
+		ERROR_OUT("Error reading back copied data\n");
+		return -1;
+	}
+
+	if(data->size != expected->size || memcmp(data->data, expected->data, data->size)) {
+		ERROR_OUT("Copied data does not match (got %zu of %zu bytes)\n", data->size, expected->size);
+		ret = -1;
+	}
+
+	nl_destroy_data(data);
+
+	return ret;
+}
+
+// Tests nl_copy_fd() and nl_stream_to_fd() with files and pipes.
+int test_copy_fd(char *input_file)
+{
+	char filename[] = "/tmp/stream_test_XXXXXX";
+	struct nl_raw_data *whole;
+	char count[32] = "";
+	int srcfd, destfd, wrfd, rdfd;
+	ssize_t size;
+	FILE *src;
+	pid_t pid;
+	int ret = 0;
+
+	INFO_OUT("Testing nl_copy_fd() and nl_stream_to_fd().\n");
+
+	whole = nl_read_file(input_file);
+	srcfd = open(input_file, O_RDONLY);
+	destfd = mkstemp(filename);
+	if(whole == NULL || srcfd < 0 || destfd < 0) {
+		ERRNO_OUT("Error opening files for copy test");
+		return -1;
+	}
+	unlink(filename);
+
+	// File to file
+	size = nl_copy_fd(srcfd, destfd);
+	if(size != (ssize_t)whole->size || check_fd_contents(destfd, whole)) {
+		ERROR_OUT("File to file copy failed (copied %zd of %zu bytes)\n", size, whole->size);
+		ret = -1;
+	}
+
+	// File to pipe
+	pid = nl_popen3("wc -c", &wrfd, &rdfd, NULL);
+	if(pid < 0 || lseek(srcfd, 0, SEEK_SET) != 0) {
+		ERROR_OUT("Error starting wc for file to pipe copy\n");
+		return -1;
+	}
+	size = nl_copy_fd(srcfd, wrfd);
+	close(wrfd);
+	if(read(rdfd, count, sizeof(count) - 1) <= 0 || strtoll(count, NULL, 10) != (long long)whole->size ||
+			size != (ssize_t)whole->size) {
+		ERROR_OUT("File to pipe copy failed (copied %zd of %zu bytes, wc says %s)\n", size, whole->size, count);
+		ret = -1;
+	}
+	close(rdfd);
+	nl_wait_get_return(pid);
+	close(srcfd);
+
+	// Stream with buffered data, starting partway through the file
+	src = fopen(input_file, "rb");
+	if(src == NULL || fgetc(src) == EOF || fgetc(src) == EOF || ftruncate(destfd, 0) || lseek(destfd, 0, SEEK_SET)) {
+		ERRNO_OUT("Error preparing stream copy test");
+		return -1;
+	}
+
+	size = nl_stream_to_fd(src, destfd);
+	whole->data += 2;
+	whole->size -= 2;
+	if(size != (ssize_t)whole->size || check_fd_contents(destfd, whole) || !feof(src)) {
+		ERROR_OUT("Stream to file copy failed (copied %zd of %zu bytes)\n", size, whole->size);
+		ret = -1;
+	}
+	whole->data -= 2;
+	whole->size += 2;
+
+	fclose(src);
+	close(destfd);
+	nl_destroy_data(whole);
+
+	return ret;
+}
+
 int main(int argc, char *argv[])
 {
 	int fail = 0;
@@ -110,6 +323,18 @@ int main(int argc, char *argv[])
 		fail += 1;
 	}
 
+	if(test_read_stream(argv[0])) {
+		fail += 1;
+	}
+
+	if(test_map_file(argv[0])) {
+		fail += 1;
+	}
+
+	if(test_copy_fd(argv[0])) {
+		fail += 1;
+	}
+
 	// TODO: Test other stream.c functions
 
 	if (fail) {
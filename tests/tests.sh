@@ -18,6 +18,7 @@ FIRMWARE02=''
 FIRMWARE02a=''
 FIRMWARE02b=''
 FIRMWARE02c=''
+FIRMWARE_SPLIT=''
 FIRMWARE_FAIL=''
 
 # Starts a parallel server process, storing its PID in $SERVER_PID.  Waits two
@@ -72,7 +73,7 @@ cleanup()
 	showfails
 
 	[ "$DEBUG" != "1" ] && rm -f "$TMPFILE1" "$TMPFILE2" "$FIRMWARE01" "$FIRMWARE02" "$FIRMWARE02a" "$FIRMWARE02b" \
-		"$FIRMWARE02c" "$FIRMWARE_FAIL"
+		"$FIRMWARE02c" "$FIRMWARE_SPLIT" "$FIRMWARE_FAIL"
 
 	exit $EXITCODE
 }
@@ -211,6 +212,10 @@ runtest true 'String function tests' \
 runtest true 'String escape tests' \
 	./escape_test
 
+headline "Testing SHA-1 functions"
+runtest true 'SHA-1 implementation tests' \
+	./sha1_selftest
+
 headline "Testing file/stream functions"
 runtest true 'Stream function tests' \
 	./stream_test
@@ -219,6 +224,10 @@ runtest true 'Stream function tests' \
 headline "Testing nl_fifo functions"
 runtest true 'FIFO tests' \
 	./fifo_test
+runtest true 'Ring buffer FIFO tests' \
+	./ring_test
+runtest true 'Multi-threaded queue tests' \
+	./queue_test
 
 
 # Test associative array functions
@@ -252,6 +261,8 @@ runtest true 'Variant to string tests' \
 	./variant/to_string_test
 runtest true 'Sized raw data tests' \
 	./variant/data_test
+runtest true 'Variant formatting and parsing tests' \
+	./variant/format_test
 
 
 # Test key-value pair parsing functions
@@ -264,6 +275,10 @@ runtest true 'Key-value pair parsing tests' \
 headline "Testing thread-related functions"
 runtest true 'Thread-related function tests' \
 	./thread_test
+runtest true 'Work-stealing thread pool tests' \
+	./threadpool_test
+runtest true 'Hierarchical timer wheel tests' \
+	./timerwheel_test
 
 
 # Test network-related functions
@@ -295,6 +310,10 @@ FIRMWARE02c=$(mktemp --tmpdir firmware02c.XXXXXX.nlfw)
 VALGRIND=0 runtest true 'Generate version 3 firmware with firmware name and arch' \
 	../tools/mk_firmware.sh firmware/success.sh "$FIRMWARE02c" "$(uname -m)" "Test Firmware"
 
+FIRMWARE_SPLIT=$(mktemp --tmpdir firmware_split.XXXXXX.nlfw)
+VALGRIND=0 runtest true 'Generate version 3 firmware with a gzip member ending at a read boundary' \
+	firmware/mk_split_firmware.sh "$FIRMWARE_SPLIT"
+
 FIRMWARE_FAIL=$(mktemp --tmpdir firmware_fail.XXXXXX.nlfw)
 VALGRIND=0 runtest true 'Generate version 3 firmware that always fails' \
 	../tools/mk_firmware.sh firmware/fail.sh "$FIRMWARE_FAIL" ""
@@ -319,6 +338,9 @@ runtest true 'Extract version 3 firmware with firmware name but no arch' \
 runtest true 'Extract version 3 firmware with firmware name and arch' \
 	../programs/do_firmware $FIRMWARE02c
 
+runtest true 'Extract version 3 firmware with a gzip member ending at a read boundary' \
+	../programs/do_firmware $FIRMWARE_SPLIT
+
 runtest false 'Extract version 3 firmware that is expected to fail' \
 	../programs/do_firmware $FIRMWARE_FAIL
 
@@ -327,6 +349,13 @@ headline "Testing debugging-related functions"
 runtest true 'Debugging-related function tests' \
 	./debug_test
 
+# Test logging functions
+headline "Testing logging functions"
+runtest true 'Synchronous and asynchronous logging tests' \
+	./log_test
+runtest true 'Binary trace logging tests' \
+	./trace_test
+
 # Test terminal-related functions
 headline "Testing terminal-related functions (e.g. color escape parsing)"
 runtest true 'Terminal-related function tests' \
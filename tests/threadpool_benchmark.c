@@ -0,0 +1,144 @@
+/*
+ * Compares task throughput and round-trip latency of nl_threadpool with
+ * starting a thread per task through nl_create_thread().
+ * Copyright (C)2026 Mike Bourgeous.  Released under AGPLv3.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "nlutils.h"
+
+#define THROUGHPUT_TASKS 20000
+#define LATENCY_COUNT 2000
+
+static struct nl_thread_ctx *ctx;
+static struct nl_threadpool *pool;
+static unsigned int workers;
+
+// Spins for the given number of iterations to simulate a small job.
+static void *work(void *data)
+{
+	volatile uintptr_t sum = 0;
+
+	for(uintptr_t i = 0; i < (uintptr_t)data; i++) {
+		sum += i;
+	}
+
+	return NULL;
+}
+
+static int compare_int64(const void *a, const void *b)
+{
+	int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+// Runs THROUGHPUT_TASKS tasks of the given size, returning tasks per second.
+// Thread-per-task runs up to one thread per pool worker at a time.
+static double bench_throughput(uintptr_t spin, int use_pool)
+{
+	struct nl_thread *threads[workers];
+	int64_t start = nl_clock_ns(CLOCK_MONOTONIC);
+
+	if(use_pool) {
+		for(int i = 0; i < THROUGHPUT_TASKS; i++) {
+			if(nl_threadpool_run(pool, work, (void *)spin)) {
+				abort();
+			}
+		}
+		nl_threadpool_wait(pool);
+	} else {
+		for(int i = 0; i < THROUGHPUT_TASKS; i += workers) {
+			for(unsigned int t = 0; t < workers; t++) {
+				if(nl_create_thread(ctx, NULL, work, (void *)spin, NULL, &threads[t])) {
+					abort();
+				}
+			}
+			for(unsigned int t = 0; t < workers; t++) {
+				nl_join_thread(threads[t], NULL);
+			}
+		}
+	}
+
+	return THROUGHPUT_TASKS * 1e9 / (nl_clock_ns(CLOCK_MONOTONIC) - start);
+}
+
+// Measures the time from submitting one empty task to getting its result,
+// storing the median and 99th percentile in microseconds.  If gap_us is
+// nonzero, the workers are given time to go to sleep between tasks.
+static void bench_latency(int use_pool, int gap_us, double *median, double *p99)
+{
+	static int64_t times[LATENCY_COUNT];
+	struct nl_thread *thread;
+
+	for(int i = 0; i < LATENCY_COUNT; i++) {
+		int64_t start = nl_clock_ns(CLOCK_MONOTONIC);
+
+		if(use_pool) {
+			nl_threadpool_task_wait(nl_threadpool_submit(pool, work, NULL));
+		} else {
+			if(nl_create_thread(ctx, NULL, work, NULL, NULL, &thread)) {
+				abort();
+			}
+			nl_join_thread(thread, NULL);
+		}
+
+		times[i] = nl_clock_ns(CLOCK_MONOTONIC) - start;
+
+		if(gap_us) {
+			nl_usleep(gap_us);
+		}
+	}
+
+	qsort(times, LATENCY_COUNT, sizeof(times[0]), compare_int64);
+	*median = times[LATENCY_COUNT / 2] / 1000.0;
+	*p99 = times[LATENCY_COUNT * 99 / 100] / 1000.0;
+}
+
+int main(int argc, char *argv[])
+{
+	static const uintptr_t spins[] = { 0, 1000, 10000, 100000 };
+	double median, p99, pool_median, pool_p99;
+
+	if(argc == 2) {
+		workers = strtoul(argv[1], NULL, 10);
+	} else if(argc > 2) {
+		printf("Usage: %s [workers (default: one per CPU)]\n", argv[0]);
+		return 1;
+	}
+
+	ctx = nl_create_thread_context();
+	pool = nl_threadpool_create(ctx, &(struct nl_threadpool_params){ .workers = workers, .name = "bench" });
+	if(pool == NULL) {
+		ERROR_OUT("Error creating thread pool\n");
+		return -1;
+	}
+	workers = nl_threadpool_workers(pool);
+
+	INFO_OUT("%u workers, %d tasks per throughput test\n", workers, THROUGHPUT_TASKS);
+
+	for(size_t i = 0; i < ARRAY_SIZE(spins); i++) {
+		double per_task = bench_throughput(spins[i], 0);
+		double pooled = bench_throughput(spins[i], 1);
+
+		INFO_OUT("%6zu spins:  thread per task %10.0f tasks/s    nl_threadpool %10.0f tasks/s\n",
+				(size_t)spins[i], per_task, pooled);
+	}
+
+	bench_latency(0, 0, &median, &p99);
+	bench_latency(1, 0, &pool_median, &pool_p99);
+	INFO_OUT("Round trip:        thread per task %6.1f us (p99 %6.1f)    nl_threadpool %6.1f us (p99 %6.1f)\n",
+			median, p99, pool_median, pool_p99);
+
+	bench_latency(0, 1000, &median, &p99);
+	bench_latency(1, 1000, &pool_median, &pool_p99);
+	INFO_OUT("Round trip, idle:  thread per task %6.1f us (p99 %6.1f)    nl_threadpool %6.1f us (p99 %6.1f)\n",
+			median, p99, pool_median, pool_p99);
+
+	nl_destroy_thread_context(ctx);
+
+	return 0;
+}
@@ -0,0 +1,360 @@
+/*
+ * Tests the work-stealing thread pool.
+ * Copyright (C)2026 Mike Bourgeous.  Released under AGPLv3.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "nlutils.h"
+
+#define SUBMITTER_COUNT 4
+#define SUBMITTER_TASKS 20000
+
+static struct nl_threadpool *test_pool;
+static unsigned int counter;
+
+static void *increment(void *data)
+{
+	__atomic_add_fetch(&counter, (uintptr_t)data, __ATOMIC_RELAXED);
+	return NULL;
+}
+
+static void *square(void *data)
+{
+	uintptr_t v = (uintptr_t)data;
+	return (void *)(v * v);
+}
+
+// Computes Fibonacci numbers by recursively submitting and waiting for
+// subtasks from within workers.
+static void *fib(void *data)
+{
+	uintptr_t n = (uintptr_t)data;
+	struct nl_threadpool_task *task;
+	uintptr_t a, b;
+
+	if(n < 2) {
+		return data;
+	}
+
+	task = nl_threadpool_submit(test_pool, fib, (void *)(n - 1));
+	if(task == NULL) {
+		abort();
+	}
+	b = (uintptr_t)fib((void *)(n - 2));
+	a = (uintptr_t)nl_threadpool_task_wait(task);
+
+	return (void *)(a + b);
+}
+
+// Submits many detached tasks from inside a worker, growing its deque.
+static void *spawn_many(void *data)
+{
+	for(uintptr_t i = 0; i < (uintptr_t)data; i++) {
+		if(nl_threadpool_run(test_pool, increment, (void *)1)) {
+			abort();
+		}
+	}
+
+	return NULL;
+}
+
+static void *get_name(void *data)
+{
+	char *name = malloc(16);
+
+	(void)data;
+	if(name == NULL || nl_get_threadname(name)) {
+		abort();
+	}
+
+	return name;
+}
+
+static void *get_cpu(void *data)
+{
+	(void)data;
+	return (void *)(intptr_t)sched_getcpu();
+}
+
+static void *wait_own_pool(void *data)
+{
+	(void)data;
+	return (void *)(intptr_t)nl_threadpool_wait(test_pool);
+}
+
+static void *submitter(void *data)
+{
+	(void)data;
+
+	for(int i = 0; i < SUBMITTER_TASKS; i++) {
+		if(nl_threadpool_run(test_pool, increment, (void *)1)) {
+			abort();
+		}
+	}
+
+	return NULL;
+}
+
+static int test_futures(void)
+{
+	struct nl_threadpool_task *tasks[1000];
+
+	for(uintptr_t i = 0; i < ARRAY_SIZE(tasks); i++) {
+		tasks[i] = nl_threadpool_submit(test_pool, square, (void *)i);
+		if(tasks[i] == NULL) {
+			ERROR_OUT("Error submitting task %zu\n", (size_t)i);
+			return -1;
+		}
+	}
+
+	for(uintptr_t i = 0; i < ARRAY_SIZE(tasks); i++) {
+		uintptr_t result = (uintptr_t)nl_threadpool_task_wait(tasks[i]);
+		if(result != i * i) {
+			ERROR_OUT("Task %zu returned %zu, expected %zu\n", (size_t)i, (size_t)result, (size_t)(i * i));
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int test_detached(void)
+{
+	counter = 0;
+
+	for(int i = 0; i < 100000; i++) {
+		if(nl_threadpool_run(test_pool, increment, (void *)1)) {
+			ERROR_OUT("Error running task %d\n", i);
+			return -1;
+		}
+	}
+
+	if(nl_threadpool_wait(test_pool)) {
+		ERROR_OUT("Error waiting for pool\n");
+		return -1;
+	}
+
+	if(counter != 100000) {
+		ERROR_OUT("Counted %u tasks, expected 100000\n", counter);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int test_nested(void)
+{
+	struct nl_threadpool_task *task;
+	uintptr_t result;
+
+	task = nl_threadpool_submit(test_pool, fib, (void *)20);
+	result = (uintptr_t)nl_threadpool_task_wait(task);
+	if(result != 6765) {
+		ERROR_OUT("fib(20) returned %zu, expected 6765\n", (size_t)result);
+		return -1;
+	}
+
+	// Many more tasks than the initial deque size from a single worker
+	counter = 0;
+	if(nl_threadpool_run(test_pool, spawn_many, (void *)50000) || nl_threadpool_wait(test_pool)) {
+		ERROR_OUT("Error running task spawner\n");
+		return -1;
+	}
+	if(counter != 50000) {
+		ERROR_OUT("Counted %u subtasks, expected 50000\n", counter);
+		return -1;
+	}
+
+	task = nl_threadpool_submit(test_pool, wait_own_pool, NULL);
+	if((intptr_t)nl_threadpool_task_wait(task) != EDEADLK) {
+		ERROR_OUT("A worker waiting for its own pool did not fail with EDEADLK\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int test_submitters(void)
+{
+	pthread_t threads[SUBMITTER_COUNT];
+
+	counter = 0;
+
+	for(int i = 0; i < SUBMITTER_COUNT; i++) {
+		if(pthread_create(&threads[i], NULL, submitter, NULL)) {
+			ERROR_OUT("Error creating submitter thread\n");
+			return -1;
+		}
+	}
+	for(int i = 0; i < SUBMITTER_COUNT; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	if(nl_threadpool_wait(test_pool)) {
+		ERROR_OUT("Error waiting for pool\n");
+		return -1;
+	}
+
+	if(counter != SUBMITTER_COUNT * SUBMITTER_TASKS) {
+		ERROR_OUT("Counted %u tasks, expected %u\n", counter, SUBMITTER_COUNT * SUBMITTER_TASKS);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int test_names(void)
+{
+	struct nl_threadpool_task *task;
+	char *name;
+
+	task = nl_threadpool_submit(test_pool, get_name, NULL);
+	name = nl_threadpool_task_wait(task);
+	if(name == NULL || nl_strstart(name, "tp_test-")) {
+		ERROR_OUT("Worker name was '%s', expected it to start with 'tp_test-'\n", name);
+		free(name);
+		return -1;
+	}
+
+	free(name);
+	return 0;
+}
+
+static int test_affinity(void)
+{
+	struct nl_threadpool_task *task;
+	int cpu;
+
+	for(unsigned int i = 0; i < nl_threadpool_workers(test_pool); i++) {
+		if(nl_threadpool_set_affinity(test_pool, i, 0)) {
+			ERROR_OUT("Error pinning worker %u to CPU 0\n", i);
+			return -1;
+		}
+	}
+
+	for(int i = 0; i < 100; i++) {
+		task = nl_threadpool_submit(test_pool, get_cpu, NULL);
+		cpu = (intptr_t)nl_threadpool_task_wait(task);
+		if(cpu != 0) {
+			ERROR_OUT("Pinned worker ran on CPU %d\n", cpu);
+			return -1;
+		}
+	}
+
+	for(unsigned int i = 0; i < nl_threadpool_workers(test_pool); i++) {
+		if(nl_threadpool_set_affinity(test_pool, i, -1)) {
+			ERROR_OUT("Error unpinning worker %u\n", i);
+			return -1;
+		}
+	}
+
+	if(nl_threadpool_set_affinity(test_pool, nl_threadpool_workers(test_pool), 0) != EINVAL) {
+		ERROR_OUT("Out of range worker did not fail with EINVAL\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+// Leaves a pool with queued work for nl_destroy_thread_context() to finish.
+static int test_context_shutdown(void)
+{
+	struct nl_thread_ctx *ctx = nl_create_thread_context();
+	struct nl_threadpool_task *task;
+	struct nl_threadpool *pool;
+
+	if(ctx == NULL) {
+		ERROR_OUT("Error creating thread context\n");
+		return -1;
+	}
+
+	pool = nl_threadpool_create(ctx, &(struct nl_threadpool_params){ .workers = 3, .cpus = (unsigned int[]){ 0 }, .cpu_count = 1 });
+	if(pool == NULL) {
+		ERROR_OUT("Error creating pinned thread pool\n");
+		return -1;
+	}
+
+	counter = 0;
+	test_pool = pool;
+	for(int i = 0; i < 10000; i++) {
+		if(nl_threadpool_run(pool, increment, (void *)1)) {
+			ERROR_OUT("Error running task %d\n", i);
+			return -1;
+		}
+	}
+	task = nl_threadpool_submit(pool, square, (void *)12);
+
+	nl_destroy_thread_context(ctx);
+
+	if(counter != 10000) {
+		ERROR_OUT("Context shutdown finished %u tasks, expected 10000\n", counter);
+		return -1;
+	}
+	if(!nl_threadpool_task_done(task) || (uintptr_t)nl_threadpool_task_wait(task) != 144) {
+		ERROR_OUT("Task was not finished by context shutdown\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+int main(void)
+{
+	struct nl_thread_ctx *ctx;
+
+	ctx = nl_create_thread_context();
+	if(ctx == NULL) {
+		ERROR_OUT("Error creating thread context\n");
+		return 1;
+	}
+
+	test_pool = nl_threadpool_create(ctx, &(struct nl_threadpool_params){ .workers = 4, .name = "tp_test" });
+	if(test_pool == NULL) {
+		ERROR_OUT("Error creating thread pool\n");
+		return 1;
+	}
+
+	printf("Testing futures\n");
+	if(test_futures()) {
+		return 1;
+	}
+
+	printf("Testing detached tasks\n");
+	if(test_detached()) {
+		return 1;
+	}
+
+	printf("Testing nested tasks\n");
+	if(test_nested()) {
+		return 1;
+	}
+
+	printf("Testing concurrent submitters\n");
+	if(test_submitters()) {
+		return 1;
+	}
+
+	printf("Testing worker names\n");
+	if(test_names()) {
+		return 1;
+	}
+
+	printf("Testing worker affinity\n");
+	if(test_affinity()) {
+		return 1;
+	}
+
+	nl_threadpool_destroy(test_pool);
+	nl_destroy_thread_context(ctx);
+
+	printf("Testing thread context shutdown\n");
+	if(test_context_shutdown()) {
+		return 1;
+	}
+
+	return 0;
+}
@@ -516,6 +516,56 @@ static void explicit_operators(void)
 	}
 }
 
+// Runs tests of int64_t nanosecond conversion and comparison
+static void ns_operators(void)
+{
+	const int64_t ns_list[] = {
+		-1700000000123456789, -3000000001, -2000000000, -1999999999, -1000000001,
+		-1000000000, -999999999, -1, 0, 1, 999999999, 1000000000, 1000000001,
+		2999999999, 1700000000123456789,
+	};
+	char testname[128];
+
+	INFO_OUT("Tests of nanosecond conversions\n");
+	for(size_t i = 0; i < ARRAY_SIZE(ns_list); i++) {
+		struct timespec ts = nl_ns_to_timespec(ns_list[i]);
+
+		snprintf(testname, sizeof(testname), "%"PRId64, ns_list[i]);
+
+		failures += !!check_timetest(nano_to_ts(ns_list[i]), ts, "nl_ns_to_timespec", testname);
+		tests++;
+
+		if(nl_timespec_to_ns(ts) != ns_list[i]) {
+			ERROR_OUT("Expected %"PRId64", got %"PRId64" for nl_timespec_to_ns on %s\n",
+					ns_list[i], nl_timespec_to_ns(ts), testname);
+			failures++;
+		}
+		tests++;
+
+		for(size_t j = 0; j < ARRAY_SIZE(ns_list); j++) {
+			int expected = i < j ? -1 : i > j ? 1 : 0;
+
+			failures += !!check_compare(expected, nl_compare_ns(ns_list[i], ns_list[j]), "nanosecond", testname);
+			tests++;
+		}
+	}
+
+	// Non-normalized timespecs
+	if(nl_timespec_to_ns((struct timespec){ .tv_sec = 1, .tv_nsec = 2000000003 }) != 3000000003 ||
+			nl_timespec_to_ns((struct timespec){ .tv_sec = 0, .tv_nsec = -2000000002 }) != -2000000002 ||
+			nl_timespec_to_ns((struct timespec){ .tv_sec = -1, .tv_nsec = 1500000000 }) != -2500000000) {
+		ERROR_OUT("Incorrect nl_timespec_to_ns result for a non-normalized timespec\n");
+		failures++;
+	}
+	tests++;
+
+	if(nl_timeval_to_ns((struct timeval){ .tv_sec = 1, .tv_usec = 500 }) != 1000500000) {
+		ERROR_OUT("Incorrect nl_timeval_to_ns result\n");
+		failures++;
+	}
+	tests++;
+}
+
 static void conversions(void)
 {
 	double v;
@@ -576,6 +626,7 @@ void operator_tests(void)
 	INFO_OUT("Testing timespec arithmetic, comparison, and conversion operators\n");
 	numeric_operators();
 	explicit_operators();
+	ns_operators();
 	conversions();
 }
 
@@ -605,6 +656,19 @@ void clock_tests(void)
 		failures += 1;
 	}
 
+	int64_t ns_before = nl_timespec_to_ns(now);
+	int64_t ns_now = nl_clock_ns(CLOCK_MONOTONIC);
+	clock_gettime(CLOCK_MONOTONIC, &after);
+	if(ns_now < ns_before || ns_now > nl_timespec_to_ns(after)) {
+		ERROR_OUT("nl_clock_ns() returned a time outside the surrounding clock_gettime() calls\n");
+		failures += 1;
+	}
+
+	if(nl_clock_ns(12345) != INT64_MIN) {
+		ERROR_OUT("nl_clock_ns() did not return INT64_MIN for an invalid clock\n");
+		failures += 1;
+	}
+
 	struct timespec diff = nl_sub_timespec(
 			nl_sub_timespec(now, start),
 			(struct timespec){.tv_sec = 1, .tv_nsec = 678901000}
@@ -0,0 +1,253 @@
+/*
+ * Compares nl_timerwheel with a binary min-heap of deadlines, the usual
+ * alternative for event loop timers, at several numbers of timers.
+ * Copyright (C)2026 Mike Bourgeous.  Released under AGPLv3.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "nlutils.h"
+
+#define TICK_NS 1000000
+#define SPAN_NS (10 * NL_NSEC_PER_SEC) // Deadlines are spread over this time
+
+struct heap_timer {
+	int64_t deadline;
+	size_t index; // Position in the heap, or SIZE_MAX if not scheduled
+};
+
+// An indexed binary min-heap, so timers can be moved and canceled.
+struct timer_heap {
+	struct heap_timer **items;
+	size_t count;
+};
+
+static size_t fired;
+
+static uint32_t rng = 1;
+
+static uint32_t next_random(void)
+{
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return rng;
+}
+
+static void heap_place(struct timer_heap *heap, struct heap_timer *timer, size_t index)
+{
+	heap->items[index] = timer;
+	timer->index = index;
+}
+
+static void heap_sift_up(struct timer_heap *heap, size_t index)
+{
+	struct heap_timer *timer = heap->items[index];
+
+	while(index > 0) {
+		size_t parent = (index - 1) / 2;
+
+		if(heap->items[parent]->deadline <= timer->deadline) {
+			break;
+		}
+
+		heap_place(heap, heap->items[parent], index);
+		index = parent;
+	}
+
+	heap_place(heap, timer, index);
+}
+
+static void heap_sift_down(struct timer_heap *heap, size_t index)
+{
+	struct heap_timer *timer = heap->items[index];
+
+	for(;;) {
+		size_t child = index * 2 + 1;
+
+		if(child >= heap->count) {
+			break;
+		}
+		if(child + 1 < heap->count && heap->items[child + 1]->deadline < heap->items[child]->deadline) {
+			child++;
+		}
+		if(timer->deadline <= heap->items[child]->deadline) {
+			break;
+		}
+
+		heap_place(heap, heap->items[child], index);
+		index = child;
+	}
+
+	heap_place(heap, timer, index);
+}
+
+// Schedules or moves a timer.
+static void heap_schedule(struct timer_heap *heap, struct heap_timer *timer, int64_t deadline)
+{
+	if(timer->index == SIZE_MAX) {
+		timer->deadline = deadline;
+		heap_place(heap, timer, heap->count++);
+		heap_sift_up(heap, timer->index);
+	} else if(deadline < timer->deadline) {
+		timer->deadline = deadline;
+		heap_sift_up(heap, timer->index);
+	} else {
+		timer->deadline = deadline;
+		heap_sift_down(heap, timer->index);
+	}
+}
+
+static void heap_cancel(struct timer_heap *heap, struct heap_timer *timer)
+{
+	size_t index = timer->index;
+	struct heap_timer *last = heap->items[--heap->count];
+
+	timer->index = SIZE_MAX;
+	if(last == timer) {
+		return;
+	}
+
+	heap_place(heap, last, index);
+	if(index > 0 && heap->items[(index - 1) / 2]->deadline > last->deadline) {
+		heap_sift_up(heap, index);
+	} else {
+		heap_sift_down(heap, index);
+	}
+}
+
+// Fires every timer with a deadline at or before now.
+static void heap_advance(struct timer_heap *heap, int64_t now)
+{
+	while(heap->count > 0 && heap->items[0]->deadline <= now) {
+		heap_cancel(heap, heap->items[0]);
+		fired++;
+	}
+}
+
+static void count_timer(struct nl_timer *timer, void *cb_data)
+{
+	(void)timer;
+	(void)cb_data;
+
+	fired++;
+}
+
+// Prints ns per timer for each phase: scheduling, moving every timer to a new
+// deadline, canceling, and scheduling again then advancing a tick at a time
+// until all have fired.
+static void bench_timers(size_t count)
+{
+	struct nl_timerwheel *wheel;
+	struct nl_timer *timers;
+	struct timer_heap heap;
+	struct heap_timer *heap_timers;
+	int64_t *deadlines, *moved;
+	int64_t base, start, now;
+	double w_sched, w_move, w_cancel, w_fire;
+	double h_sched, h_move, h_cancel, h_fire;
+
+	wheel = nl_timerwheel_create(&(struct nl_timerwheel_params){ .tick_ns = TICK_NS });
+	timers = calloc(count, sizeof(timers[0]));
+	heap_timers = calloc(count, sizeof(heap_timers[0]));
+	heap = (struct timer_heap){ .items = calloc(count, sizeof(heap.items[0])) };
+	deadlines = calloc(count, sizeof(deadlines[0]));
+	moved = calloc(count, sizeof(moved[0]));
+	if(wheel == NULL || timers == NULL || heap_timers == NULL || heap.items == NULL ||
+			deadlines == NULL || moved == NULL) {
+		ERROR_OUT("Error allocating %zu timers\n", count);
+		abort();
+	}
+
+	base = nl_clock_ns(CLOCK_MONOTONIC);
+	for(size_t i = 0; i < count; i++) {
+		deadlines[i] = base + (int64_t)(((uint64_t)next_random() << 32 | next_random()) % SPAN_NS);
+		moved[i] = base + (int64_t)(((uint64_t)next_random() << 32 | next_random()) % SPAN_NS);
+		nl_timer_init(&timers[i], count_timer, NULL);
+		heap_timers[i].index = SIZE_MAX;
+	}
+
+	// Timer wheel
+	start = nl_clock_ns(CLOCK_MONOTONIC);
+	for(size_t i = 0; i < count; i++) {
+		nl_timerwheel_schedule(wheel, &timers[i], deadlines[i]);
+	}
+	w_sched = (double)(nl_clock_ns(CLOCK_MONOTONIC) - start) / count;
+
+	start = nl_clock_ns(CLOCK_MONOTONIC);
+	for(size_t i = 0; i < count; i++) {
+		nl_timerwheel_schedule(wheel, &timers[i], moved[i]);
+	}
+	w_move = (double)(nl_clock_ns(CLOCK_MONOTONIC) - start) / count;
+
+	start = nl_clock_ns(CLOCK_MONOTONIC);
+	for(size_t i = 0; i < count; i++) {
+		nl_timerwheel_cancel(wheel, &timers[i]);
+	}
+	w_cancel = (double)(nl_clock_ns(CLOCK_MONOTONIC) - start) / count;
+
+	fired = 0;
+	start = nl_clock_ns(CLOCK_MONOTONIC);
+	for(size_t i = 0; i < count; i++) {
+		nl_timerwheel_schedule(wheel, &timers[i], deadlines[i]);
+	}
+	for(now = base; fired < count; now += TICK_NS) {
+		nl_timerwheel_advance(wheel, now);
+	}
+	w_fire = (double)(nl_clock_ns(CLOCK_MONOTONIC) - start) / count;
+
+	// Binary heap
+	start = nl_clock_ns(CLOCK_MONOTONIC);
+	for(size_t i = 0; i < count; i++) {
+		heap_schedule(&heap, &heap_timers[i], deadlines[i]);
+	}
+	h_sched = (double)(nl_clock_ns(CLOCK_MONOTONIC) - start) / count;
+
+	start = nl_clock_ns(CLOCK_MONOTONIC);
+	for(size_t i = 0; i < count; i++) {
+		heap_schedule(&heap, &heap_timers[i], moved[i]);
+	}
+	h_move = (double)(nl_clock_ns(CLOCK_MONOTONIC) - start) / count;
+
+	start = nl_clock_ns(CLOCK_MONOTONIC);
+	for(size_t i = 0; i < count; i++) {
+		heap_cancel(&heap, &heap_timers[i]);
+	}
+	h_cancel = (double)(nl_clock_ns(CLOCK_MONOTONIC) - start) / count;
+
+	fired = 0;
+	start = nl_clock_ns(CLOCK_MONOTONIC);
+	for(size_t i = 0; i < count; i++) {
+		heap_schedule(&heap, &heap_timers[i], deadlines[i]);
+	}
+	for(now = base; fired < count; now += TICK_NS) {
+		heap_advance(&heap, now);
+	}
+	h_fire = (double)(nl_clock_ns(CLOCK_MONOTONIC) - start) / count;
+
+	INFO_OUT("%zu timers:\n", count);
+	INFO_OUT("  schedule:       nl_timerwheel %8.2f ns/op    heap %8.2f ns/op\n", w_sched, h_sched);
+	INFO_OUT("  reschedule:     nl_timerwheel %8.2f ns/op    heap %8.2f ns/op\n", w_move, h_move);
+	INFO_OUT("  cancel:         nl_timerwheel %8.2f ns/op    heap %8.2f ns/op\n", w_cancel, h_cancel);
+	INFO_OUT("  schedule+fire:  nl_timerwheel %8.2f ns/op    heap %8.2f ns/op\n", w_fire, h_fire);
+
+	free(moved);
+	free(deadlines);
+	free(heap.items);
+	free(heap_timers);
+	free(timers);
+	nl_timerwheel_destroy(wheel);
+}
+
+int main(void)
+{
+	static const size_t counts[] = { 1000, 10000, 100000, 1000000 };
+
+	for(size_t i = 0; i < ARRAY_SIZE(counts); i++) {
+		bench_timers(counts[i]);
+	}
+
+	return 0;
+}
@@ -0,0 +1,565 @@
+/*
+ * Tests the hierarchical timer wheel.
+ * Copyright (C)2026 Mike Bourgeous.  Released under AGPLv3.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
+#include <event.h>
+
+#include "nlutils.h"
+
+#define TICK_NS 1000000
+#define ORDER_TIMERS 20000
+#define SUBMITTER_COUNT 4
+#define SUBMITTER_TIMERS 5000
+
+struct test_timer {
+	struct nl_timer timer;
+	struct nl_timerwheel *wheel;
+	int64_t deadline;
+	unsigned int fired;
+	unsigned int repeat; // Times to reschedule from the callback
+	struct test_timer *cancel; // Timer to cancel from the callback
+};
+
+static int64_t current_now; // Time passed to nl_timerwheel_advance()
+static int64_t previous_now; // Time passed to the previous advance
+static int64_t last_fired_tick;
+static int64_t overdue_before; // Timers due before this fire first, in any order
+static unsigned int fired_count;
+static unsigned int errors;
+
+static uint32_t rng = 1;
+
+static uint32_t next_random(void)
+{
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return rng;
+}
+
+// Returns the deadline rounded up to the start of a tick.
+static int64_t tick_round(int64_t deadline)
+{
+	return (deadline + TICK_NS - 1) / TICK_NS * TICK_NS;
+}
+
+// Checks that a timer fired in the first advance at or after its rounded
+// deadline, and in tick order unless it was overdue when scheduled.
+static void check_timer(struct nl_timer *timer, void *cb_data)
+{
+	struct test_timer *t = cb_data;
+	int64_t rounded = tick_round(t->deadline);
+
+	if(timer != &t->timer) {
+		ERROR_OUT("Timer callback received the wrong timer\n");
+		errors++;
+	}
+
+	if(rounded > current_now || rounded <= previous_now) {
+		ERROR_OUT("Timer with deadline %"PRId64" fired at %"PRId64" (previous advance %"PRId64")\n",
+				t->deadline, current_now, previous_now);
+		errors++;
+	}
+
+	if(rounded >= overdue_before) {
+		if(rounded / TICK_NS < last_fired_tick) {
+			ERROR_OUT("Timer for tick %"PRId64" fired after tick %"PRId64"\n", rounded / TICK_NS, last_fired_tick);
+			errors++;
+		}
+		last_fired_tick = rounded / TICK_NS;
+	}
+
+	if(t->cancel != NULL && nl_timerwheel_cancel(t->wheel, &t->cancel->timer)) {
+		ERROR_OUT("Error canceling a timer from a callback\n");
+		errors++;
+	}
+
+	if(t->repeat) {
+		t->repeat--;
+		t->deadline += 3 * TICK_NS;
+		nl_timerwheel_schedule(t->wheel, &t->timer, t->deadline);
+	}
+
+	t->fired++;
+	fired_count++;
+}
+
+// Advances the wheel to now, recording the time for check_timer().
+static size_t advance(struct nl_timerwheel *wheel, int64_t now)
+{
+	size_t fired;
+
+	previous_now = current_now;
+	current_now = now;
+	fired = nl_timerwheel_advance(wheel, now);
+	last_fired_tick = 0;
+
+	return fired;
+}
+
+// Resets counters and creates a wheel, storing its starting time in start.
+static struct nl_timerwheel *create_wheel(int64_t *start)
+{
+	struct nl_timerwheel *wheel;
+
+	wheel = nl_timerwheel_create(&(struct nl_timerwheel_params){ .tick_ns = TICK_NS });
+	if(wheel == NULL) {
+		ERROR_OUT("Error creating timer wheel\n");
+		return NULL;
+	}
+
+	*start = nl_clock_ns(CLOCK_MONOTONIC);
+	current_now = INT64_MIN;
+	overdue_before = *start;
+	fired_count = 0;
+	errors = 0;
+
+	return wheel;
+}
+
+// Schedules timers at random times (including the past and the distant
+// future) and advances in random steps, checking that each fires on time.
+static int test_order(void)
+{
+	struct test_timer *timers;
+	struct nl_timerwheel *wheel;
+	int64_t start, now, end;
+	int ret = 0;
+
+	wheel = create_wheel(&start);
+	if(wheel == NULL) {
+		return -1;
+	}
+
+	timers = calloc(ORDER_TIMERS, sizeof(timers[0]));
+	if(timers == NULL) {
+		ERRNO_OUT("Error allocating timers");
+		nl_timerwheel_destroy(wheel);
+		return -1;
+	}
+
+	end = start;
+	for(size_t i = 0; i < ORDER_TIMERS; i++) {
+		switch(i % 10) {
+			case 0:
+				// Already due
+				timers[i].deadline = start - (int64_t)(next_random() % 1000) * TICK_NS;
+				break;
+			case 1:
+				// Hours to days away
+				timers[i].deadline = start + (int64_t)(next_random() % 200000) * 1000 * TICK_NS;
+				break;
+			default:
+				// Within 100 seconds, at any nanosecond
+				timers[i].deadline = start + (int64_t)(next_random() % 100000000) * 1000 + next_random() % 1000;
+				break;
+		}
+		end = MAX_NUM(end, timers[i].deadline);
+
+		timers[i].wheel = wheel;
+		nl_timer_init(&timers[i].timer, check_timer, &timers[i]);
+		if(nl_timerwheel_schedule(wheel, &timers[i].timer, timers[i].deadline)) {
+			ERROR_OUT("Error scheduling timer %zu\n", i);
+			ret = -1;
+		}
+	}
+
+	if(nl_timerwheel_count(wheel) != ORDER_TIMERS) {
+		ERROR_OUT("Wheel has %zu timers, expected %d\n", nl_timerwheel_count(wheel), ORDER_TIMERS);
+		ret = -1;
+	}
+
+	for(now = start; now <= end + TICK_NS; ) {
+		int64_t next = nl_timerwheel_next(wheel);
+
+		if(current_now != INT64_MIN && next < current_now - TICK_NS) {
+			ERROR_OUT("Next deadline %"PRId64" is in the past at %"PRId64"\n", next, current_now);
+			ret = -1;
+		}
+
+		// Mix short steps with jumps across many rotations
+		now += next_random() % 4 ? (int64_t)(next_random() % 3000) * 100000 : (int64_t)(next_random() % 100000) * TICK_NS;
+		advance(wheel, now);
+	}
+
+	if(fired_count != ORDER_TIMERS || nl_timerwheel_count(wheel) != 0 || nl_timerwheel_next(wheel) != INT64_MAX) {
+		ERROR_OUT("Fired %u of %d timers, %zu left on the wheel\n", fired_count, ORDER_TIMERS, nl_timerwheel_count(wheel));
+		ret = -1;
+	}
+
+	for(size_t i = 0; i < ORDER_TIMERS && !ret; i++) {
+		if(timers[i].fired != 1 || nl_timer_pending(&timers[i].timer)) {
+			ERROR_OUT("Timer %zu fired %u times\n", i, timers[i].fired);
+			ret = -1;
+		}
+	}
+
+	free(timers);
+	nl_timerwheel_destroy(wheel);
+
+	return ret || errors ? -1 : 0;
+}
+
+// Tests cancellation and rescheduling, including from callbacks.
+static int test_cancel(void)
+{
+	struct test_timer timers[64] = { { .deadline = 0 } };
+	struct nl_timerwheel *wheel;
+	int64_t start;
+	int ret = 0;
+
+	wheel = create_wheel(&start);
+	if(wheel == NULL) {
+		return -1;
+	}
+
+	for(size_t i = 0; i < ARRAY_SIZE(timers); i++) {
+		timers[i].wheel = wheel;
+		timers[i].deadline = start + (int64_t)(i + 1) * 100 * TICK_NS;
+		nl_timer_init(&timers[i].timer, check_timer, &timers[i]);
+		nl_timerwheel_schedule(wheel, &timers[i].timer, timers[i].deadline);
+	}
+
+	// Cancel every fourth timer
+	for(size_t i = 0; i < ARRAY_SIZE(timers); i += 4) {
+		if(nl_timerwheel_cancel(wheel, &timers[i].timer) || nl_timer_pending(&timers[i].timer)) {
+			ERROR_OUT("Error canceling timer %zu\n", i);
+			ret = -1;
+		}
+		if(nl_timerwheel_cancel(wheel, &timers[i].timer) != ENOENT) {
+			ERROR_OUT("Canceling timer %zu twice did not return ENOENT\n", i);
+			ret = -1;
+		}
+	}
+
+	// Move timers 1 and 2 far forward and back to the start
+	timers[1].deadline = start + 100000 * (int64_t)TICK_NS;
+	timers[2].deadline = start + TICK_NS;
+	nl_timerwheel_schedule(wheel, &timers[1].timer, timers[1].deadline);
+	nl_timerwheel_schedule(wheel, &timers[2].timer, timers[2].deadline);
+
+	// Timer 3 cancels timer 5 when it fires; timers 6 and 7 share a tick,
+	// and whichever fires first cancels the other
+	timers[3].cancel = &timers[5];
+	timers[7].deadline = timers[6].deadline;
+	nl_timerwheel_schedule(wheel, &timers[7].timer, timers[7].deadline);
+	timers[6].cancel = &timers[7];
+	timers[7].cancel = &timers[6];
+
+	// Timer 9 reschedules itself ten times
+	timers[9].repeat = 10;
+
+	if(nl_timerwheel_count(wheel) != ARRAY_SIZE(timers) - ARRAY_SIZE(timers) / 4) {
+		ERROR_OUT("Wheel has %zu timers after canceling\n", nl_timerwheel_count(wheel));
+		ret = -1;
+	}
+	if(nl_timerwheel_next(wheel) != tick_round(timers[2].deadline)) {
+		ERROR_OUT("Next deadline is %"PRId64", expected %"PRId64"\n",
+				nl_timerwheel_next(wheel), tick_round(timers[2].deadline));
+		ret = -1;
+	}
+
+	for(int64_t now = start; nl_timerwheel_count(wheel) > 0; now += TICK_NS * 7) {
+		advance(wheel, now);
+	}
+
+	for(size_t i = 0; i < ARRAY_SIZE(timers); i++) {
+		unsigned int expected = 1;
+
+		if(i % 4 == 0 || i == 5) {
+			expected = 0;
+		} else if(i == 9) {
+			expected = 11;
+		}
+
+		if(i == 6 || i == 7) {
+			if(timers[6].fired + timers[7].fired != 1) {
+				ERROR_OUT("Timers 6 and 7 fired %u and %u times; expected one to cancel the other\n",
+						timers[6].fired, timers[7].fired);
+				ret = -1;
+			}
+		} else if(timers[i].fired != expected) {
+			ERROR_OUT("Timer %zu fired %u times, expected %u\n", i, timers[i].fired, expected);
+			ret = -1;
+		}
+	}
+
+	nl_timerwheel_destroy(wheel);
+
+	return ret || errors ? -1 : 0;
+}
+
+// Tests that past deadlines scheduled from a callback wait for the next tick
+// or call.
+static void reschedule_now(struct nl_timer *timer, void *cb_data)
+{
+	struct test_timer *t = cb_data;
+
+	t->fired++;
+	if(t->fired < 5) {
+		nl_timerwheel_schedule(t->wheel, timer, 0);
+	}
+}
+
+static int test_reschedule_past(void)
+{
+	struct test_timer t = { .deadline = 0 };
+	struct nl_timerwheel *wheel;
+	int64_t start;
+	size_t fired;
+
+	wheel = create_wheel(&start);
+	if(wheel == NULL) {
+		return -1;
+	}
+
+	start = tick_round(start);
+	t.wheel = wheel;
+	nl_timer_init(&t.timer, reschedule_now, &t);
+	nl_timerwheel_schedule(wheel, &t.timer, start);
+
+	// The first reschedule waits for the next call, then each lands in
+	// the following tick
+	fired = nl_timerwheel_advance(wheel, start);
+	fired += nl_timerwheel_advance(wheel, start + 2 * TICK_NS);
+	nl_timerwheel_destroy(wheel);
+
+	if(fired != 4 || t.fired != 4) {
+		ERROR_OUT("Timer rescheduled into the past fired %zu/%u times in three ticks, expected 4\n", fired, t.fired);
+		return -1;
+	}
+
+	return 0;
+}
+
+struct submit_info {
+	struct nl_timerwheel *wheel;
+	struct nl_timer *timers;
+	int64_t *deadlines;
+};
+
+static unsigned int submit_fired;
+static unsigned int submit_early;
+
+static void submit_cb(struct nl_timer *timer, void *cb_data)
+{
+	(void)timer;
+
+	if(nl_clock_ns(CLOCK_MONOTONIC) < *(int64_t *)cb_data) {
+		submit_early++;
+	}
+	submit_fired++;
+}
+
+static void *submitter(void *data)
+{
+	struct submit_info *info = data;
+
+	for(int i = 0; i < SUBMITTER_TIMERS; i++) {
+		info->deadlines[i] = nl_clock_ns(CLOCK_MONOTONIC) + (i % 20) * TICK_NS;
+		nl_timer_init(&info->timers[i], submit_cb, &info->deadlines[i]);
+		if(nl_timerwheel_submit(info->wheel, &info->timers[i], info->deadlines[i]) ||
+				nl_timerwheel_submit(info->wheel, &info->timers[i], info->deadlines[i]) != EBUSY) {
+			ERROR_OUT("Error submitting timer, or second submission did not fail\n");
+			abort();
+		}
+	}
+
+	return NULL;
+}
+
+// Submits timers from several threads while the wheel is driven by polling
+// its file descriptor.
+static int test_submit_fd(void)
+{
+	struct submit_info info[SUBMITTER_COUNT];
+	pthread_t threads[SUBMITTER_COUNT];
+	struct nl_timerwheel *wheel;
+	struct pollfd pfd;
+	int64_t start;
+	int ret = 0;
+
+	wheel = create_wheel(&start);
+	if(wheel == NULL) {
+		return -1;
+	}
+
+	submit_fired = 0;
+	submit_early = 0;
+
+	pfd = (struct pollfd){ .fd = nl_timerwheel_fd(wheel), .events = POLLIN };
+	if(pfd.fd < 0) {
+		ERROR_OUT("Error getting timer wheel file descriptor\n");
+		nl_timerwheel_destroy(wheel);
+		return -1;
+	}
+
+	for(int i = 0; i < SUBMITTER_COUNT; i++) {
+		info[i].wheel = wheel;
+		info[i].timers = calloc(SUBMITTER_TIMERS, sizeof(struct nl_timer));
+		info[i].deadlines = calloc(SUBMITTER_TIMERS, sizeof(int64_t));
+		if(info[i].timers == NULL || info[i].deadlines == NULL) {
+			ERRNO_OUT("Error allocating timers");
+			abort();
+		}
+
+		if(pthread_create(&threads[i], NULL, submitter, &info[i])) {
+			ERROR_OUT("Error creating submitter thread\n");
+			abort();
+		}
+	}
+
+	// A lost wakeup would leave poll() waiting for the full timeout
+	while(submit_fired < SUBMITTER_COUNT * SUBMITTER_TIMERS) {
+		int nev = poll(&pfd, 1, 2000);
+
+		if(nev == 0) {
+			ERROR_OUT("Timed out with %u of %d submitted timers fired\n", submit_fired, SUBMITTER_COUNT * SUBMITTER_TIMERS);
+			ret = -1;
+			break;
+		}
+		if(nev < 0) {
+			ERRNO_OUT("Error polling timer wheel");
+			ret = -1;
+			break;
+		}
+
+		nl_timerwheel_run(wheel);
+	}
+
+	for(int i = 0; i < SUBMITTER_COUNT; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	if(submit_early) {
+		ERROR_OUT("%u submitted timers fired early\n", submit_early);
+		ret = -1;
+	}
+
+	// The wheel must be idle before the timers are freed
+	if(nl_timerwheel_count(wheel) != 0) {
+		ERROR_OUT("%zu timers remain after all fired\n", nl_timerwheel_count(wheel));
+		ret = -1;
+	}
+
+	for(int i = 0; i < SUBMITTER_COUNT; i++) {
+		free(info[i].timers);
+		free(info[i].deadlines);
+	}
+	nl_timerwheel_destroy(wheel);
+
+	return ret;
+}
+
+struct event_info {
+	struct event_base *base;
+	struct nl_timerwheel *wheel;
+	int64_t deadlines[3];
+	unsigned int fired;
+	unsigned int early;
+};
+
+static void event_timer_cb(struct nl_timer *timer, void *cb_data)
+{
+	struct event_info *info = cb_data;
+
+	(void)timer;
+
+	if(nl_clock_ns(CLOCK_MONOTONIC) < info->deadlines[info->fired]) {
+		info->early++;
+	}
+
+	if(++info->fired == ARRAY_SIZE(info->deadlines)) {
+		event_base_loopbreak(info->base);
+	}
+}
+
+static void wheel_event_cb(int fd, short events, void *data)
+{
+	(void)fd;
+	(void)events;
+
+	nl_timerwheel_run(data);
+}
+
+// Drives the wheel from a libevent event loop.
+static int test_libevent(void)
+{
+	struct nl_timer timers[3];
+	struct event_info info = { .fired = 0 };
+	struct event ev;
+	int64_t start;
+	int ret = 0;
+
+	info.wheel = create_wheel(&start);
+	if(info.wheel == NULL) {
+		return -1;
+	}
+
+	info.base = event_base_new();
+	if(info.base == NULL) {
+		ERROR_OUT("Error creating event base\n");
+		nl_timerwheel_destroy(info.wheel);
+		return -1;
+	}
+
+	event_set(&ev, nl_timerwheel_fd(info.wheel), EV_READ | EV_PERSIST, wheel_event_cb, info.wheel);
+	if(event_base_set(info.base, &ev) || event_add(&ev, NULL)) {
+		ERROR_OUT("Error adding timer wheel event\n");
+		ret = -1;
+	} else {
+		// Scheduled after the fd is in use, out of order
+		for(size_t i = 0; i < ARRAY_SIZE(timers); i++) {
+			info.deadlines[i] = start + (int64_t)(i + 1) * 10 * TICK_NS;
+			nl_timer_init(&timers[i], event_timer_cb, &info);
+		}
+		nl_timerwheel_schedule(info.wheel, &timers[2], info.deadlines[2]);
+		nl_timerwheel_schedule(info.wheel, &timers[0], info.deadlines[0]);
+		nl_timerwheel_schedule(info.wheel, &timers[1], info.deadlines[1]);
+
+		if(event_base_dispatch(info.base) == -1) {
+			ERROR_OUT("Error running event loop\n");
+			ret = -1;
+		}
+		event_del(&ev);
+	}
+
+	if(info.fired != ARRAY_SIZE(timers) || info.early) {
+		ERROR_OUT("Fired %u timers (%u early) from libevent, expected %zu\n",
+				info.fired, info.early, ARRAY_SIZE(timers));
+		ret = -1;
+	}
+
+	event_base_free(info.base);
+	nl_timerwheel_destroy(info.wheel);
+
+	return ret;
+}
+
+int main(void)
+{
+	int ret = 0;
+
+	printf("Testing timer ordering\n");
+	ret |= test_order();
+
+	printf("Testing timer cancellation and rescheduling\n");
+	ret |= test_cancel();
+
+	printf("Testing rescheduling into the past from a callback\n");
+	ret |= test_reschedule_past();
+
+	printf("Testing submission from other threads with a file descriptor\n");
+	ret |= test_submit_fd();
+
+	printf("Testing libevent integration\n");
+	ret |= test_libevent();
+
+	return !!ret;
+}
@@ -1,50 +1,115 @@
 /*
- * Tests speed of different approaches to adding and subtracting timespecs.
- * Copyright (C)2015 Mike Bourgeous.  Released under AGPLv3 in 2018.
+ * Compares the speed of different approaches to timespec and nanosecond time
+ * arithmetic, comparison, conversion, and clock reads.  The optional argument
+ * sets the seconds spent on each variant (default 1).
+ * Copyright (C)2015-2026 Mike Bourgeous.  Released under AGPLv3 in 2018.
  */
 #include <stdio.h>
+#include <stdlib.h>
 #include <time.h>
 
 #include "nlutils.h"
 
-// Returns integer nanoseconds for the given normalized timespec
-// TODO: Maybe move this method to library or header
-static inline int64_t ts_to_nano(struct timespec ts)
+#define BATCH_SIZE 1000000 // Operations between clock checks
+#define RANDOM_COUNT 4096 // Number of pseudorandom timespecs (a power of two)
+
+// A benchmarked variant, which runs count operations starting at 1 and
+// returns nonzero if a result was wrong.
+struct timespec_bench {
+	const char *group;
+	const char *name;
+	int (*run)(int count);
+};
+
+static volatile struct timespec result;
+static volatile int64_t result_ns;
+static volatile int result_int;
+
+// Pseudorandom normalized timespecs of either sign, and their sums with the
+// next entry, so that signs and carries can't be predicted
+static struct timespec random_ts[RANDOM_COUNT];
+static struct timespec random_sum[RANDOM_COUNT];
+
+
+// The previous loop-based nl_normalize_timespec().
+static inline struct timespec legacy_normalize_timespec(struct timespec ts)
 {
-	return ts.tv_sec * 1000000000 + (ts.tv_sec >= 0 ? ts.tv_nsec : -ts.tv_nsec);
+	ts = nl_timespec_to_pos(ts);
+
+	while(ts.tv_nsec < 0) {
+		ts.tv_sec--;
+		ts.tv_nsec += 1000000000;
+	}
+	while(ts.tv_nsec >= 1000000000) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	}
+
+	return nl_timespec_from_pos(ts);
 }
 
-// Returns a normalized timespec for the given integer nanoseconds
-// TODO: Maybe move this method to library or header
-static inline struct timespec nano_to_ts(int64_t nano)
+// The previous loop-based nl_add_timespec().
+static inline struct timespec legacy_add_timespec(const struct timespec a, const struct timespec b)
 {
-	return (struct timespec){
-		.tv_sec = nano / 1000000000,
-		.tv_nsec = nano > -1000000000 ? nano % 1000000000 : -nano % 1000000000
-	};
+	struct timespec ts;
+	struct timespec a_pos = nl_timespec_to_pos(a), b_pos = nl_timespec_to_pos(b);
+
+	ts.tv_sec = a_pos.tv_sec + b_pos.tv_sec;
+	ts.tv_nsec = a_pos.tv_nsec + b_pos.tv_nsec;
+
+	int sign = ts.tv_nsec < 0 ? -1 : 1;
+	int offs = sign * 1000000000;
+	while(ts.tv_nsec >= 1000000000 || ts.tv_nsec < 0) {
+		ts.tv_sec += sign;
+		ts.tv_nsec -= offs;
+	}
+
+	return nl_timespec_from_pos(ts);
 }
 
+// The previous nl_sub_timespec().
+static inline struct timespec legacy_sub_timespec(const struct timespec a, const struct timespec b)
+{
+	return legacy_add_timespec(a, nl_negate_timespec(b));
+}
 
-static int64_t clock_getnano(void)
+// The previous branching nl_compare_timespec().
+static inline int legacy_compare_timespec(const struct timespec a, const struct timespec b)
 {
-	struct timespec now;
-	clock_gettime(CLOCK_MONOTONIC, &now);
-	return ts_to_nano(now);
+	if(a.tv_sec < b.tv_sec) {
+		return -1;
+	}
+	if(a.tv_sec == b.tv_sec) {
+		if(a.tv_nsec == b.tv_nsec) {
+			return 0;
+		}
+		if(a.tv_sec < 0) {
+			if(a.tv_nsec > b.tv_nsec) {
+				return -1;
+			}
+		} else {
+			if(a.tv_nsec < b.tv_nsec) {
+				return -1;
+			}
+		}
+	}
+
+	return 1;
 }
 
+// Adds positive normalized timespecs in place.
 static inline void add_timespec_unsafe(struct timespec *ts1, const struct timespec *ts2)
 {
 	ts1->tv_sec += ts2->tv_sec;
 	ts1->tv_nsec += ts2->tv_nsec;
 
-	// Since this will rarely exceed 2 billion, it is probably faster to
-	// iteratively subtract than to do a full division and remainder.
 	while(ts1->tv_nsec >= 1000000000) {
 		ts1->tv_sec++;
 		ts1->tv_nsec -= 1000000000;
 	}
 }
 
+// Adds positive normalized timespecs by value.
 static inline struct timespec add_timespec_unsafe_direct(struct timespec ts1, struct timespec ts2)
 {
 	struct timespec ts = {
@@ -60,6 +125,7 @@ static inline struct timespec add_timespec_unsafe_direct(struct timespec ts1, st
 	return ts;
 }
 
+// Subtracts positive normalized timespecs in place, for positive results.
 static inline void sub_timespec_unsafe(struct timespec *ts1, const struct timespec *ts2)
 {
 	ts1->tv_sec -= ts2->tv_sec;
@@ -71,127 +137,347 @@ static inline void sub_timespec_unsafe(struct timespec *ts1, const struct timesp
 	}
 }
 
-static inline struct timespec nano_add(const struct timespec ts1, const struct timespec ts2)
+
+// Addition of i seconds and i nanoseconds
+#define CHECK_ADD(ts, i) ((ts).tv_sec != (i) || (ts).tv_nsec != (i))
+
+static int bench_add_legacy(int count)
 {
-	return nano_to_ts(ts_to_nano(ts1) + ts_to_nano(ts2));
+	for(int i = 1; i < count; i++) {
+		result = legacy_add_timespec((struct timespec){.tv_sec = i}, (struct timespec){.tv_nsec = i});
+		if(CHECK_ADD(result, i)) {
+			return -1;
+		}
+	}
+	return 0;
 }
 
-static inline struct timespec nano_sub(const struct timespec ts1, const struct timespec ts2)
+static int bench_add_nl(int count)
 {
-	return nano_to_ts(ts_to_nano(ts1) - ts_to_nano(ts2));
+	for(int i = 1; i < count; i++) {
+		result = nl_add_timespec((struct timespec){.tv_sec = i}, (struct timespec){.tv_nsec = i});
+		if(CHECK_ADD(result, i)) {
+			return -1;
+		}
+	}
+	return 0;
 }
 
+static int bench_add_unsafe(int count)
+{
+	for(int i = 1; i < count; i++) {
+		result = (struct timespec){.tv_sec = i};
+		add_timespec_unsafe((struct timespec *)&result, &(struct timespec){.tv_nsec = i});
+		if(CHECK_ADD(result, i)) {
+			return -1;
+		}
+	}
+	return 0;
+}
 
-#define TIME_LIMIT 5000000000 // five seconds
+static int bench_add_unsafe_direct(int count)
+{
+	for(int i = 1; i < count; i++) {
+		result = add_timespec_unsafe_direct((struct timespec){.tv_sec = i}, (struct timespec){.tv_nsec = i});
+		if(CHECK_ADD(result, i)) {
+			return -1;
+		}
+	}
+	return 0;
+}
 
-int main(void)
+static int bench_add_ns(int count)
 {
-	volatile struct timespec result;
-	int64_t start;
-	int64_t elapsed;
-	double seconds;
-	size_t iterations;
-	int i;
+	for(int i = 1; i < count; i++) {
+		result_ns = i * NL_NSEC_PER_SEC + i;
+		if(result_ns != i * NL_NSEC_PER_SEC + i) {
+			return -1;
+		}
+	}
+	return 0;
+}
 
-	INFO_OUT("Testing nl_add_timespec\n");
-	for(start = clock_getnano(), iterations = 0, elapsed = 0; elapsed < TIME_LIMIT; elapsed = clock_getnano() - start) {
-		for(i = 1; i < 10000000; i++) {
-			iterations++;
-			result = nl_add_timespec((struct timespec){.tv_sec = i}, (struct timespec){.tv_nsec = i});
-			if(result.tv_sec != i || result.tv_nsec != i) {
-				ERROR_OUT("Result failed\n");
-				return -1;
-			}
+// Negative sum: -(i + 0.5s) + -0.7s = -(i + 1.2s)
+#define CHECK_ADD_NEG(ts, i) ((ts).tv_sec != -(i) - 1 || (ts).tv_nsec != 200000000)
+
+static int bench_add_neg_legacy(int count)
+{
+	for(int i = 1; i < count; i++) {
+		result = legacy_add_timespec((struct timespec){.tv_sec = -i, .tv_nsec = 500000000}, (struct timespec){.tv_nsec = -700000000});
+		if(CHECK_ADD_NEG(result, i)) {
+			return -1;
 		}
 	}
-	seconds = (double)elapsed / 1000000000.0;
-	INFO_OUT("  %zd iterations in %.3lfs: %.3lf per second\n", iterations, seconds, (double)iterations / seconds);
+	return 0;
+}
 
-	INFO_OUT("Testing add_timespec_unsafe\n");
-	for(start = clock_getnano(), iterations = 0, elapsed = 0; elapsed < TIME_LIMIT; elapsed = clock_getnano() - start) {
-		for(i = 1; i < 10000000; i++) {
-			iterations++;
-			result = (struct timespec){.tv_sec = i};
-			add_timespec_unsafe((struct timespec *)&result, &(struct timespec){.tv_nsec = i});
-			if(result.tv_sec != i || result.tv_nsec != i) {
-				ERROR_OUT("Result failed\n");
-				return -1;
-			}
+static int bench_add_neg_nl(int count)
+{
+	for(int i = 1; i < count; i++) {
+		result = nl_add_timespec((struct timespec){.tv_sec = -i, .tv_nsec = 500000000}, (struct timespec){.tv_nsec = -700000000});
+		if(CHECK_ADD_NEG(result, i)) {
+			return -1;
 		}
 	}
-	seconds = (double)elapsed / 1000000000.0;
-	INFO_OUT("  %zd iterations in %.3lfs: %.3lf per second\n", iterations, seconds, (double)iterations / seconds);
+	return 0;
+}
 
-	INFO_OUT("Testing add_timespec_unsafe_direct\n");
-	for(start = clock_getnano(), iterations = 0, elapsed = 0; elapsed < TIME_LIMIT; elapsed = clock_getnano() - start) {
-		for(i = 1; i < 10000000; i++) {
-			iterations++;
-			result = add_timespec_unsafe_direct((struct timespec){.tv_sec = i}, (struct timespec){.tv_nsec = i});
-			if(result.tv_sec != i || result.tv_nsec != i) {
-				ERROR_OUT("Result failed\n");
-				return -1;
-			}
+// Sums of unpredictable pairs
+static int bench_add_random_legacy(int count)
+{
+	for(int i = 1; i < count; i++) {
+		unsigned int idx = i & (RANDOM_COUNT - 1);
+		result = legacy_add_timespec(random_ts[idx], random_ts[(idx + 1) & (RANDOM_COUNT - 1)]);
+		if(result.tv_sec != random_sum[idx].tv_sec || result.tv_nsec != random_sum[idx].tv_nsec) {
+			return -1;
 		}
 	}
-	seconds = (double)elapsed / 1000000000.0;
-	INFO_OUT("  %zd iterations in %.3lfs: %.3lf per second\n", iterations, seconds, (double)iterations / seconds);
+	return 0;
+}
 
-	INFO_OUT("Testing nano_add\n");
-	for(start = clock_getnano(), iterations = 0, elapsed = 0; elapsed < TIME_LIMIT; elapsed = clock_getnano() - start) {
-		for(i = 1; i < 10000000; i++) {
-			iterations++;
-			result = nano_add((struct timespec){.tv_sec = i}, (struct timespec){.tv_nsec = i});
-			if(result.tv_sec != i || result.tv_nsec != i) {
-				ERROR_OUT("Result failed\n");
-				return -1;
-			}
+static int bench_add_random_nl(int count)
+{
+	for(int i = 1; i < count; i++) {
+		unsigned int idx = i & (RANDOM_COUNT - 1);
+		result = nl_add_timespec(random_ts[idx], random_ts[(idx + 1) & (RANDOM_COUNT - 1)]);
+		if(result.tv_sec != random_sum[idx].tv_sec || result.tv_nsec != random_sum[idx].tv_nsec) {
+			return -1;
 		}
 	}
-	seconds = (double)elapsed / 1000000000.0;
-	INFO_OUT("  %zd iterations in %.3lfs: %.3lf per second\n", iterations, seconds, (double)iterations / seconds);
+	return 0;
+}
 
-	INFO_OUT("Testing nl_sub_timespec\n");
-	for(start = clock_getnano(), iterations = 0, elapsed = 0; elapsed < TIME_LIMIT; elapsed = clock_getnano() - start) {
-		for(i = 1; i < 10000000; i++) {
-			iterations++;
-			result = nl_sub_timespec((struct timespec){.tv_sec = i + 1}, (struct timespec){.tv_nsec = i});
-			if(result.tv_sec != i || result.tv_nsec != (1000000000 - i)) {
-				ERROR_OUT("Result %d failed with %ld.%09ld\n", i, result.tv_sec, result.tv_nsec);
-				return -1;
-			}
+// Subtraction of i nanoseconds from i + 1 seconds
+#define CHECK_SUB(ts, i) ((ts).tv_sec != (i) || (ts).tv_nsec != 1000000000 - (i))
+
+static int bench_sub_legacy(int count)
+{
+	for(int i = 1; i < count; i++) {
+		result = legacy_sub_timespec((struct timespec){.tv_sec = i + 1}, (struct timespec){.tv_nsec = i});
+		if(CHECK_SUB(result, i)) {
+			return -1;
 		}
 	}
-	seconds = (double)elapsed / 1000000000.0;
-	INFO_OUT("  %zd iterations in %.3lfs: %.3lf per second\n", iterations, seconds, (double)iterations / seconds);
+	return 0;
+}
 
-	INFO_OUT("Testing sub_timespec_unsafe\n");
-	for(start = clock_getnano(), iterations = 0, elapsed = 0; elapsed < TIME_LIMIT; elapsed = clock_getnano() - start) {
-		for(i = 1; i < 10000000; i++) {
-			iterations++;
-			result = (struct timespec){.tv_sec = i + 1};
-			sub_timespec_unsafe((struct timespec *)&result, &(struct timespec){.tv_nsec = i});
-			if(result.tv_sec != i || result.tv_nsec != (1000000000 - i)) {
-				ERROR_OUT("Result %d failed with %ld.%09ld\n", i, result.tv_sec, result.tv_nsec);
-				return -1;
-			}
+static int bench_sub_nl(int count)
+{
+	for(int i = 1; i < count; i++) {
+		result = nl_sub_timespec((struct timespec){.tv_sec = i + 1}, (struct timespec){.tv_nsec = i});
+		if(CHECK_SUB(result, i)) {
+			return -1;
 		}
 	}
-	seconds = (double)elapsed / 1000000000.0;
-	INFO_OUT("  %zd iterations in %.3lfs: %.3lf per second\n", iterations, seconds, (double)iterations / seconds);
+	return 0;
+}
 
-	INFO_OUT("Testing nano_sub\n");
-	for(start = clock_getnano(), iterations = 0, elapsed = 0; elapsed < TIME_LIMIT; elapsed = clock_getnano() - start) {
-		for(i = 1; i < 10000000; i++) {
-			iterations++;
-			result = nano_sub((struct timespec){.tv_sec = i + 1}, (struct timespec){.tv_nsec = i});
-			if(result.tv_sec != i || result.tv_nsec != (1000000000 - i)) {
-				ERROR_OUT("Result %d failed with %ld.%09ld\n", i, result.tv_sec, result.tv_nsec);
+static int bench_sub_unsafe(int count)
+{
+	for(int i = 1; i < count; i++) {
+		result = (struct timespec){.tv_sec = i + 1};
+		sub_timespec_unsafe((struct timespec *)&result, &(struct timespec){.tv_nsec = i});
+		if(CHECK_SUB(result, i)) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int bench_sub_ns(int count)
+{
+	for(int i = 1; i < count; i++) {
+		result_ns = (i + 1) * NL_NSEC_PER_SEC - i;
+		if(result_ns != i * NL_NSEC_PER_SEC + 1000000000 - i) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+// Normalization of i seconds plus 1.5 billion nanoseconds
+#define CHECK_NORMALIZE(ts, i) ((ts).tv_sec != (i) + 1 || (ts).tv_nsec != 500000000)
+
+static int bench_normalize_legacy(int count)
+{
+	for(int i = 1; i < count; i++) {
+		result = legacy_normalize_timespec((struct timespec){.tv_sec = i, .tv_nsec = 1500000000});
+		if(CHECK_NORMALIZE(result, i)) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int bench_normalize_nl(int count)
+{
+	for(int i = 1; i < count; i++) {
+		result = nl_normalize_timespec((struct timespec){.tv_sec = i, .tv_nsec = 1500000000});
+		if(CHECK_NORMALIZE(result, i)) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+// Comparisons alternating between positive and negative times, with the
+// result changing with i so branches can't all be predicted
+#define COMPARE_A(i) ((struct timespec){.tv_sec = (i) & 2 ? -(i) : (i), .tv_nsec = (i) & 1 ? 5 : 6})
+#define COMPARE_B(i) ((struct timespec){.tv_sec = (i) & 2 ? -(i) : (i), .tv_nsec = 5})
+#define COMPARE_EXPECTED(i) ((i) & 1 ? 0 : (i) & 2 ? -1 : 1)
+
+static int bench_compare_legacy(int count)
+{
+	for(int i = 1; i < count; i++) {
+		result_int = legacy_compare_timespec(COMPARE_A(i), COMPARE_B(i));
+		if(result_int != COMPARE_EXPECTED(i)) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int bench_compare_nl(int count)
+{
+	for(int i = 1; i < count; i++) {
+		result_int = nl_compare_timespec(COMPARE_A(i), COMPARE_B(i));
+		if(result_int != COMPARE_EXPECTED(i)) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int bench_compare_ns(int count)
+{
+	for(int i = 1; i < count; i++) {
+		int64_t a = (i & 2 ? -i : i) * NL_NSEC_PER_SEC + (i & 1 ? 0 : i & 2 ? -1 : 1);
+		result_int = nl_compare_ns(a, (i & 2 ? -i : i) * NL_NSEC_PER_SEC);
+		if(result_int != COMPARE_EXPECTED(i)) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+// Conversions in both directions, with alternating signs
+static int bench_to_ns(int count)
+{
+	for(int i = 1; i < count; i++) {
+		result_ns = nl_timespec_to_ns((struct timespec){.tv_sec = i & 1 ? -i : i, .tv_nsec = i});
+		if(result_ns != (i & 1 ? -(i * NL_NSEC_PER_SEC + i) : i * NL_NSEC_PER_SEC + i)) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int bench_from_ns(int count)
+{
+	for(int i = 1; i < count; i++) {
+		result = nl_ns_to_timespec(i & 1 ? -(i * NL_NSEC_PER_SEC + i) : i * NL_NSEC_PER_SEC + i);
+		if(result.tv_sec != (i & 1 ? -i : i) || result.tv_nsec != i) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+// Clock reads
+static int bench_clock_timespec(int count)
+{
+	struct timespec ts;
+
+	for(int i = 1; i < count; i++) {
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		result = ts;
+	}
+	return 0;
+}
+
+static int bench_clock_ns(int count)
+{
+	int64_t last = 0;
+
+	for(int i = 1; i < count; i++) {
+		result_ns = nl_clock_ns(CLOCK_MONOTONIC);
+		if(result_ns < last) {
+			return -1;
+		}
+		last = result_ns;
+	}
+	return 0;
+}
+
+static const struct timespec_bench benchmarks[] = {
+	{ "add", "legacy nl_add_timespec", bench_add_legacy },
+	{ "add", "nl_add_timespec", bench_add_nl },
+	{ "add", "add_timespec_unsafe", bench_add_unsafe },
+	{ "add", "add_timespec_unsafe_direct", bench_add_unsafe_direct },
+	{ "add", "int64_t nanoseconds", bench_add_ns },
+	{ "add negative", "legacy nl_add_timespec", bench_add_neg_legacy },
+	{ "add negative", "nl_add_timespec", bench_add_neg_nl },
+	{ "add random", "legacy nl_add_timespec", bench_add_random_legacy },
+	{ "add random", "nl_add_timespec", bench_add_random_nl },
+	{ "subtract", "legacy nl_sub_timespec", bench_sub_legacy },
+	{ "subtract", "nl_sub_timespec", bench_sub_nl },
+	{ "subtract", "sub_timespec_unsafe", bench_sub_unsafe },
+	{ "subtract", "int64_t nanoseconds", bench_sub_ns },
+	{ "normalize", "legacy nl_normalize_timespec", bench_normalize_legacy },
+	{ "normalize", "nl_normalize_timespec", bench_normalize_nl },
+	{ "compare", "legacy nl_compare_timespec", bench_compare_legacy },
+	{ "compare", "nl_compare_timespec", bench_compare_nl },
+	{ "compare", "nl_compare_ns", bench_compare_ns },
+	{ "convert", "nl_timespec_to_ns", bench_to_ns },
+	{ "convert", "nl_ns_to_timespec", bench_from_ns },
+	{ "clock", "clock_gettime", bench_clock_timespec },
+	{ "clock", "nl_clock_ns", bench_clock_ns },
+};
+
+int main(int argc, char *argv[])
+{
+	double limit = argc > 1 ? atof(argv[1]) : 1.0;
+	int64_t time_limit = limit * NL_NSEC_PER_SEC;
+	const char *group = "";
+	uint32_t seed = 1;
+
+	// Random values within three seconds of zero; sums use the independent
+	// loop-based implementation
+	for(size_t i = 0; i < RANDOM_COUNT; i++) {
+		int64_t ns;
+
+		seed ^= seed << 13;
+		seed ^= seed >> 17;
+		seed ^= seed << 5;
+
+		ns = (int64_t)(seed % 6000000000u) - 3000000000;
+		random_ts[i] = nl_ns_to_timespec(ns);
+	}
+	for(size_t i = 0; i < RANDOM_COUNT; i++) {
+		random_sum[i] = legacy_add_timespec(random_ts[i], random_ts[(i + 1) % RANDOM_COUNT]);
+	}
+
+	for(size_t b = 0; b < ARRAY_SIZE(benchmarks); b++) {
+		int64_t start, elapsed;
+		size_t iterations;
+
+		if(strcmp(group, benchmarks[b].group)) {
+			group = benchmarks[b].group;
+			INFO_OUT("%s:\n", group);
+		}
+
+		for(start = nl_clock_ns(CLOCK_MONOTONIC), iterations = 0, elapsed = 0; elapsed < time_limit;
+				elapsed = nl_clock_ns(CLOCK_MONOTONIC) - start) {
+			if(benchmarks[b].run(BATCH_SIZE)) {
+				ERROR_OUT("Result failed for %s %s\n", group, benchmarks[b].name);
 				return -1;
 			}
+			iterations += BATCH_SIZE - 1;
 		}
+
+		INFO_OUT("  %-30s %8.3f ns/op %14.0f ops/s\n", benchmarks[b].name,
+				(double)elapsed / iterations, (double)iterations * NL_NSEC_PER_SEC / elapsed);
 	}
-	seconds = (double)elapsed / 1000000000.0;
-	INFO_OUT("  %zd iterations in %.3lfs: %.3lf per second\n", iterations, seconds, (double)iterations / seconds);
 
 	return 0;
 }
@@ -0,0 +1,111 @@
+/*
+ * Measures nanoseconds per message for nl_fptmf() and NL_TRACE(), each with
+ * synchronous and asynchronous logging, with output sent to /dev/null.
+ * Copyright (C)2026 Mike Bourgeous.  Released under AGPLv3.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include "nlutils.h"
+
+#define MESSAGE_COUNT 200000 // Messages per thread
+
+static int trace;
+
+static void *log_thread(void *data)
+{
+	(void)data;
+
+	for(int i = 0; i < MESSAGE_COUNT; i++) {
+		if(trace) {
+			NL_TRACE("Benchmark message %d with a value of %f\n", i, i * 0.5);
+		} else {
+			nl_fptmf(stderr, "Benchmark message %d with a value of %f\n", i, i * 0.5);
+		}
+	}
+
+	return NULL;
+}
+
+// Logs MESSAGE_COUNT messages from each of the given number of threads,
+// returning nanoseconds per message including the time to write them all.
+static double bench_mode(int use_trace, int async, unsigned int threads)
+{
+	struct nl_thread_ctx *ctx;
+	int64_t start;
+
+	trace = use_trace;
+
+	ctx = nl_create_thread_context();
+	if(ctx == NULL) {
+		ERROR_OUT("Error creating thread context\n");
+		exit(1);
+	}
+
+	if(trace && nl_trace_open("/dev/null")) {
+		ERROR_OUT("Error opening trace file\n");
+		exit(1);
+	}
+
+	if(async && nl_log_start_async(&(struct nl_log_params){ .block_usec = 1000000 })) {
+		ERROR_OUT("Error starting asynchronous logging\n");
+		exit(1);
+	}
+
+	start = nl_clock_ns(CLOCK_MONOTONIC);
+
+	for(unsigned int i = 0; i < threads; i++) {
+		if(nl_create_thread(ctx, NULL, log_thread, NULL, "log_bench", NULL)) {
+			ERROR_OUT("Error creating logging thread\n");
+			exit(1);
+		}
+	}
+	nl_destroy_thread_context(ctx);
+
+	if(async) {
+		nl_log_stop_async();
+	}
+	if(trace) {
+		nl_trace_close();
+	}
+	fflush(stderr);
+
+	return (double)(nl_clock_ns(CLOCK_MONOTONIC) - start) / ((double)MESSAGE_COUNT * threads);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int max_threads = argc > 1 ? atoi(argv[1]) : 4;
+	int saved_stderr;
+	int devnull;
+
+	devnull = open("/dev/null", O_WRONLY);
+	if(devnull < 0) {
+		ERRNO_OUT("Error opening /dev/null");
+		return -1;
+	}
+
+	// Log messages go to /dev/null; results go to stdout
+	fflush(stderr);
+	saved_stderr = dup(STDERR_FILENO);
+	dup2(devnull, STDERR_FILENO);
+
+	for(unsigned int threads = 1; threads <= max_threads; threads *= 2) {
+		double text_sync = bench_mode(0, 0, threads);
+		double text_async = bench_mode(0, 1, threads);
+		double trace_sync = bench_mode(1, 0, threads);
+		double trace_async = bench_mode(1, 1, threads);
+
+		INFO_OUT("%u thread(s):  nl_fptmf sync %7.1f ns  async %7.1f ns    NL_TRACE sync %7.1f ns  async %7.1f ns per message\n",
+				threads, text_sync, text_async, trace_sync, trace_async);
+	}
+
+	dup2(saved_stderr, STDERR_FILENO);
+	close(saved_stderr);
+	close(devnull);
+
+	return 0;
+}
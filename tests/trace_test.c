@@ -0,0 +1,280 @@
+/*
+ * Tests binary trace logging and decoding.
+ * Copyright (C)2026 Mike Bourgeous.  Released under AGPLv3.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <regex.h>
+
+#include "nlutils.h"
+
+#define THREAD_COUNT 2
+#define ITERATIONS 200
+
+// Timestamp and thread name prefix written by nl_ptmf() and friends
+#define PREFIX_REGEX "^[0-9]{4}-[0-9]{2}-[0-9]{2} [0-9]{2}:[0-9]{2}:[0-9]{2}\\.[0-9]{6} [+-][0-9]{4} - ([^ ]+) - "
+
+// Traces a message and appends the expected decoded text to the thread's
+// expected output.
+#define TRACE_CASE(...) do { \
+	NL_TRACE(__VA_ARGS__); \
+	fprintf(expected, "%s|", nl_threadname()); \
+	fprintf(expected, __VA_ARGS__); \
+} while(0)
+
+static regex_t prefix_regex;
+static char trace_path[64];
+
+static const char unterminated[4] = { 'w', 'x', 'y', 'z' };
+static const char * volatile null_string = NULL;
+
+// Traces one of each supported and unsupported kind of conversion.
+static void trace_cases(FILE *expected, int iteration)
+{
+	char long_string[1000];
+
+	memset(long_string, 'a' + iteration % 26, sizeof(long_string) - 1);
+	long_string[sizeof(long_string) - 1] = 0;
+
+	TRACE_CASE("iteration %d\n", iteration);
+	TRACE_CASE("int %d unsigned %u hex %#x octal %o char %c\n", -42 - iteration, 42u, 255u, 8u, 'x');
+	TRACE_CASE("short %hd %hhu\n", (short)-5, (unsigned char)200);
+	TRACE_CASE("long %ld %lu llong %lld %llx\n", -1234567890123L * iteration, 5UL, -(1LL << 40), 0xfeedULL);
+	TRACE_CASE("size %zu %zd intmax %jd ptrdiff %td\n", (size_t)12345, (ssize_t)-3, (intmax_t)INT64_MIN, (ptrdiff_t)-77);
+	TRACE_CASE("double %f %.3e %g %a\n", iteration * 0.25, -1e-10, 1e300, 0.5);
+	TRACE_CASE("long double %Lf %.2Lg\n", 1.5L * iteration, 2.25L);
+	TRACE_CASE("pointer %p null %p\n", (void *)long_string, NULL);
+	TRACE_CASE("string '%s' '%-8s|' '%8s|' null %s\n", "hello", "left", "right", null_string);
+	TRACE_CASE("star width '%*d' precision '%.*f' both '%*.*s'\n", 6, iteration, 2, 3.14159, 10, 3, "abcdefgh");
+	TRACE_CASE("string precision '%.*s' '%.*s'\n", 4, unterminated, -1, "negative");
+	TRACE_CASE("percent %% and %d%% then %%%% text\n", 100);
+	TRACE_CASE("no arguments\n");
+	TRACE_CASE("long string %s end\n", long_string);
+	TRACE_CASE("fixed precision '%.3s'\n", "abcdef");
+	TRACE_CASE("positional %2$d %1$d\n", 1, 2);
+	TRACE_CASE("too many %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d\n",
+			1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17);
+	errno = ENOENT;
+	TRACE_CASE("errno %m\n");
+}
+
+// Traces all cases from a thread, renaming it halfway through.
+static void *trace_thread(void *data)
+{
+	FILE *expected = data;
+	char name[16];
+
+	for(int i = 0; i < ITERATIONS; i++) {
+		if(i == ITERATIONS / 2) {
+			snprintf(name, sizeof(name), "%s_b", nl_threadname());
+			nl_set_threadname(name);
+		}
+
+		trace_cases(expected, i);
+	}
+
+	return NULL;
+}
+
+// Decodes the trace file, storing each thread's lines as "name|message" in
+// the thread's output stream.  Returns 0 on success, -1 on error.
+static int decode_trace(FILE **actual)
+{
+	char *text = NULL;
+	size_t size = 0;
+	FILE *in, *out;
+	int ret;
+
+	in = fopen(trace_path, "r");
+	if(in == NULL) {
+		ERRNO_OUT("Error opening trace file %s", trace_path);
+		return -1;
+	}
+
+	out = open_memstream(&text, &size);
+	if(out == NULL) {
+		ERRNO_OUT("Error opening decoder output stream");
+		fclose(in);
+		return -1;
+	}
+
+	ret = nl_trace_decode(in, out);
+	fclose(in);
+	fclose(out);
+
+	if(ret) {
+		ERROR_OUT("Error decoding trace file\n");
+		free(text);
+		return -1;
+	}
+
+	for(char *line = strtok(text, "\n"); line != NULL; line = strtok(NULL, "\n")) {
+		regmatch_t match[2];
+		int id;
+
+		if(regexec(&prefix_regex, line, ARRAY_SIZE(match), match, 0)) {
+			ERROR_OUT("Invalid trace prefix on line '%s'\n", line);
+			ret = -1;
+			break;
+		}
+
+		line[match[1].rm_eo] = 0;
+		if(strncmp(line + match[1].rm_so, "trace_", 6)) {
+			ERROR_OUT("Unexpected thread name %s\n", line + match[1].rm_so);
+			ret = -1;
+			break;
+		}
+
+		id = line[match[1].rm_so + 6] - '0';
+		if(id < 0 || id >= THREAD_COUNT) {
+			ERROR_OUT("Unexpected thread name %s\n", line + match[1].rm_so);
+			ret = -1;
+			break;
+		}
+
+		fprintf(actual[id], "%s|%s\n", line + match[1].rm_so, line + match[0].rm_eo);
+	}
+
+	free(text);
+
+	return ret;
+}
+
+// Traces from THREAD_COUNT threads and compares the decoded trace with
+// snprintf() output.  Returns 0 on success, -1 on error.
+static int test_trace(int async)
+{
+	struct nl_thread_ctx *ctx;
+	FILE *expected[THREAD_COUNT];
+	FILE *actual[THREAD_COUNT];
+	char *expected_text[THREAD_COUNT];
+	char *actual_text[THREAD_COUNT];
+	size_t sizes[THREAD_COUNT * 2];
+	int ret;
+
+	NL_TRACE("traced before the file is opened %d\n", 1);
+
+	ret = nl_trace_open(trace_path);
+	if(ret) {
+		ERROR_OUT("Error %d opening trace file\n", ret);
+		return -1;
+	}
+	if(nl_trace_open(trace_path) != EBUSY) {
+		ERROR_OUT("Opening a second trace file did not fail with EBUSY\n");
+		nl_trace_close();
+		return -1;
+	}
+
+	if(async && nl_log_start_async(&(struct nl_log_params){ .ring_size = 4096, .block_usec = 10000000 })) {
+		ERROR_OUT("Error starting asynchronous logging\n");
+		nl_trace_close();
+		return -1;
+	}
+
+	ctx = nl_create_thread_context();
+	if(ctx == NULL) {
+		ERROR_OUT("Error creating thread context\n");
+		return -1;
+	}
+
+	for(int i = 0; i < THREAD_COUNT; i++) {
+		char name[16];
+
+		expected[i] = open_memstream(&expected_text[i], &sizes[i]);
+		actual[i] = open_memstream(&actual_text[i], &sizes[THREAD_COUNT + i]);
+		if(expected[i] == NULL || actual[i] == NULL) {
+			ERRNO_OUT("Error opening memory stream");
+			return -1;
+		}
+
+		snprintf(name, sizeof(name), "trace_%d", i);
+		nl_create_thread(ctx, NULL, trace_thread, expected[i], name, NULL);
+	}
+	nl_destroy_thread_context(ctx);
+
+	if(async) {
+		nl_log_stop_async();
+	}
+
+	ret = nl_trace_close();
+	if(ret) {
+		ERROR_OUT("Error %d closing trace file\n", ret);
+	}
+
+	NL_TRACE("traced after the file is closed %d\n", 2);
+
+	if(decode_trace(actual)) {
+		ret = -1;
+	}
+
+	for(int i = 0; i < THREAD_COUNT; i++) {
+		fclose(expected[i]);
+		fclose(actual[i]);
+
+		if(!ret && strcmp(expected_text[i], actual_text[i])) {
+			ERROR_OUT("Decoded trace for thread %d does not match\n", i);
+			ERROR_OUT_EX("Expected:\n%s\n", expected_text[i]);
+			ERROR_OUT_EX("Actual:\n%s\n", actual_text[i]);
+			ret = -1;
+		}
+
+		free(expected_text[i]);
+		free(actual_text[i]);
+	}
+
+	return ret;
+}
+
+static int test_invalid_file(void)
+{
+	FILE *f = tmpfile();
+	int ret = 0;
+
+	if(f == NULL) {
+		ERRNO_OUT("Error creating temporary file");
+		return -1;
+	}
+
+	fputs("This is not a trace file.\n", f);
+	rewind(f);
+
+	printf("\tExpecting an error message about an invalid file:\n");
+	fflush(stdout);
+	if(nl_trace_decode(f, stdout) != -1) {
+		ERROR_OUT("Decoding a text file did not fail\n");
+		ret = -1;
+	}
+
+	fclose(f);
+
+	return ret;
+}
+
+int main(void)
+{
+	int ret = 0;
+
+	nl_set_threadname("trace_test");
+
+	if(regcomp(&prefix_regex, PREFIX_REGEX, REG_EXTENDED)) {
+		ERROR_OUT("Error compiling prefix regex\n");
+		return 1;
+	}
+
+	snprintf(trace_path, sizeof(trace_path), "/tmp/nl_trace_test_%d.trace", (int)getpid());
+
+	printf("Testing synchronous tracing\n");
+	ret |= test_trace(0);
+
+	printf("Testing asynchronous tracing\n");
+	ret |= test_trace(1);
+
+	printf("Testing decoding an invalid file\n");
+	ret |= test_invalid_file();
+
+	unlink(trace_path);
+	regfree(&prefix_regex);
+
+	return !!ret;
+}
@@ -26,6 +26,19 @@ server.mount_proc '/delayed' do |req, resp|
 	resp.body = 'Delayed'
 	resp.status = 404 unless req.path =~ %r{\A/delayed/?\z}
 end
+server.mount_proc '/stream' do |req, resp|
+	# A 1MB body of repeating digits for streaming tests
+	resp.body = '0123456789' * 100000
+end
+server.mount_proc '/chunked' do |req, resp|
+	# Like /stream, but without a Content-Length
+	resp.chunked = true
+	resp.body = '0123456789' * 100000
+end
+server.mount_proc '/peer' do |req, resp|
+	# Lets clients check whether consecutive requests used the same connection
+	resp.body = req.peeraddr[1].to_s
+end
 server.mount '/', TestServer
 
 ['INT', 'TERM'].each do |s|
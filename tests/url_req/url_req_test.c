@@ -4,6 +4,9 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
 
 #define u_char uint8_t
 #include <event.h>
@@ -22,6 +25,7 @@ struct url_req_test {
 	unsigned int expect_error:1; // 1 to expect an error in result, 0 to expect success
 	unsigned int expect_timeout:1; // 1 to expect a timeout
 	unsigned int expect_add_error:1; // 1 to expect error adding request
+	unsigned int expect_too_large:1; // 1 to expect a response size limit error
 
 	// Alternating key/value strings, NULL key to end
 	char **headers; // Request headers to convert to form used by nl_url_params
@@ -285,6 +289,44 @@ static struct url_req_test req_tests[] = {
 		},
 	},
 
+	// Response size limit tests
+	{
+		.desc = "Response at size limit",
+		.params = {
+			.method = "POST",
+			.url = BASE_URL "/reverse",
+			.body = { .size = 3, .data = "abc" },
+			.max_response_size = 3,
+		},
+		.expect_body_size = &(size_t){3},
+		.expect_body = (char *[]){
+			"cba",
+			NULL
+		},
+	},
+	{
+		.desc = "Response over size limit with Content-Length",
+		.params = {
+			.url = BASE_URL "/stream",
+			.max_response_size = 1000,
+		},
+		.expect_error = 1,
+		.expect_too_large = 1,
+		.expect_errmsg = "size limit",
+		.expect_body_size = &(size_t){0},
+	},
+	{
+		.desc = "Chunked response over size limit",
+		.params = {
+			.url = BASE_URL "/chunked",
+			.max_response_size = 1000,
+		},
+		.expect_error = 1,
+		.expect_too_large = 1,
+		.expect_errmsg = "size limit",
+		.expect_body_size = &(size_t){0},
+	},
+
 	// Connection problem tests
 	{
 		.desc = "Connection timeout",
@@ -398,6 +440,14 @@ static void test_url_cb(const struct nl_url_result *result, void *data)
 		test->failed = 1;
 	}
 
+	if(test->expect_too_large != result->too_large) {
+		ERROR_OUT("Expected %s size limit error, got %s size limit error on %s\n",
+				test->expect_too_large ? "a" : "no",
+				result->too_large ? "a" : "no",
+				test->desc);
+		test->failed = 1;
+	}
+
 	if(test->expect_code && test->expect_code != result->code) {
 		ERROR_OUT("Expected HTTP code %d, got %d on %s\n",
 				test->expect_code, result->code, test->desc);
@@ -555,7 +605,616 @@ void libevent_log(int severity, const char *msg)
 	}
 }
 
-int main(void)
+// Connection reuse test state (see reuse_cb())
+struct reuse_test {
+	struct nl_url_ctx *ctx;
+	unsigned int count; // Number of responses received
+	char port[2][32]; // Client port reported by the server for each request
+	unsigned int error:1;
+};
+
+// Records the client port from /peer, then sends the second request from the
+// callback so it can reuse the first request's connection.
+static void reuse_cb(const struct nl_url_result *result, void *data)
+{
+	struct reuse_test *t = data;
+
+	if(result->error || result->code != 200 || t->count >= ARRAY_SIZE(t->port) ||
+			strtol(result->response_body.data, NULL, 10) <= 0) {
+		ERROR_OUT("Connection reuse request %u failed: %d %s\n", t->count, result->code, result->errmsg);
+		t->error = 1;
+		return;
+	}
+
+	snprintf(t->port[t->count], sizeof(t->port[t->count]), "%s", result->response_body.data);
+	t->count++;
+
+	if(t->count == 1 && nl_url_req_add(t->ctx, reuse_cb, t, &(struct nl_url_params){ .url = BASE_URL "/peer" })) {
+		ERROR_OUT("Error adding second connection reuse request\n");
+		t->error = 1;
+	}
+}
+
+// Verifies that two sequential requests on a context share one connection.
+// Returns 0 on success, -1 on failure.
+static int test_reuse(const struct nl_url_ctx_params *params)
+{
+	struct reuse_test t = { .count = 0 };
+
+	INFO_OUT("Testing connection reuse.\n");
+
+	if(CHECK_NULL(t.ctx = nl_url_req_init_ex(NULL, params))) {
+		return -1;
+	}
+
+	if(nl_url_req_add(t.ctx, reuse_cb, &t, &(struct nl_url_params){ .url = BASE_URL "/peer" })) {
+		ERROR_OUT("Error adding first connection reuse request\n");
+		nl_url_req_deinit(t.ctx);
+		return -1;
+	}
+
+	nl_url_req_shutdown(t.ctx);
+	nl_url_req_wait(t.ctx);
+	nl_url_req_deinit(t.ctx);
+
+	if(t.error || t.count != 2) {
+		ERROR_OUT("Expected two connection reuse responses, got %u\n", t.count);
+		return -1;
+	}
+
+	if(strcmp(t.port[0], t.port[1])) {
+		ERROR_OUT("Expected both requests to use one connection, got client ports %s and %s\n",
+				t.port[0], t.port[1]);
+		return -1;
+	}
+
+	return 0;
+}
+
+#define STREAM_SIZE 1000000
+
+// Streaming test state (see stream_data_cb())
+struct stream_test {
+	struct nl_url_ctx *ctx;
+	unsigned int abort:1; // Set to 1 to abort from the first chunk
+	unsigned int stall:1; // Set to 1 to pause at the first chunk and never resume
+
+	unsigned int headers_calls; // Number of headers callbacks
+	int headers_code; // HTTP code seen by the headers callback
+	unsigned int chunks; // Number of data callbacks
+	size_t received; // Bytes consumed by the data callback
+	unsigned int bad_data:1; // Set if data was out of order or before headers
+
+	const struct nl_url_result *paused_result; // Set for the main thread to resume
+	int waiting; // Set atomically when the main thread should resume
+
+	unsigned int done:1; // Set by the completion callback
+	unsigned int error:1;
+	unsigned int timeout:1;
+	char errmsg[1024];
+	size_t body_size;
+};
+
+static void stream_headers_cb(const struct nl_url_result *result, void *data)
+{
+	struct stream_test *t = data;
+
+	t->headers_calls++;
+	t->headers_code = result->code;
+}
+
+// Checks the digit pattern from /stream.  The third chunk resumes itself before
+// returning busy, and the fifth waits for the main thread to resume it.
+static int stream_data_cb(const struct nl_url_result *result, const char *chunk, size_t size, void *data)
+{
+	struct stream_test *t = data;
+
+	t->chunks++;
+
+	if(t->headers_calls != 1) {
+		ERROR_OUT("Data callback called before headers callback\n");
+		t->bad_data = 1;
+	}
+
+	if(t->abort) {
+		return NL_URL_STREAM_ABORT;
+	}
+
+	if(t->stall) {
+		return NL_URL_STREAM_BUSY;
+	}
+
+	if(t->chunks == 3) {
+		if(nl_url_req_resume(t->ctx, result)) {
+			ERROR_OUT("Error resuming a stream from its data callback\n");
+			t->bad_data = 1;
+		}
+		return NL_URL_STREAM_BUSY;
+	}
+
+	if(t->chunks == 5) {
+		t->paused_result = result;
+		__atomic_store_n(&t->waiting, 1, __ATOMIC_RELEASE);
+		return NL_URL_STREAM_BUSY;
+	}
+
+	for(size_t i = 0; i < size; i++) {
+		if(chunk[i] != '0' + (char)((t->received + i) % 10)) {
+			ERROR_OUT("Unexpected byte 0x%02x at offset %zu of stream\n", chunk[i], t->received + i);
+			t->bad_data = 1;
+			return NL_URL_STREAM_ABORT;
+		}
+	}
+
+	t->received += size;
+
+	return NL_URL_STREAM_OK;
+}
+
+static void stream_done_cb(const struct nl_url_result *result, void *data)
+{
+	struct stream_test *t = data;
+
+	t->done = 1;
+	t->error = result->error;
+	t->timeout = result->timeout;
+	t->body_size = result->response_body.size;
+	snprintf(t->errmsg, sizeof(t->errmsg), "%s", result->errmsg);
+}
+
+// Runs a streaming request to /stream, resuming it from the main thread when
+// the data callback asks.  Returns 0 on success, -1 on error.
+static int run_stream(const struct nl_url_ctx_params *params, struct stream_test *t)
+{
+	if(CHECK_NULL(t->ctx = nl_url_req_init_ex(NULL, params))) {
+		return -1;
+	}
+
+	if(nl_url_req_add(t->ctx, stream_done_cb, t, &(struct nl_url_params){
+				.url = BASE_URL "/stream",
+				.headers_cb = stream_headers_cb,
+				.data_cb = stream_data_cb,
+				.request_timeout = t->stall ? 1000 : 0,
+				})) {
+		ERROR_OUT("Error adding streaming request\n");
+		nl_url_req_deinit(t->ctx);
+		return -1;
+	}
+
+	if(!t->abort && !t->stall) {
+		for(int i = 0; i < 1000 && !__atomic_load_n(&t->waiting, __ATOMIC_ACQUIRE); i++) {
+			usleep(10000);
+		}
+
+		if(!__atomic_load_n(&t->waiting, __ATOMIC_ACQUIRE)) {
+			ERROR_OUT("Streaming request never waited to be resumed\n");
+		} else {
+			// Give the request time to notice it is paused
+			usleep(100000);
+			if(nl_url_req_resume(t->ctx, t->paused_result)) {
+				ERROR_OUT("Error resuming a stream from the main thread\n");
+				t->bad_data = 1;
+			}
+		}
+	}
+
+	nl_url_req_shutdown(t->ctx);
+	nl_url_req_wait(t->ctx);
+	nl_url_req_deinit(t->ctx);
+
+	return 0;
+}
+
+// Verifies streaming response callbacks, backpressure, and aborting.
+// Returns 0 on success, -1 on failure.
+static int test_streaming(const struct nl_url_ctx_params *params)
+{
+	struct stream_test t = { .abort = 0 };
+	int ret = 0;
+
+	INFO_OUT("Testing streaming responses.\n");
+
+	if(run_stream(params, &t)) {
+		return -1;
+	}
+
+	if(!t.done || t.error || t.bad_data) {
+		ERROR_OUT("Streaming request failed (done=%u, error=%u, bad_data=%u): %s\n",
+				t.done, t.error, t.bad_data, t.errmsg);
+		ret = -1;
+	}
+	if(t.headers_calls != 1 || t.headers_code != 200) {
+		ERROR_OUT("Expected one headers callback with code 200, got %u with code %d\n",
+				t.headers_calls, t.headers_code);
+		ret = -1;
+	}
+	if(t.received != STREAM_SIZE || t.body_size != 0) {
+		ERROR_OUT("Expected %d streamed bytes and an empty stored body, got %zu and %zu\n",
+				STREAM_SIZE, t.received, t.body_size);
+		ret = -1;
+	}
+
+	INFO_OUT("Testing aborting a streaming response.\n");
+
+	t = (struct stream_test){ .abort = 1 };
+	if(run_stream(params, &t)) {
+		return -1;
+	}
+
+	if(!t.done || !t.error || t.chunks != 1 || !strstr(t.errmsg, "aborted")) {
+		ERROR_OUT("Expected an aborted error after one chunk, got done=%u, error=%u, chunks=%u: %s\n",
+				t.done, t.error, t.chunks, t.errmsg);
+		ret = -1;
+	}
+
+	INFO_OUT("Testing the timeout of a paused streaming response.\n");
+
+	t = (struct stream_test){ .stall = 1 };
+	if(run_stream(params, &t)) {
+		return -1;
+	}
+
+	if(!t.done || !t.timeout || t.chunks != 1) {
+		ERROR_OUT("Expected a timeout after one chunk, got done=%u, timeout=%u, chunks=%u: %s\n",
+				t.done, t.timeout, t.chunks, t.errmsg);
+		ret = -1;
+	}
+
+	return ret;
+}
+
+#define BUDGET_SIZE 100000
+
+// Memory budget test state (see budget_cb())
+struct budget_test {
+	struct nl_url_ctx *ctx;
+	unsigned int count; // Number of completed requests
+	unsigned int error:1;
+};
+
+// Expects the first request to exceed the budget, then sends a second request
+// that fits in the budget released by the first.
+static void budget_cb(const struct nl_url_result *result, void *data)
+{
+	struct budget_test *t = data;
+
+	t->count++;
+
+	if(t->count == 1) {
+		if(!result->error || !result->too_large || !strstr(result->errmsg, "memory budget")) {
+			ERROR_OUT("Expected a memory budget error, got %d %s\n", result->code, result->errmsg);
+			t->error = 1;
+			return;
+		}
+
+		if(nl_url_req_add(t->ctx, budget_cb, t, &(struct nl_url_params){
+					.method = "POST",
+					.url = BASE_URL "/reverse",
+					.body = { .size = 3, .data = "abc" },
+					})) {
+			ERROR_OUT("Error adding second memory budget request\n");
+			t->error = 1;
+		}
+	} else if(result->error || result->too_large || strcmp(result->response_body.data, "cba")) {
+		ERROR_OUT("Request after exceeding the memory budget failed: %d %s\n", result->code, result->errmsg);
+		t->error = 1;
+	}
+}
+
+// Verifies that a context's memory budget stops a response that would exceed
+// it, and that the budget is released when the request is freed.  Returns 0 on
+// success, -1 on failure.
+static int test_budget(const struct nl_url_ctx_params *params)
+{
+	struct nl_url_ctx_params budget_params = *params;
+	struct budget_test t = { .count = 0 };
+
+	INFO_OUT("Testing the memory budget.\n");
+
+	budget_params.memory_budget = BUDGET_SIZE;
+	if(CHECK_NULL(t.ctx = nl_url_req_init_ex(NULL, &budget_params))) {
+		return -1;
+	}
+
+	if(nl_url_req_add(t.ctx, budget_cb, &t, &(struct nl_url_params){ .url = BASE_URL "/chunked" })) {
+		ERROR_OUT("Error adding first memory budget request\n");
+		nl_url_req_deinit(t.ctx);
+		return -1;
+	}
+
+	nl_url_req_shutdown(t.ctx);
+	nl_url_req_wait(t.ctx);
+	nl_url_req_deinit(t.ctx);
+
+	if(t.error || t.count != 2) {
+		ERROR_OUT("Expected two memory budget responses, got %u\n", t.count);
+		return -1;
+	}
+
+	return 0;
+}
+
+// Cancellation test state (see cancel_cb())
+struct cancel_test {
+	unsigned int cancelled; // Number of cancelled results
+	unsigned int ok; // Number of successful results
+	unsigned int error:1;
+};
+
+static void cancel_cb(const struct nl_url_result *result, void *data)
+{
+	struct cancel_test *t = data;
+
+	if(result->cancelled) {
+		if(!result->error || strcmp(result->errmsg, "Request cancelled") || result->response_body.size != 0) {
+			ERROR_OUT("Cancelled request to %s had an unexpected result: %s\n", result->url, result->errmsg);
+			t->error = 1;
+		}
+		t->cancelled++;
+	} else if(!result->error && !strcmp(result->response_body.data, "cba")) {
+		t->ok++;
+	} else {
+		ERROR_OUT("Request to %s was not cancelled and failed: %s\n", result->url, result->errmsg);
+		t->error = 1;
+	}
+}
+
+// Verifies that requests can be cancelled by handle and by tag, both before and
+// after they start, without waiting for them to finish.  Returns 0 on success,
+// -1 on failure.
+static int test_cancel(const struct nl_url_ctx_params *params)
+{
+	struct nl_url_params delayed = { .url = BASE_URL "/delayed", .tag = "page" };
+	struct cancel_test t = { .cancelled = 0 };
+	struct nl_url_ctx *ctx;
+	uint64_t handle[2];
+	struct timespec start, end;
+	int ret;
+
+	INFO_OUT("Testing request cancellation.\n");
+
+	if(CHECK_NULL(ctx = nl_url_req_init_ex(NULL, params))) {
+		return -1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	// One untagged request is cancelled before it can start
+	if(nl_url_req_add_ex(ctx, cancel_cb, &t, &(struct nl_url_params){ .url = BASE_URL "/delayed" }, &handle[0]) ||
+			nl_url_req_cancel(ctx, handle[0])) {
+		ERROR_OUT("Error adding and cancelling a request by handle\n");
+		nl_url_req_deinit(ctx);
+		return -1;
+	}
+
+	// Tagged requests are cancelled after they start; the untagged
+	// request is left alone
+	if(nl_url_req_add_ex(ctx, cancel_cb, &t, &delayed, &handle[1]) ||
+			nl_url_req_add(ctx, cancel_cb, &t, &delayed) ||
+			nl_url_req_add(ctx, cancel_cb, &t, &(struct nl_url_params){
+				.method = "POST",
+				.url = BASE_URL "/reverse",
+				.body = { .size = 3, .data = "abc" },
+				})) {
+		ERROR_OUT("Error adding tagged requests\n");
+		nl_url_req_deinit(ctx);
+		return -1;
+	}
+
+	usleep(250000);
+
+	ret = nl_url_req_cancel_tag(ctx, "page");
+	if(ret != 2) {
+		ERROR_OUT("Expected to cancel 2 tagged requests, cancelled %d\n", ret);
+		t.error = 1;
+	}
+
+	nl_url_req_shutdown(ctx);
+	nl_url_req_wait(ctx);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	ret = nl_url_req_cancel(ctx, handle[1]);
+	if(ret != ENOENT) {
+		ERROR_OUT("Expected ENOENT cancelling a finished request, got %d\n", ret);
+		t.error = 1;
+	}
+
+	nl_url_req_deinit(ctx);
+
+	if(t.error || t.cancelled != 3 || t.ok != 1) {
+		ERROR_OUT("Expected 3 cancelled and 1 successful request, got %u cancelled and %u successful\n",
+				t.cancelled, t.ok);
+		return -1;
+	}
+
+	// /delayed takes 2s, so cancelled requests must not have run to completion
+	if(end.tv_sec - start.tv_sec + (end.tv_nsec - start.tv_nsec) * 1e-9 > 1.5) {
+		ERROR_OUT("Cancelled requests were not stopped early\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+// Concurrency limit test state (see limit_cb())
+struct limit_test {
+	char order[8]; // First letters of reversed response bodies, in completion order
+	unsigned int count;
+	unsigned int error:1;
+};
+
+static void limit_cb(const struct nl_url_result *result, void *data)
+{
+	struct limit_test *t = data;
+
+	if(result->error) {
+		ERROR_OUT("Queued request to %s failed: %s\n", result->url, result->errmsg);
+		t->error = 1;
+	}
+
+	// /delayed ends up as 'D' and the /reverse requests as 'H', 'N', or 'L'
+	if(t->count < sizeof(t->order) - 1) {
+		t->order[t->count++] = result->response_body.size ? result->response_body.data[0] : '?';
+	}
+}
+
+// Verifies that a context's max_in_flight limit queues requests by priority,
+// and that queueing statistics are reported.  Returns 0 on success, -1 on
+// failure.
+static int test_limit(const struct nl_url_ctx_params *params)
+{
+	struct nl_url_ctx_params limit_params = *params;
+	struct limit_test t = { .count = 0 };
+	struct nl_url_stats stats;
+	struct nl_url_ctx *ctx;
+	int i;
+
+	INFO_OUT("Testing the concurrency limit and priority queue.\n");
+
+	limit_params.max_in_flight = 1;
+	if(CHECK_NULL(ctx = nl_url_req_init_ex(NULL, &limit_params))) {
+		return -1;
+	}
+
+	// The slot is held by /delayed while the other requests queue up
+	if(nl_url_req_add(ctx, limit_cb, &t, &(struct nl_url_params){ .url = BASE_URL "/delayed" }) ||
+			nl_url_req_add(ctx, limit_cb, &t, &(struct nl_url_params){
+				.method = "POST", .url = BASE_URL "/reverse",
+				.body = { .size = 1, .data = "L" }, .priority = NL_URL_PRIORITY_LOW,
+				}) ||
+			nl_url_req_add(ctx, limit_cb, &t, &(struct nl_url_params){
+				.method = "POST", .url = BASE_URL "/reverse",
+				.body = { .size = 1, .data = "N" },
+				}) ||
+			nl_url_req_add(ctx, limit_cb, &t, &(struct nl_url_params){
+				.method = "POST", .url = BASE_URL "/reverse",
+				.body = { .size = 1, .data = "H" }, .priority = NL_URL_PRIORITY_HIGH,
+				})) {
+		ERROR_OUT("Error adding concurrency limit requests\n");
+		nl_url_req_deinit(ctx);
+		return -1;
+	}
+
+	if(nl_url_req_add(ctx, limit_cb, &t, &(struct nl_url_params){ .url = BASE_URL "/", .priority = 2 }) != EINVAL) {
+		ERROR_OUT("Expected EINVAL for an invalid request priority\n");
+		t.error = 1;
+	}
+
+	// Wait for the event thread to queue the requests
+	for(i = 0; i < 100; i++) {
+		if(nl_url_req_get_stats(ctx, &stats) || stats.queued == 3) {
+			break;
+		}
+		usleep(10000);
+	}
+	if(stats.queued != 3 || stats.in_flight != 1) {
+		ERROR_OUT("Expected 3 queued and 1 running request, got %u queued and %u running\n",
+				stats.queued, stats.in_flight);
+		t.error = 1;
+	}
+
+	nl_url_req_shutdown(ctx);
+	nl_url_req_wait(ctx);
+
+	if(nl_url_req_get_stats(ctx, &stats)) {
+		ERROR_OUT("Error getting final url_req statistics\n");
+		t.error = 1;
+	}
+
+	nl_url_req_deinit(ctx);
+
+	if(t.error || strcmp(t.order, "DHNL")) {
+		ERROR_OUT("Expected requests to finish in order DHNL, got %s\n", t.order);
+		return -1;
+	}
+
+	// Queued requests waited for /delayed's 2 seconds
+	if(stats.in_flight != 0 || stats.queued != 0 || stats.max_queued != 3 || stats.started != 4 ||
+			stats.max_wait_ns < 1000000000 || stats.total_wait_ns < 3 * stats.max_wait_ns / 2) {
+		ERROR_OUT("Unexpected queueing statistics: %u running, %u queued, %u max queued, "
+				"%"PRIu64" started, %"PRIu64"ns total wait, %"PRIu64"ns max wait\n",
+				stats.in_flight, stats.queued, stats.max_queued,
+				stats.started, stats.total_wait_ns, stats.max_wait_ns);
+		return -1;
+	}
+
+	return 0;
+}
+
+// Verifies that curl processes that fail to start while other requests are
+// queued release their slots without being freed twice.  Uses the process
+// backend, with TMPDIR pointing at a missing directory so the option FIFO
+// cannot be created.  Returns 0 on success, -1 on failure.
+static int test_start_failure(void)
+{
+	struct nl_url_ctx_params fail_params = { .backend = NL_URL_BACKEND_PROCESS, .max_in_flight = 1 };
+	struct limit_test t = { .count = 0 };
+	struct nl_url_stats stats;
+	struct nl_url_ctx *ctx;
+	char *old_tmpdir;
+	int ret = 0;
+	int i;
+
+	INFO_OUT("Testing requests that fail to start while others are queued.\n");
+
+	old_tmpdir = getenv("TMPDIR");
+	if(old_tmpdir != NULL && CHECK_NULL(old_tmpdir = strdup(old_tmpdir))) {
+		return -1;
+	}
+
+	if(CHECK_NULL(ctx = nl_url_req_init_ex(NULL, &fail_params))) {
+		free(old_tmpdir);
+		return -1;
+	}
+
+	setenv("TMPDIR", "/nonexistent/url_req_test", 1);
+
+	for(i = 0; i < 3; i++) {
+		if(nl_url_req_add(ctx, limit_cb, &t, &(struct nl_url_params){ .url = BASE_URL "/" })) {
+			ERROR_OUT("Error adding request %d that should fail to start\n", i);
+			ret = -1;
+		}
+	}
+
+	// Each failure starts the next queued request
+	for(i = 0; i < 200; i++) {
+		if(nl_url_req_get_stats(ctx, &stats) || stats.started == 3) {
+			break;
+		}
+		usleep(10000);
+	}
+
+	if(old_tmpdir != NULL) {
+		setenv("TMPDIR", old_tmpdir, 1);
+		free(old_tmpdir);
+	} else {
+		unsetenv("TMPDIR");
+	}
+
+	nl_url_req_shutdown(ctx);
+	nl_url_req_wait(ctx);
+
+	if(nl_url_req_get_stats(ctx, &stats)) {
+		ERROR_OUT("Error getting final url_req statistics\n");
+		ret = -1;
+	}
+
+	nl_url_req_deinit(ctx);
+
+	if(stats.started != 3 || stats.in_flight != 0 || stats.queued != 0) {
+		ERROR_OUT("Expected 3 started and no running or queued requests, got %"PRIu64" started, "
+				"%u running, %u queued\n", stats.started, stats.in_flight, stats.queued);
+		ret = -1;
+	}
+
+	return ret;
+}
+
+// Runs all request tests using the given context parameters, then tests
+// startup and shutdown without requests.  Returns the number of failed tests,
+// or -1 if a context could not be created.
+static int run_tests(const struct nl_url_ctx_params *params)
 {
 	struct nl_url_ctx *ctx[2];
 	struct nl_thread_ctx *threads;
@@ -566,13 +1225,15 @@ int main(void)
 		return -1;
 	}
 
-	// Make sure libevent log messages are displayed
-	INFO_OUT("libevent version: %s\n", event_get_version());
-	event_set_log_callback(libevent_log);
+	for(i = 0; i < ARRAY_SIZE(req_tests); i++) {
+		req_tests[i].passed = 0;
+		req_tests[i].failed = 0;
+		req_tests[i].skipped = 0;
+	}
 
 	// Test with two contexts to verify thread context handling
 	INFO_OUT("Creating two URL request contexts to test thread handling\n");
-	if(CHECK_NULL(ctx[0] = nl_url_req_init(NULL)) || CHECK_NULL(ctx[1] = nl_url_req_init(threads))) {
+	if(CHECK_NULL(ctx[0] = nl_url_req_init_ex(NULL, params)) || CHECK_NULL(ctx[1] = nl_url_req_init_ex(threads, params))) {
 		return -1;
 	}
 
@@ -604,21 +1265,92 @@ int main(void)
 	}
 
 	INFO_OUT("Testing startup and shutdown without adding requests.\n");
-	if(CHECK_NULL(ctx[0] = nl_url_req_init(NULL))) {
+	if(CHECK_NULL(ctx[0] = nl_url_req_init_ex(NULL, params))) {
 		return -1;
 	}
 	nl_url_req_deinit(ctx[0]);
 
 	INFO_OUT("Testing startup, wait, and shutdown without adding requests.\n");
-	if(CHECK_NULL(ctx[0] = nl_url_req_init(NULL))) {
+	if(CHECK_NULL(ctx[0] = nl_url_req_init_ex(NULL, params))) {
 		return -1;
 	}
 	nl_url_req_shutdown(ctx[0]);
 	nl_url_req_wait(ctx[0]);
 	nl_url_req_deinit(ctx[0]);
 
+	return ret;
+}
+
+int main(void)
+{
+	int ret;
+
+	// Make sure libevent log messages are displayed
+	INFO_OUT("libevent version: %s\n", event_get_version());
+	event_set_log_callback(libevent_log);
+
+	INFO_OUT("Testing the curl process backend.\n");
+	ret = run_tests(&(struct nl_url_ctx_params){ .backend = NL_URL_BACKEND_PROCESS });
+	if(ret < 0) {
+		return -1;
+	}
+
+	if(test_streaming(&(struct nl_url_ctx_params){ .backend = NL_URL_BACKEND_PROCESS })) {
+		ret++;
+	}
+
+	if(test_budget(&(struct nl_url_ctx_params){ .backend = NL_URL_BACKEND_PROCESS })) {
+		ret++;
+	}
+
+	if(test_cancel(&(struct nl_url_ctx_params){ .backend = NL_URL_BACKEND_PROCESS })) {
+		ret++;
+	}
+
+	if(test_limit(&(struct nl_url_ctx_params){ .backend = NL_URL_BACKEND_PROCESS })) {
+		ret++;
+	}
+
+	if(test_start_failure()) {
+		ret++;
+	}
+
+	if(nl_url_req_has_backend(NL_URL_BACKEND_LIBCURL)) {
+		struct nl_url_ctx_params curl_params = { .backend = NL_URL_BACKEND_LIBCURL };
+		int curl_ret;
+
+		INFO_OUT("Testing the libcurl backend.\n");
+		curl_ret = run_tests(&curl_params);
+		if(curl_ret < 0) {
+			return -1;
+		}
+		ret += curl_ret;
+
+		if(test_reuse(&curl_params)) {
+			ret++;
+		}
+
+		if(test_streaming(&curl_params)) {
+			ret++;
+		}
+
+		if(test_budget(&curl_params)) {
+			ret++;
+		}
+
+		if(test_cancel(&curl_params)) {
+			ret++;
+		}
+
+		if(test_limit(&curl_params)) {
+			ret++;
+		}
+	} else {
+		INFO_OUT("Skipping libcurl backend tests; nlutils was built without libcurl.\n");
+	}
+
 	if(ret) {
-		ERROR_OUT("%d of %zu url_req tests failed\n", ret, ARRAY_SIZE(req_tests));
+		ERROR_OUT("%d url_req tests failed\n", ret);
 	} else {
 		INFO_OUT("All url_req tests passed.\n");
 	}
@@ -0,0 +1,385 @@
+/*
+ * Tests nl_variant_format_into(), nl_fprint_variant(), and numeric
+ * nl_string_to_varvalue() against the libc functions they must match exactly.
+ * Copyright (C)2026 Mike Bourgeous.  Released under AGPLv3.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <float.h>
+#include <math.h>
+
+#include "nlutils.h"
+
+// Returns a float with the given bit pattern.
+static float bits_to_float(uint32_t bits)
+{
+	float f;
+	memcpy(&f, &bits, sizeof(f));
+	return f;
+}
+
+// Checks every display and serialization path for the given value against
+// the expected display and serialization strings.
+static int check_format(struct nl_variant value, const char *display, const char *serial)
+{
+	size_t display_len = strlen(display);
+	char *buf, *str, *printed;
+	size_t printed_len;
+	FILE *out;
+	int ret;
+
+	buf = malloc(display_len + 1);
+	ret = nl_variant_format_into(buf, display_len + 1, value);
+	if(ret != (int)display_len || strcmp(buf, display)) {
+		ERROR_OUT("nl_variant_format_into() gave '%s' (%d), expected '%s'\n", buf, ret, display);
+		free(buf);
+		return -1;
+	}
+	free(buf);
+
+	str = nl_variant_to_string(value);
+	if(str == NULL || strcmp(str, display)) {
+		ERROR_OUT("nl_variant_to_string() gave '%s', expected '%s'\n", str, display);
+		free(str);
+		return -1;
+	}
+	free(str);
+
+	out = open_memstream(&printed, &printed_len);
+	if(out == NULL) {
+		ERRNO_OUT("Error opening memory stream");
+		return -1;
+	}
+	ret = nl_fprint_variant(out, value);
+	fclose(out);
+	if(ret != (int)strlen(serial) || strcmp(printed, serial)) {
+		ERROR_OUT("nl_fprint_variant() gave '%s' (%d), expected '%s'\n", printed, ret, serial);
+		free(printed);
+		return -1;
+	}
+	free(printed);
+
+	out = open_memstream(&printed, &printed_len);
+	if(out == NULL) {
+		ERRNO_OUT("Error opening memory stream");
+		return -1;
+	}
+	nl_display_variant(out, value);
+	fclose(out);
+	if(strcmp(printed, display)) {
+		ERROR_OUT("nl_display_variant() gave '%s', expected '%s'\n", printed, display);
+		free(printed);
+		return -1;
+	}
+	free(printed);
+
+	return 0;
+}
+
+// Checks formatting of f against the printf() formats used before
+// nl_variant_format_into().
+static int check_float_format(float f)
+{
+	char display[128], serial[128];
+
+	snprintf(display, sizeof(display), "%f", f);
+	if((f < 0.001 && f > -0.001) || f <= -1000 || f >= 1000) {
+		snprintf(serial, sizeof(serial), "%.12e", f);
+	} else {
+		snprintf(serial, sizeof(serial), "%.15f", f);
+	}
+
+	return check_format((struct nl_variant){ .type = FLOAT, .value.floating = f }, display, serial);
+}
+
+static int check_int_format(int i)
+{
+	char expected[32];
+
+	snprintf(expected, sizeof(expected), "%d", i);
+
+	return check_format((struct nl_variant){ .type = INTEGER, .value.integer = i }, expected, expected);
+}
+
+// Checks that nl_string_to_varvalue() parses str as a float exactly like
+// strtof(), including rejecting out-of-range values.
+static int check_float_parse(const char *str)
+{
+	union nl_varvalue result = { .floating = 12345.0f };
+	const char *skipped = str + strspn(str, " \t\v\f");
+	float expected;
+	int ret, expected_ret;
+
+	errno = 0;
+	expected = strtof(skipped, NULL);
+	expected_ret = errno ? -1 : 0;
+
+	ret = nl_string_to_varvalue(FLOAT, str, &result);
+	if(ret != expected_ret) {
+		ERROR_OUT("Parsing '%s' as float returned %d, expected %d\n", str, ret, expected_ret);
+		return -1;
+	}
+	if(ret == 0 && memcmp(&result.floating, &expected, sizeof(expected))) {
+		ERROR_OUT("Parsing '%s' as float gave %a, expected %a\n", str, result.floating, expected);
+		return -1;
+	}
+
+	return 0;
+}
+
+// Checks that nl_string_to_varvalue() parses str as an integer exactly like
+// the strtol() calls it used before its internal parser.
+static int check_int_parse(const char *str)
+{
+	union nl_varvalue result = { .integer = 12345 };
+	const char *skipped = str + strspn(str, " \t\v\f");
+	int expected, ret, expected_ret;
+
+	errno = 0;
+	if(skipped[0] == '0' && skipped[1] == 'x') {
+		expected = strtol(skipped + 2, NULL, 16);
+	} else {
+		expected = strtol(skipped, NULL, 10);
+	}
+	expected_ret = errno ? -1 : 0;
+
+	ret = nl_string_to_varvalue(INTEGER, str, &result);
+	if(ret != expected_ret) {
+		ERROR_OUT("Parsing '%s' as integer returned %d, expected %d\n", str, ret, expected_ret);
+		return -1;
+	}
+	if(ret == 0 && result.integer != expected) {
+		ERROR_OUT("Parsing '%s' as integer gave %d, expected %d\n", str, result.integer, expected);
+		return -1;
+	}
+
+	return 0;
+}
+
+// Parses f formatted in several ways, including its own serialized form.
+static int check_float_round_trip(float f, double d)
+{
+	static const char *formats[] = { "%f", "%.15f", "%.12e", "%.9g", "%.6g", "%.17g", "%.3f", "%.15e", "%.16e" };
+	char buf[128];
+
+	for(size_t i = 0; i < ARRAY_SIZE(formats); i++) {
+		snprintf(buf, sizeof(buf), formats[i], f);
+		if(check_float_parse(buf)) {
+			return -1;
+		}
+
+		snprintf(buf, sizeof(buf), formats[i], d);
+		if(check_float_parse(buf)) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int test_special_formats(void)
+{
+	static const float floats[] = {
+		0.0f, -0.0f, 1.0f, -1.0f, 0.5f, 1.5f, 2.5f, 0.1f, 0.001f, -0.001f,
+		0.0009999f, 999.9999f, 1000.0f, -1000.0f, 1e-5f, 1e-6f, 1e-7f,
+		5e-7f, 4.9999999e-7f, 1e6f, 1e10f, 1.8e13f, 1.9e13f, 1e19f, 1e20f,
+		FLT_MAX, -FLT_MAX, FLT_MIN, -FLT_MIN, FLT_EPSILON, 1.4e-45f,
+		16777216.0f, 16777217.0f, 0.0078125f, 1.0f / 3.0f, 2.0f / 3.0f,
+		3.14159265f, 9.9999999e12f, 9.9999995e-6f,
+		INFINITY, -INFINITY, NAN, -NAN,
+	};
+	static const int ints[] = { 0, 1, -1, 9, 10, 99, 100, 12345, -98765, INT_MAX, INT_MIN, INT_MIN + 1 };
+
+	for(size_t i = 0; i < ARRAY_SIZE(floats); i++) {
+		if(check_float_format(floats[i]) || check_float_round_trip(floats[i], floats[i])) {
+			return -1;
+		}
+	}
+
+	for(size_t i = 0; i < ARRAY_SIZE(ints); i++) {
+		if(check_int_format(ints[i])) {
+			return -1;
+		}
+	}
+
+	// Exact halfway cases for six and fifteen decimal places
+	for(int shift = 5; shift < 30; shift++) {
+		for(int j = -300; j <= 300; j += 1) {
+			if(check_float_format(ldexpf(j, -shift))) {
+				return -1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+static int test_other_formats(void)
+{
+	char buf[64];
+	int ret;
+
+	if(check_format((struct nl_variant){ .type = ANY, .value.any = 0x1234 }, "0x00001234", "0x00001234") ||
+			check_format((struct nl_variant){ .type = ANY, .value.any = 0 }, "0x00000000", "0x00000000") ||
+			check_format((struct nl_variant){ .type = ANY, .value.any = 0x12345678 }, "0x12345678", "0x12345678") ||
+			check_format((struct nl_variant){ .type = STRING, .value.string = "a\tb\\" }, "a\tb\\", "a\\tb\\\\") ||
+			check_format((struct nl_variant){ .type = STRING, .value.string = NULL }, "(null)", "\\0") ||
+			check_format((struct nl_variant){ .type = DATA, .value.data = NULL }, "[NULL raw data]", "[NULL raw data]") ||
+			check_format((struct nl_variant){ .type = DATA, .value.data = &(struct nl_raw_data){ .size = 4294967295u } },
+				"[NULL raw data of length 4294967295]",
+				"[NULL raw data of length 4294967295]") ||
+			check_format((struct nl_variant){ .type = DATA, .value.data = &(struct nl_raw_data){ .size = 0, .data = "" } },
+				"[Raw data of length 0]", "[Raw data of length 0]") ||
+			check_format((struct nl_variant){ .type = INVALID }, "Unknown type -1", "Unknown type -1")) {
+		return -1;
+	}
+
+	// Long strings go through the heap when escaped
+	char *long_str = malloc(1001);
+	char *long_escaped = malloc(2001);
+	for(int i = 0; i < 1000; i++) {
+		long_str[i] = "a\n"[i % 2];
+	}
+	long_str[1000] = 0;
+	size_t len = nl_escape_table_into(nl_escape_string_table(), long_str, 1000, long_escaped, 2000);
+	long_escaped[len] = 0;
+	ret = check_format((struct nl_variant){ .type = STRING, .value.string = long_str }, long_str, long_escaped);
+	free(long_str);
+	free(long_escaped);
+	if(ret) {
+		return -1;
+	}
+
+	// Truncation follows snprintf()
+	ret = nl_variant_format_into(buf, 5, (struct nl_variant){ .type = INTEGER, .value.integer = -123456 });
+	if(ret != 7 || strcmp(buf, "-123")) {
+		ERROR_OUT("Truncated integer formatting gave '%s' (%d)\n", buf, ret);
+		return -1;
+	}
+	ret = nl_variant_format_into(buf, 3, (struct nl_variant){ .type = STRING, .value.string = "Hello" });
+	if(ret != 5 || strcmp(buf, "He")) {
+		ERROR_OUT("Truncated string formatting gave '%s' (%d)\n", buf, ret);
+		return -1;
+	}
+	ret = nl_variant_format_into(NULL, 0, (struct nl_variant){ .type = FLOAT, .value.floating = 1.0f });
+	if(ret != 8) {
+		ERROR_OUT("Measuring float formatting gave %d\n", ret);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int test_special_parses(void)
+{
+	static const char *floats[] = {
+		"0", "-0", "+0", "0.0", "-0.0e10", "0e99999", "1", "-1", "+1.5", ".5", "5.", ".", "-", "",
+		"abc", "1e", "1e+", "1e-", "1ex", "1.5e3", "1.5E-3", "  \t42.25", "\n42",
+		"0x1p3", "0X10", "-0x1.8p1", "inf", "-Infinity", "nan", "NAN(123)",
+		"1e38", "3.4028235e38", "3.4028236e38", "3.5e38", "1e39", "-1e39",
+		"1.17549435e-38", "1.1754942e-38", "1e-45", "1e-46", "1e-50",
+		"16777217", "16777217.0", "33554435", "9007199254740993", "9007199254740992e-10",
+		"0.1", "0.2", "0.3", "0.30000001192092896", "1e22", "1e23", "1e-22", "1e-23",
+		"12345678901234567890", "1234567890123456789", "0.000000000000000000000000000001",
+		"1e0000000000000000000000000000001", "1e-100000000000", "0.0000000000000000000000000000001e31",
+		"3.141592741012573", "1.234567890123e+05", "1.000000000000e-03", "-9.999999747379e-04",
+		"7.038531e-26", "8.589973e9", "1.00000005960464477539062500", "1.000000059604644775390625",
+	};
+	static const char *ints[] = {
+		"0", "-0", "+0", "1", "-1", "+17", "007", "0x", "0x0", "0x1f", "0xFF", "0xffffffff", "0x7fffffff",
+		"0x80000000", "0x0x10", "0x-5", "0x+5", "0x 5", "0xg", "0xfffffffffffffff", "0x7fffffffffffffff",
+		"0x8000000000000000", "0x123456789abcdef01",
+		"2147483647", "2147483648", "-2147483648", "-2147483649", "4294967296",
+		"999999999999999999", "9223372036854775807", "9223372036854775808",
+		"-9223372036854775808", "-9223372036854775809", "99999999999999999999999",
+		"000000000000000000000000000001", "-", "+", "-+5", "+-5", "--5", "12abc", " \t\v\f42", "1e5", "0X10",
+	};
+
+	for(size_t i = 0; i < ARRAY_SIZE(floats); i++) {
+		if(check_float_parse(floats[i])) {
+			return -1;
+		}
+	}
+
+	for(size_t i = 0; i < ARRAY_SIZE(ints); i++) {
+		if(check_int_parse(ints[i])) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int test_random(void)
+{
+	char buf[64];
+
+	srand(2026);
+
+	// A stride through every float bit pattern, plus random patterns
+	for(uint64_t bits = 0; bits <= UINT32_MAX; bits += 9973) {
+		if(check_float_format(bits_to_float(bits))) {
+			return -1;
+		}
+	}
+
+	for(int i = 0; i < 200000; i++) {
+		uint32_t bits = (uint32_t)rand() << 16 ^ (uint32_t)rand();
+		float f = bits_to_float(bits);
+		double d = ldexp((double)rand() / RAND_MAX, rand() % 100 - 50);
+		double halfway = ((double)f + nextafterf(f, INFINITY)) / 2;
+
+		if(check_float_format(f) || check_float_round_trip(f, d) || check_float_round_trip(f, halfway)) {
+			return -1;
+		}
+
+		int v = (int)((uint32_t)rand() << 16 ^ (uint32_t)rand()) >> (rand() % 32);
+		if(check_int_format(v)) {
+			return -1;
+		}
+
+		snprintf(buf, sizeof(buf), "%d", v);
+		if(check_int_parse(buf)) {
+			return -1;
+		}
+
+		snprintf(buf, sizeof(buf), "0x%x", (unsigned int)v);
+		if(check_int_parse(buf)) {
+			return -1;
+		}
+
+		snprintf(buf, sizeof(buf), "%lld", (long long)v * rand() * rand());
+		if(check_int_parse(buf)) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int main(void)
+{
+	printf("Checking special value formatting\n");
+	if(test_special_formats()) {
+		return 1;
+	}
+
+	printf("Checking other type formatting\n");
+	if(test_other_formats()) {
+		return 1;
+	}
+
+	printf("Checking special value parsing\n");
+	if(test_special_parses()) {
+		return 1;
+	}
+
+	printf("Checking random values\n");
+	if(test_random()) {
+		return 1;
+	}
+
+	return 0;
+}
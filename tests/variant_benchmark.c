@@ -0,0 +1,218 @@
+/*
+ * Measures nanoseconds per value for variant formatting and numeric parsing,
+ * compared with the snprintf(), strtol(), and strtof() calls used before
+ * nl_variant_format_into() and the internal number parsers.
+ * Copyright (C)2026 Mike Bourgeous.  Released under AGPLv3.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "nlutils.h"
+
+#define TIME_LIMIT 200000000 // 0.2 seconds per test
+#define VALUE_COUNT 4096
+
+enum bench_op {
+	FORMAT_LEGACY,
+	FORMAT_INTO,
+	TO_STRING_LEGACY,
+	TO_STRING,
+	FPRINT_LEGACY,
+	FPRINT,
+	PARSE_LEGACY,
+	PARSE,
+};
+
+static struct nl_variant values[VALUE_COUNT];
+static char *strings[VALUE_COUNT];
+static FILE *devnull;
+
+// The previous display formatting of numeric values.
+static int legacy_format(char *buf, size_t len, struct nl_variant value)
+{
+	if(value.type == INTEGER) {
+		return snprintf(buf, len, "%d", value.value.integer);
+	}
+	return snprintf(buf, len, "%f", value.value.floating);
+}
+
+// The previous nl_variant_to_string(): measure, allocate, then format again.
+static char *legacy_to_string(struct nl_variant value)
+{
+	int length = legacy_format(NULL, 0, value) + 1;
+	char *buf = malloc(length);
+
+	if(buf != NULL) {
+		legacy_format(buf, length, value);
+	}
+
+	return buf;
+}
+
+// The previous nl_fprint_variant() for numeric values.
+static int legacy_fprint(FILE *output, struct nl_variant value)
+{
+	float f = value.value.floating;
+
+	if(value.type == INTEGER) {
+		return fprintf(output, "%d", value.value.integer);
+	}
+	if((f < 0.001 && f > -0.001) || f <= -1000 || f >= 1000) {
+		return fprintf(output, "%.12e", f);
+	}
+	return fprintf(output, "%.15f", f);
+}
+
+// The previous numeric nl_string_to_varvalue() conversion.
+static union nl_varvalue legacy_parse(enum nl_vartype type, const char *str)
+{
+	union nl_varvalue result;
+
+	if(type == INTEGER) {
+		result.integer = strtol(str, NULL, 10);
+	} else {
+		result.floating = strtof(str, NULL);
+	}
+
+	return result;
+}
+
+// Runs op over every value of the given type for TIME_LIMIT, returning
+// nanoseconds per value.
+static double bench_op(enum nl_vartype type, enum bench_op op)
+{
+	int64_t start = nl_clock_ns(CLOCK_MONOTONIC), elapsed;
+	size_t iterations = 0;
+	size_t sum = 0;
+	char buf[64];
+
+	do {
+		for(size_t i = 0; i < VALUE_COUNT; i++) {
+			struct nl_variant value = values[i];
+			union nl_varvalue parsed;
+			char *str;
+
+			value.type = type;
+
+			switch(op) {
+				case FORMAT_LEGACY:
+					sum += legacy_format(buf, sizeof(buf), value);
+					break;
+
+				case FORMAT_INTO:
+					sum += nl_variant_format_into(buf, sizeof(buf), value);
+					break;
+
+				case TO_STRING_LEGACY:
+				case TO_STRING:
+					str = op == TO_STRING ? nl_variant_to_string(value) : legacy_to_string(value);
+					sum += str[0];
+					free(str);
+					break;
+
+				case FPRINT_LEGACY:
+					sum += legacy_fprint(devnull, value);
+					break;
+
+				case FPRINT:
+					sum += nl_fprint_variant(devnull, value);
+					break;
+
+				case PARSE_LEGACY:
+					parsed = legacy_parse(type, strings[i]);
+					sum += parsed.integer;
+					break;
+
+				case PARSE:
+					nl_string_to_varvalue(type, strings[i], &parsed);
+					sum += parsed.integer;
+					break;
+			}
+		}
+
+		iterations++;
+		elapsed = nl_clock_ns(CLOCK_MONOTONIC) - start;
+	} while(elapsed < TIME_LIMIT);
+
+	DEBUG_OUT("Checksum %zu\n", sum);
+
+	return (double)elapsed / (iterations * VALUE_COUNT);
+}
+
+// Fills the value and string tables with random values of the given type.
+// Floats span several orders of magnitude around 1, like typical state.
+static void fill_values(enum nl_vartype type, int serialized)
+{
+	char buf[64];
+
+	for(size_t i = 0; i < VALUE_COUNT; i++) {
+		if(type == INTEGER) {
+			values[i].value.integer = (int)((unsigned int)rand() << 16 ^ rand()) >> (rand() % 32);
+		} else {
+			values[i].value.floating = (rand() - RAND_MAX / 2) / (float)(1 << (rand() % 24)) * 1e-3f;
+		}
+
+		values[i].type = type;
+		if(serialized) {
+			FILE *out = fmemopen(buf, sizeof(buf), "w");
+			nl_fprint_variant(out, values[i]);
+			fclose(out);
+		} else {
+			nl_variant_format_into(buf, sizeof(buf), values[i]);
+		}
+
+		free(strings[i]);
+		strings[i] = strdup(buf);
+	}
+}
+
+static void print_result(enum nl_vartype type, const char *label, const char *legacy_name, enum bench_op legacy_op,
+		const char *name, enum bench_op op)
+{
+	double legacy_ns = bench_op(type, legacy_op);
+	double ns = bench_op(type, op);
+
+	INFO_OUT("%-5s %-15s %-8s %7.1f ns    %-22s %7.1f ns\n",
+			NL_VARTYPE_NAME(type), label, legacy_name, legacy_ns, name, ns);
+}
+
+static void bench_type(enum nl_vartype type, int serialized)
+{
+	const char *parse_name = type == INTEGER ? "strtol" : "strtof";
+
+	fill_values(type, serialized);
+
+	if(serialized) {
+		print_result(type, "serialize:", "fprintf", FPRINT_LEGACY, "nl_fprint_variant", FPRINT);
+		print_result(type, "parse lossless:", parse_name, PARSE_LEGACY, "nl_string_to_varvalue", PARSE);
+	} else {
+		print_result(type, "format:", "snprintf", FORMAT_LEGACY, "nl_variant_format_into", FORMAT_INTO);
+		print_result(type, "to string:", "legacy", TO_STRING_LEGACY, "nl_variant_to_string", TO_STRING);
+		print_result(type, "parse display:", parse_name, PARSE_LEGACY, "nl_string_to_varvalue", PARSE);
+	}
+}
+
+int main(void)
+{
+	devnull = fopen("/dev/null", "w");
+	if(devnull == NULL) {
+		ERRNO_OUT("Error opening /dev/null");
+		return -1;
+	}
+
+	srand(2026);
+
+	bench_type(INTEGER, 0);
+	bench_type(INTEGER, 1);
+	bench_type(FLOAT, 0);
+	bench_type(FLOAT, 1);
+
+	for(size_t i = 0; i < VALUE_COUNT; i++) {
+		free(strings[i]);
+	}
+	fclose(devnull);
+
+	return 0;
+}